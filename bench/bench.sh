@@ -0,0 +1,223 @@
+#!/bin/bash
+# Benchmarks dvdauthor, spumux, spuunmux and mpeg2desc on synthetic program
+# streams made by mkstream, spumux on full-frame menu overlays (counting
+# the RGBA pixel data) and on four subtitle streams at once (counting the
+# stream once for each, as four separate runs would), reports their
+# throughput and compares it against a baseline saved on the same machine.
+# Normally run with "make bench"; "make bench-baseline" saves the results
+# as the new baseline. The start code search the tools share is also timed
+# on its own, on the video of an 8000kbps stream, by the startcode program
+# built alongside MKSTREAM.
+#
+# The figures depend on the machine, so no baseline is shipped: without
+# one made here, with the same settings, the results are only reported,
+# never counted as a regression.
+#
+# usage: bench.sh BINDIR MKSTREAM BASELINE [--save]
+#
+# The streams are set up with these environment variables:
+#     BENCH_SECONDS   length of each stream in seconds [120]
+#     BENCH_VOBS      nr of streams making up the dvdauthor title [4]
+#     BENCH_AUDIO     nr of MPEG audio streams [1]
+#     BENCH_AC3       nr of AC3 audio streams [1]
+#     BENCH_SPU       nr of subpicture streams [2]
+#     BENCH_GOP       pictures per GOP [15]
+#     BENCH_M         distance between I/P pictures [3]
+#     BENCH_KBPS      average video bitrate [6000]
+# and the runs with these:
+#     BENCH_RUNS      runs of each tool, of which the fastest counts [5]
+#     BENCH_TOLERANCE percentage below a matching baseline that is slower [10]
+#     BENCH_ARGS      extra options for dvdauthor
+#     BENCH_DIR       where to put the streams and output, kept afterwards
+#                     [temporary directory, deleted afterwards]
+
+if [ $# -lt 3 ]; then
+    echo "usage: $0 BINDIR MKSTREAM BASELINE [--save]" >&2
+    exit 1
+fi
+bindir="$1"
+mkstream="$2"
+baseline="$3"
+save=
+[ "$4" = "--save" ] && save=1
+
+seconds=${BENCH_SECONDS:-120}
+vobs=${BENCH_VOBS:-4}
+audio=${BENCH_AUDIO:-1}
+ac3=${BENCH_AC3:-1}
+spu=${BENCH_SPU:-2}
+gop=${BENCH_GOP:-15}
+anchors=${BENCH_M:-3}
+kbps=${BENCH_KBPS:-6000}
+runs=${BENCH_RUNS:-5}
+tolerance=${BENCH_TOLERANCE:-10}
+settings="seconds=$seconds vobs=$vobs audio=$audio ac3=$ac3 spu=$spu gop=$gop m=$anchors kbps=$kbps"
+machine="$(uname -n) $(uname -sm)"
+
+if [ -n "$BENCH_DIR" ]; then
+    work="$BENCH_DIR"
+    mkdir -p "$work" || exit 1
+else
+    work=$(mktemp -d "${TMPDIR:-/tmp}/dvdauthor-bench.XXXXXX") || exit 1
+    trap 'rm -rf "$work"' EXIT
+fi
+log="$work/log"
+: >"$log"
+export VIDEO_FORMAT=PAL
+
+fail()
+  {
+    echo "ERR:  $*" >&2
+    [ -z "$BENCH_DIR" ] && tail -20 "$log" >&2
+    exit 1
+  }
+
+filesize()
+  {
+    wc -c <"$1" | tr -d ' '
+  }
+
+timeit()
+  # timeit INPUT OUTPUT COMMAND ARGS... -- runs the command BENCH_RUNS times
+  # with the given standard input and output, and prints the fastest time
+  # in seconds. The output directory is cleared out before each run.
+  {
+    local input="$1" output="$2" best= t i
+    shift 2
+    for ((i = 0; i < runs; i++)); do
+        rm -rf "$work/out"
+        mkdir "$work/out"
+        t=$( { TIMEFORMAT=%R; time "$@" <"$input" >"$output" 2>>"$log"; } 2>&1 ) \
+            || fail "$(basename "$1") failed"
+        if [ -z "$best" ] || awk "BEGIN {exit !($t < $best)}"; then
+            best=$t
+        fi
+    done
+    echo "$best"
+  }
+
+echo "STAT: Generating streams ($settings)"
+streamargs="-l $seconds -a $audio -A $ac3 -g $gop -m $anchors -b $kbps"
+xml="<dvdauthor>
+<vmgm/>
+<titleset>
+<titles>"
+for ((s = 0; s < spu; s++)); do
+    xml="$xml
+<subpicture lang=\"en\"/>"
+done
+xml="$xml
+<pgc>"
+chapters=0
+for ((t = 60; t < seconds; t += 60)); do
+    chapters="$chapters,$((t / 60)):00"
+done
+total=0
+for ((v = 1; v <= vobs; v++)); do
+    "$mkstream" $streamargs -s "$spu" -r "$v" -o "$work/title$v.mpg" || fail "mkstream failed"
+    xml="$xml
+<vob file=\"$work/title$v.mpg\" chapters=\"$chapters\"/>"
+    total=$((total + $(filesize "$work/title$v.mpg")))
+done
+xml="$xml
+</pgc>
+</titles>
+</titleset>
+</dvdauthor>"
+echo "$xml" >"$work/dvdauthor.xml"
+
+"$mkstream" $streamargs -s 0 -o "$work/plain.mpg" || fail "mkstream failed"
+"$mkstream" -l $seconds -a 0 -A 0 -s 0 -b 8000 -o "$work/video.mpg" || fail "mkstream failed"
+"$mkstream" -i "$work/sub.png" -I "$work/menu.png" || fail "mkstream failed"
+{
+    echo "<subpictures><stream>"
+    for ((t = 1; t + 1 < seconds; t += 2)); do
+        printf '<spu image="%s" start="%d:%02d:%02d.00" end="%d:%02d:%02d.50" xoffset="200" yoffset="488"/>\n' \
+            "$work/sub.png" $((t / 3600)) $((t / 60 % 60)) $((t % 60)) $((t / 3600)) $((t / 60 % 60)) $((t % 60))
+    done
+    echo "</stream></subpictures>"
+} >"$work/spumux.xml"
+menus=$((seconds / 2))
+{
+    echo "<subpictures><stream>"
+    for ((t = 0; t < menus; t++)); do
+        printf '<spu image="%s" start="%d.00"/>\n' "$work/menu.png" $((t * 2))
+    done
+    echo "</stream></subpictures>"
+} >"$work/menu.xml"
+
+echo "STAT: Running each tool $runs times"
+results=
+bench()
+  # bench NAME BYTES SECONDS -- records the result for one tool.
+  {
+    results="$results$1 $(awk "BEGIN {printf \"%.1f\", $2 / 1048576 / ($3 > 0 ? $3 : 0.001)}")
+"
+  }
+t=$(timeit /dev/null /dev/null "$bindir/dvdauthor" -K $BENCH_ARGS -o "$work/out" -x "$work/dvdauthor.xml") || exit 1
+bench dvdauthor $total "$t"
+t=$(timeit "$work/plain.mpg" "$work/out/spumux.mpg" "$bindir/spumux" "$work/spumux.xml") || exit 1
+bench spumux $(filesize "$work/plain.mpg") "$t"
+t=$(timeit "$work/plain.mpg" "$work/out/spumux.mpg" "$bindir/spumux" \
+    "$work/spumux.xml" "$work/spumux.xml" "$work/spumux.xml" "$work/spumux.xml") || exit 1
+bench spumux-multi $((4 * $(filesize "$work/plain.mpg"))) "$t"
+t=$(timeit /dev/null "$work/out/menu.sub" "$bindir/spumux" --nomux "$work/menu.xml") || exit 1
+bench spumux-menu $((menus * 720 * 576 * 4)) "$t"
+t=$(timeit /dev/null /dev/null "$bindir/spuunmux" -o "$work/out/sub" "$work/title1.mpg") || exit 1
+bench spuunmux $(filesize "$work/title1.mpg") "$t"
+t=$(timeit "$work/title1.mpg" /dev/null "$bindir/mpeg2desc") || exit 1
+bench mpeg2desc $(filesize "$work/title1.mpg") "$t"
+startcode="$(dirname "$mkstream")/startcode"
+if [ -x "$startcode" ]; then
+    read -r bytes t < <("$startcode" -r "$runs" "$work/video.mpg" 2>>"$log")
+    [ -n "$t" ] || fail "startcode failed"
+    bench startcode "$bytes" "$t"
+else
+    echo "WARN: $startcode not built, not timing the start code search"
+fi
+
+if [ -n "$save" ]; then
+    {
+        echo "# throughput in MB/s from \"make bench-baseline\", $(date +%Y-%m-%d)"
+        echo "# machine: $machine"
+        echo "# settings: $settings"
+        printf '%s' "$results"
+    } >"$baseline" || exit 1
+    printf '%s' "$results"
+    echo "STAT: Saved baseline in $baseline"
+    exit 0
+fi
+
+# only a baseline from this machine with the same settings can show a regression
+matching=
+if [ ! -r "$baseline" ]; then
+    echo "WARN: No baseline in $baseline, make one with \"make bench-baseline\" to compare against"
+else
+    basemachine=$(sed -n 's/^# machine: //p' "$baseline")
+    basesettings=$(sed -n 's/^# settings: //p' "$baseline")
+    if [ "$basemachine" != "$machine" ]; then
+        echo "WARN: Baseline was made on ${basemachine:-another machine}, only comparing for information"
+    elif [ "$basesettings" != "$settings" ]; then
+        echo "WARN: Baseline was made with different settings: $basesettings, only comparing for information"
+    else
+        matching=1
+    fi
+fi
+status=0
+printf '%-12s %10s %10s %8s\n' tool "MB/s" baseline change
+while read -r tool rate; do
+    [ -z "$tool" ] && continue
+    base=$( [ -r "$baseline" ] && awk -v t="$tool" '$1 == t {print $2}' "$baseline" )
+    if [ -z "$base" ]; then
+        printf '%-12s %10s %10s\n' "$tool" "$rate" -
+        continue
+    fi
+    change=$(awk "BEGIN {printf \"%+.1f%%\", ($rate - $base) * 100 / $base}")
+    if [ -n "$matching" ] && awk "BEGIN {exit !($rate < $base * (100 - $tolerance) / 100)}"; then
+        printf '%-12s %10s %10s %8s  SLOWER\n' "$tool" "$rate" "$base" "$change"
+        status=1
+    else
+        printf '%-12s %10s %10s %8s\n' "$tool" "$rate" "$base" "$change"
+    fi
+done <<<"$results"
+exit $status
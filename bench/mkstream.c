@@ -0,0 +1,889 @@
+/*
+    mkstream -- generates synthetic DVD-compliant MPEG-2 program streams
+    for benchmarking dvdauthor and the other tools.
+
+    The video is made up of correctly-structured sequence, GOP and picture
+    headers filled out with random bytes, the audio of MPEG-1 layer II or
+    AC3 frames with valid headers, and the subpictures of properly
+    run-length-encoded images, so the tools have to do all their usual work
+    on them even though nothing would decode to anything meaningful.
+*/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+
+typedef int64_t pts_t; /* timestamp in units of 90kHz clock */
+
+#define SECTOR 2048
+#define MAXGOP 36 /* maximum pictures in a GOP */
+#define MAXAUDIO 8
+#define MAXSPU 32
+
+#define SPUWIDTH 320 /* size of subpicture image */
+#define SPUHEIGHT 48
+#define SPUINTERVAL 2 /* seconds from one subpicture to the next */
+
+static FILE *out;
+static unsigned char pack[SECTOR];
+static pts_t scr; /* system clock reference for next pack */
+static unsigned int seed = 1;
+static bool ntsc = false;
+
+static unsigned int nextrand(void)
+  /* simple repeatable pseudorandom number generator. */
+  {
+    seed = seed * 1103515245 + 12345;
+    return
+        seed >> 8;
+  } /*nextrand*/
+
+/*
+    Pack and packet headers
+*/
+
+static void packheader(void)
+  /* starts a new pack with the current SCR. */
+  {
+    memset(pack, 0, SECTOR);
+    pack[0] = 0;
+    pack[1] = 0;
+    pack[2] = 1;
+    pack[3] = 0xba;
+    pack[4] = 0x44 | (scr >> 27 & 0x38) | (scr >> 28 & 3);
+    pack[5] = scr >> 20;
+    pack[6] = 0x04 | (scr >> 12 & 0xf8) | (scr >> 13 & 3);
+    pack[7] = scr >> 5;
+    pack[8] = 0x04 | (scr << 3 & 0xf8);
+    pack[9] = 1; /* SCR extension */
+    pack[10] = 0x01; /* mux rate 10.08Mb/s */
+    pack[11] = 0x89;
+    pack[12] = 0xc3;
+    pack[13] = 0xf8; /* no stuffing */
+  } /*packheader*/
+
+static void putpts(unsigned char *b, int flag, pts_t pts)
+  /* encodes a PTS or DTS in the 5-byte form used in PES headers. */
+  {
+    b[0] = flag << 4 | (pts >> 29 & 0xe) | 1;
+    b[1] = pts >> 22;
+    b[2] = (pts >> 14 & 0xfe) | 1;
+    b[3] = pts >> 7;
+    b[4] = (pts << 1 & 0xfe) | 1;
+  } /*putpts*/
+
+static void putpadding(int pos)
+  /* fills the rest of the pack from pos with a padding packet. */
+  {
+    const int len = SECTOR - pos;
+    if (len == 0)
+        return;
+    if (len < 6)
+      {
+        fprintf(stderr, "ERR:  internal error: no room for padding packet\n");
+        exit(1);
+      } /*if*/
+    pack[pos] = 0;
+    pack[pos + 1] = 0;
+    pack[pos + 2] = 1;
+    pack[pos + 3] = 0xbe;
+    pack[pos + 4] = (len - 6) >> 8;
+    pack[pos + 5] = len - 6;
+    memset(pack + pos + 6, 0xff, len - 6);
+  } /*putpadding*/
+
+static void emitpack(void)
+  /* writes out the pack and advances the SCR by the time it takes at the mux rate. */
+  {
+    if (fwrite(pack, SECTOR, 1, out) != 1)
+      {
+        fprintf(stderr, "ERR:  Error %d writing output: %s\n", errno, strerror(errno));
+        exit(1);
+      } /*if*/
+    scr += 147;
+  } /*emitpack*/
+
+static void emitnav(void)
+  /* writes a NAV pack with empty PCI and DSI packets, as a DVD multiplexer
+    does at the start of each GOP for dvdauthor to fill in. */
+  {
+    static const unsigned char sysheader[] =
+      {
+        0, 0, 1, 0xbb, 0, 18, 0x80, 0xc4, 0xe1, 0x04, 0xe1, 0xff,
+        0xb9, 0xe0, 0xe8, 0xb8, 0xc0, 0x20, 0xbd, 0xe0, 0x3a, 0xbf, 0xe0, 0x02,
+      };
+    packheader();
+    memcpy(pack + 14, sysheader, sizeof sysheader);
+    pack[38] = 0; /* PCI packet */
+    pack[39] = 0;
+    pack[40] = 1;
+    pack[41] = 0xbf;
+    pack[42] = 0x03;
+    pack[43] = 0xd4;
+    pack[44] = 0;
+    pack[1024] = 0; /* DSI packet */
+    pack[1025] = 0;
+    pack[1026] = 1;
+    pack[1027] = 0xbf;
+    pack[1028] = 0x03;
+    pack[1029] = 0xfa;
+    pack[1030] = 1;
+    emitpack();
+  } /*emitnav*/
+
+/*
+    Audio
+*/
+
+struct audiostream
+  {
+    bool ac3; /* else MPEG-1 layer II */
+    int id; /* stream number within its type */
+    pts_t nextpts; /* time of next frame to be written */
+  };
+
+static struct audiostream audio[MAXAUDIO];
+static int numaudio = 0;
+
+#define AUDIOFRAMESIZE 768 /* 256kb/s MP2 or 192kb/s AC3 at 48kHz */
+#define AUDIOFRAMES 2 /* per pack */
+
+static void emitaudio(struct audiostream *a)
+  /* writes a pack containing the next frames for the audio stream a. */
+  {
+    const int duration = a->ac3 ? 2880 : 2160; /* of one frame */
+    const int paylen = AUDIOFRAMES * AUDIOFRAMESIZE + (a->ac3 ? 4 : 0);
+    int pos, i, j;
+    packheader();
+    pos = 14;
+    pack[pos] = 0;
+    pack[pos + 1] = 0;
+    pack[pos + 2] = 1;
+    pack[pos + 3] = a->ac3 ? 0xbd : 0xc0 + a->id;
+    pack[pos + 4] = (paylen + 8) >> 8;
+    pack[pos + 5] = paylen + 8;
+    pack[pos + 6] = 0x81;
+    pack[pos + 7] = 0x80; /* PTS only */
+    pack[pos + 8] = 5;
+    putpts(pack + pos + 9, 2, a->nextpts);
+    pos += 14;
+    if (a->ac3)
+      {
+        pack[pos] = 0x80 + a->id; /* substream ID */
+        pack[pos + 1] = AUDIOFRAMES; /* nr frame headers */
+        pack[pos + 2] = 0; /* offset to first one */
+        pack[pos + 3] = 1;
+        pos += 4;
+      } /*if*/
+    for (i = 0; i < AUDIOFRAMES; i++)
+      {
+        unsigned char * const frame = pack + pos;
+        for (j = 0; j < AUDIOFRAMESIZE; j++)
+            frame[j] = (nextrand() & 0x7f) | 1; /* avoid start codes and sync words */
+        if (a->ac3)
+          {
+            static const unsigned char ac3header[] = {0x0b, 0x77, 0x12, 0x34, 0x14, 0x40, 0x40, 0x00};
+            memcpy(frame, ac3header, sizeof ac3header);
+          }
+        else
+          {
+            static const unsigned char mp2header[] = {0xff, 0xfd, 0xc4, 0x44};
+            memcpy(frame, mp2header, sizeof mp2header);
+          } /*if*/
+        pos += AUDIOFRAMESIZE;
+      } /*for*/
+    putpadding(pos);
+    emitpack();
+    a->nextpts += AUDIOFRAMES * duration;
+  } /*emitaudio*/
+
+static void audioupto(pts_t when)
+  /* writes out all audio due before when, in order of time. */
+  {
+    while (true)
+      {
+        struct audiostream *next = 0;
+        int i;
+        for (i = 0; i < numaudio; i++)
+            if (audio[i].nextpts <= when && (!next || audio[i].nextpts < next->nextpts))
+                next = &audio[i];
+        if (!next)
+            break;
+        emitaudio(next);
+      } /*while*/
+  } /*audioupto*/
+
+/*
+    Subpictures
+*/
+
+static int spucolor(int x, int y)
+  /* returns the colour index 0 .. 3 of a pixel in the subpicture image: lines
+    of "text" in colour 1, outlined in colour 2, with colour 3 underlines, on
+    a transparent background. */
+  {
+    const int row = y % 24, col = x / 6;
+    if (row == 21)
+        return
+            3;
+    if (row < 4 || row >= 18)
+        return
+            0;
+    if ((col * 7 + row / 3 * 3) % 5 == 0)
+        return
+            0; /* gap between "letters" */
+    if (x % 6 == 0 || row == 4 || row == 17)
+        return
+            2;
+    return
+        1;
+  } /*spucolor*/
+
+static int menucolor(int x, int y)
+  /* returns the colour index 0 .. 3 of a pixel in a full-frame menu overlay:
+    a grid of outlined buttons, each with a line of "text" in it. */
+  {
+    const int bx = x % 180, by = y % 96;
+    if (bx < 20 || bx > 160 || by < 16 || by > 80)
+        return
+            0;
+    if (bx == 20 || bx == 160 || by == 16 || by == 80)
+        return
+            3;
+    if (by >= 36 && by < 60)
+        return
+            spucolor(bx - 20, by - 36);
+    return
+        0;
+  } /*menucolor*/
+
+static unsigned char *nibbles;
+static int nibblepos; /* in nibbles */
+
+static void putnibble(int n)
+  {
+    if (nibblepos % 2 == 0)
+        nibbles[nibblepos / 2] = n << 4;
+    else
+        nibbles[nibblepos / 2] |= n;
+    nibblepos++;
+  } /*putnibble*/
+
+static void putrun(int count, int color)
+  /* encodes a run of count pixels in the specified colour, 0 for count meaning
+    to the end of the line. */
+  {
+    if (count >= 1 && count <= 3)
+      {
+        putnibble(count << 2 | color);
+      }
+    else if (count >= 4 && count <= 15)
+      {
+        putnibble(count >> 2);
+        putnibble((count & 3) << 2 | color);
+      }
+    else if (count >= 16 && count <= 63)
+      {
+        putnibble(0);
+        putnibble(count >> 2);
+        putnibble((count & 3) << 2 | color);
+      }
+    else
+      {
+        putnibble(0);
+        putnibble(count >> 6);
+        putnibble((count >> 2) & 15);
+        putnibble((count & 3) << 2 | color);
+      } /*if*/
+  } /*putrun*/
+
+static void encodefield(int field)
+  /* run-length-encodes alternate lines of the subpicture image. */
+  {
+    int y;
+    for (y = field; y < SPUHEIGHT; y += 2)
+      {
+        int x = 0;
+        while (x < SPUWIDTH)
+          {
+            const int color = spucolor(x, y);
+            int count = 1;
+            while (x + count < SPUWIDTH && spucolor(x + count, y) == color && count < 255)
+                count++;
+            putrun(x + count == SPUWIDTH && count > 63 ? 0 : count, color);
+            x += count;
+          } /*while*/
+        if (nibblepos % 2)
+            putnibble(0); /* lines start on byte boundaries */
+      } /*for*/
+  } /*encodefield*/
+
+static unsigned char spu[4096];
+static int spulen;
+
+static void buildspu(void)
+  /* creates the subpicture unit, displaying the image centred near the bottom
+    of the screen for one second. */
+  {
+    const int x0 = (720 - SPUWIDTH) / 2, y0 = (ntsc ? 480 : 576) - SPUHEIGHT - 40;
+    int topfield, bottomfield, dcsq1, dcsq2, p;
+    nibbles = spu;
+    nibblepos = 8; /* room for size and offset of first control sequence */
+    topfield = nibblepos / 2;
+    encodefield(0);
+    bottomfield = nibblepos / 2;
+    encodefield(1);
+    p = nibblepos / 2;
+    dcsq1 = p;
+    spu[p++] = 0; /* delay */
+    spu[p++] = 0;
+    p += 2; /* offset to next control sequence, filled in below */
+    spu[p++] = 0x01; /* start display */
+    spu[p++] = 0x03; /* colours */
+    spu[p++] = 0x32;
+    spu[p++] = 0x10;
+    spu[p++] = 0x04; /* contrast */
+    spu[p++] = 0xff;
+    spu[p++] = 0xf0;
+    spu[p++] = 0x05; /* coordinates */
+    spu[p++] = x0 >> 4;
+    spu[p++] = (x0 & 15) << 4 | (x0 + SPUWIDTH - 1) >> 8;
+    spu[p++] = (x0 + SPUWIDTH - 1) & 255;
+    spu[p++] = y0 >> 4;
+    spu[p++] = (y0 & 15) << 4 | (y0 + SPUHEIGHT - 1) >> 8;
+    spu[p++] = (y0 + SPUHEIGHT - 1) & 255;
+    spu[p++] = 0x06; /* line offsets */
+    spu[p++] = topfield >> 8;
+    spu[p++] = topfield;
+    spu[p++] = bottomfield >> 8;
+    spu[p++] = bottomfield;
+    spu[p++] = 0xff; /* end of control sequence */
+    if (p % 2)
+        spu[p++] = 0xff;
+    dcsq2 = p;
+    spu[dcsq1 + 2] = dcsq2 >> 8;
+    spu[dcsq1 + 3] = dcsq2;
+    spu[p++] = 0; /* delay, in units of 1024/90000 seconds */
+    spu[p++] = 90000 / 1024;
+    spu[p++] = dcsq2 >> 8; /* last control sequence points to itself */
+    spu[p++] = dcsq2;
+    spu[p++] = 0x02; /* stop display */
+    spu[p++] = 0xff;
+    spu[0] = p >> 8;
+    spu[1] = p;
+    spu[2] = dcsq1 >> 8;
+    spu[3] = dcsq1;
+    spulen = p;
+  } /*buildspu*/
+
+static int numspu = 0;
+static pts_t spupts = -1; /* time of next subpicture in each stream */
+
+static void emitspu(void)
+  /* writes out the subpicture unit for each stream, due at spupts. */
+  {
+    int s;
+    for (s = 0; s < numspu; s++)
+      {
+        int done = 0;
+        while (done < spulen)
+          {
+            const int hdrlen = done == 0 ? 5 : 0;
+            const int room = SECTOR - 14 - 9 - hdrlen - 1;
+            int len = spulen - done, pos = 14;
+            if (len > room)
+                len = room;
+            else if (room - len > 0 && room - len < 6)
+                len = room - 6; /* leave enough for a padding packet */
+            packheader();
+            pack[pos] = 0;
+            pack[pos + 1] = 0;
+            pack[pos + 2] = 1;
+            pack[pos + 3] = 0xbd;
+            pack[pos + 4] = (len + 4 + hdrlen) >> 8;
+            pack[pos + 5] = len + 4 + hdrlen;
+            pack[pos + 6] = 0x81;
+            pack[pos + 7] = hdrlen ? 0x80 : 0;
+            pack[pos + 8] = hdrlen;
+            if (hdrlen)
+                putpts(pack + pos + 9, 2, spupts);
+            pos += 9 + hdrlen;
+            pack[pos++] = 0x20 + s; /* substream ID */
+            memcpy(pack + pos, spu + done, len);
+            pos += len;
+            done += len;
+            putpadding(pos);
+            emitpack();
+          } /*while*/
+      } /*for*/
+    spupts += SPUINTERVAL * 90000;
+  } /*emitspu*/
+
+static void spuupto(pts_t when)
+  /* writes out all subpictures due before when. */
+  {
+    while (numspu != 0 && spupts <= when)
+        emitspu();
+  } /*spuupto*/
+
+/*
+    PNG output of the subpicture image, for use with spumux
+*/
+
+static uint32_t crctable[256];
+
+static uint32_t crc(uint32_t c, const unsigned char *buf, size_t len)
+  /* continues the PNG chunk CRC c over buf. */
+  {
+    size_t i;
+    if (crctable[1] == 0)
+      {
+        uint32_t n, k;
+        for (n = 0; n < 256; n++)
+          {
+            uint32_t v = n;
+            for (k = 0; k < 8; k++)
+                v = v & 1 ? 0xedb88320 ^ v >> 1 : v >> 1;
+            crctable[n] = v;
+          } /*for*/
+      } /*if*/
+    c = ~c;
+    for (i = 0; i < len; i++)
+        c = crctable[(c ^ buf[i]) & 255] ^ c >> 8;
+    return
+        ~c;
+  } /*crc*/
+
+static void put32(unsigned char *b, uint32_t v)
+  {
+    b[0] = v >> 24;
+    b[1] = v >> 16;
+    b[2] = v >> 8;
+    b[3] = v;
+  } /*put32*/
+
+static void pngchunk(FILE *f, const char *type, const unsigned char *data, size_t len)
+  {
+    unsigned char b[4];
+    uint32_t c;
+    put32(b, len);
+    fwrite(b, 4, 1, f);
+    fwrite(type, 4, 1, f);
+    fwrite(data, len, 1, f);
+    c = crc(crc(0, (const unsigned char *)type, 4), data, len);
+    put32(b, c);
+    fwrite(b, 4, 1, f);
+  } /*pngchunk*/
+
+static void writepng(const char *fname, int width, int height, int (*color)(int x, int y))
+  /* writes an image with the specified dimensions and pixel colours as an RGBA
+    PNG file. The image data is not compressed, so no zlib is needed. */
+  {
+    static const unsigned char colors[4][4] =
+      {
+        {0, 0, 0, 0},
+        {255, 255, 255, 255},
+        {0, 0, 0, 255},
+        {128, 128, 128, 255},
+      };
+    const size_t rowlen = width * 4 + 1, rawlen = rowlen * height;
+    const size_t nrblocks = (rawlen + 65534) / 65535;
+    unsigned char * const raw = malloc(rawlen);
+    unsigned char * const idat = malloc(2 + rawlen + nrblocks * 5 + 4);
+    unsigned char ihdr[13];
+    uint32_t a = 1, b = 0; /* Adler-32 */
+    size_t i, ilen;
+    int x, y;
+    FILE * const f = fopen(fname, "wb");
+    if (!f)
+      {
+        fprintf(stderr, "ERR:  Cannot create %s: %s\n", fname, strerror(errno));
+        exit(1);
+      } /*if*/
+    for (y = 0; y < height; y++)
+      {
+        raw[y * rowlen] = 0; /* no filtering */
+        for (x = 0; x < width; x++)
+            memcpy(raw + y * rowlen + 1 + x * 4, colors[color(x, y)], 4);
+      } /*for*/
+    for (i = 0; i < rawlen; i++)
+      {
+        a = (a + raw[i]) % 65521;
+        b = (b + a) % 65521;
+      } /*for*/
+    idat[0] = 0x78; /* zlib header, no compression */
+    idat[1] = 0x01;
+    ilen = 2;
+    for (i = 0; i < rawlen; i += 65535)
+      {
+        const size_t len = rawlen - i < 65535 ? rawlen - i : 65535;
+        idat[ilen] = i + len == rawlen; /* final block flag, stored */
+        idat[ilen + 1] = len;
+        idat[ilen + 2] = len >> 8;
+        idat[ilen + 3] = ~len;
+        idat[ilen + 4] = ~len >> 8;
+        memcpy(idat + ilen + 5, raw + i, len);
+        ilen += 5 + len;
+      } /*for*/
+    put32(idat + ilen, b << 16 | a);
+    ilen += 4;
+    put32(ihdr, width);
+    put32(ihdr + 4, height);
+    ihdr[8] = 8; /* bit depth */
+    ihdr[9] = 6; /* RGBA */
+    ihdr[10] = 0;
+    ihdr[11] = 0;
+    ihdr[12] = 0;
+    fwrite("\x89PNG\r\n\x1a\n", 8, 1, f);
+    pngchunk(f, "IHDR", ihdr, sizeof ihdr);
+    pngchunk(f, "IDAT", idat, ilen);
+    pngchunk(f, "IEND", 0, 0);
+    if (fclose(f) != 0)
+      {
+        fprintf(stderr, "ERR:  Error writing %s: %s\n", fname, strerror(errno));
+        exit(1);
+      } /*if*/
+    free(raw);
+    free(idat);
+  } /*writepng*/
+
+/*
+    Video
+*/
+
+static unsigned char *es; /* elementary stream data for one GOP */
+static int eslen, esmax;
+
+struct picture /* where a picture starts in es, and when it is to be decoded and shown */
+  {
+    int offset;
+    pts_t pts, dts;
+  };
+
+static void esput(const unsigned char *b, int len)
+  {
+    if (eslen + len > esmax)
+      {
+        esmax = (eslen + len) * 2;
+        es = realloc(es, esmax);
+      } /*if*/
+    memcpy(es + eslen, b, len);
+    eslen += len;
+  } /*esput*/
+
+static int buildgop
+  (
+    struct picture *pics,
+    int firstframe, /* frame nr of first picture in GOP, in display order */
+    int numframes, /* nr pictures in GOP */
+    int anchorspacing, /* distance between I/P pictures */
+    int kbps, /* average video bitrate */
+    bool last, /* whether to end the sequence after this GOP */
+    pts_t ptsbase
+  )
+  /* generates the elementary stream data for a closed GOP into es, returning the
+    number of pictures, which are described in pics in coded order. */
+  {
+    const int frameticks = ntsc ? 3003 : 3600;
+    const int picbytes = (int)((int64_t)kbps * 1000 / 8 * frameticks / 90000);
+    int coded[MAXGOP], numcoded = 0, anchor, prev, i;
+    eslen = 0;
+  /* coded order: each I/P picture followed by the B pictures displayed before it */
+    coded[numcoded++] = 0;
+    prev = 0;
+    while (prev < numframes - 1)
+      {
+        anchor = prev + anchorspacing < numframes - 1 ? prev + anchorspacing : numframes - 1;
+          /* closed GOP, so mustn't end with B pictures */
+        coded[numcoded++] = anchor;
+        for (i = prev + 1; i < anchor; i++)
+            coded[numcoded++] = i;
+        prev = anchor;
+      } /*while*/
+    for (i = 0; i < numcoded; i++)
+      {
+        const int frame = coded[i];
+        const int type =
+            frame == 0 ? 1 : (frame % anchorspacing == 0 || frame == numframes - 1) ? 2 : 3;
+              /* I, P or B */
+        unsigned char hdr[17];
+        int size, j;
+        pics[i].offset = eslen;
+        pics[i].pts = ptsbase + (pts_t)(firstframe + frame) * frameticks;
+        pics[i].dts = type == 3 ? -1 : ptsbase + (pts_t)(firstframe + i - 1) * frameticks;
+        if (i == 0)
+          {
+            const unsigned char seqhdr[] =
+              {
+                0, 0, 1, 0xb3, /* sequence header */
+                0x2d, ntsc ? 0x01 : 0x02, ntsc ? 0xe0 : 0x40, /* 720x480 or 720x576 */
+                ntsc ? 0x24 : 0x23, /* 4:3, 29.97 or 25 frames/s */
+                0x1d, 0x4c, 0x23, 0x80, /* bitrate, VBV buffer size */
+                0, 0, 1, 0xb5, 0x14, 0x8a, 0x00, 0x01, 0x00, 0x00, /* sequence extension */
+                0, 0, 1, 0xb8, 0x00, 0x08, 0x00, 0x40, /* GOP header, closed */
+              };
+            esput(seqhdr, sizeof seqhdr);
+          } /*if*/
+        hdr[0] = 0; /* picture header */
+        hdr[1] = 0;
+        hdr[2] = 1;
+        hdr[3] = 0;
+        hdr[4] = frame >> 2; /* temporal reference */
+        hdr[5] = (frame & 3) << 6 | type << 3 | 7;
+        hdr[6] = 0xff;
+        hdr[7] = 0xf8;
+        hdr[8] = 0; /* picture coding extension */
+        hdr[9] = 0;
+        hdr[10] = 1;
+        hdr[11] = 0xb5;
+        hdr[12] = 0x8f;
+        hdr[13] = 0xff;
+        hdr[14] = 0x83;
+        hdr[15] = 0x80;
+        hdr[16] = 0x80;
+        esput(hdr, sizeof hdr);
+        size = type == 1 ? picbytes * 3 : type == 2 ? picbytes : picbytes / 2;
+        size += nextrand() % 2000;
+        for (j = 0; j < size; j++)
+          {
+            const unsigned char b = (nextrand() & 0xff) | 1; /* avoid start codes */
+            esput(&b, 1);
+          } /*for*/
+      } /*for*/
+    if (last)
+      {
+        static const unsigned char seqend[] = {0, 0, 1, 0xb7};
+        esput(seqend, sizeof seqend);
+      } /*if*/
+    return
+        numcoded;
+  } /*buildgop*/
+
+static void emitgop(const struct picture *pics, int numpics)
+  /* packetizes the GOP in es, interleaving the audio and subpictures due
+    during it. */
+  {
+    int offset = 0, p = 0;
+    while (offset < eslen)
+      {
+        int hdrlen = 0, len, pos, room;
+        pts_t pts = 0, dts = -1, due;
+        while (p < numpics && pics[p].offset < offset)
+            p++;
+        if (p < numpics && pics[p].offset < offset + SECTOR - 14 - 9 - 10 - 10)
+          {
+          /* a picture starts in this packet, so it gets its timestamps */
+            pts = pics[p].pts;
+            dts = pics[p].dts;
+            hdrlen = dts >= 0 ? 10 : 5;
+          } /*if*/
+        due = hdrlen ? (dts >= 0 ? dts : pts) : scr + 20000;
+        audioupto(due + 30000);
+        spuupto(due + 30000);
+        room = SECTOR - 14 - 9 - hdrlen;
+        len = eslen - offset;
+        if (len > room)
+            len = room;
+        else if (room - len > 0 && room - len < 6)
+            len = room - 6; /* leave enough for a padding packet */
+        packheader();
+        pos = 14;
+        pack[pos] = 0;
+        pack[pos + 1] = 0;
+        pack[pos + 2] = 1;
+        pack[pos + 3] = 0xe0;
+        pack[pos + 4] = (len + 3 + hdrlen) >> 8;
+        pack[pos + 5] = len + 3 + hdrlen;
+        pack[pos + 6] = 0x81;
+        pack[pos + 7] = hdrlen == 0 ? 0 : hdrlen == 5 ? 0x80 : 0xc0;
+        pack[pos + 8] = hdrlen;
+        if (hdrlen != 0)
+            putpts(pack + pos + 9, hdrlen == 5 ? 2 : 3, pts);
+        if (hdrlen == 10)
+            putpts(pack + pos + 14, 1, dts);
+        pos += 9 + hdrlen;
+        memcpy(pack + pos, es + offset, len);
+        pos += len;
+        offset += len;
+        putpadding(pos);
+        emitpack();
+      } /*while*/
+  } /*emitgop*/
+
+static void usage(void)
+  {
+    fprintf
+      (
+        stderr,
+        "usage: mkstream [options]\n"
+        "\t-l SECS   length of the stream in seconds (default 60)\n"
+        "\t-g N      pictures per GOP (default 15 PAL, 18 NTSC)\n"
+        "\t-m M      distance between I/P pictures, 1 for no B pictures (default 3)\n"
+        "\t-b KBPS   average video bitrate (default 6000)\n"
+        "\t-a N      number of MPEG audio streams (default 1)\n"
+        "\t-A N      number of AC3 audio streams (default 0)\n"
+        "\t-s N      number of subpicture streams (default 0)\n"
+        "\t-n        NTSC instead of PAL\n"
+        "\t-r SEED   random number seed (default 1)\n"
+        "\t-o FILE   output file (default stdout)\n"
+        "\t-i FILE   write the subpicture image to FILE as a PNG, and no stream\n"
+        "\t-I FILE   write a full-frame menu overlay to FILE as a PNG, and no stream\n"
+      );
+    exit(1);
+  } /*usage*/
+
+int main(int argc, char **argv)
+  {
+    double seconds = 60;
+    int gopsize = 0, anchorspacing = 3, kbps = 6000, nrmpeg = 1, nrac3 = 0;
+    const char *outname = 0, *pngname = 0, *menuname = 0;
+    const pts_t ptsbase = 45000;
+    struct picture pics[MAXGOP];
+    int numframes, firstframe, i;
+    while (true)
+      {
+        const int c = getopt(argc, argv, "l:g:m:b:a:A:s:nr:o:i:I:h");
+        if (c == -1)
+            break;
+        switch (c)
+          {
+        case 'l':
+            seconds = atof(optarg);
+        break;
+        case 'g':
+            gopsize = atoi(optarg);
+        break;
+        case 'm':
+            anchorspacing = atoi(optarg);
+        break;
+        case 'b':
+            kbps = atoi(optarg);
+        break;
+        case 'a':
+            nrmpeg = atoi(optarg);
+        break;
+        case 'A':
+            nrac3 = atoi(optarg);
+        break;
+        case 's':
+            numspu = atoi(optarg);
+        break;
+        case 'n':
+            ntsc = true;
+        break;
+        case 'r':
+            seed = strtoul(optarg, 0, 10);
+        break;
+        case 'o':
+            outname = optarg;
+        break;
+        case 'i':
+            pngname = optarg;
+        break;
+        case 'I':
+            menuname = optarg;
+        break;
+        default:
+            usage();
+          } /*switch*/
+      } /*while*/
+    if (optind != argc)
+        usage();
+    if (pngname || menuname)
+      {
+        if (pngname)
+            writepng(pngname, SPUWIDTH, SPUHEIGHT, spucolor);
+        if (menuname)
+            writepng(menuname, 720, ntsc ? 480 : 576, menucolor);
+        return
+            0;
+      } /*if*/
+    if (gopsize == 0)
+        gopsize = ntsc ? 18 : 15;
+    if
+      (
+            gopsize < 1 || gopsize > MAXGOP
+        ||
+            anchorspacing < 1 || anchorspacing > gopsize
+        ||
+            nrmpeg < 0 || nrac3 < 0 || nrmpeg > 8 || nrac3 > 8 || nrmpeg + nrac3 > MAXAUDIO
+        ||
+            numspu < 0 || numspu > MAXSPU
+        ||
+            kbps < 500 || kbps > 9000
+        ||
+            seconds <= 0
+      )
+      {
+        fprintf(stderr, "ERR:  Invalid stream parameters\n");
+        exit(1);
+      } /*if*/
+    for (i = 0; i < nrac3; i++)
+      {
+        audio[numaudio].ac3 = true;
+        audio[numaudio].id = i;
+        audio[numaudio].nextpts = ptsbase;
+        numaudio++;
+      } /*for*/
+    for (i = 0; i < nrmpeg; i++)
+      {
+        audio[numaudio].ac3 = false;
+        audio[numaudio].id = i;
+        audio[numaudio].nextpts = ptsbase;
+        numaudio++;
+      } /*for*/
+    if (numspu != 0)
+      {
+        buildspu();
+        spupts = ptsbase + 90000;
+      } /*if*/
+    if (outname)
+      {
+        out = fopen(outname, "wb");
+        if (!out)
+          {
+            fprintf(stderr, "ERR:  Cannot create %s: %s\n", outname, strerror(errno));
+            exit(1);
+          } /*if*/
+      }
+    else
+        out = stdout;
+    numframes = seconds * 90000 / (ntsc ? 3003 : 3600);
+    scr = ptsbase - 20000;
+    for (firstframe = 0; firstframe < numframes; firstframe += gopsize)
+      {
+        const int n = numframes - firstframe < gopsize ? numframes - firstframe : gopsize;
+        const int numpics =
+            buildgop(pics, firstframe, n, anchorspacing, kbps, firstframe + n >= numframes, ptsbase);
+        emitnav();
+        emitgop(pics, numpics);
+      } /*for*/
+    audioupto(ptsbase + (pts_t)numframes * (ntsc ? 3003 : 3600));
+    if (fclose(out) != 0)
+      {
+        fprintf(stderr, "ERR:  Error writing output: %s\n", strerror(errno));
+        exit(1);
+      } /*if*/
+    return
+        0;
+  } /*main*/
@@ -0,0 +1,409 @@
+#!/bin/bash
+# Checks that dvdauthor generates byte-for-byte the same DVD structure
+# as a known-good version, whichever of its performance options are used.
+# Synthetic projects made with mkstream are authored in the plain way, and
+# again with each option or combination of options. The checksums of every
+# VOB, IFO and BUP file must match those in regress.sums, which were made
+# by an earlier dvdauthor from the same streams (mkstream always generates
+# the same ones), or those from a reference dvdauthor if one is given.
+# spumux is checked the same way on a synthetic subtitle stream in each of
+# its modes, and its output with several subtitle streams muxed in one pass
+# is checked against that from adding them one at a time, as extracted by
+# spuunmux. Normally run with "make regress".
+#
+# usage: regress.sh BINDIR MKSTREAM
+#
+# environment variables:
+#     REGRESS_SECONDS    length of the title streams in seconds [60]; there are
+#                        only known-good checksums for the default
+#     REGRESS_REFERENCE  dvdauthor to generate the reference output with,
+#                        run without any options [use regress.sums, or
+#                        BINDIR/dvdauthor -K if it has none for these streams]
+#     REGRESS_SPUMUX_REFERENCE
+#                        spumux to generate the reference output with
+#                        [use regress.sums, or BINDIR/spumux]
+#     REGRESS_SAVE_SUMS  file to save the reference checksums in, in the form
+#                        of regress.sums [not saved]
+#     REGRESS_MODES      names of the modes to check, separated by spaces [all of them]
+#     REGRESS_DIR        where to put the streams and output, kept afterwards
+#                        [temporary directory, deleted afterwards]
+
+if [ $# -ne 2 ]; then
+    echo "usage: $0 BINDIR MKSTREAM" >&2
+    exit 1
+fi
+dvdauthor="$1/dvdauthor"
+spumux="$1/spumux"
+spuunmux="$1/spuunmux"
+mkstream="$2"
+seconds=${REGRESS_SECONDS:-60}
+sums="$(dirname "$0")/regress.sums"
+pinseconds=60 # stream length the known-good checksums are for
+
+if [ -n "$REGRESS_DIR" ]; then
+    work="$REGRESS_DIR"
+    mkdir -p "$work" || exit 1
+else
+    work=$(mktemp -d "${TMPDIR:-/tmp}/dvdauthor-regress.XXXXXX") || exit 1
+    trap 'rm -rf "$work"' EXIT
+fi
+log="$work/log"
+: >"$log"
+unset DVDAUTHOR_TIMINGS
+export VIDEO_FORMAT=PAL
+
+# name and dvdauthor options for each mode. A name ending in "/2" means
+# run twice, keeping the scan caches (and with -I, the output) from the
+# first run, and check the second result. With -I, the first run is of a
+# version of the project with longer menus, and a VMG menu if it has none,
+# so the second run has to shrink or remove them.
+modes=(
+    "plain:-K"
+    "jobs:-K -J 4"
+    "vtsjobs:-K -V 3"
+    "blocksize:-K -B 1024"
+    "direct:-K -D"
+    "nocache:-K -N"
+    "mmap:-K -M"
+    "zerocopy:-K -Z"
+    "navwindow:-K -W 16"
+    "spilldir:-K -S $work/spill" # only spills with REGRESS_SECONDS of 600 or so
+    "timings:-K -Y $work/timings.json"
+    "scancache/2:"
+    "incremental/2:-I"
+    "everything:-K -J 6 -V 3 -B 1024 -N -Z -W 16 -S $work/spill" # 2 threads for each titleset process
+    "everything-cached/2:-J 6 -V 3 -B 1024 -N -Z -W 16 -S $work/spill"
+)
+
+# the same for spumux, each checked in all the subpicture formats
+spumodes=(
+    "spumux:"
+    "spumux-jobs:-J 4"
+)
+spuformats="dvd svcd cvd"
+
+# spumux options for muxing several subtitle streams in one pass, only in
+# the DVD format, as spuunmux can't extract the others
+spumultimodes=(
+    "spumux-multi:"
+    "spumux-multi-jobs:-J 4"
+)
+spustreams=3
+
+fail()
+  {
+    echo "ERR:  $*" >&2
+    exit 1
+  }
+
+stream()
+  # stream NAME MKSTREAM-ARGS... -- generates a stream unless it already exists.
+  {
+    local name="$work/$1"
+    shift
+    [ -f "$name" ] || "$mkstream" "$@" -o "$name" || fail "mkstream failed"
+  }
+
+echo "STAT: Generating projects"
+mkdir -p "$work/spill"
+stream menu.mpg -l 8 -a 1 -A 0
+stream menun.mpg -l 8 -a 1 -A 0 -n
+stream menulong.mpg -l 16 -a 1 -A 0
+stream menulongn.mpg -l 16 -a 1 -A 0 -n
+stream t1.mpg -l "$seconds" -a 1 -A 1 -s 2 -r 1
+stream t2.mpg -l "$seconds" -a 1 -A 1 -s 2 -r 2 -g 12 -m 2
+stream t3.mpg -l "$seconds" -a 1 -A 1 -s 2 -r 3 -m 1
+stream t4.mpg -l "$((seconds / 2))" -a 2 -A 0 -s 1 -r 4 -b 8000
+stream t5.mpg -l "$((seconds / 2))" -a 0 -A 3 -s 0 -r 5 -b 3000
+stream tn.mpg -l "$seconds" -a 1 -A 1 -s 1 -r 6 -n
+stream plain.mpg -l "$seconds" -a 1 -A 1 -s 0 -r 7
+[ -f "$work/sub.png" ] || "$mkstream" -i "$work/sub.png" || fail "mkstream failed"
+half=$((seconds / 2))
+
+# menus in the VMG and titleset, two titles with chapters, cells and stills
+cat >"$work/menus.xml" <<EOF
+<dvdauthor>
+<vmgm>
+<menus>
+<pgc entry="title"><vob file="$work/menu.mpg" pause="inf"/><post>jump titleset 1 menu;</post></pgc>
+</menus>
+</vmgm>
+<titleset>
+<menus>
+<pgc entry="root"><vob file="$work/menu.mpg"/><post>jump title 1;</post></pgc>
+</menus>
+<titles>
+<subpicture lang="en"/>
+<subpicture lang="de"/>
+<pgc>
+<vob file="$work/t1.mpg" chapters="0,0:10,0:20"/>
+<vob file="$work/t2.mpg" chapters="0,0:15" pause="3"/>
+<post>call menu;</post>
+</pgc>
+<pgc>
+<vob file="$work/t3.mpg">
+<cell start="0" end="$half" chapter="1"/>
+<cell start="$half" chapter="1" pause="2"/>
+</vob>
+</pgc>
+</titles>
+</titleset>
+</dvdauthor>
+EOF
+
+# several titlesets with different audio, for generating them in parallel
+cat >"$work/titlesets.xml" <<EOF
+<dvdauthor>
+<vmgm/>
+<titleset><titles><subpicture lang="en"/><pgc><vob file="$work/t4.mpg"/><vob file="$work/t1.mpg"/></pgc></titles></titleset>
+<titleset><titles><pgc><vob file="$work/t5.mpg" chapters="0,0:05"/></pgc></titles></titleset>
+<titleset><titles><subpicture lang="en"/><pgc><vob file="$work/t2.mpg"/></pgc><pgc><vob file="$work/t3.mpg"/></pgc></titles></titleset>
+</dvdauthor>
+EOF
+
+# NTSC, to go through the other frame rate
+cat >"$work/ntsc.xml" <<EOF
+<dvdauthor>
+<vmgm><menus><pgc><vob file="$work/menun.mpg"/></pgc></menus></vmgm>
+<titleset><titles><subpicture lang="en"/><pgc><vob file="$work/tn.mpg" chapters="0,0:30"/></pgc></titles></titleset>
+</dvdauthor>
+EOF
+
+# a title made up of many cells from several VOBs, some of them chapters
+# and some with pauses, for the cell and VOBU lookups
+{
+    echo "<dvdauthor>"
+    echo "<vmgm/>"
+    echo "<titleset><titles><subpicture lang=\"en\"/><subpicture lang=\"de\"/><pgc>"
+    for v in 1 2 3; do
+        echo "<vob file=\"$work/t$v.mpg\">"
+        for ((t = 0; t < seconds; t += 5)); do
+            chapter=
+            ((t % 15 == 0)) && chapter=" chapter=\"1\""
+            pause=
+            ((t % 20 == 10)) && pause=" pause=\"1\""
+            if ((t + 5 < seconds)); then
+                echo "<cell start=\"$t\" end=\"$((t + 5))\"$chapter$pause/>"
+            else
+                echo "<cell start=\"$t\"$chapter$pause/>"
+            fi
+        done
+        echo "</vob>"
+    done
+    echo "</pgc></titles></titleset>"
+    echo "</dvdauthor>"
+} >"$work/cells.xml"
+
+projects="menus titlesets ntsc cells"
+
+# the versions of the projects for the first run with -I
+for project in $projects; do
+    sed \
+        -e "s|/menu\.mpg\"|/menulong.mpg\"|g" \
+        -e "s|/menun\.mpg\"|/menulongn.mpg\"|g" \
+        -e "s|<vmgm/>|<vmgm><menus><pgc><vob file=\"$work/menulong.mpg\"/></pgc></menus></vmgm>|" \
+        "$work/$project.xml" >"$work/$project-grown.xml"
+done
+
+# subtitles at varying positions, some without an end time, with those of
+# each further stream (in spumux1.xml, spumux2.xml...) starting a second later
+spuxml=("$work/spumux.xml")
+for ((k = 1; k < spustreams; k++)); do
+    spuxml+=("$work/spumux$k.xml")
+done
+for ((k = 0; k < spustreams; k++)); do
+    {
+        echo "<subpictures><stream>"
+        for ((t = 1 + k; t + 1 < seconds; t += 3)); do
+            end=
+            ((t % 4 == 1)) && end=" end=\"$((t + 2)).50\""
+            echo "<spu image=\"$work/sub.png\" start=\"$t.00\"$end xoffset=\"$((t * 8 % 400))\" yoffset=\"$((t * 16 % 500))\"/>"
+        done
+        echo "</stream></subpictures>"
+    } >"${spuxml[k]}"
+done
+
+author()
+  # author PROJECT OUTDIR COMMAND... -- generates the project into OUTDIR,
+  # and lists the checksums of the files.
+  {
+    local project="$1" out="$2"
+    shift 2
+    echo "=== $project: $*" >>"$log"
+    "$@" -o "$out" -x "$work/$project.xml" >>"$log" 2>&1 || fail "$project: $* failed, see $log"
+    (cd "$out/VIDEO_TS" && for f in $(ls); do echo "$f $(cksum <"$f")"; done)
+  }
+
+clearcaches()
+  {
+    rm -f "$work"/*.dvdauthor-scan
+  }
+
+pinned()
+  # pinned NAME -- puts the known-good checksums for NAME into $work/NAME.sums.
+  {
+    sed -n "/^=== $1\$/,/^===/{/^===/!p}" "$sums" >"$work/$1.sums"
+    [ -s "$work/$1.sums" ] || fail "no checksums for $1 in $sums"
+  }
+
+savesums()
+  # savesums NAME... -- appends the reference checksums for each NAME to
+  # $REGRESS_SAVE_SUMS, if set.
+  {
+    local name
+    [ -n "$REGRESS_SAVE_SUMS" ] || return 0
+    for name in "$@"; do
+        echo "=== $name"
+        cat "$work/$name.sums"
+    done >>"$REGRESS_SAVE_SUMS"
+  }
+
+[ -z "$REGRESS_SAVE_SUMS" ] || : >"$REGRESS_SAVE_SUMS"
+usepinned=
+if [ "$seconds" = "$pinseconds" ] && [ -f "$sums" ]; then
+    usepinned=1
+fi
+
+echo "STAT: Generating reference output"
+if [ -z "$REGRESS_REFERENCE" ] && [ -n "$usepinned" ]; then
+    echo "STAT: Using known-good checksums from $sums"
+    for project in $projects; do
+        pinned "$project"
+    done
+else
+    if [ -z "$REGRESS_REFERENCE" ]; then
+        echo "WARN: No known-good checksums for $seconds-second streams, only checking $dvdauthor against itself"
+    fi
+    reference=${REGRESS_REFERENCE:-$dvdauthor -K}
+    for project in $projects; do
+        clearcaches
+        rm -rf "$work/ref"
+        author "$project" "$work/ref" $reference >"$work/$project.sums" || exit 1
+    done
+fi
+savesums $projects
+
+status=0
+for mode in "${modes[@]}"; do
+    name="${mode%%:*}"
+    args="${mode#*:}"
+    if [ -n "$REGRESS_MODES" ] && [[ " $REGRESS_MODES " != *" ${name%/2} "* ]]; then
+        continue
+    fi
+    result=ok
+    for project in $projects; do
+        clearcaches
+        rm -rf "$work/out"
+        if [ "${name%/2}" != "$name" ]; then
+            if [[ " $args " = *" -I "* ]]; then
+                author "$project-grown" "$work/out" "$dvdauthor" $args >/dev/null || exit 1
+            else
+                author "$project" "$work/out" "$dvdauthor" $args >/dev/null || exit 1
+                rm -rf "$work/out"
+            fi
+        fi
+        author "$project" "$work/out" "$dvdauthor" $args >"$work/$project.$$" || exit 1
+        if ! cmp -s "$work/$project.sums" "$work/$project.$$"; then
+            echo "  $project differs:"
+            diff "$work/$project.sums" "$work/$project.$$" | sed -n 's/^> \([^ ]*\) .*/    \1/p'
+            result=DIFFERENT
+            status=1
+        fi
+        rm -f "$work/$project.$$"
+    done
+    printf '%-20s %s\n' "${name%/2}" "$result"
+done
+clearcaches
+
+mux()
+  # mux FORMAT COMMAND... -- muxes the subtitles into plain.mpg in the given
+  # format, and prints the checksum of the result.
+  {
+    local format="$1"
+    shift
+    echo "=== spumux $format: $*" >>"$log"
+    "$@" -m "$format" "$work/spumux.xml" <"$work/plain.mpg" >"$work/spumux.mpg" 2>>"$log" \
+        || fail "spumux $format: $* failed, see $log"
+    cksum <"$work/spumux.mpg"
+  }
+
+echo "STAT: Generating spumux reference output"
+if [ -z "$REGRESS_SPUMUX_REFERENCE" ] && [ -n "$usepinned" ]; then
+    for format in $spuformats; do
+        pinned "spumux-$format"
+    done
+else
+    spureference=${REGRESS_SPUMUX_REFERENCE:-$spumux}
+    for format in $spuformats; do
+        mux $format $spureference >"$work/spumux-$format.sums" || exit 1
+    done
+fi
+savesums $(for format in $spuformats; do echo "spumux-$format"; done)
+for mode in "${spumodes[@]}"; do
+    name="${mode%%:*}"
+    args="${mode#*:}"
+    if [ -n "$REGRESS_MODES" ] && [[ " $REGRESS_MODES " != *" $name "* ]]; then
+        continue
+    fi
+    result=ok
+    for format in $spuformats; do
+        if [ "$(mux $format "$spumux" $args)" != "$(cat "$work/spumux-$format.sums")" ]; then
+            echo "  $format differs"
+            result=DIFFERENT
+            status=1
+        fi
+    done
+    printf '%-20s %s\n' "$name" "$result"
+done
+
+unmux()
+  # unmux FILE STREAM -- extracts a subtitle stream from FILE with spuunmux,
+  # and prints the checksums of the images and of the timings and positions.
+  {
+    local dir="$work/unmux"
+    rm -rf "$dir"
+    mkdir "$dir" || exit 1
+    echo "=== spuunmux $*" >>"$log"
+    "$spuunmux" -s "$2" -o "$dir/sub" "$1" >>"$log" 2>&1 || fail "spuunmux $* failed, see $log"
+    (cd "$dir" && cksum *.png)
+    sed "s|$dir/||" "$dir/sub.xml" | cksum
+  }
+
+multimodes=
+for mode in "${spumultimodes[@]}"; do
+    name="${mode%%:*}"
+    if [ -z "$REGRESS_MODES" ] || [[ " $REGRESS_MODES " = *" $name "* ]]; then
+        multimodes="$multimodes $name"
+    fi
+done
+if [ -n "$multimodes" ]; then
+    echo "STAT: Adding the subtitle streams one at a time"
+    cp "$work/plain.mpg" "$work/spumux-chained.mpg"
+    for ((k = 0; k < spustreams; k++)); do
+        echo "=== spumux -s $k" >>"$log"
+        "$spumux" -s $k "${spuxml[k]}" <"$work/spumux-chained.mpg" >"$work/spumux.mpg" 2>>"$log" \
+            || fail "spumux -s $k failed, see $log"
+        mv "$work/spumux.mpg" "$work/spumux-chained.mpg"
+        unmux "$work/spumux-chained.mpg" $k >"$work/spumux-stream$k.sums" || exit 1
+    done
+    rm -f "$work/spumux-chained.mpg"
+fi
+for mode in "${spumultimodes[@]}"; do
+    name="${mode%%:*}"
+    args="${mode#*:}"
+    [[ " $multimodes " = *" $name "* ]] || continue
+    result=ok
+    echo "=== spumux $args ${spuxml[*]}" >>"$log"
+    "$spumux" $args "${spuxml[@]}" <"$work/plain.mpg" >"$work/spumux.mpg" 2>>"$log" \
+        || fail "spumux $args ${spuxml[*]} failed, see $log"
+    for ((k = 0; k < spustreams; k++)); do
+        if [ "$(unmux "$work/spumux.mpg" $k)" != "$(cat "$work/spumux-stream$k.sums")" ]; then
+            echo "  stream $k differs"
+            result=DIFFERENT
+            status=1
+        fi
+    done
+    printf '%-20s %s\n' "$name" "$result"
+done
+rm -rf "$work/spumux.mpg" "$work/unmux"
+exit $status
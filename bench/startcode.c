@@ -0,0 +1,179 @@
+/*
+    startcode -- times find_startcode on the video of a program stream.
+
+    The video elementary stream is pulled out of the PES packets of the
+    input, then scanned repeatedly for start codes with find_startcode, the
+    same way the tools look for them, and the fastest run is reported. The
+    positions found are checked against a plain byte-at-a-time search.
+*/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "compat.h"
+
+#include <errno.h>
+#include <sys/time.h>
+
+#define VIDEO_ID 0xe0 /* stream ID of the video PES packets */
+
+static double nowseconds(void)
+  /* returns the current time in seconds. */
+  {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return
+        now.tv_sec + now.tv_usec / 1e6;
+  } /*nowseconds*/
+
+static unsigned char *readvideo(const char *fname, int *len)
+  /* returns the concatenated payloads of the video PES packets in the
+    program stream fname, setting *len to their total length. */
+  {
+    FILE * const f = fopen(fname, "rb");
+    unsigned char *ps, *video;
+    size_t pslen = 0, psmax = 1024 * 1024;
+    size_t pos = 0;
+    int vlen = 0;
+    if (!f)
+      {
+        fprintf(stderr, "ERR:  Cannot open %s: %s\n", fname, strerror(errno));
+        exit(1);
+      } /*if*/
+    ps = malloc(psmax);
+    while (true)
+      {
+        const size_t got = fread(ps + pslen, 1, psmax - pslen, f);
+        pslen += got;
+        if (pslen < psmax)
+            break;
+        psmax *= 2;
+        ps = realloc(ps, psmax);
+      } /*while*/
+    fclose(f);
+    video = malloc(pslen);
+    while (pos + 6 <= pslen)
+      {
+        size_t next;
+        if (ps[pos] != 0 || ps[pos + 1] != 0 || ps[pos + 2] != 1)
+          {
+            fprintf(stderr, "ERR:  %s is not a program stream (at offset %zu)\n", fname, pos);
+            exit(1);
+          } /*if*/
+        if (ps[pos + 3] == 0xba) /* pack header */
+          {
+            if (pos + 14 > pslen)
+                break;
+            next = pos + 14 + (ps[pos + 13] & 7); /* MPEG-2, with any stuffing */
+          }
+        else if (ps[pos + 3] == 0xb9) /* program end */
+            break;
+        else
+          {
+            next = pos + 6 + (ps[pos + 4] << 8 | ps[pos + 5]);
+            if (next > pslen)
+                break;
+            if (ps[pos + 3] == VIDEO_ID)
+              {
+                const size_t start = pos + 9 + ps[pos + 8]; /* skip PES header */
+                if (start < next)
+                  {
+                    memcpy(video + vlen, ps + start, next - start);
+                    vlen += next - start;
+                  } /*if*/
+              } /*if*/
+          } /*if*/
+        pos = next;
+      } /*while*/
+    free(ps);
+    *len = vlen;
+    return
+        video;
+  } /*readvideo*/
+
+static int countplain(const unsigned char *buf, int len)
+  /* counts the start code prefixes in buf a byte at a time, for checking. */
+  {
+    int count = 0, pos = 0;
+    while (pos + 3 <= len)
+      {
+        if (buf[pos] == 0 && buf[pos + 1] == 0 && buf[pos + 2] == 1)
+          {
+            count++;
+            pos += 3;
+          }
+        else
+            pos++;
+      } /*while*/
+    return
+        count;
+  } /*countplain*/
+
+static int countfast(const unsigned char *buf, int len)
+  /* counts the start code prefixes in buf with find_startcode. */
+  {
+    int count = 0, pos = 0;
+    while (true)
+      {
+        pos = find_startcode(buf, pos, len);
+        if (pos == len)
+            break;
+        count++;
+        pos += 3;
+      } /*while*/
+    return
+        count;
+  } /*countfast*/
+
+int main(int argc, char **argv)
+  {
+    unsigned char *video;
+    int len, runs = 5, expect, i;
+    double best = -1;
+    if (argc >= 3 && strcmp(argv[1], "-r") == 0)
+      {
+        runs = atoi(argv[2]);
+        argv += 2;
+        argc -= 2;
+      } /*if*/
+    if (argc != 2 || runs < 1)
+      {
+        fprintf(stderr, "usage: startcode [-r RUNS] FILE\n");
+        return
+            1;
+      } /*if*/
+    video = readvideo(argv[1], &len);
+    expect = countplain(video, len);
+    for (i = 0; i < runs; i++)
+      {
+        const double start = nowseconds();
+        const int count = countfast(video, len);
+        const double elapsed = nowseconds() - start;
+        if (count != expect)
+          {
+            fprintf(stderr, "ERR:  find_startcode found %d start codes, expected %d\n", count, expect);
+            return
+                1;
+          } /*if*/
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+      } /*for*/
+    fprintf(stderr, "INFO: %d start codes in %d bytes of video\n", expect, len);
+    printf("%d %.6f\n", len, best);
+    free(video);
+    return
+        0;
+  } /*main*/
@@ -11,6 +11,16 @@
 #include <locale.h>
 #include <langinfo.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#if defined(__SSE2__)
+#define STARTCODE_SSE2
+#endif
+#if defined(__clang__) || __GNUC__ > 4 || __GNUC__ == 4 && __GNUC_MINOR__ >= 9
+#define STARTCODE_AVX2 /* can compile AVX2 code, to be used if the CPU supports it */
+#endif
+#endif
+
 /*
     Useful string stuff
 */
@@ -1507,3 +1517,111 @@ colorspec parse_color
       } /*if*/
     return result;
   } /*parse_color*/
+
+/*
+    Searching for MPEG start codes
+*/
+
+static int find_startcode_scalar(const unsigned char * buf, int pos, int end)
+  {
+    while (pos + 3 <= end)
+      {
+        const unsigned char c = buf[pos + 2];
+        if (c > 1)
+            pos += 3; /* no start code can begin at pos, pos + 1 or pos + 2 */
+        else if (c == 0)
+            pos += 1;
+        else if (buf[pos + 1] == 0 && buf[pos] == 0)
+            return
+                pos;
+        else
+            pos += 3;
+      } /*while*/
+    return
+        end;
+  } /*find_startcode_scalar*/
+
+#ifdef STARTCODE_SSE2
+
+static int find_startcode_sse2(const unsigned char * buf, int pos, int end)
+  /* checks 16 candidate positions at a time. */
+  {
+    const __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi8(1);
+    while (pos + 18 <= end)
+      {
+        const __m128i b0 = _mm_loadu_si128((const __m128i *)(buf + pos));
+        const __m128i b1 = _mm_loadu_si128((const __m128i *)(buf + pos + 1));
+        const __m128i b2 = _mm_loadu_si128((const __m128i *)(buf + pos + 2));
+        const int found = _mm_movemask_epi8
+          (
+            _mm_and_si128
+              (
+                _mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero)),
+                _mm_cmpeq_epi8(b2, one)
+              )
+          );
+        if (found != 0)
+            return
+                pos + __builtin_ctz(found);
+        pos += 16;
+      } /*while*/
+    return
+        find_startcode_scalar(buf, pos, end);
+  } /*find_startcode_sse2*/
+
+#endif
+
+#ifdef STARTCODE_AVX2
+
+__attribute__((target("avx2")))
+static int find_startcode_avx2(const unsigned char * buf, int pos, int end)
+  /* checks 32 candidate positions at a time. */
+  {
+    const __m256i zero = _mm256_setzero_si256(), one = _mm256_set1_epi8(1);
+    while (pos + 34 <= end)
+      {
+        const __m256i b0 = _mm256_loadu_si256((const __m256i *)(buf + pos));
+        const __m256i b1 = _mm256_loadu_si256((const __m256i *)(buf + pos + 1));
+        const __m256i b2 = _mm256_loadu_si256((const __m256i *)(buf + pos + 2));
+        const unsigned int found = _mm256_movemask_epi8
+          (
+            _mm256_and_si256
+              (
+                _mm256_and_si256(_mm256_cmpeq_epi8(b0, zero), _mm256_cmpeq_epi8(b1, zero)),
+                _mm256_cmpeq_epi8(b2, one)
+              )
+          );
+        if (found != 0)
+            return
+                pos + __builtin_ctz(found);
+        pos += 32;
+      } /*while*/
+    return
+        find_startcode_scalar(buf, pos, end);
+  } /*find_startcode_avx2*/
+
+#endif
+
+int find_startcode
+  (
+    const unsigned char * buf,
+    int pos,
+    int end
+  )
+  /* returns the index of the first MPEG start code prefix (bytes 00 00 01) lying
+    entirely within buf[pos .. end - 1], or end if there is none. Uses the widest
+    vector instructions the CPU supports. */
+  {
+#ifdef STARTCODE_AVX2
+    if (__builtin_cpu_supports("avx2"))
+        return
+            find_startcode_avx2(buf, pos, end);
+#endif
+#ifdef STARTCODE_SSE2
+    return
+        find_startcode_sse2(buf, pos, end);
+#else
+    return
+        find_startcode_scalar(buf, pos, end);
+#endif
+  } /*find_startcode*/
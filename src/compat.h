@@ -252,3 +252,12 @@ colorspec parse_color
   );
   /* parses colorstr and returns the resulting colour. Will abort the process
     on any errors. */
+
+int find_startcode
+  (
+    const unsigned char * buf,
+    int pos,
+    int end
+  );
+  /* returns the index of the first MPEG start code prefix (bytes 00 00 01) lying
+    entirely within buf[pos .. end - 1], or end if there is none. */
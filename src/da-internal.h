@@ -73,7 +73,13 @@ struct vobuinfo { /* describes a VOBU in a VOB */
     int firstIfield;
     int numfields;
     int lastrefsect[3]; // why on earth do they want the LAST sector of the ref (I, P) frame?
-    unsigned char sectdata[0x26]; // PACK and system header, so we don't have to reread it
+};
+
+struct vobuindex { /* compact copies of the vobu fields that get searched, one array element per VOBU */
+    pts_t *startpts; /* vobu[].sectpts[0] */
+    int *sector; /* vobu[].sector */
+    int *vobcellid; /* vobu[].vobcellid */
+    unsigned char *hasvideo; /* vobu[].hasvideo */
 };
 
 struct colorinfo { /* a colour table for subpictures */
@@ -148,6 +154,10 @@ struct vob { /* one entry created for each source in each pgc */
     int vobid,numcells;
     struct pgc *progchain; /* backpointer to PGC, used for colorinfo and buttons */
     struct vobuinfo *vobu; /* array of VOBUs in the VOB */
+    unsigned char (*vobuhdr)[0x26];
+      /* PACK and system header for each VOBU, so we don't have to reread it;
+        kept apart from vobu because it is only needed when writing the NAV packs */
+    struct vobuindex vobuidx; /* built by indexvobus once the VOBUs are final */
     struct audchannel audch[64]; /* vob-wide audio and subpicture mapping */
       /* index meaning:
         0-31: top two bits are the audio type (0 => AC3, 1 => MPEG, 2 => PCM, 3 => DTS),
@@ -222,6 +232,8 @@ struct vobgroup { /* contents of a menuset or titleset (<menus> or <titles>) */
     struct audiodesc adwarn[8]; /* for saving attribute value mismatches */
     struct subpicdesc sp[32]; /* describes the subpicture streams, one per <subpicture> tag */
     struct subpicdesc spwarn[32]; /* for saving attribute value mismatches */
+    struct vobwriter *heldvob;
+      /* output FindVobus has not yet written, awaiting NAV packs from FixVobus, if any */
 };
 
 struct vtsdef { /* describes a VTS */
@@ -247,12 +259,31 @@ struct workset { /* overall parameters for generation of a domain (VMG or VTS) *
     const struct pgcgroup *titles; /* VTS only */
 };
 
+struct ifoimage { /* an IFO (or BUP) file assembled in memory */
+    unsigned char *buf;
+    size_t len; /* bytes generated so far */
+    size_t size; /* total bytes, as computed by the layout pass */
+};
+
 /* following implemented in dvdauthor.c */
 
 extern const char * const entries[]; /* PGC menu entry types */
 extern bool
     jumppad, /* reserve registers and set up code to allow convenient jumping between titlesets */
     allowallreg; /* don't reserve any registers for convenience purposes */
+extern int maxjobs; /* maximum nr of threads to use for processing input files */
+extern int maxvtsjobs; /* maximum nr of titlesets to generate at once */
+extern int writeblocksize; /* size of writes to output VOBs, 0 for default */
+extern bool
+    directio, /* bypass the kernel page cache when writing output VOBs */
+    nocache; /* tell the kernel not to keep output VOBs in the page cache */
+extern bool
+    mapinput, /* map regular input files into memory instead of reading them */
+    zerocopy; /* let the kernel copy unmodified sectors from mapped input files to the output */
+extern int navwindow; /* megabytes of output to keep in memory until its NAV packs are done */
+extern bool scancache; /* save scans of input files alongside them, and use them instead of rescanning */
+extern bool incremental; /* only regenerate titlesets which have changed since the last run */
+extern const char *spilldir; /* where to keep big tables as temporary files, NULL for in memory */
 extern const char * const pstypes[]; /* names of PGC types, indexed by vtypes values */
 
 void write8(unsigned char *p,unsigned char d0,unsigned char d1,
@@ -265,6 +296,11 @@ unsigned int read4(const unsigned char *p);
 unsigned int read2(const unsigned char *p);
 int getsubpmask(const struct videodesc *vd);
 int getratedenom(const struct vobgroup *va);
+void *growtable(void *table, size_t oldsize, size_t newsize);
+void freetable(void *table, size_t size);
+void releasetable(void *table, size_t size);
+void freevobtables(struct vob *thisvob);
+void indexvobus(struct vob *va);
 int findvobu(const struct vob *va,pts_t pts,int l,int h);
 pts_t getptsspan(const struct pgc *ch);
 pts_t getframepts(const struct vobgroup *va);
@@ -295,18 +331,21 @@ struct vm_statement *vm_parse(const char *b);
 
 /* following implemented in dvdifo.c */
 
+void nfwrite(const void *ptr,size_t len,struct ifoimage *h);
 void WriteIFOs(const char *fbase,const struct workset *ws);
-void TocGen(const struct workset *ws,const struct pgc *fpc,const char *fname);
+void TocGen(const struct workset *ws,const struct pgc *fpc,const char *fbase);
 
 /* following implemented in dvdpgc.c */
 
-int CreatePGC(FILE *h,const struct workset *ws,vtypes ismenu);
+int CreatePGC(struct ifoimage *h,const struct workset *ws,vtypes ismenu);
 
 /* following implemented in dvdvob.c */
 
 int FindVobus(const char *fbase,struct vobgroup *va,vtypes ismenu);
 void MarkChapters(struct vobgroup *va);
-void FixVobus(const char *fbase,const struct vobgroup *va,const struct workset *ws,vtypes ismenu);
+void FixVobus(const char *fbase, struct vobgroup *va, const struct workset *ws, vtypes ismenu);
+void ReportVobStats(void);
+bool HashVobInputs(const struct vobgroup *va, uint64_t *hash);
 int calcaudiogap(const struct vobgroup *va,int vcid0,int vcid1,int ach);
 
 #endif
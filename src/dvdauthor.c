@@ -29,6 +29,11 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <dirent.h>
+#if defined(HAVE_FORK) && defined(HAVE_SYS_WAIT_H)
+#define USE_VTSJOBS
+#include <signal.h>
+#include <sys/wait.h>
+#endif
 
 #include "dvdauthor.h"
 #include "da-internal.h"
@@ -44,6 +49,35 @@ bool jumppad = false;
 // prohibits certain convenience features, like multiple commands on a button
 bool allowallreg = false;
 
+// with this greater than 1, input VOBs for titles are scanned on up to
+// this many threads at once
+int maxjobs = 1;
+
+// with this greater than 1, up to this many titlesets are generated at once,
+// each in its own process
+int maxvtsjobs = 1;
+
+// settings for writing output VOBs: size of each write (0 for default),
+// whether to use direct I/O, and whether to keep them out of the page cache
+int writeblocksize = 0;
+bool directio = false;
+bool nocache = false;
+// whether to map input files into memory where possible
+bool mapinput = false;
+// whether to have the kernel copy unmodified sectors from input to output files
+bool zerocopy = false;
+// with this nonzero, up to this many megabytes of each output VOB are kept in
+// memory until their NAV packs have been filled in
+int navwindow = 0;
+// whether to save and reuse the results of scanning input files
+bool scancache = true;
+// directory in which to keep big VOBU and audio packet tables as temporary files,
+// so they need not stay in memory, NULL to keep them all in memory
+const char *spilldir = 0;
+// with this enabled, titlesets whose definitions and input files are unchanged
+// since they were last generated in the same output directory are left as they are
+bool incremental = false;
+
 /* video/audio/subpicture attribute keywords -- note they are all unique to allow
   xxx_ANY attribute setting to work */
 static const char * const vmpegdesc[4]={"","mpeg1","mpeg2",0};
@@ -991,20 +1025,42 @@ noinfer:
       } /*for*/
   } /*setattr*/
 
+void indexvobus(struct vob *va)
+/* (re)builds the search index for the VOBUs of va from the vobu array. The columns
+  share one allocation, with the widest first to keep them all aligned. */
+{
+    const int n=va->numvobus;
+    struct vobuindex * const vx=&va->vobuidx;
+    int i;
+    free(vx->startpts);
+    vx->startpts=malloc((n>0?n:1)*(sizeof(pts_t)+2*sizeof(int)+1));
+    vx->sector=(int *)(vx->startpts+n);
+    vx->vobcellid=vx->sector+n;
+    vx->hasvideo=(unsigned char *)(vx->vobcellid+n);
+    for( i=0; i<n; i++ ) {
+        const struct vobuinfo * const vi=&va->vobu[i];
+        vx->startpts[i]=vi->sectpts[0];
+        vx->sector[i]=vi->sector;
+        vx->vobcellid[i]=vi->vobcellid;
+        vx->hasvideo[i]=vi->hasvideo!=0;
+    }
+}
+
 int findcellvobu(const struct vob *va,int cellid)
 /* finds the element of array va that includes the cell with ID cellid. */
 {
+    const int * const vobcellid=va->vobuidx.vobcellid;
     int l=0,h=va->numvobus-1;
     if( h<l )
         return 0;
     cellid=(cellid&255)|(va->vobid*256);
-    if( cellid<va->vobu[0].vobcellid )
+    if( cellid<vobcellid[0] )
         return 0;
-    if( cellid>va->vobu[h].vobcellid )
+    if( cellid>vobcellid[h] )
         return h+1;
     while(l<h) { /* search by binary chop */
         int m=(l+h)/2;
-        if( cellid<=va->vobu[m].vobcellid )
+        if( cellid<=vobcellid[m] )
             h=m;
         else
             l=m+1;
@@ -1017,23 +1073,24 @@ pts_t getcellpts(const struct vob *va,int cellid)
 {
     int s=findcellvobu(va,cellid),e=findcellvobu(va,cellid+1);
     if( s==e ) return 0;
-    return va->vobu[e-1].sectpts[1]-va->vobu[s].sectpts[0];
+    return va->vobu[e-1].sectpts[1]-va->vobuidx.startpts[s];
 }
 
 int findvobu(const struct vob *va,pts_t pts,int l,int h)
 /* finds the element of array va, within indexes l and h, that includes time pts. */
 {
     // int l=0,h=va->numvobus-1;
+    const pts_t * const startpts=va->vobuidx.startpts;
 
     if( h<l )
         return l-1;
-    if( pts<va->vobu[l].sectpts[0] )
+    if( pts<startpts[l] )
         return l-1;
     if( pts>=va->vobu[h].sectpts[1] )
         return h+1;
     while(l<h) { /* search by binary chop */
         int m=(l+h+1)/2;
-        if( pts < va->vobu[m].sectpts[0] )
+        if( pts < startpts[m] )
             h=m-1;
         else
             l=m;
@@ -1161,6 +1218,164 @@ static void checkaddentry(struct pgcgroup *va, int entry)
         forceaddentry(va, entry);
   } /*checkaddentry*/
 
+#define MANIFEST_NAME ".dvdauthor-manifest"
+#define MANIFEST_MAGIC "dvdauthor manifest v1"
+
+static int lastvtsnum = 0; /* last titleset nr assigned in this run */
+static bool manifestloaded = false;
+static uint64_t manifest[100];
+  /* for incremental mode: fingerprints of the definitions and inputs from which each
+    titleset in the output directory was generated, 0 if unknown */
+
+static void loadmanifest(const char *fbase)
+  /* reads the manifest from the output directory, if it hasn't already been done. */
+  {
+    char *fname;
+    FILE *f;
+    char line[100];
+    int vtsnum;
+    uint64_t fingerprint;
+    if (manifestloaded)
+        return;
+    memset(manifest, 0, sizeof manifest);
+    manifestloaded = true;
+    fname = sprintf_alloc("%s/%s", fbase, MANIFEST_NAME);
+    f = fopen(fname, "r");
+    free(fname);
+    if (!f)
+        return;
+    if (fgets(line, sizeof line, f) && !strncmp(line, MANIFEST_MAGIC "\n", sizeof MANIFEST_MAGIC))
+      {
+        while (fgets(line, sizeof line, f))
+            if
+              (
+                    sscanf(line, "VTS %d %" SCNx64, &vtsnum, &fingerprint) == 2
+                &&
+                    vtsnum >= 1
+                &&
+                    vtsnum <= 99
+              )
+                manifest[vtsnum] = fingerprint;
+      } /*if*/
+    fclose(f);
+  } /*loadmanifest*/
+
+static void savemanifest(const char *fbase)
+  /* writes out the current manifest to the output directory. */
+  {
+    char * const fname = sprintf_alloc("%s/%s", fbase, MANIFEST_NAME);
+    FILE * const f = fopen(fname, "w");
+    int i;
+    if (!f)
+      {
+        fprintf(stderr, "ERR:  cannot create %s: %s\n", fname, strerror(errno));
+        exit(1);
+      } /*if*/
+    fprintf(f, MANIFEST_MAGIC "\n");
+    for (i = 1; i <= 99; i++)
+        if (manifest[i] != 0)
+            fprintf(f, "VTS %02d %016" PRIx64 "\n", i, manifest[i]);
+    if (ferror(f) | (fclose(f) != 0))
+      {
+        fprintf(stderr, "ERR:  cannot write %s: %s\n", fname, strerror(errno));
+        exit(1);
+      } /*if*/
+    free(fname);
+  } /*savemanifest*/
+
+static bool vtsexists(const char *fbase, int vtsnum)
+  /* does the output directory contain the IFO and BUP files for the specified titleset. */
+  {
+    char *fname;
+    bool exists;
+    fname = sprintf_alloc("%s/VIDEO_TS/VTS_%02d_0.IFO", fbase, vtsnum);
+    exists = access(fname, F_OK) == 0;
+    free(fname);
+    fname = sprintf_alloc("%s/VIDEO_TS/VTS_%02d_0.BUP", fbase, vtsnum);
+    exists = exists && access(fname, F_OK) == 0;
+    free(fname);
+    return
+        exists;
+  } /*vtsexists*/
+
+static void deletevts(const char *fbase, int vtsnum)
+  /* deletes all the files for the specified titleset from the output directory. */
+  {
+    char * const dirname = sprintf_alloc("%s/VIDEO_TS", fbase);
+    char prefix[8];
+    DIR * const subdir = opendir(dirname);
+    if (subdir == NULL && errno != ENOENT)
+      {
+        fprintf(stderr, "ERR:  cannot open dir for deleting %s: %s\n", dirname, strerror(errno));
+        exit(1);
+      } /*if*/
+    snprintf(prefix, sizeof prefix, "VTS_%02d_", vtsnum);
+    if (subdir != NULL)
+      {
+        for (;;)
+          {
+            const struct dirent * const entry = readdir(subdir);
+            if (entry == NULL)
+                break;
+            if
+              (
+                    strlen(entry->d_name) == 12
+                &&
+                    !strncmp(entry->d_name, prefix, 7)
+                &&
+                    entry->d_name[8] == '.'
+                &&
+                    (
+                        !strcmp(entry->d_name + 9, "IFO")
+                    ||
+                        !strcmp(entry->d_name + 9, "BUP")
+                    ||
+                        !strcmp(entry->d_name + 9, "VOB")
+                    )
+              )
+              {
+                char * const subname = sprintf_alloc("%s/%s", dirname, entry->d_name);
+                if (unlink(subname))
+                  {
+                    fprintf(stderr, "ERR:  cannot delete file %s: %s\n", subname, strerror(errno));
+                    exit(1);
+                  } /*if*/
+                free(subname);
+              } /*if*/
+          } /*for*/
+        closedir(subdir);
+      } /*if*/
+    free(dirname);
+    errno = 0;
+  } /*deletevts*/
+
+static uint64_t vtsfingerprint(const struct menugroup *menus, const struct pgcgroup *titles, int vtsnum, uint64_t defhash)
+  /* works out a fingerprint for the titleset from a hash of its definition,
+    global settings that affect its contents, the version of dvdauthor, and the
+    identifying keys of its input files as used for the scan cache. Returns 0 if
+    it cannot be fingerprinted. */
+  {
+    const int settings[] = {vtsnum, default_video_format, jumppad, allowallreg};
+    const unsigned char *b;
+    uint64_t hash = defhash;
+    size_t i;
+    if (defhash == 0)
+        return
+            0;
+    b = (const unsigned char *)settings;
+    for (i = 0; i < sizeof settings; i++)
+        hash = (hash ^ b[i]) * 1099511628211ULL;
+    for (i = 0; i < strlen(provider_str); i++)
+        hash = (hash ^ (unsigned char)provider_str[i]) * 1099511628211ULL;
+    for (i = 0; i <= strlen(PACKAGE_VERSION); i++)
+        hash = (hash ^ (unsigned char)PACKAGE_VERSION[i]) * 1099511628211ULL;
+    if (!HashVobInputs(menus->mg_vg, &hash) || !HashVobInputs(titles->pg_vg, &hash))
+        return
+            0;
+    return
+        hash != 0 ? hash : 1;
+  } /*vtsfingerprint*/
+
 static int getvtsnum(const char *fbase)
   /* returns the next unused titleset number within output directory fbase. */
   {
@@ -1168,7 +1383,17 @@ static int getvtsnum(const char *fbase)
     int i;
     if (!fbase)
         return 1;
-    for (i = 1; i <= 99; i++)
+    if (incremental)
+      {
+      /* existing titlesets are replaced in order */
+        i = ++lastvtsnum;
+        fprintf(stderr, "STAT: Picking VTS %02d\n", i);
+        return i;
+      } /*if*/
+    for (i = lastvtsnum + 1; i <= 99; i++)
+      /* titlesets after the first one in this run follow on from it, whether or
+        not their predecessors have finished being written, skipping any left
+        from before */
       {
         FILE *h;
         snprintf(realfbase, sizeof realfbase, "%s/VIDEO_TS/VTS_%02d_0.IFO", fbase, i);
@@ -1178,9 +1403,58 @@ static int getvtsnum(const char *fbase)
         fclose(h);
       } /*for*/
     fprintf(stderr, "STAT: Picking VTS %02d\n", i);
+    lastvtsnum = i;
     return i;
   } /*getvtsnum*/
 
+#ifdef USE_VTSJOBS
+
+struct vtsjob /* a titleset being generated in a child process */
+  {
+    pid_t pid;
+    int vtsnum;
+    uint64_t fingerprint; /* for the manifest, 0 if none */
+  };
+
+static struct vtsjob vtsjobs[99];
+static int numvtsjobs = 0; /* used portion of vtsjobs */
+
+static void waitvtsjob(const char *fbase)
+  /* waits for any of the child processes generating titlesets to finish,
+    and records the titleset in the manifest if needed. */
+  {
+    int status, i;
+    const pid_t pid = wait(&status);
+    if (pid == -1)
+      {
+        fprintf(stderr, "ERR:  Error %d waiting for titleset process: %s\n", errno, strerror(errno));
+        exit(1);
+      } /*if*/
+    for (i = 0; i < numvtsjobs && vtsjobs[i].pid != pid; i++)
+      /* find it */;
+    if (i == numvtsjobs)
+        return; /* not one of mine */
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      {
+        int j;
+        fprintf(stderr, "ERR:  Generation of VTS %02d failed\n", vtsjobs[i].vtsnum);
+        for (j = 0; j < numvtsjobs; j++)
+            if (j != i)
+                kill(vtsjobs[j].pid, SIGTERM);
+        exit(1);
+      } /*if*/
+    fprintf(stderr, "INFO: VTS %02d done\n", vtsjobs[i].vtsnum);
+    timing_mergechild(pid);
+    if (vtsjobs[i].fingerprint != 0)
+      {
+        manifest[vtsjobs[i].vtsnum] = vtsjobs[i].fingerprint;
+        savemanifest(fbase);
+      } /*if*/
+    vtsjobs[i] = vtsjobs[--numvtsjobs];
+  } /*waitvtsjob*/
+
+#endif /*USE_VTSJOBS*/
+
 static void deletedir(const char * fbase)
   /* deletes any existing output directory structure. Note for safety I only look for
     names matching limited patterns. */
@@ -1255,7 +1529,7 @@ static void initdir(const char * fbase)
     static char realfbase[1000];
     if (fbase)
       {
-        if (delete_output_dir)
+        if (delete_output_dir && !incremental)
           {
             deletedir(fbase);
             delete_output_dir = false; /* only do on first call */
@@ -1312,11 +1586,9 @@ static void vob_free(struct vob *v)
   {
     if (v)
       {
-        int i;
         free(v->fname);
-        free(v->vobu);
-        for (i = 0; i < 64; i++)
-            free(v->audch[i].audpts);
+        freevobtables(v);
+        free(v->vobuidx.startpts);
         free(v);
       } /*if*/
   } /*vob_free*/
@@ -1854,6 +2126,124 @@ void dvdauthor_enable_allgprm()
     allowallreg = true;
 }
 
+void dvdauthor_set_jobs(int jobs)
+  {
+    if (jobs < 1)
+      {
+        fprintf(stderr, "ERR:  Number of jobs must be at least 1\n");
+        exit(1);
+      } /*if*/
+#ifndef HAVE_PTHREAD
+    if (jobs > 1)
+        fprintf(stderr, "WARN: Built without thread support, ignoring number of jobs\n");
+#endif
+    maxjobs = jobs;
+  } /*dvdauthor_set_jobs*/
+
+void dvdauthor_set_vtsjobs(int jobs)
+  {
+    if (jobs < 1 || jobs > 99)
+      {
+        fprintf(stderr, "ERR:  Number of titleset jobs must be from 1 to 99\n");
+        exit(1);
+      } /*if*/
+#ifndef USE_VTSJOBS
+    if (jobs > 1)
+        fprintf(stderr, "WARN: Cannot create processes on this system, ignoring number of titleset jobs\n");
+#endif
+    maxvtsjobs = jobs;
+  } /*dvdauthor_set_vtsjobs*/
+
+void dvdauthor_set_blocksize(int kbytes)
+  {
+    if (kbytes < 2 || kbytes % 2 != 0 || kbytes > 65536)
+      {
+        fprintf(stderr, "ERR:  Block size must be a multiple of 2KB, up to 64MB\n");
+        exit(1);
+      } /*if*/
+    writeblocksize = kbytes * 1024;
+  } /*dvdauthor_set_blocksize*/
+
+void dvdauthor_enable_directio()
+  {
+#ifndef O_DIRECT
+    fprintf(stderr, "WARN: Direct I/O not supported on this system, ignoring\n");
+#endif
+    directio = true;
+  } /*dvdauthor_enable_directio*/
+
+void dvdauthor_enable_nocache()
+  {
+#ifndef HAVE_POSIX_FADVISE
+    fprintf(stderr, "WARN: posix_fadvise not available on this system, ignoring nocache\n");
+#endif
+    nocache = true;
+  } /*dvdauthor_enable_nocache*/
+
+void dvdauthor_enable_mapinput()
+  {
+#if !defined(HAVE_MMAP) || !defined(HAVE_SYS_MMAN_H)
+    fprintf(stderr, "WARN: Memory-mapped input not supported on this system, ignoring\n");
+#endif
+    mapinput = true;
+  } /*dvdauthor_enable_mapinput*/
+
+void dvdauthor_enable_zerocopy()
+  {
+#ifndef HAVE_COPY_FILE_RANGE
+    fprintf(stderr, "WARN: copy_file_range not supported on this system, ignoring zerocopy\n");
+#endif
+    dvdauthor_enable_mapinput(); /* needed to check which sectors are unmodified */
+    zerocopy = true;
+  } /*dvdauthor_enable_zerocopy*/
+
+void dvdauthor_set_navwindow(int mbytes)
+  {
+    if (mbytes > 1024)
+      {
+        fprintf(stderr, "ERR:  NAV window cannot be more than 1024MB\n");
+        exit(1);
+      } /*if*/
+    navwindow = mbytes;
+  } /*dvdauthor_set_navwindow*/
+
+void dvdauthor_disable_scancache()
+  {
+    scancache = false;
+  } /*dvdauthor_disable_scancache*/
+
+void dvdauthor_set_spilldir(const char *dir)
+  {
+#if !defined(HAVE_MMAP) || !defined(HAVE_SYS_MMAN_H)
+    fprintf(stderr, "WARN: Memory-mapped files not supported on this system, ignoring spill directory\n");
+#endif
+    spilldir = strdup(dir);
+  } /*dvdauthor_set_spilldir*/
+
+void dvdauthor_enable_incremental()
+  {
+    incremental = true;
+  } /*dvdauthor_enable_incremental*/
+
+static void deletevmg(const char *vtsdir)
+  /* deletes the files for the VMG from the VIDEO_TS directory, so none of the old
+    version can be left behind when it is regenerated. */
+  {
+    static const char * const suffixes[] = {"VOB", "IFO", "BUP"};
+    int i;
+    for (i = 0; i < 3; i++)
+      {
+        char * const fname = sprintf_alloc("%s/VIDEO_TS.%s", vtsdir, suffixes[i]);
+        if (unlink(fname) && errno != ENOENT)
+          {
+            fprintf(stderr, "ERR:  cannot delete file %s: %s\n", fname, strerror(errno));
+            exit(1);
+          } /*if*/
+        free(fname);
+      } /*for*/
+    errno = 0;
+  } /*deletevmg*/
+
 void dvdauthor_vmgm_gen(struct pgc *fpc, struct menugroup *menus, const char *fbase)
   /* generates the VMG, taking into account all already-generated titlesets. */
   {
@@ -1883,6 +2273,9 @@ void dvdauthor_vmgm_gen(struct pgc *fpc, struct menugroup *menus, const char *fb
     // create base entry, if not already existing
     memset(&ts, 0, sizeof(struct toc_summary));
     vtsdir = makevtsdir(fbase);
+    if (incremental)
+      /* output directory wasn't cleared, and the VMG is always regenerated */
+        deletevmg(vtsdir);
     for (i = 0; i < 101; i++)
         ifonames[i][0] = 0; /* mark all name entries as unused */
     d = opendir(vtsdir);
@@ -1952,22 +2345,52 @@ void dvdauthor_vmgm_gen(struct pgc *fpc, struct menugroup *menus, const char *fb
         set_video_format_attr(menus->mg_vg, VTYPE_VMGM); /* for the sake of buildtimeeven */
       } /*if*/
   /* (re)generate VMG IFO */
-    snprintf(fbuf, sizeof fbuf, "%s/VIDEO_TS.IFO", vtsdir);
-    TocGen(&ws, fpc, fbuf);
-    snprintf(fbuf, sizeof fbuf, "%s/VIDEO_TS.BUP", vtsdir); /* same thing again, backup copy */
-    TocGen(&ws, fpc, fbuf);
+    snprintf(fbuf, sizeof fbuf, "%s/VIDEO_TS", vtsdir);
+    TocGen(&ws, fpc, fbuf); /* IFO and backup copy */
     for (i = 0; i < ts.numvts; i++)
         if (ts.vts[i].numchapters)
             free(ts.vts[i].numchapters);
     free(vtsdir);
   } /*dvdauthor_vmgm_gen*/
 
-void dvdauthor_vts_gen(struct menugroup *menus, struct pgcgroup *titles, const char *fbase)
-  /* generates a VTS (titleset). */
+static void vts_write(struct menugroup *menus, struct pgcgroup *titles, const struct workset *ws, const char *fbase)
+  /* generates the VOB and IFO files for a VTS, fbase being the common prefix
+    for their names. */
+  {
+    if (menus->mg_vg->numvobs != 0)
+      {
+        FindVobus(fbase, menus->mg_vg, VTYPE_VTSM);
+        MarkChapters(menus->mg_vg);
+        setattr(menus->mg_vg, VTYPE_VTSM);
+      }
+    else if (menus->mg_vg->numallpgcs != 0)
+      {
+        set_video_format_attr(menus->mg_vg, VTYPE_VTSM); /* for the sake of buildtimeeven */
+      } /*if*/
+    FindVobus(fbase, titles->pg_vg, VTYPE_VTS);
+    MarkChapters(titles->pg_vg);
+    setattr(titles->pg_vg, VTYPE_VTS);
+    if (!menus->mg_vg->numvobs) // for undefined menus, we'll just copy the video type of the title
+      {
+        menus->mg_vg->vd = titles->pg_vg->vd;
+      } /*if*/
+    fprintf(stderr, "\n");
+    WriteIFOs(fbase, ws);
+    if (menus->mg_vg->numvobs)
+        FixVobus(fbase, menus->mg_vg, ws, VTYPE_VTSM);
+    FixVobus(fbase, titles->pg_vg, ws, VTYPE_VTS);
+    ReportVobStats();
+  } /*vts_write*/
+
+void dvdauthor_vts_gen(struct menugroup *menus, struct pgcgroup *titles, const char *fbase, uint64_t defhash)
+  /* generates a VTS (titleset). defhash is a hash of the titleset definition, for
+    incremental mode, or 0 if none is available. */
   {
     int vtsnum, i;
     static char realfbase[1000];
     struct workset ws;
+    const char * const outdir = fbase;
+    uint64_t fingerprint = 0;
 
     fprintf(stderr, "INFO: dvdauthor creating VTS\n");
     initdir(fbase);
@@ -1990,31 +2413,87 @@ void dvdauthor_vts_gen(struct menugroup *menus, struct pgcgroup *titles, const c
         exit(1);
       } /*if*/
     vtsnum = getvtsnum(fbase);
+    if (fbase && incremental)
+      {
+        loadmanifest(fbase);
+        fingerprint = vtsfingerprint(menus, titles, vtsnum, defhash);
+        if (fingerprint != 0 && manifest[vtsnum] == fingerprint && vtsexists(fbase, vtsnum))
+          {
+            fprintf(stderr, "INFO: VTS %02d is unchanged, keeping existing output\n", vtsnum);
+            return;
+          } /*if*/
+      /* forget about old version before deleting it, in case I don't finish */
+        manifest[vtsnum] = 0;
+        savemanifest(fbase);
+        deletevts(fbase, vtsnum);
+      } /*if*/
     if (fbase)
       {
         snprintf(realfbase, sizeof realfbase, "%s/VIDEO_TS/VTS_%02d", fbase, vtsnum);
         fbase = realfbase;
       } /*if*/
-    if (menus->mg_vg->numvobs != 0)
-      {
-        FindVobus(fbase, menus->mg_vg, VTYPE_VTSM);
-        MarkChapters(menus->mg_vg);
-        setattr(menus->mg_vg, VTYPE_VTSM);
-      }
-    else if (menus->mg_vg->numallpgcs != 0)
-      {
-        set_video_format_attr(menus->mg_vg, VTYPE_VTSM); /* for the sake of buildtimeeven */
+#ifdef USE_VTSJOBS
+    if (maxvtsjobs > 1 && fbase)
+      {
+        pid_t pid;
+        while (numvtsjobs >= maxvtsjobs)
+            waitvtsjob(outdir);
+        fflush(stdout);
+        fflush(stderr);
+        pid = fork();
+        if (pid == -1)
+          {
+            fprintf(stderr, "ERR:  Cannot create process for VTS %02d: %s\n", vtsnum, strerror(errno));
+            exit(1);
+          } /*if*/
+        if (pid == 0)
+          {
+          /* share the -J threads out between the titleset processes, so no more
+            input files are read at once than with -J alone */
+            maxjobs /= maxvtsjobs;
+            if (maxjobs < 1)
+                maxjobs = 1;
+            vts_write(menus, titles, &ws, fbase);
+            timing_savechild();
+            fflush(stdout);
+            _exit(0);
+          } /*if*/
+        vtsjobs[numvtsjobs].pid = pid;
+        vtsjobs[numvtsjobs].vtsnum = vtsnum;
+        vtsjobs[numvtsjobs].fingerprint = fingerprint;
+        numvtsjobs++;
+        return;
       } /*if*/
-    FindVobus(fbase, titles->pg_vg, VTYPE_VTS);
-    MarkChapters(titles->pg_vg);
-    setattr(titles->pg_vg, VTYPE_VTS);
-    if (!menus->mg_vg->numvobs) // for undefined menus, we'll just copy the video type of the title
+#endif
+    vts_write(menus, titles, &ws, fbase);
+    if (fingerprint != 0)
       {
-        menus->mg_vg->vd = titles->pg_vg->vd;
+        manifest[vtsnum] = fingerprint;
+        savemanifest(outdir);
       } /*if*/
-    fprintf(stderr, "\n");
-    WriteIFOs(fbase, &ws);
-    if (menus->mg_vg->numvobs)
-        FixVobus(fbase, menus->mg_vg, &ws, VTYPE_VTSM);
-    FixVobus(fbase, titles->pg_vg, &ws, VTYPE_VTS);
   } /*dvdauthor_vts_gen*/
+
+void dvdauthor_vts_end(const char *fbase)
+  /* called after all titlesets have been generated, to wait for any still being
+    written. In incremental mode, also removes any titlesets left over from a
+    previous run that no longer exist. */
+  {
+    int i;
+#ifdef USE_VTSJOBS
+    while (numvtsjobs > 0)
+        waitvtsjob(fbase);
+#endif
+    if (!fbase || !incremental)
+        return;
+    loadmanifest(fbase);
+    for (i = lastvtsnum + 1; i <= 99; i++)
+      {
+        if (manifest[i] != 0 || vtsexists(fbase, i))
+          {
+            fprintf(stderr, "INFO: Removing old VTS %02d\n", i);
+            deletevts(fbase, i);
+            manifest[i] = 0;
+          } /*if*/
+      } /*for*/
+    savemanifest(fbase);
+  } /*dvdauthor_vts_end*/
@@ -96,9 +96,38 @@ void source_set_filename(struct source *v,const char *s);
 
 void dvdauthor_enable_jumppad();
 void dvdauthor_enable_allgprm();
-void dvdauthor_vts_gen(struct menugroup *menus,struct pgcgroup *titles,const char *fbase);
+void dvdauthor_set_jobs(int jobs);
+void dvdauthor_set_vtsjobs(int jobs);
+void dvdauthor_set_blocksize(int kbytes);
+void dvdauthor_enable_directio();
+void dvdauthor_enable_nocache();
+void dvdauthor_enable_mapinput();
+void dvdauthor_enable_zerocopy();
+void dvdauthor_set_navwindow(int mbytes);
+void dvdauthor_disable_scancache();
+void dvdauthor_set_spilldir(const char *dir);
+void dvdauthor_enable_incremental();
+void dvdauthor_set_timingfile(const char *fname);
+void dvdauthor_vts_gen(struct menugroup *menus,struct pgcgroup *titles,const char *fbase,uint64_t defhash);
+void dvdauthor_vts_end(const char *fbase);
 void dvdauthor_vmgm_gen(struct pgc *fpc,struct menugroup *menus,const char *fbase);
 
+struct phasetimer { /* measures one phase of processing for the timing report */
+    bool active; /* false if no timing report is wanted */
+    bool thread; /* running on a worker thread */
+    const char *name;
+    char *detail; /* what the phase is working on, as a JSON string, or NULL */
+    int depth; /* nesting level, -1 on a worker thread */
+    double start, cpu; /* wall-clock and CPU time at start */
+};
+
+/* following implemented in dvdtiming.c */
+
+void phase_start(struct phasetimer *t,const char *name,const char *detail,bool thread);
+void phase_stop(struct phasetimer *t,uint64_t bytesread,uint64_t byteswritten,uint64_t sectors);
+void timing_savechild(void);
+void timing_mergechild(pid_t pid);
+
 #ifdef __cplusplus
 }
 #endif
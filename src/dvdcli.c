@@ -314,6 +314,32 @@ static void usage()
             "\n\t" LONGOPT("--jumppad or ") "-j enables the creation of jumppads, which allow greater\n"
             "\t    flexibility in choosing jump/call destinations.\n"
             "\n\t" LONGOPT("--allgprm or ") "-g enables the use of all 16 general purpose registers.\n"
+            "\n\t" LONGOPT("--jobs=N or ") "-J N scans up to N input files for titles at once, using\n"
+            "\t    separate threads, and builds IFO tables on up to N threads.  Default is 1.\n"
+            "\n\t" LONGOPT("--vtsjobs=N or ") "-V N generates up to N titlesets from an XML file at\n"
+            "\t    once, using separate processes, which share out the -J threads (at\n"
+            "\t    least one each).  Default is 1.\n"
+            "\n\t" LONGOPT("--blocksize=N or ") "-B N writes output VOBs in blocks of N KB (a multiple\n"
+            "\t    of 2).  Default is 32.\n"
+            "\n\t" LONGOPT("--direct or ") "-D writes output VOBs with direct I/O, bypassing the page\n"
+            "\t    cache, where supported.\n"
+            "\n\t" LONGOPT("--nocache or ") "-N tells the system not to keep output VOBs in the page\n"
+            "\t    cache once written.\n"
+            "\n\t" LONGOPT("--mmap or ") "-M maps input files into memory instead of reading them,\n"
+            "\t    where they are regular files.\n"
+            "\n\t" LONGOPT("--zerocopy or ") "-Z has the system copy sectors that are unchanged\n"
+            "\t    straight from input files to output VOBs.  Implies -M.\n"
+            "\n\t" LONGOPT("--navwindow=N or ") "-W N keeps up to N MB of each output VOB in memory\n"
+            "\t    until its NAV packs are filled in, to avoid rewriting them on disk.\n"
+            "\n\t" LONGOPT("--no-scan-cache or ") "-K neither uses nor saves the scan results kept\n"
+            "\t    alongside input files in FILE.dvdauthor-scan.\n"
+            "\n\t" LONGOPT("--incremental or ") "-I only regenerates the titlesets in an XML file\n"
+            "\t    whose definitions or input files have changed since the last run.\n"
+            "\n\t" LONGOPT("--spilldir=DIR or ") "-S DIR keeps big VOBU and audio packet tables in\n"
+            "\t    temporary files in DIR, so long titles need not hold them all in memory.\n"
+            "\n\t" LONGOPT("--timings=FILE or ") "-Y FILE writes the time taken, data processed and\n"
+            "\t    memory used by each phase of processing to FILE as JSON (- for stdout).\n"
+            "\t    Can also be requested with the DVDAUTHOR_TIMINGS environment variable.\n"
             "\n\t" LONGOPT("--help or ") "-h displays this screen.\n"
         );
     exit(1);
@@ -371,7 +397,8 @@ int main(int argc, char **argv)
     char * xmlfile = 0; /* name of XML control file, if any */
     bool istitle = true; /* index into va */
     bool istoc = false, /* true if doing VMG, false if doing titleset */
-        usedtocflag = false; /* indicates that istoc can no longer be changed */
+        usedtocflag = false, /* indicates that istoc can no longer be changed */
+        incremental = false; /* whether -I was specified */
     struct pgc *curpgc = 0,* fpc = 0;
     struct source *curvob = 0;
 #ifdef HAVE_GETOPT_LONG
@@ -392,6 +419,18 @@ int main(int argc, char **argv)
         {"fpc",1,0,'F'},
         {"jumppad",0,0,'j'},
         {"allgprm",0,0,'g'},
+        {"jobs",1,0,'J'},
+        {"vtsjobs",1,0,'V'},
+        {"blocksize",1,0,'B'},
+        {"direct",0,0,'D'},
+        {"nocache",0,0,'N'},
+        {"mmap",0,0,'M'},
+        {"zerocopy",0,0,'Z'},
+        {"navwindow",1,0,'W'},
+        {"no-scan-cache",0,0,'K'},
+        {"incremental",0,0,'I'},
+        {"spilldir",1,0,'S'},
+        {"timings",1,0,'Y'},
         {0,0,0,0}
     };
 #define GETOPTFUNC(x,y,z) getopt_long(x,y,"-" z,longopts,NULL)
@@ -401,6 +440,8 @@ int main(int argc, char **argv)
 
     default_video_format = get_video_format();
     init_locale();
+    if (getenv("DVDAUTHOR_TIMINGS") && *getenv("DVDAUTHOR_TIMINGS"))
+        dvdauthor_set_timingfile(getenv("DVDAUTHOR_TIMINGS"));
     fputs(PACKAGE_HEADER("dvdauthor"), stderr);
     if (default_video_format != VF_NONE)
       {
@@ -433,7 +474,7 @@ int main(int argc, char **argv)
 
     while (true)
       {
-        int c = GETOPTFUNC(argc, argv, "f:o:O:v:a:s:hc:Cp:Pmtb:Ti:e:x:jgn");
+        int c = GETOPTFUNC(argc, argv, "f:o:O:v:a:s:hc:Cp:Pmtb:Ti:e:x:jgnJ:B:DNMZW:KIV:S:Y:");
         if (c == -1)
             break;
         switch (c)
@@ -472,6 +513,54 @@ int main(int argc, char **argv)
             dvdauthor_enable_allgprm();
         break;
 
+        case 'J':
+            dvdauthor_set_jobs(strtounsigned(optarg, "number of jobs"));
+        break;
+
+        case 'V':
+            dvdauthor_set_vtsjobs(strtounsigned(optarg, "number of titleset jobs"));
+        break;
+
+        case 'B':
+            dvdauthor_set_blocksize(strtounsigned(optarg, "block size"));
+        break;
+
+        case 'D':
+            dvdauthor_enable_directio();
+        break;
+
+        case 'N':
+            dvdauthor_enable_nocache();
+        break;
+
+        case 'M':
+            dvdauthor_enable_mapinput();
+        break;
+
+        case 'Z':
+            dvdauthor_enable_zerocopy();
+        break;
+
+        case 'W':
+            dvdauthor_set_navwindow(strtounsigned(optarg, "NAV window size"));
+        break;
+
+        case 'K':
+            dvdauthor_disable_scancache();
+        break;
+
+        case 'I':
+            incremental = true;
+        break;
+
+        case 'S':
+            dvdauthor_set_spilldir(optarg);
+        break;
+
+        case 'Y':
+            dvdauthor_set_timingfile(optarg);
+        break;
+
         case 'T':
             NOXML
             if (usedtocflag)
@@ -636,10 +725,16 @@ int main(int argc, char **argv)
       } /*while*/
     if (xmlfile)
       {
+        if (incremental)
+            dvdauthor_enable_incremental();
         return readdvdauthorxml(xmlfile, fbase);
       }
     else
       {
+        if (incremental)
+          {
+            fprintf(stderr, "WARN: Incremental mode (-I) only applies to XML files, ignoring\n");
+          } /*if*/
         if (curvob)
           {
             fprintf(stderr, "ERR:  Chapters defined without a file source.\n");
@@ -677,7 +772,10 @@ int main(int argc, char **argv)
         if (istoc)
             dvdauthor_vmgm_gen(fpc, mg, fbase);
         else
-            dvdauthor_vts_gen(mg, va[1], fbase);
+          {
+            dvdauthor_vts_gen(mg, va[1], fbase, 0);
+            dvdauthor_vts_end(fbase);
+          } /*if*/
         pgc_free(fpc);
         menugroup_free(mg);
         pgcgroup_free(va[1]);
@@ -713,7 +811,10 @@ static vtypes
     ismenuf = VTYPE_VTS; /* type of current pgcgroup structure being parsed */
 static bool
     istoc = false, /* true for vmgm, false for titleset */
-    hadtoc = false; /* set to true when vmgm seen */
+    hadtoc = false, /* set to true when vmgm seen */
+    hadrootdigest = false; /* set to true when rootdigest has been set */
+static uint64_t
+    rootdigest; /* parser_digest after <dvdauthor> tag and its attributes */
 static int
     setvideo=0, /* to keep count of <video> tags */
     setaudio=0, /* to keep count of <audio> tags */
@@ -740,6 +841,10 @@ static double
     cell_endtime;
 static char
     menulang[3];
+static const char
+    *xmlfilename = 0; /* name of the XML file being read */
+static struct phasetimer
+    parsetimer; /* for the time spent parsing the XML file, not generating output */
 
 static void set_video_attr(int attr,const char *s)
 {
@@ -830,6 +935,18 @@ static void dvdauthor_provider
     provider_str[PROVIDER_SIZE - 1] = 0;
   } /*dvdauthor_provider*/
 
+static void parsing_stop(void)
+  /* stops timing the parse of the XML file, before generating output. */
+  {
+    phase_stop(&parsetimer, 0, 0, 0);
+  } /*parsing_stop*/
+
+static void parsing_start(void)
+  /* starts or resumes timing the parse of the XML file. */
+  {
+    phase_start(&parsetimer, "ReadXML", xmlfilename, false);
+  } /*parsing_start*/
+
 static void getfbase()
   {
     if (!writeoutput)
@@ -852,6 +969,8 @@ static void dvdauthor_end(void)
   This needs to be done after all the titles, so it can include
   information about them. */
   {
+    parsing_stop();
+    dvdauthor_vts_end(fbase);
     if (hadtoc)
       {
         dvdauthor_vmgm_gen(fpc, vmgmmenus, fbase);
@@ -860,12 +979,26 @@ static void dvdauthor_end(void)
         fpc = 0;
         vmgmmenus = 0;
       } /*if*/
+    parsing_start();
   } /*dvdauthor_end*/
 
+static void getrootdigest()
+  /* called at the start of each child of <dvdauthor>, to remember the hash of
+    the <dvdauthor> settings. */
+  {
+    if (!hadrootdigest)
+      {
+        rootdigest = parser_digest;
+        hadrootdigest = true;
+      } /*if*/
+  } /*getrootdigest*/
+
 static void titleset_start()
 {
     mg=menugroup_new();
     istoc = false;
+    getrootdigest();
+    parser_digest = rootdigest; /* hash titleset definition and global settings only */
 }
 
 static void titleset_end()
@@ -875,7 +1008,9 @@ static void titleset_end()
       {
         if (!titles)
             titles = pgcgroup_new(VTYPE_VTS);
-        dvdauthor_vts_gen(mg, titles, fbase);
+        parsing_stop();
+        dvdauthor_vts_gen(mg, titles, fbase, parser_digest);
+        parsing_start();
         menugroup_free(mg);
         pgcgroup_free(titles);
         mg = 0;
@@ -893,6 +1028,7 @@ static void vmgm_start()
     mg=menugroup_new();
     istoc = true;
     hadtoc = true;
+    getrootdigest();
 }
 
 static void vmgm_end()
@@ -1429,10 +1565,23 @@ static struct elemattr attrs[]={
 
 static int readdvdauthorxml(const char *xmlfile, const char *fb)
 {
+    struct phasetimer timer;
+    struct stat xmlstat;
+    int result;
     fbase = fb;
     if (!fbase)
       {
         fbase = get_outputdir();
       } /*if*/
-    return readxml(xmlfile, elems, attrs);
+    xmlfilename = xmlfile;
+    phase_start(&timer, "Total", xmlfile, false);
+      /* includes generating everything the XML file describes */
+    parsing_start();
+    result = readxml(xmlfile, elems, attrs);
+    if (stat(xmlfile, &xmlstat) != 0)
+        xmlstat.st_size = 0;
+    phase_stop(&parsetimer, xmlstat.st_size, 0, 0);
+      /* with the last part of the parse, the whole file has been read */
+    phase_stop(&timer, xmlstat.st_size, 0, 0);
+    return result;
 }
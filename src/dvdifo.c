@@ -23,7 +23,11 @@
 #include "config.h"
 #include "compat.h"
 #include <errno.h>
+#include <fcntl.h>
 #include <assert.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "dvdauthor.h"
 #include "da-internal.h"
@@ -112,28 +116,82 @@ static void buf_write8b
     bigbuf[o + 7] = b7;
   } /*buf_write8b*/
 
-static void nfwrite(const void *ptr, size_t len, FILE *h)
-  /* writes to h, or turns into a noop if h is null. */
+static void ifo_alloc(struct ifoimage *h, size_t size)
+  /* allocates h to hold an IFO of the size computed by its layout pass. It starts
+    out zeroed, so nothing left unwritten by mistake can leak into the file. */
   {
-    if (h)
+    h->buf = calloc(size, 1);
+    if (h->buf == 0)
+      {
+        fprintf(stderr, "ERR:  ifo_alloc: out of memory\n");
+        exit(1);
+      } /*if*/
+    h->len = 0;
+    h->size = size;
+  } /*ifo_alloc*/
+
+static void ifo_save(const struct ifoimage *h, const char *fname)
+  /* writes the complete contents of h to the file fname with a single write. */
+  {
+    const int fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+    size_t done = 0;
+    if (fd < 0)
       {
-        errno = 0; /* where is this being set? */
-        (void)fwrite(ptr, len, 1, h);
-        if (errno != 0)
+        fprintf
+          (
+            stderr,
+            "\nERR:  Error %d -- %s -- creating %s\n",
+            errno,
+            strerror(errno),
+            fname
+          );
+        exit(1);
+      } /*if*/
+    while (done < h->len)
+      {
+        const ssize_t written = write(fd, h->buf + done, h->len - done);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
           {
             fprintf
               (
                 stderr,
-                "\nERR:  Error %d -- %s -- writing output IFO\n",
+                "\nERR:  Error %d -- %s -- writing %s\n",
                 errno,
-                strerror(errno)
+                strerror(errno),
+                fname
               );
             exit(1);
           } /*if*/
+        done += written;
+      } /*while*/
+    if (close(fd) != 0)
+      {
+        fprintf
+          (
+            stderr,
+            "\nERR:  Error %d -- %s -- closing %s\n",
+            errno,
+            strerror(errno),
+            fname
+          );
+        exit(1);
+      } /*if*/
+  } /*ifo_save*/
+
+void nfwrite(const void *ptr, size_t len, struct ifoimage *h)
+  /* appends to h, or turns into a noop if h is null. */
+  {
+    if (h)
+      {
+        assert(h->len + len <= h->size); /* layout pass must have allowed for it */
+        memcpy(h->buf + h->len, ptr, len);
+        h->len += len;
       } /*if*/
   } /*nfwrite*/
 
-static void nfpad(size_t len, FILE *h)
+static void nfpad(size_t len, struct ifoimage *h)
   /* writes len bytes of padding to h, or turns into a noop if h is null. */
   {
     static unsigned char buf[2048];
@@ -158,47 +216,83 @@ static void nfpad(size_t len, FILE *h)
       } /*if*/
   } /*nfpad*/
 
-static const struct vobuinfo *globalfindvobu(const struct pgc *ch, int pts)
-  /* finds the VOBU spanning the specified time. */
+struct celltime /* where a cell lies in the timeline of a PGC */
+  {
+    pts_t end; /* time from start of PGC to end of cell */
+    const struct vob *vob; /* the VOB containing the cell */
+    int firstvobu; /* index of first VOBU of cell in vob */
+  };
+
+struct pgctimeline /* cumulative cell times for a PGC, for finding VOBUs by time */
+  {
+    struct celltime *cells;
+    int numcells;
+  };
+
+static void buildtimeline(struct pgctimeline *tl, const struct pgc *ch)
+  /* fills in tl with the times of all the cells in ch. */
   {
-    int s, c, ci;
+    int s, c, ci, n;
+    pts_t end = 0;
+    n = 0;
+    for (s = 0; s < ch->numsources; s++)
+        n += ch->sources[s]->numcells;
+    tl->cells = malloc((n > 0 ? n : 1) * sizeof(struct celltime));
+    tl->numcells = 0;
     for (s = 0; s < ch->numsources; s++)
       {
         const struct source * const thissource = ch->sources[s];
         for (c = 0; c < thissource->numcells; c++)
           {
             const struct cell * const thiscell = &thissource->cells[c];
-            int span = 0;
-            const int fv = findcellvobu(thissource->vob, thiscell->scellid);
-            if (pts < 0)
-                return
-                    &thissource->vob->vobu[fv];
+            struct celltime * const ct = &tl->cells[tl->numcells++];
             for (ci = thiscell->scellid; ci < thiscell->ecellid; ci++)
-                span += getcellpts(thissource->vob, ci);
-            if (pts < span)
-              {
-              /* desired time lies within timespan of this cell */
-                const int r = findvobu
-                  (
-                    /*va =*/ thissource->vob,
-                    /*pts =*/ pts + thissource->vob->vobu[fv].sectpts[0],
-                      /* offset from start time */
-                    /*l =*/ fv,
-                    /*h =*/ thissource->vob->numvobus-1
-                  );
-                return
-                    &thissource->vob->vobu[r];
-              } /*if*/
-            pts -= span; /* desired time lies beyond this cell */
+                end += getcellpts(thissource->vob, ci);
+            ct->end = end;
+            ct->vob = thissource->vob;
+            ct->firstvobu = findcellvobu(thissource->vob, thiscell->scellid);
           } /*for*/
       } /*for*/
-    // return last vob
-    // if (ch->numsources) {
-    // struct vob *s = ch->sources[ch->numsources - 1];
-    // return &s->vobu[s->numvobus - 1];
-    // }
+  } /*buildtimeline*/
+
+static const struct vobuinfo *globalfindvobu(const struct pgctimeline *tl, int pts)
+  /* finds the VOBU spanning the specified time. */
+  {
+    const struct celltime *ct;
+    int l, h;
+    if (tl->numcells == 0)
+        return
+            0;
+    if (pts < 0)
+        return
+            &tl->cells[0].vob->vobu[tl->cells[0].firstvobu];
+    l = 0;
+    h = tl->numcells;
+    while (l < h)
+      {
+      /* find first cell ending after desired time */
+        const int m = (l + h) / 2;
+        if (tl->cells[m].end > pts)
+            h = m;
+        else
+            l = m + 1;
+      } /*while*/
+    if (l == tl->numcells)
+        return
+            0;
+    ct = &tl->cells[l];
     return
-        0;
+        &ct->vob->vobu
+          [
+            findvobu
+              (
+                /*va =*/ ct->vob,
+                /*pts =*/ pts - (l != 0 ? tl->cells[l - 1].end : 0) + ct->vob->vobuidx.startpts[ct->firstvobu],
+                  /* offset from start time */
+                /*l =*/ ct->firstvobu,
+                /*h =*/ ct->vob->numvobus - 1
+              )
+          ];
   } /*globalfindvobu*/
 
 static int getvoblen(const struct vobgroup *va)
@@ -273,7 +367,7 @@ static int numsectTMAPT(const struct pgcgroup *va)
         (sizeTMAPT(va) + 2047) / 2048;
   } /*numsectTMAPT*/
 
-static void CreateTMAPT(FILE *h, const struct pgcgroup *va)
+static void CreateTMAPT(struct ifoimage *h, const struct pgcgroup *va)
 /* creates the VTS_TMAPTI structure which contains the time maps for each PGC. */
 {
     int pgcindex, mapblock;
@@ -307,16 +401,18 @@ static void CreateTMAPT(FILE *h, const struct pgcgroup *va)
         if (numtmapt > 0)
           {
           /* write VTS_TMAP entries */
+            struct pgctimeline tl;
             const struct vobuinfo *vobu1;
+            buildtimeline(&tl, thispgc);
             // I don't know why I ever did this
             // ptsbase = -getframepts(va->pg_vg);
             ptsbase = 0; // this matches Bullitt
-            vobu1 = globalfindvobu(thispgc, ptsbase + pts_seconds_to_ticks(va->pg_vg, units));
+            vobu1 = globalfindvobu(&tl, ptsbase + pts_seconds_to_ticks(va->pg_vg, units));
             for (j = 0; j < numtmapt; j++)
               {
                 const struct vobuinfo * const vobu2 = globalfindvobu
                   (
-                    thispgc,
+                    &tl,
                     ptsbase + pts_seconds_to_ticks(va->pg_vg, (j + 2) * units)
                   );
                 write4(buf, vobu1->sector);
@@ -325,6 +421,7 @@ static void CreateTMAPT(FILE *h, const struct pgcgroup *va)
                 nfwrite(buf, 4, h);
                 vobu1 = vobu2;
               } /*for*/
+            free(tl.cells);
           } /*if*/
       } /*for*/
 
@@ -352,43 +449,53 @@ static int numsectVOBUAD(const struct vobgroup *va)
     return (4+nv*4+2047)/2048;
 }
 
-static int CreateCellAddressTable(FILE *h, const struct vobgroup *va)
-  /* outputs a VMGM_C_ADT, VTSM_C_ADT or VTS_C_ADT structure containing pointers to all cells. */
+static int CreateCellAddressTable(struct ifoimage *h, const struct vobgroup *va)
+  /* outputs a VMGM_C_ADT, VTSM_C_ADT or VTS_C_ADT structure containing pointers to all cells.
+    Uses its own buffer, so it can be called concurrently with the other table builders. */
   {
-    int i, p, k;
-    buf_init();
+    int i, p, k, len;
+    unsigned char *buf;
+    len = 8;
+    for (k = 0; k < va->numvobs; k++)
+        len += (va->vobs[k]->numcells > 0 ? va->vobs[k]->numcells : 1) * 12;
+    len = (len + 2047) & (-2048); /* round up to whole sectors */
+    if (!h)
+        return len / 2048; /* just computing layout */
+    buf = calloc(len, 1);
     p = 8;
     for (k = 0; k < va->numvobs; k++)
       {
         const struct vob * const thisvob = va->vobs[k];
+        const int * const vobcellid = thisvob->vobuidx.vobcellid;
         for (i = 0; i < thisvob->numvobus; i++)
           {
-            if (!i || thisvob->vobu[i].vobcellid != thisvob->vobu[i - 1].vobcellid)
+            if (!i || vobcellid[i] != vobcellid[i - 1])
               { /* starting a new cell */
                 if (i)
                   {
-                    buf_write4(p + 8, thisvob->vobu[i - 1].lastsector);
+                    write4(buf + p + 8, thisvob->vobu[i - 1].lastsector);
                       /* ending sector within VOB in previous entry */
                     p += 12;
                   } /*if*/
-                buf_write2(p, thisvob->vobu[i].vobcellid >> 8); /* VOBidn */
-                buf_write1(p + 2, thisvob->vobu[i].vobcellid); /* CELLidn */
-                buf_write4(p + 4, thisvob->vobu[i].sector); /* starting sector within VOB */
+                write2(buf + p, vobcellid[i] >> 8); /* VOBidn */
+                buf[p + 2] = vobcellid[i]; /* CELLidn */
+                write4(buf + p + 4, thisvob->vobuidx.sector[i]); /* starting sector within VOB */
               } /*if*/
           } /*for*/
-        buf_write4(p + 8, thisvob->vobu[i - 1].lastsector);
+        write4(buf + p + 8, thisvob->vobu[i - 1].lastsector);
           /* ending sector within VOB in last entry */
         p += 12;
       } /*for*/
-    buf_write4(4, p - 1); /* end address (last byte of last entry) */
+    assert(p <= len);
+    write4(buf + 4, p - 1); /* end address (last byte of last entry) */
     // first 2 bytes of C_ADT contains number of vobs
-    buf_write2(0, va->numvobs);
-    p = (p + 2047) & (-2048); /* round up to whole sectors */
-    nfwrite(bigbuf, p, h);
-    return p / 2048; /* nr sectors written */
+    write2(buf, va->numvobs);
+    nfwrite(buf, len, h);
+    free(buf);
+    return len / 2048; /* nr sectors written */
   } /*CreateCellAddressTable*/
 
-static void CreateVOBUAD(FILE *h, const struct vobgroup *va)
+static void CreateVOBUAD(struct ifoimage *h, const struct vobgroup *va)
 /* outputs a VOBU_ADMAP structure containing pointers to all VOBUs. */
   {
     int i, j, nv;
@@ -403,7 +510,7 @@ static void CreateVOBUAD(FILE *h, const struct vobgroup *va)
         const struct vob * const thisvob = va->vobs[j];
         for (i = 0; i < thisvob->numvobus; i++)
           {
-            write4(buf, thisvob->vobu[i].sector); /* starting sector of VOBU within VOB */
+            write4(buf, thisvob->vobuidx.sector[i]); /* starting sector of VOBU within VOB */
             nfwrite(buf, 4, h);
           } /*for*/
       } /*for*/
@@ -422,7 +529,7 @@ static void CreateVOBUAD(FILE *h, const struct vobgroup *va)
       } /*if*/
   } /*CreateVOBUAD*/
 
-static int Create_PTT_SRPT(FILE *h, const struct pgcgroup *t)
+static int Create_PTT_SRPT(struct ifoimage *h, const struct pgcgroup *t)
   /* creates the VTS_PTT_SRPT and VTS_PTT tables for each title. */
   {
     int i, j, p;
@@ -466,7 +573,7 @@ static int Create_PTT_SRPT(FILE *h, const struct pgcgroup *t)
 
 static int Create_TT_SRPT
   (
-    FILE *h,
+    struct ifoimage *h,
     const struct toc_summary *ts,
     int vtsstart /* starting sector for VTS */
   )
@@ -575,6 +682,131 @@ static int Create_TT_SRPT
       } /*for*/
   } /*BuildAVInfo*/
 
+struct ifotable /* a table at the end of an IFO which depends on nothing else written to it */
+  {
+    enum
+      {
+        IFOTABLE_TMAPT,
+        IFOTABLE_C_ADT,
+        IFOTABLE_VOBU_ADMAP,
+      } type;
+    const struct pgcgroup *titles; /* for IFOTABLE_TMAPT */
+    const struct vobgroup *va; /* for IFOTABLE_C_ADT and IFOTABLE_VOBU_ADMAP */
+    int startsect; /* where it goes in the IFO, as computed by the layout pass */
+    struct ifoimage part; /* its part of the IFO */
+  };
+
+static void addtable
+  (
+    struct ifotable *tables,
+    int *numtables,
+    int type,
+    const struct pgcgroup *titles,
+    const struct vobgroup *va,
+    int startsect
+  )
+  /* appends an entry to tables. */
+  {
+    struct ifotable * const t = &tables[(*numtables)++];
+    t->type = type;
+    t->titles = titles;
+    t->va = va;
+    t->startsect = startsect;
+  } /*addtable*/
+
+static void buildtable(struct ifotable *t)
+  /* generates a table into its part of the IFO. */
+  {
+    switch (t->type)
+      {
+    case IFOTABLE_TMAPT:
+        CreateTMAPT(&t->part, t->titles);
+    break;
+    case IFOTABLE_C_ADT:
+        CreateCellAddressTable(&t->part, t->va);
+    break;
+    case IFOTABLE_VOBU_ADMAP:
+        CreateVOBUAD(&t->part, t->va);
+    break;
+      } /*switch*/
+    assert(t->part.len == t->part.size); /* must exactly fill space allowed by layout */
+  } /*buildtable*/
+
+#ifdef HAVE_PTHREAD
+
+struct tablepool /* tables to be shared out among threads */
+  {
+    pthread_mutex_t lock;
+    struct ifotable *tables;
+    int numtables;
+    int nexttable; /* index of next table to hand out */
+  };
+
+static void *tableworker(void *arg)
+  /* repeatedly takes the next table from the pool and generates it. */
+  {
+    struct tablepool * const pool = (struct tablepool *)arg;
+    while (true)
+      {
+        struct ifotable *t;
+        pthread_mutex_lock(&pool->lock);
+        t = pool->nexttable < pool->numtables ? &pool->tables[pool->nexttable++] : 0;
+        pthread_mutex_unlock(&pool->lock);
+        if (!t)
+            break;
+        buildtable(t);
+      } /*while*/
+    return
+        NULL;
+  } /*tableworker*/
+
+#endif
+
+static void buildtables(struct ifoimage *h, struct ifotable *tables, int numtables)
+  /* generates tables, which follow each other in order up to the end of the IFO, into h.
+    They are built on separate threads if allowed; the result is the same either way. */
+  {
+    int i;
+    assert(numtables != 0 ? h->len == tables[0].startsect * 2048 : h->len == h->size);
+      /* everything up to the tables, or the whole IFO if none, must already have been generated */
+    for (i = 0; i < numtables; i++)
+      {
+        const size_t start = tables[i].startsect * 2048;
+        const size_t end = i + 1 < numtables ? tables[i + 1].startsect * 2048 : h->size;
+        tables[i].part.buf = h->buf + start;
+        tables[i].part.len = 0;
+        tables[i].part.size = end - start;
+      } /*for*/
+#ifdef HAVE_PTHREAD
+    if (maxjobs > 1 && numtables > 1)
+      {
+        struct tablepool pool;
+        pthread_t threads[8];
+        int nrthreads = (maxjobs < numtables ? maxjobs : numtables) - 1, started;
+          /* main thread does its share too */
+        if (nrthreads > 8)
+            nrthreads = 8;
+        pthread_mutex_init(&pool.lock, NULL);
+        pool.tables = tables;
+        pool.numtables = numtables;
+        pool.nexttable = 0;
+        for (started = 0; started < nrthreads; started++)
+            if (pthread_create(&threads[started], NULL, tableworker, &pool) != 0)
+                break; /* make do with what I've got */
+        tableworker(&pool);
+        for (i = 0; i < started; i++)
+            pthread_join(threads[i], NULL);
+        pthread_mutex_destroy(&pool.lock);
+      }
+    else
+#endif
+      {
+        for (i = 0; i < numtables; i++)
+            buildtable(&tables[i]);
+      } /*if*/
+    h->len = h->size;
+  } /*buildtables*/
+
 static bool needmenus(const struct menugroup *mg)
 /* do I actually have any menu definitions in mg. */
 {
@@ -584,11 +816,12 @@ static bool needmenus(const struct menugroup *mg)
     return true;
 }
 
-static void WriteIFO(FILE *h, const struct workset *ws)
-  /* writes the IFO for a VTSM. */
+static void WriteIFO(struct ifoimage *h, const struct workset *ws)
+  /* generates the IFO for a VTSM into h, if not null. */
   {
     static unsigned char buf[2048];
-    int nextsector;
+    struct ifotable tables[5];
+    int nextsector, numtables = 0;
     const bool forcemenus = needmenus(ws->menus);
     size_t ifo_pad = 0;
 
@@ -649,6 +882,9 @@ static void WriteIFO(FILE *h, const struct workset *ws)
     if (jumppad || forcemenus)
         BuildAVInfo(buf + 256, ws->menus->mg_vg);
     BuildAVInfo(buf + 512, ws->titles->pg_vg);
+    if (!h)
+        return;
+    ifo_alloc(h, (read4(buf + 28) + 1) * 2048);
     nfwrite(buf, 2048, h);
 
     // sect 1: VTS_PTT_SRPT
@@ -661,81 +897,60 @@ static void WriteIFO(FILE *h, const struct workset *ws)
         CreatePGC(h, ws, VTYPE_VTSM);
 
     // sect 3: ??? VTS_TMAPT
-    CreateTMAPT(h, ws->titles);
+    addtable(tables, &numtables, IFOTABLE_TMAPT, ws->titles, 0, read4(buf + 0xD4));
 
     if (jumppad || forcemenus)
       {
-        CreateCellAddressTable(h, ws->menus->mg_vg);
-        CreateVOBUAD(h, ws->menus->mg_vg);
+        addtable(tables, &numtables, IFOTABLE_C_ADT, 0, ws->menus->mg_vg, read4(buf + 0xD8));
+        addtable(tables, &numtables, IFOTABLE_VOBU_ADMAP, 0, ws->menus->mg_vg, read4(buf + 0xDC));
       } /*if*/
-    CreateCellAddressTable(h, ws->titles->pg_vg);
-    CreateVOBUAD(h, ws->titles->pg_vg);
+    addtable(tables, &numtables, IFOTABLE_C_ADT, 0, ws->titles->pg_vg, read4(buf + 0xE0));
+    addtable(tables, &numtables, IFOTABLE_VOBU_ADMAP, 0, ws->titles->pg_vg, read4(buf + 0xE4));
+    buildtables(h, tables, numtables);
   /* nfpad(ifo_pad, h); */ /* unneeded, genisoimage will fix it for me */
+    assert(h->len == h->size);
   } /*WriteIFO*/
 
 void WriteIFOs(const char *fbase, const struct workset *ws)
 /* writes out a .IFO and corresponding .BUP file for a VTSM. */
   {
-    FILE *h;
-    static char buf[1000];
-    bool backup;
-
-    errno = 0;
+    struct phasetimer timer;
+    phase_start(&timer, "WriteIFOs", fbase, false);
     if (fbase)
       {
-        backup = false;
-        for (;;)
-          {
-            snprintf(buf, sizeof buf, "%s_0.%s", fbase, backup ? "BUP" : "IFO");
-            h = fopen(buf, "wb");
-            if (!h)
-              {
-                fprintf
-                  (
-                    stderr,
-                    "\nERR:  Error %d -- %s -- creating %s\n",
-                    errno,
-                    strerror(errno),
-                    buf
-                  );
-                exit(1);
-              } /*if*/
-            WriteIFO(h, ws);
-            fflush(h);
-            if (errno != 0)
-              {
-                fprintf
-                  (
-                    stderr,
-                    "\nERR:  Error %d -- %s -- flushing %s\n",
-                    errno,
-                    strerror(errno),
-                    buf
-                  );
-                exit(1);
-              } /*if*/
-            fclose(h);
-            if (backup)
-                break;
-            backup = true;
-          } /*for*/
+        struct ifoimage h;
+        char * fname;
+        WriteIFO(&h, ws); /* generate it once, write it twice */
+        fname = sprintf_alloc("%s_0.IFO", fbase);
+        ifo_save(&h, fname);
+        free(fname);
+        fname = sprintf_alloc("%s_0.BUP", fbase);
+        ifo_save(&h, fname);
+        free(fname);
+        free(h.buf);
+        phase_stop(&timer, 0, h.len * 2, h.len * 2 / 2048);
       }
     else
+      {
       /* dummy write */
         WriteIFO(0, ws);
+        phase_stop(&timer, 0, 0, 0);
+      } /*if*/
   } /*WriteIFOs*/
 
-void TocGen(const struct workset *ws, const struct pgc *fpc, const char *fname)
-  /* writes the IFO for a VMGM. */
+void TocGen(const struct workset *ws, const struct pgc *fpc, const char *fbase)
+  /* writes the IFO and BUP for a VMGM. */
   {
     static unsigned char buf[2048];
-    int nextsector, offset, i, j, vtsstart;
+    struct ifotable tables[2];
+    int nextsector, offset, i, j, vtsstart, numtables = 0;
     const bool forcemenus = needmenus(ws->menus);
-    FILE *h;
+    struct ifoimage image, * const h = &image;
+    char * fname;
     size_t ifo_pad = 0;
+    struct phasetimer timer;
 
-    h = fopen(fname, "wb");
-
+    phase_start(&timer, "TocGen", fbase, false);
     memset(buf, 0, 2048);
     memcpy(buf, "DVDVIDEO-VMG", 12);
     buf[0x21] = 0x11; /* version number */
@@ -768,10 +983,12 @@ void TocGen(const struct workset *ws, const struct pgc *fpc, const char *fname)
         write4(buf + 0xd8, nextsector);
           /* sector pointer to VMGM_C_ADT (menu cell address table) */
           /* I make it follow VMG_VTS_ATRT */
+        addtable(tables, &numtables, IFOTABLE_C_ADT, 0, ws->menus->mg_vg, nextsector);
         nextsector += CreateCellAddressTable(0, ws->menus->mg_vg); /* how much room it will need */
 
         write4(buf + 0xdc, nextsector);
           /* sector pointer to VMGM_VOBU_ADMAP (menu VOBU address map) */
+        addtable(tables, &numtables, IFOTABLE_VOBU_ADMAP, 0, ws->menus->mg_vg, nextsector);
         nextsector += numsectVOBUAD(ws->menus->mg_vg);
       } /*if*/
 
@@ -859,6 +1076,7 @@ void TocGen(const struct workset *ws, const struct pgc *fpc, const char *fname)
       } /*if*/
     write2(buf + 0x4f2, 7 + buf[0x4ed] * 8); /* end address relative to command table */
     write2(buf + 0x82 /* end byte address, low word, of VMGI_MAT */, 0x4ec + read2(buf + 0x4f2));
+    ifo_alloc(h, (read4(buf + 0x1c) + 1) * 2048);
     nfwrite(buf, 2048, h);
 
     Create_TT_SRPT(h, ws->titlesets, vtsstart); /* generate it for real */
@@ -892,17 +1110,15 @@ void TocGen(const struct workset *ws, const struct pgc *fpc, const char *fname)
         nfpad(j, h);
       } /*if*/
 
-    if (jumppad || forcemenus)
-      {
-        CreateCellAddressTable(h, ws->menus->mg_vg); /* actually generate VMGM_C_ADT */
-        CreateVOBUAD(h, ws->menus->mg_vg); /* generate VMGM_VOBU_ADMAP */
-      } /*if*/
+    buildtables(h, tables, numtables); /* actually generate VMGM_C_ADT and VMGM_VOBU_ADMAP */
   /* nfpad(ifo_pad, h); */ /* unneeded, genisoimage will fix it for me */
-    fflush(h);
-    if (errno != 0)
-      {
-        fprintf(stderr, "\nERR:  Error %d -- %s -- flushing VMGM\n", errno, strerror(errno));
-        exit(1);
-      } /*if*/
-    fclose(h);
+    assert(h->len == h->size);
+    fname = sprintf_alloc("%s.IFO", fbase);
+    ifo_save(h, fname);
+    free(fname);
+    fname = sprintf_alloc("%s.BUP", fbase); /* same thing again, backup copy */
+    ifo_save(h, fname);
+    free(fname);
+    free(h->buf);
+    phase_stop(&timer, 0, h->len * 2, h->len * 2 / 2048);
   } /*TocGen*/
@@ -489,12 +489,14 @@ static int createpgcgroup(const struct workset *ws,vtypes ismenu,const struct pg
     return len;
   } /*createpgcgroup*/
 
-int CreatePGC(FILE *h, const struct workset *ws, vtypes ismenu)
+int CreatePGC(struct ifoimage *h, const struct workset *ws, vtypes ismenu)
   {
     unsigned char *buf;
     int len,ph,i;
     bool in_it;
+    struct phasetimer timer;
 
+    phase_start(&timer, "CreatePGC", pstypes[ismenu], false);
     in_it = bigwritebuflen == 0; /* don't do first allocation if already got a buffer from last time */
  retry: /* come back here if buffer wasn't big enough to generate a PGC group */
     if (in_it)
@@ -544,20 +546,7 @@ int CreatePGC(FILE *h, const struct workset *ws, vtypes ismenu)
 
     assert(ph <= bigwritebuflen);
     ph = (ph + 2047) & (-2048);
-    if (h)
-      {
-        (void)fwrite(buf, 1, ph, h);
-        if (errno != 0)
-          {
-            fprintf
-              (
-                stderr,
-                "\nERR:  Error %d -- %s -- writing output PGC\n",
-                errno,
-                strerror(errno)
-              );
-            exit(1);
-          } /*if*/
-      } /*if*/
+    nfwrite(buf, ph, h);
+    phase_stop(&timer, 0, h ? ph : 0, ph / 2048);
     return ph / 2048;
   } /*CreatePGC*/
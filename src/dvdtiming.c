@@ -0,0 +1,292 @@
+/*
+    Per-phase timing and throughput report for dvdauthor
+*/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#include "compat.h"
+
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "dvdauthor.h"
+
+static char *timingfile = 0; /* where to write the report, "-" for stdout, NULL if not wanted */
+static pid_t reportpid; /* process which writes the report */
+static double programstart; /* when timing was enabled */
+static int depth = 0; /* nesting level of phases currently running on the main thread */
+static char **records = 0; /* one JSON object per finished phase */
+static int numrecords = 0, maxrecords = 0;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t recordlock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static double nowseconds(void)
+  /* returns the current time in seconds. */
+  {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return
+        now.tv_sec + now.tv_usec / 1000000.0;
+  } /*nowseconds*/
+
+static double cpuseconds(int who, long *maxrss)
+  /* returns the CPU time (user + system) used so far by who, and its peak
+    resident set size in kilobytes if maxrss is not NULL. */
+  {
+    struct rusage usage;
+    if (getrusage(who, &usage) != 0)
+        memset(&usage, 0, sizeof usage);
+    if (maxrss)
+        *maxrss = usage.ru_maxrss;
+    return
+            usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0
+        +
+            usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+  } /*cpuseconds*/
+
+static int threadusage(bool thread)
+  /* which getrusage figures to use for a phase. */
+  {
+#ifdef RUSAGE_THREAD
+    if (thread)
+        return
+            RUSAGE_THREAD;
+#endif
+    return
+        RUSAGE_SELF;
+  } /*threadusage*/
+
+static void addrecord(char *rec)
+  /* adds a finished JSON object to the report, taking ownership of rec. */
+  {
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&recordlock);
+#endif
+    if (numrecords == maxrecords)
+      {
+        maxrecords = maxrecords ? maxrecords * 2 : 32;
+        records = realloc(records, maxrecords * sizeof(char *));
+      } /*if*/
+    records[numrecords++] = rec;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&recordlock);
+#endif
+  } /*addrecord*/
+
+static char *jsonstring(const char *s)
+  /* returns s as a quoted JSON string literal, in a newly-allocated buffer. */
+  {
+    char * const result = malloc(strlen(s) * 6 + 3);
+    char *d = result;
+    *d++ = '"';
+    for (; *s; s++)
+      {
+        const unsigned char c = *s;
+        if (c == '"' || c == '\\')
+          {
+            *d++ = '\\';
+            *d++ = c;
+          }
+        else if (c < 0x20)
+          {
+            sprintf(d, "\\u%04x", c);
+            d += 6;
+          }
+        else
+            *d++ = c;
+      } /*for*/
+    *d++ = '"';
+    *d = 0;
+    return
+        result;
+  } /*jsonstring*/
+
+static char *tempname(pid_t pid)
+  /* name of the file in which a titleset child process with the specified
+    process ID leaves its records. */
+  {
+    const char * tmpdir = getenv("TMPDIR");
+    if (!tmpdir)
+        tmpdir = "/tmp";
+    return
+        sprintf_alloc("%s/dvdauthor-timing.%d.%d", tmpdir, (int)reportpid, (int)pid);
+  } /*tempname*/
+
+static void writereport(void)
+  /* writes out the report, called at exit. */
+  {
+    FILE *f;
+    long maxrss, childrss;
+    double cpu;
+    int i;
+    if (getpid() != reportpid)
+        return; /* a titleset child process exiting on an error */
+    cpu = cpuseconds(RUSAGE_SELF, &maxrss) + cpuseconds(RUSAGE_CHILDREN, &childrss);
+      /* peak for children is that of the biggest titleset process */
+    if (!strcmp(timingfile, "-"))
+      {
+        fflush(stdout);
+        f = stdout;
+      }
+    else
+      {
+        f = fopen(timingfile, "w");
+        if (!f)
+          {
+            fprintf(stderr, "WARN: Cannot create timing report %s: %s\n", timingfile, strerror(errno));
+            return;
+          } /*if*/
+      } /*if*/
+    fprintf
+      (
+        f,
+        "{\n  \"program\": \"dvdauthor\",\n  \"version\": \"%s\",\n  \"wall\": %.6f,\n"
+        "  \"cpu\": %.6f,\n  \"peak_rss_kb\": %ld,\n  \"phases\": [",
+        PACKAGE_VERSION,
+        nowseconds() - programstart,
+        cpu,
+        maxrss > childrss ? maxrss : childrss
+      );
+    for (i = 0; i < numrecords; i++)
+        fprintf(f, "%s\n    %s", i ? "," : "", records[i]);
+    fprintf(f, "\n  ]\n}\n");
+    if (f == stdout)
+        fflush(f);
+    else if (fclose(f) != 0)
+        fprintf(stderr, "WARN: Error writing timing report %s: %s\n", timingfile, strerror(errno));
+  } /*writereport*/
+
+void dvdauthor_set_timingfile(const char *fname)
+  {
+    if (timingfile)
+      {
+        free(timingfile);
+      }
+    else
+      {
+        reportpid = getpid();
+        programstart = nowseconds();
+        atexit(writereport);
+      } /*if*/
+    timingfile = strdup(fname);
+  } /*dvdauthor_set_timingfile*/
+
+void phase_start(struct phasetimer *t, const char *name, const char *detail, bool thread)
+  /* starts timing a phase. thread is true if it runs on a worker thread, in which case
+    only the CPU time of that thread is counted, where the system can tell. Does
+    nothing if no timing report is wanted. */
+  {
+    t->active = timingfile != 0;
+    if (!t->active)
+        return;
+    t->name = name;
+    t->detail = detail ? jsonstring(detail) : 0;
+    t->thread = thread;
+    t->depth = thread ? -1 : depth++;
+    t->start = nowseconds();
+    t->cpu = cpuseconds(threadusage(thread), NULL);
+  } /*phase_start*/
+
+void phase_stop(struct phasetimer *t, uint64_t bytesread, uint64_t byteswritten, uint64_t sectors)
+  /* finishes timing a phase started with phase_start, and adds it to the report
+    together with the amounts of data it processed. */
+  {
+    double wall, cpu;
+    long maxrss;
+    if (!t->active)
+        return;
+    wall = nowseconds() - t->start;
+    cpu = cpuseconds(threadusage(t->thread), NULL);
+    cpu -= t->cpu;
+    cpuseconds(RUSAGE_SELF, &maxrss);
+    if (!t->thread)
+        depth--;
+    addrecord
+      (
+        sprintf_alloc
+          (
+            "{\"phase\": \"%s\", \"detail\": %s, \"pid\": %d, \"thread\": \"%s\", \"depth\": %d,"
+            " \"start\": %.6f, \"wall\": %.6f, \"cpu\": %.6f, \"bytes_read\": %" PRIu64 ","
+            " \"bytes_written\": %" PRIu64 ", \"sectors\": %" PRIu64 ", \"sectors_per_sec\": %.1f,"
+            " \"peak_rss_kb\": %ld}",
+            t->name,
+            t->detail ? t->detail : "null",
+            (int)getpid(),
+            t->thread ? "worker" : "main",
+            t->depth,
+            t->start - programstart,
+            wall,
+            cpu,
+            bytesread,
+            byteswritten,
+            sectors,
+            wall > 0 ? sectors / wall : 0.0,
+            maxrss
+          )
+      );
+    free(t->detail);
+    t->active = false;
+  } /*phase_stop*/
+
+void timing_savechild(void)
+  /* called in a titleset child process before it exits, to pass its records
+    back to the parent. */
+  {
+    char * fname;
+    FILE *f;
+    int i;
+    if (!timingfile)
+        return;
+    fname = tempname(getpid());
+    f = fopen(fname, "w");
+    if (f)
+      {
+        for (i = 0; i < numrecords; i++)
+            fprintf(f, "%s\n", records[i]);
+        fclose(f);
+      } /*if*/
+    free(fname);
+  } /*timing_savechild*/
+
+void timing_mergechild(pid_t pid)
+  /* called in the parent after a titleset child process has finished, to add
+    its records to the report. */
+  {
+    char * fname;
+    FILE *f;
+    char line[16384];
+    if (!timingfile)
+        return;
+    fname = tempname(pid);
+    f = fopen(fname, "r");
+    if (f)
+      {
+        while (fgets(line, sizeof line, f))
+          {
+            line[strcspn(line, "\n")] = 0;
+            addrecord(strdup(line));
+          } /*while*/
+        fclose(f);
+        unlink(fname);
+      } /*if*/
+    free(fname);
+  } /*timing_mergechild*/
@@ -26,6 +26,17 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <sys/time.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+#define USE_MMAP
+#endif
 
 #include "dvdauthor.h"
 #include "da-internal.h"
@@ -44,16 +55,119 @@ struct vscani {
     int firstgop; /* 1 => looking for first GOP, 2 => found first GOP, 0 => don't bother looking any more */
     int firsttemporal; /* first temporal sequence number seen in current sequence */
     int lastadjust; /* temporal sequence reset */
+    bool attrguess;
+      /* a sequence header was rewritten without knowing all the video attributes
+        it depends on, so the result might differ if they were already set */
+    unsigned char slidebuf[15];
+      /* carries the last few bytes of one video packet over to the next, so
+        start codes split across packets are still seen */
 };
 
 static pts_t const timeline[19]={1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,
                            20,60,120,240};
   /* various time steps for VOBU offsets needed in DSI packet, in units of half a second */
 
-#define BIGWRITEBUFLEN (16*2048)
-static unsigned char bigwritebuf[BIGWRITEBUFLEN];
-static int writebufpos=0;
-static int writefile=-1; /* fd of output file */
+#define BIGWRITEBUFLEN (16*2048) /* default size of output buffers */
+#define NOCACHELAG (8 * 1024 * 1024)
+  /* how much output to accumulate between posix_fadvise calls when not caching it */
+#define NRWRITEBUFS 4 /* how many full output buffers can be waiting to be written */
+#define READCHUNKLEN (64*2048)
+#define NRREADCHUNKS 4 /* how many chunks of input can be read ahead */
+#define IOBUFALIGN 4096
+#define NAVBATCH 256 /* how many NAV packs FixVobus collects before writing them out */
+
+struct vobwriter /* buffered output of sectors to a VOB file */
+  {
+    int fd; /* fd of output file, -1 if none */
+    int bufsize; /* size of each buffer, a multiple of 2048 */
+    int bufpos; /* length of data in buf */
+    unsigned char *buf; /* = bufs[curbuf], buffer currently being filled */
+    unsigned char *bufs[NRWRITEBUFS];
+    int curbuf;
+    bool direct; /* output file is currently open with O_DIRECT */
+    off_t filepos; /* how much has been written to output file */
+    off_t advised[2]; /* limits of last range of output file passed to posix_fadvise */
+    uint64_t totalwritten; /* bytes written across all output files */
+    unsigned char *held;
+      /* most recent output sectors, kept in memory as a ring so FixVobus can fill
+        in their NAV packs before they are written, or NULL if not holding output */
+    int heldmax; /* capacity of held in sectors */
+    int heldfirst; /* index in held of oldest sector */
+    int heldcount; /* nr sectors currently in held */
+    int heldsect; /* sector nr within output file of oldest sector in held */
+    int fnum; /* number of output file, once handed on to FixVobus */
+    off_t *srcoffs[NRWRITEBUFS];
+      /* for each sector in each buffer, its offset in the source file if it is an
+        unmodified copy of it, else -1; NULL if not using copy_file_range */
+    int srcfd; /* file sectors can be copied from, -1 if none */
+    const unsigned char *srcmap; /* contents of srcfd */
+    int srccheck; /* index in buf of sector that might be unmodified, -1 if none */
+    bool copyok; /* copy_file_range hasn't failed on output file yet */
+    uint64_t totalcopied; /* bytes written with copy_file_range across all output files */
+#ifdef HAVE_PTHREAD
+    int buflen[NRWRITEBUFS]; /* length of data waiting to be written from each buffer, 0 if none */
+    int nextwrite; /* index of next buffer for writer thread to write */
+    bool threaded; /* whether writer thread is running */
+    bool stop; /* tells writer thread to finish */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond; /* signalled when a buffer is queued or written */
+#endif
+  };
+
+struct vobreader /* supplies sectors from an input file, read ahead on a separate thread if possible */
+  {
+    struct vfile vf;
+    unsigned char *chunks[NRREADCHUNKS];
+    int chunklen[NRREADCHUNKS];
+      /* length of data in each chunk, -1 if not yet read; less than READCHUNKLEN
+        means end of file or error */
+    int chunkerr[NRREADCHUNKS]; /* errno if chunk was cut short by an error */
+    int curchunk; /* index of chunk being consumed */
+    int chunkpos; /* how much of curchunk has been consumed */
+#ifdef USE_MMAP
+    const unsigned char *map; /* contents of whole input file if mapped, else NULL */
+    size_t maplen; /* length of file */
+    size_t mappos; /* how much of map has been consumed */
+#endif
+#ifdef HAVE_PTHREAD
+    bool threaded; /* whether reader thread is running */
+    bool stop; /* tells reader thread to finish */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond; /* signalled when a chunk is read or consumed */
+#endif
+  };
+
+static int writebufsize(void)
+  /* returns the size to use for output buffers. */
+  {
+    int size = writeblocksize != 0 ? writeblocksize : BIGWRITEBUFLEN;
+    if (directio)
+      /* keep file offsets of all but the last write aligned */
+        size = (size + IOBUFALIGN - 1) / IOBUFALIGN * IOBUFALIGN;
+    return
+        size;
+  } /*writebufsize*/
+
+static unsigned char *allocbuf(size_t len)
+  /* allocates a buffer suitably aligned for file I/O. */
+  {
+    void *result;
+#ifdef HAVE_POSIX_MEMALIGN
+    if (posix_memalign(&result, IOBUFALIGN, len) != 0)
+        result = 0;
+#else
+    result = malloc(len);
+#endif
+    if (!result)
+      {
+        fprintf(stderr, "ERR:  Cannot allocate %lu bytes for I/O buffer\n", (unsigned long)len);
+        exit(1);
+      } /*if*/
+    return
+        (unsigned char *)result;
+  } /*allocbuf*/
 
 static void flushclose(int fd)
   /* ensures all data has been successfully written to disk before closing fd. */
@@ -78,10 +192,163 @@ static void flushclose(int fd)
             errno = 0;
           } /*if*/
       } /*if*/
+#ifdef HAVE_POSIX_FADVISE
+    if (nocache)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED); /* all written out now, so can all go */
+#endif
     close(fd);
   } /*flushclose*/
 
-static unsigned char videoslidebuf[15]={255,255,255,255, 255,255,255, 0,0,0,0, 0,0,0,0};
+static struct /* accumulated over all FindVobus calls since last ReportVobStats */
+  {
+    uint64_t bytes; /* amount of VOB data written */
+    uint64_t copied; /* how much of that was copied by the kernel with copy_file_range */
+    double seconds; /* time taken */
+  } vobstats;
+
+static double nowseconds(void)
+  /* returns the current time in seconds, for measuring elapsed time. */
+  {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return
+        now.tv_sec + now.tv_usec / 1000000.0;
+  } /*nowseconds*/
+
+#define SPILLMINSIZE (256 * 1024)
+  /* tables at least this big are kept in temporary files when spilldir is set */
+
+static bool spilled(size_t size)
+  /* is a table of this size kept in a temporary file. */
+  {
+#ifdef USE_MMAP
+    return
+        spilldir != 0 && size >= SPILLMINSIZE;
+#else
+    return
+        false;
+#endif
+  } /*spilled*/
+
+void releasetable(void *table, size_t size)
+  /* lets the system write out the contents of a table kept in a temporary file and
+    reclaim the memory; it is read back in when next accessed. Does nothing for
+    tables kept in memory. */
+  {
+#ifdef USE_MMAP
+    if (table && spilled(size))
+        madvise(table, size, MADV_DONTNEED);
+#endif
+  } /*releasetable*/
+
+void *growtable(void *table, size_t oldsize, size_t newsize)
+  /* like realloc, but tables which get big enough are moved to a temporary file
+    in spilldir, mapped into memory, so their contents need not stay resident.
+    oldsize must be what the table was last allocated with. Doesn't return if
+    there isn't enough memory. */
+  {
+    void *newtable;
+#ifdef USE_MMAP
+    if (spilled(newsize))
+      {
+        char * const fname = sprintf_alloc("%s/dvdauthor-XXXXXX", spilldir);
+        const int fd = mkstemp(fname);
+        newtable = MAP_FAILED;
+        if (fd >= 0)
+          {
+            unlink(fname); /* goes away once unmapped */
+            if (ftruncate(fd, newsize) == 0)
+                newtable = mmap(NULL, newsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+          } /*if*/
+        if (newtable == MAP_FAILED)
+          {
+            fprintf(stderr, "\nERR:  Error %d creating table in %s: %s\n", errno, fname, strerror(errno));
+            exit(1);
+          } /*if*/
+        free(fname);
+        if (table)
+          {
+            memcpy(newtable, table, oldsize < newsize ? oldsize : newsize);
+            freetable(table, oldsize);
+            releasetable(newtable, oldsize < newsize ? oldsize : newsize);
+              /* not likely to be needed again for a while */
+          } /*if*/
+        return
+            newtable;
+      } /*if*/
+    if (spilled(oldsize))
+      {
+      /* shrinking back into memory */
+        newtable = malloc(newsize);
+        if (!newtable)
+          {
+            fprintf(stderr, "\nERR:  Cannot allocate %lu bytes for table\n", (unsigned long)newsize);
+            exit(1);
+          } /*if*/
+        memcpy(newtable, table, newsize);
+        freetable(table, oldsize);
+        return
+            newtable;
+      } /*if*/
+#endif
+    newtable = realloc(table, newsize);
+    if (!newtable && newsize != 0)
+      {
+        fprintf(stderr, "\nERR:  Cannot allocate %lu bytes for table\n", (unsigned long)newsize);
+        exit(1);
+      } /*if*/
+    return
+        newtable;
+  } /*growtable*/
+
+void freetable(void *table, size_t size)
+  /* frees a table allocated with growtable, given the size it was allocated with. */
+  {
+#ifdef USE_MMAP
+    if (table && spilled(size))
+      {
+        munmap(table, size);
+        return;
+      } /*if*/
+#endif
+    free(table);
+  } /*freetable*/
+
+void freevobtables(struct vob *thisvob)
+  /* frees the VOBU and audio packet tables of thisvob, leaving them empty. */
+  {
+    int i;
+    freetable(thisvob->vobu, thisvob->maxvobus * sizeof(struct vobuinfo));
+    freetable(thisvob->vobuhdr, thisvob->maxvobus * sizeof *thisvob->vobuhdr);
+    thisvob->vobu = 0;
+    thisvob->vobuhdr = 0;
+    thisvob->numvobus = 0;
+    thisvob->maxvobus = 0;
+    for (i = 0; i < 64; i++)
+      {
+        struct audchannel * const ach = &thisvob->audch[i];
+        freetable(ach->audpts, ach->maxaudpts * sizeof(struct audpts));
+        ach->audpts = 0;
+        ach->numaudpts = 0;
+        ach->maxaudpts = 0;
+      } /*for*/
+  } /*freevobtables*/
+
+static void releasevobtables(const struct vob *thisvob)
+  /* lets the system reclaim the memory for the tables of thisvob that are kept
+    in temporary files, until they are next needed. */
+  {
+    int i;
+    releasetable(thisvob->vobu, thisvob->maxvobus * sizeof(struct vobuinfo));
+    releasetable(thisvob->vobuhdr, thisvob->maxvobus * sizeof *thisvob->vobuhdr);
+    for (i = 0; i < 64; i++)
+        releasetable
+          (
+            thisvob->audch[i].audpts,
+            thisvob->audch[i].maxaudpts * sizeof(struct audpts)
+          );
+  } /*releasevobtables*/
 
 
 /* The following are variants for the ways I've seen DVD's encoded */
@@ -121,29 +388,6 @@ static pts_t calcpts
     return (*align + nfields * fpts) / 2;
   } /*calcpts*/
 
-static int findnextvideo(const struct vob *va, int cur, int dir)
-  // find next (dir=1) or previous(dir=-1) vobu with video
-  {
-    int i, numvobus;
-    numvobus = va->numvobus;
-    switch(dir)
-      {
-    case 1:  // forward
-        for (i = cur+1; i < numvobus; i++)
-            if(va->vobu[i].hasvideo)
-                return i;
-        return -1;
-    case -1: // backward
-        for (i = cur-1; i > -1; i--)
-            if(va->vobu[i].hasvideo)
-                return i;
-        return -1;
-    default:
-        // ??
-        return -1;
-      } /*switch*/
-  } /*findnextvideo*/
-
 static int findaudsect(const struct vob *va, int aind, pts_t pts0, pts_t pts1)
   /* finds the audpts entry, starting from aind, that includes the time pts0 .. pts1,
     or -1 if not found. */
@@ -172,12 +416,12 @@ static int findvobubysect(const struct vob *va, int sect)
     int l = 0, h = va->numvobus - 1;
     if (h < 0)
         return -1;
-    if (sect < va->vobu[0].sector)
+    if (sect < va->vobuidx.sector[0])
         return -1;
     while (l < h)
       {
         const int m = (l + h + 1) / 2; /* binary search */
-        if (sect < va->vobu[m].sector)
+        if (sect < va->vobuidx.sector[m])
             h = m - 1;
         else
             l = m;
@@ -207,54 +451,35 @@ static unsigned int getsect
     const struct vob * va,
     int curvobunum, /* the VOBU number I'm jumping from */
     int jumpvobunum, /* the VOBU number I'm jumping to */
-    int skip, /* whether to set the skipping-more-than-one-VOBU bit */
+    bool skip,
+      /* whether to set the skipping-more-than-one-VOBU bit. Caller only sets this
+        if one of the VOBUs from here to there contains video. */
+      /* hmm, this page <http://www.mpucoder.com/DVD/dsi_pkt.html> doesn't say
+        it has to contain video */
     unsigned notfound /* what to return if there is no matching VOBU */
   )
   /* computes relative VOBU offsets needed at various points in a DSI packet,
     including the mask bit that indicates a backward jump, and optionally the
     one indicating skipping multiple video VOBUs as well. */
   {
-    if (skip)
-      {
-        int l, h, i;
-        // only set skip bit if one of the VOBU's from here to there contain video
-      /* hmm, this page <http://www.mpucoder.com/DVD/dsi_pkt.html> doesn't say
-        it has to contain video */
-        if (curvobunum < jumpvobunum)
-          {
-            l = curvobunum + 1;
-            h = jumpvobunum - 1;
-          }
-        else
-          {
-            l = jumpvobunum + 1;
-            h = curvobunum - 1;
-          } /*if*/
-        for (i = l; i <= h; i++)
-            if (va->vobu[i].hasvideo)
-                break; /* found an in-between VOBU containing video */
-        if (i <= h)
-            skip = 0x40000000;
-        else
-            skip = 0;
-      } /*if*/
+    const unsigned int skipbit = skip ? 0x40000000 : 0;
     if
       (
           jumpvobunum < 0
       ||
           jumpvobunum >= va->numvobus
       ||
-          va->vobu[jumpvobunum].vobcellid != va->vobu[curvobunum].vobcellid
+          va->vobuidx.vobcellid[jumpvobunum] != va->vobuidx.vobcellid[curvobunum]
             /* never cross cells */
       )
         return
-            notfound | skip;
+            notfound | skipbit;
     return
-            abs(va->vobu[jumpvobunum].sector - va->vobu[curvobunum].sector)
+            abs(va->vobuidx.sector[jumpvobunum] - va->vobuidx.sector[curvobunum])
         |
-            (va->vobu[jumpvobunum].hasvideo ? 0x80000000 : 0)
+            (va->vobuidx.hasvideo[jumpvobunum] ? 0x80000000 : 0)
         |
-            skip;
+            skipbit;
   } /*getsect*/
 
 static pts_t readscr(const unsigned char *buf)
@@ -449,111 +674,690 @@ static int mpa_len(const unsigned char *b)
     return 3 * bitrate + padding; // 144 * bitrate / sampling; 144 / 48 = 3
   } /*mpa_len*/
 
-static void writeflush()
-  /* writes out the data buffered so far. */
+static void writedata(struct vobwriter *wr, const unsigned char *buf, int len)
+  /* writes len bytes from buf to the output file, aborting on error. */
+  {
+    ssize_t written = write(wr->fd, buf, len);
+#ifdef O_DIRECT
+    if (written < 0 && errno == EINVAL && wr->direct)
+      {
+      /* probably a short final write that doesn't meet O_DIRECT alignment
+        requirements, so finish off the file without it */
+        fcntl(wr->fd, F_SETFL, fcntl(wr->fd, F_GETFL) & ~O_DIRECT);
+        wr->direct = false;
+        written = write(wr->fd, buf, len);
+      } /*if*/
+#endif
+    if (written != len)
+      {
+        fprintf(stderr, "ERR:  Error %d -- %s -- writing data\n", errno, strerror(errno));
+        exit(1);
+      } /*if*/
+    wr->filepos += len;
+    wr->totalwritten += len;
+#ifdef HAVE_POSIX_FADVISE
+    if (nocache && wr->filepos - wr->advised[1] >= NOCACHELAG)
+      {
+      /* pages can only be dropped once they have been written to disk, so drop the
+        previous range, which should be done by now, and start writeback on this one */
+        posix_fadvise(wr->fd, wr->advised[0], wr->advised[1] - wr->advised[0], POSIX_FADV_DONTNEED);
+        wr->advised[0] = wr->advised[1];
+        wr->advised[1] = wr->filepos;
+        posix_fadvise(wr->fd, wr->advised[0], wr->advised[1] - wr->advised[0], POSIX_FADV_DONTNEED);
+      } /*if*/
+#endif
+  } /*writedata*/
+
+static void writeheld(struct vobwriter *wr, int minsect)
+  /* writes out at least minsect of the oldest held sectors, in whole buffers
+    where possible. */
+  {
+    const int bufsects = wr->bufsize / 2048;
+    int count = (minsect + bufsects - 1) / bufsects * bufsects;
+    if (count > wr->heldcount)
+        count = wr->heldcount;
+    while (count > 0)
+      {
+        int n = wr->heldmax - wr->heldfirst; /* contiguous up to end of ring */
+        if (n > count)
+            n = count;
+        writedata(wr, wr->held + wr->heldfirst * 2048, n * 2048);
+        wr->heldfirst = (wr->heldfirst + n) % wr->heldmax;
+        wr->heldcount -= n;
+        wr->heldsect += n;
+        count -= n;
+      } /*while*/
+  } /*writeheld*/
+
+static void writeout(struct vobwriter *wr, const unsigned char *buf, int len)
+  /* writes len bytes (a whole number of sectors) from buf to the output file, or
+    adds them to the held output, writing out the oldest to make room. */
   {
-    if (!writebufpos) /* nothing in buffer */
+    int nsect = len / 2048;
+    if (!wr->held)
+      {
+        writedata(wr, buf, len);
         return;
-    if (writefile != -1)
+      } /*if*/
+    if (wr->heldcount + nsect > wr->heldmax)
+        writeheld(wr, wr->heldcount + nsect - wr->heldmax);
+    while (nsect > 0)
       {
-        if (write(writefile, bigwritebuf, writebufpos) != writebufpos)
+        const int pos = (wr->heldfirst + wr->heldcount) % wr->heldmax;
+        int n = wr->heldmax - pos;
+        if (n > nsect)
+            n = nsect;
+        memcpy(wr->held + pos * 2048, buf, n * 2048);
+        wr->heldcount += n;
+        buf += n * 2048;
+        nsect -= n;
+      } /*while*/
+  } /*writeout*/
+
+#ifdef HAVE_COPY_FILE_RANGE
+
+static void writecopy(struct vobwriter *wr, off_t srcpos, const unsigned char *buf, int len)
+  /* writes len bytes to the output file, which are also to be found at srcpos in the
+    source file, so the kernel can copy them without going through my buffers, or
+    even just share the disk blocks. buf is used if that can't be done. */
+  {
+    loff_t inpos = srcpos;
+    while (len > 0 && wr->copyok)
+      {
+        const ssize_t copied = copy_file_range(wr->srcfd, &inpos, wr->fd, NULL, len, 0);
+        if (copied <= 0)
           {
-            fprintf(stderr, "ERR:  Error %d -- %s -- writing data\n", errno, strerror(errno));
-            exit(1);
+            if
+              (
+                    copied < 0
+                &&
+                    errno != EXDEV
+                &&
+                    errno != ENOSYS
+                &&
+                    errno != EINVAL
+                &&
+                    errno != EOPNOTSUPP
+              )
+              {
+                fprintf(stderr, "ERR:  Error %d -- %s -- copying data\n", errno, strerror(errno));
+                exit(1);
+              } /*if*/
+            wr->copyok = false; /* not supported here, don't try again */
+            break;
+          } /*if*/
+        buf += copied;
+        len -= copied;
+        wr->filepos += copied;
+        wr->totalwritten += copied;
+        wr->totalcopied += copied;
+      } /*while*/
+    if (len > 0)
+        writedata(wr, buf, len);
+  } /*writecopy*/
+
+#endif
+
+static void writebuffer(struct vobwriter *wr, int index, int len)
+  /* writes out the first len bytes of the specified buffer, copying unmodified
+    sectors directly from the source file where possible. */
+  {
+    const unsigned char * const buf = wr->bufs[index];
+#ifdef HAVE_COPY_FILE_RANGE
+    const off_t * const offs = wr->srcoffs[index];
+    if (offs && !wr->held)
+      {
+        const int nsect = len / 2048;
+        int i, j;
+        for (i = 0; i < nsect; i = j)
+          {
+            j = i + 1;
+            if (offs[i] < 0)
+              {
+                while (j < nsect && offs[j] < 0)
+                    j++;
+                writedata(wr, buf + i * 2048, (j - i) * 2048);
+              }
+            else
+              {
+                while (j < nsect && offs[j] == offs[i] + (j - i) * 2048)
+                    j++;
+                writecopy(wr, offs[i], buf + i * 2048, (j - i) * 2048);
+              } /*if*/
+          } /*for*/
+        return;
+      } /*if*/
+#endif
+    writeout(wr, buf, len);
+  } /*writebuffer*/
+
+#ifdef HAVE_PTHREAD
+
+static void *writerthread(void *arg)
+  /* writes out buffers as they are queued by writeflush, so the main thread
+    can get on with filling the next one. */
+  {
+    struct vobwriter * const wr = (struct vobwriter *)arg;
+    pthread_mutex_lock(&wr->lock);
+    while (true)
+      {
+        const int len = wr->buflen[wr->nextwrite];
+        if (len != 0)
+          {
+            pthread_mutex_unlock(&wr->lock);
+            writebuffer(wr, wr->nextwrite, len);
+            pthread_mutex_lock(&wr->lock);
+            wr->buflen[wr->nextwrite] = 0; /* buffer free for reuse */
+            wr->nextwrite = (wr->nextwrite + 1) % NRWRITEBUFS;
+            pthread_cond_broadcast(&wr->cond);
+          }
+        else if (wr->stop)
+            break;
+        else
+            pthread_cond_wait(&wr->cond, &wr->lock);
+      } /*while*/
+    pthread_mutex_unlock(&wr->lock);
+    return
+        0;
+  } /*writerthread*/
+
+#endif
+
+static struct vobwriter *writernew(void)
+  /* returns a new writer with no output file open. */
+  {
+    struct vobwriter * const wr = malloc(sizeof(struct vobwriter));
+    int i;
+    wr->fd = -1;
+    wr->bufsize = writebufsize();
+    wr->bufpos = 0;
+    wr->direct = false;
+    wr->totalwritten = 0;
+    wr->held = 0;
+    wr->heldmax = 0;
+    wr->srcfd = -1;
+    wr->srcmap = 0;
+    wr->srccheck = -1;
+    wr->totalcopied = 0;
+    for (i = 0; i < NRWRITEBUFS; i++)
+      {
+        wr->bufs[i] = allocbuf(wr->bufsize);
+        wr->srcoffs[i] = 0;
+#ifdef HAVE_COPY_FILE_RANGE
+        if (zerocopy)
+          {
+            int j;
+            wr->srcoffs[i] = malloc(wr->bufsize / 2048 * sizeof(off_t));
+            for (j = 0; j < wr->bufsize / 2048; j++)
+                wr->srcoffs[i][j] = -1;
           } /*if*/
+#endif
+      } /*for*/
+    wr->curbuf = 0;
+    wr->buf = wr->bufs[0];
+#ifdef HAVE_PTHREAD
+    for (i = 0; i < NRWRITEBUFS; i++)
+        wr->buflen[i] = 0;
+    wr->threaded = false;
+    pthread_mutex_init(&wr->lock, NULL);
+    pthread_cond_init(&wr->cond, NULL);
+#endif
+    return
+        wr;
+  } /*writernew*/
+
+static void writerhold(struct vobwriter *wr, int mbytes)
+  /* makes wr keep up to the last mbytes megabytes of output in memory, until the
+    output file is closed. */
+  {
+    const int bufsects = wr->bufsize / 2048;
+    wr->heldmax = (mbytes * 512 + bufsects - 1) / bufsects * bufsects;
+    wr->held = allocbuf((size_t)wr->heldmax * 2048);
+    wr->heldfirst = 0;
+    wr->heldcount = 0;
+    wr->heldsect = 0;
+  } /*writerhold*/
+
+static void writerfree(struct vobwriter *wr)
+  /* disposes of wr, which must have no output file open. */
+  {
+    int i;
+    for (i = 0; i < NRWRITEBUFS; i++)
+      {
+        free(wr->bufs[i]);
+        free(wr->srcoffs[i]);
+      } /*for*/
+    free(wr->held);
+#ifdef HAVE_PTHREAD
+    pthread_cond_destroy(&wr->cond);
+    pthread_mutex_destroy(&wr->lock);
+#endif
+    free(wr);
+  } /*writerfree*/
+
+static void writecheck(struct vobwriter *wr)
+  /* finishes deciding whether the last sector marked by writemark can be copied
+    from the source file, now that nothing more is going to change it. */
+  {
+    if (wr->srccheck >= 0)
+      {
+        off_t * const offs = wr->srcoffs[wr->curbuf];
+        if (memcmp(wr->buf + wr->srccheck * 2048, wr->srcmap + offs[wr->srccheck], 2048) != 0)
+            offs[wr->srccheck] = -1;
+        wr->srccheck = -1;
+      } /*if*/
+  } /*writecheck*/
+
+static void writeflush(struct vobwriter *wr)
+  /* writes out the data buffered so far, or passes it to the writer thread. */
+  {
+    writecheck(wr);
+    if (!wr->bufpos) /* nothing in buffer */
+        return;
+    if (wr->fd != -1)
+      {
+#ifdef HAVE_PTHREAD
+        if (wr->threaded)
+          {
+            pthread_mutex_lock(&wr->lock);
+            wr->buflen[wr->curbuf] = wr->bufpos;
+            pthread_cond_broadcast(&wr->cond);
+            wr->curbuf = (wr->curbuf + 1) % NRWRITEBUFS;
+            while (wr->buflen[wr->curbuf] != 0) /* wait for writer thread to catch up */
+                pthread_cond_wait(&wr->cond, &wr->lock);
+            pthread_mutex_unlock(&wr->lock);
+            wr->buf = wr->bufs[wr->curbuf];
+          }
+        else
+#endif
+            writebuffer(wr, wr->curbuf, wr->bufpos);
       } /*if*/
-    writebufpos = 0;
+    wr->bufpos = 0;
   } /*writeflush*/
 
-static unsigned char *writegrabbuf()
+static unsigned char *writegrabbuf(struct vobwriter *wr)
   /* returns the start address at which to write the next sector,
     automatically flushing previously-written sectors as necessary. */
   {
     unsigned char *buf;
-    if (writebufpos == BIGWRITEBUFLEN)
-        writeflush();
-    buf=bigwritebuf+writebufpos;
-    writebufpos += 2048; /* sector will be written to output file */
+    writecheck(wr);
+    if (wr->bufpos == wr->bufsize)
+        writeflush(wr);
+    buf = wr->buf + wr->bufpos;
+    if (wr->srcoffs[wr->curbuf])
+        wr->srcoffs[wr->curbuf][wr->bufpos / 2048] = -1;
+    wr->bufpos += 2048; /* sector will be written to output file */
     return buf;
   } /*writegrabbuf*/
 
-static void writeundo()
+static void writeundo(struct vobwriter *wr)
   /* drops the last sector from the output buffer. */
   {
-    writebufpos -= 2048;
+    wr->srccheck = -1;
+    wr->bufpos -= 2048;
   } /*writeundo*/
 
-static void writeclose()
+static void writefinish(struct vobwriter *wr)
+  /* waits until all the data so far has been written, and stops the writer thread.
+    Leaves the output file open. */
+  {
+    writeflush(wr);
+#ifdef HAVE_PTHREAD
+    if (wr->threaded)
+      {
+        pthread_mutex_lock(&wr->lock);
+        wr->stop = true;
+        pthread_cond_broadcast(&wr->cond);
+        pthread_mutex_unlock(&wr->lock);
+        pthread_join(wr->thread, NULL);
+        wr->threaded = false;
+      } /*if*/
+#endif
+  } /*writefinish*/
+
+static void writeclose(struct vobwriter *wr)
   /* flushes and closes the output file. */
   {
-    writeflush();
-    if (writefile != -1)
+    writefinish(wr);
+    if (wr->fd != -1)
       {
-        flushclose(writefile);
-        writefile = -1;
+        if (wr->held)
+            writeheld(wr, wr->heldcount);
+        flushclose(wr->fd);
+        wr->fd = -1;
       } /*if*/
   } /*writeclose*/
 
-static void writeopen(const char *newname)
-  /* opens an output file for writing. */
+static void writeopen(struct vobwriter *wr, const char *newname, off_t pos)
+  /* opens an output file for writing from pos, discarding anything already in it
+    from there on, and starts a writer thread for it if possible. */
   {
-    writefile = open(newname, O_CREAT | O_WRONLY | O_BINARY, 0666);
-    if (writefile < 0)
+    const int flags = O_CREAT | O_WRONLY | O_BINARY | (pos == 0 ? O_TRUNC : 0);
+    wr->fd = -1;
+#ifdef O_DIRECT
+    if (directio)
+      {
+        wr->fd = open(newname, flags | O_DIRECT, 0666);
+        if (wr->fd < 0 && errno == EINVAL)
+            fprintf(stderr, "WARN: %s does not support direct I/O, using normal writes\n", newname);
+      } /*if*/
+    wr->direct = wr->fd >= 0;
+#endif
+    if (wr->fd < 0)
+        wr->fd = open(newname, flags, 0666);
+    if (wr->fd < 0)
       {
         fprintf(stderr, "ERR:  Error %d opening %s: %s\n", errno, newname, strerror(errno));
         exit(1);
       } /*if*/
-  }
+    if (pos != 0 && (ftruncate(wr->fd, pos) != 0 || lseek(wr->fd, pos, SEEK_SET) != pos))
+      {
+        fprintf(stderr, "ERR:  Error %d truncating %s: %s\n", errno, newname, strerror(errno));
+        exit(1);
+      } /*if*/
+    wr->filepos = pos;
+    wr->advised[0] = pos;
+    wr->advised[1] = pos;
+    wr->heldfirst = 0;
+    wr->heldcount = 0;
+    wr->heldsect = pos / 2048;
+#ifdef HAVE_PTHREAD
+    wr->nextwrite = wr->curbuf;
+    wr->stop = false;
+    wr->threaded = pthread_create(&wr->thread, NULL, writerthread, wr) == 0;
+      /* just do the writes myself if I can't have a thread */
+#endif
+  } /*writeopen*/
 
-static void closelastref(struct vobuinfo *thisvi, struct vscani *vsi, int cursect)
-  /* collects another end-sector of another reference frame, if I don't have enough already. */
+#ifdef HAVE_PTHREAD
+
+static void *readerthread(void *arg)
+  /* reads chunks of the input file ahead of them being needed by readsector. */
   {
-    if (vsi->lastrefsect && thisvi->numref < 3)
+    struct vobreader * const rd = (struct vobreader *)arg;
+    int fill = 0; /* index of next chunk to read into */
+    while (true)
       {
-        thisvi->lastrefsect[thisvi->numref++] = cursect;
-        vsi->lastrefsect = 0;
-      } /*if*/
-  } /*closelastref*/
+        int len, err;
+        bool stop;
+        pthread_mutex_lock(&rd->lock);
+        while (rd->chunklen[fill] != -1 && !rd->stop) /* wait for chunk to be consumed */
+            pthread_cond_wait(&rd->cond, &rd->lock);
+        stop = rd->stop;
+        pthread_mutex_unlock(&rd->lock);
+        if (stop)
+            break;
+        len = fread(rd->chunks[fill], 1, READCHUNKLEN, rd->vf.h);
+        err = len < READCHUNKLEN && ferror(rd->vf.h) ? errno : 0;
+        pthread_mutex_lock(&rd->lock);
+        rd->chunkerr[fill] = err;
+        rd->chunklen[fill] = len;
+        pthread_cond_broadcast(&rd->cond);
+        pthread_mutex_unlock(&rd->lock);
+        if (len < READCHUNKLEN) /* no more to come */
+            break;
+        fill = (fill + 1) % NRREADCHUNKS;
+      } /*while*/
+    return
+        0;
+  } /*readerthread*/
 
-// this function is allowed to update buf[7] and guarantee it will end up
-// in the output stream
-// prevbytesect is the sector for the byte immediately preceding buf[0]
-static void scanvideoptr
-  (
-    struct vobgroup *va,
-    unsigned char *buf,
-    struct vobuinfo *thisvi,
-    int prevbytesect,
-    struct vscani *vsi
-  )
+#endif
+
+#ifdef USE_MMAP
+
+static bool readermap(struct vobreader *rd)
+  /* tries to map the input file into memory, if it is a regular file. */
   {
+    struct stat info;
+    const int fd = fileno(rd->vf.h);
+    void *map;
+    off_t pos;
     if
       (
-            buf[0] == 0
-        &&
-            buf[1] == 0
-        &&
-            buf[2] == 1 /* looks like a packet header */
+            rd->vf.ftype != VFTYPE_FILE
+        ||
+            fstat(fd, &info) != 0
+        ||
+            !S_ISREG(info.st_mode)
+        ||
+            info.st_size == 0
+        ||
+            (size_t)info.st_size != info.st_size /* too big to map */
+        ||
+            (pos = ftello(rd->vf.h)) < 0
       )
-      {
-        switch(buf[3])
-          {
-        case MPID_PICTURE: /* picture header */
-          {
-            const int ptype = (buf[5] >> 3) & 7; /* frame type, 1 => I, 2 => P, 3 => B, 4 => D */
-            const int temporal = (buf[4] << 2) | (buf[5] >> 6); /* temporal sequence number */
-            closelastref(thisvi, vsi, prevbytesect);
-            if (vsi->firsttemporal == -1)
-                vsi->firsttemporal = temporal;
-            vsi->lastadjust = (temporal < vsi->firsttemporal);
-            if (ptype == 1 || ptype == 2) // I or P frame
-                vsi->lastrefsect = 1; /* it's a reference frame */
-            if (va->vd.vmpeg == VM_MPEG1)
-              {
-                thisvi->numfields += 2;
-                if (vsi->lastadjust && vsi->firstgop == 2)
-                    thisvi->firstIfield += 2;
-              } /*if*/
+        return false;
+    map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return false;
+#ifdef HAVE_MADVISE
+    madvise(map, info.st_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(map, info.st_size, MADV_HUGEPAGE); /* only a hint, may not be possible */
+#endif
+#endif
+    rd->map = (const unsigned char *)map;
+    rd->maplen = info.st_size;
+    rd->mappos = pos > info.st_size ? info.st_size : pos;
+    return true;
+  } /*readermap*/
+
+#endif
+
+static void readeropen(struct vobreader *rd, const char *fname)
+  /* opens an input file, maps it into memory if allowed and possible, and
+    otherwise starts a thread reading ahead in it if possible. */
+  {
+    int i;
+    rd->vf = varied_open(fname, O_RDONLY, "input video file");
+#ifdef USE_MMAP
+    rd->map = 0;
+    if (mapinput && readermap(rd))
+      {
+        for (i = 0; i < NRREADCHUNKS; i++)
+            rd->chunks[i] = 0;
+#ifdef HAVE_PTHREAD
+        rd->threaded = false;
+        pthread_mutex_init(&rd->lock, NULL);
+        pthread_cond_init(&rd->cond, NULL);
+#endif
+        return;
+      } /*if*/
+#endif
+    for (i = 0; i < NRREADCHUNKS; i++)
+      {
+        rd->chunks[i] = allocbuf(READCHUNKLEN);
+        rd->chunklen[i] = -1;
+        rd->chunkerr[i] = 0;
+      } /*for*/
+    rd->curchunk = 0;
+    rd->chunkpos = 0;
+#ifdef HAVE_PTHREAD
+    rd->stop = false;
+    pthread_mutex_init(&rd->lock, NULL);
+    pthread_cond_init(&rd->cond, NULL);
+    rd->threaded = pthread_create(&rd->thread, NULL, readerthread, rd) == 0;
+#endif
+  } /*readeropen*/
+
+static int readsector(struct vobreader *rd, unsigned char *buf)
+  /* reads the next sector from the input file into buf. Returns the number of
+    bytes read, which is only less than 2048 at the end of the file, or -1 on error. */
+  {
+#ifdef USE_MMAP
+    if (rd->map)
+      {
+        size_t len = rd->maplen - rd->mappos;
+        if (len > 2048)
+            len = 2048;
+        memcpy(buf, rd->map + rd->mappos, len);
+        rd->mappos += len;
+        return
+            len;
+      } /*if*/
+#endif
+#ifdef HAVE_PTHREAD
+    if (rd->threaded)
+      {
+        int len;
+        pthread_mutex_lock(&rd->lock);
+        while (true)
+          {
+            while (rd->chunklen[rd->curchunk] == -1) /* wait for it to be read */
+                pthread_cond_wait(&rd->cond, &rd->lock);
+            if (rd->chunkpos < READCHUNKLEN || rd->chunklen[rd->curchunk] < READCHUNKLEN)
+                break;
+          /* finished with this chunk, hand it back to reader thread */
+            rd->chunklen[rd->curchunk] = -1;
+            pthread_cond_broadcast(&rd->cond);
+            rd->curchunk = (rd->curchunk + 1) % NRREADCHUNKS;
+            rd->chunkpos = 0;
+          } /*while*/
+        pthread_mutex_unlock(&rd->lock);
+      /* chunk contents won't change until I hand it back */
+        len = rd->chunklen[rd->curchunk] - rd->chunkpos;
+        if (len > 2048)
+            len = 2048;
+        memcpy(buf, rd->chunks[rd->curchunk] + rd->chunkpos, len);
+        rd->chunkpos += len;
+        if (len < 2048 && rd->chunkerr[rd->curchunk] != 0)
+          {
+            errno = rd->chunkerr[rd->curchunk];
+            len = -1;
+          } /*if*/
+        return
+            len;
+      } /*if*/
+#endif
+    return
+        fread(buf, 1, 2048, rd->vf.h);
+  } /*readsector*/
+
+static void readerclose(struct vobreader *rd)
+  /* stops any reader thread and closes the input file. */
+  {
+    int i;
+#ifdef HAVE_PTHREAD
+    if (rd->threaded)
+      {
+        pthread_mutex_lock(&rd->lock);
+        rd->stop = true;
+        pthread_cond_broadcast(&rd->cond);
+        pthread_mutex_unlock(&rd->lock);
+        pthread_join(rd->thread, NULL);
+      } /*if*/
+    pthread_cond_destroy(&rd->cond);
+    pthread_mutex_destroy(&rd->lock);
+#endif
+#ifdef USE_MMAP
+    if (rd->map)
+        munmap((void *)rd->map, rd->maplen);
+#endif
+    varied_close(rd->vf);
+    for (i = 0; i < NRREADCHUNKS; i++)
+        free(rd->chunks[i]);
+  } /*readerclose*/
+
+static void writeattach(struct vobwriter *wr, const struct vobreader *rd)
+  /* lets unmodified sectors from rd be copied directly to the output, if
+    allowed and possible. */
+  {
+#ifdef USE_MMAP
+    if (wr->srcoffs[0] && rd->map)
+      {
+        wr->srcfd = fileno(rd->vf.h);
+        wr->srcmap = rd->map;
+        wr->copyok = true;
+      } /*if*/
+#endif
+  } /*writeattach*/
+
+static void writemark(struct vobwriter *wr, const struct vobreader *rd)
+  /* notes that the sector just read from rd into the last buffer obtained from
+    writegrabbuf might be copied directly from the source file, if it doesn't
+    end up being modified. */
+  {
+#ifdef USE_MMAP
+    if (wr->srcfd != -1)
+      {
+        wr->srccheck = wr->bufpos / 2048 - 1;
+        wr->srcoffs[wr->curbuf][wr->srccheck] = rd->mappos - 2048;
+      } /*if*/
+#endif
+  } /*writemark*/
+
+static void writedetach(struct vobwriter *wr)
+  /* waits for all sectors to be copied from the current source file, so it can be closed. */
+  {
+    if (wr->srcfd != -1)
+      {
+        writeflush(wr);
+#ifdef HAVE_PTHREAD
+        if (wr->threaded)
+          {
+            int i;
+            pthread_mutex_lock(&wr->lock);
+            for (i = 0; i < NRWRITEBUFS; i++)
+                while (wr->buflen[i] != 0)
+                    pthread_cond_wait(&wr->cond, &wr->lock);
+            pthread_mutex_unlock(&wr->lock);
+          } /*if*/
+#endif
+        wr->srcfd = -1;
+        wr->srcmap = 0;
+      } /*if*/
+  } /*writedetach*/
+
+static void closelastref(struct vobuinfo *thisvi, struct vscani *vsi, int cursect)
+  /* collects another end-sector of another reference frame, if I don't have enough already. */
+  {
+    if (vsi->lastrefsect && thisvi->numref < 3)
+      {
+        thisvi->lastrefsect[thisvi->numref++] = cursect;
+        vsi->lastrefsect = 0;
+      } /*if*/
+  } /*closelastref*/
+
+// this function is allowed to update buf[7] and guarantee it will end up
+// in the output stream
+// prevbytesect is the sector for the byte immediately preceding buf[0]
+static void scanvideoptr
+  (
+    struct vobgroup *va,
+    unsigned char *buf,
+    struct vobuinfo *thisvi,
+    int prevbytesect,
+    struct vscani *vsi
+  )
+  {
+    if
+      (
+            buf[0] == 0
+        &&
+            buf[1] == 0
+        &&
+            buf[2] == 1 /* looks like a packet header */
+      )
+      {
+        switch(buf[3])
+          {
+        case MPID_PICTURE: /* picture header */
+          {
+            const int ptype = (buf[5] >> 3) & 7; /* frame type, 1 => I, 2 => P, 3 => B, 4 => D */
+            const int temporal = (buf[4] << 2) | (buf[5] >> 6); /* temporal sequence number */
+            closelastref(thisvi, vsi, prevbytesect);
+            if (vsi->firsttemporal == -1)
+                vsi->firsttemporal = temporal;
+            vsi->lastadjust = (temporal < vsi->firsttemporal);
+            if (ptype == 1 || ptype == 2) // I or P frame
+                vsi->lastrefsect = 1; /* it's a reference frame */
+            if (va->vd.vmpeg == VM_MPEG1)
+              {
+                thisvi->numfields += 2;
+                if (vsi->lastadjust && vsi->firstgop == 2)
+                    thisvi->firstIfield += 2;
+              } /*if*/
 
             // fprintf(stderr,"INFO: frame type %d, tempref=%d, prevsect=%d\n",ptype,temporal,prevbytesect);
         break;
@@ -596,7 +1400,9 @@ static void scanvideoptr
               } /* switch(framerate) */
             sprintf(sizestring, "%dx%d", hsize, vsize);
             vobgroup_set_video_attr(va, VIDEO_RESOLUTION, sizestring);
-            if (va->vd.vmpeg == VM_MPEG1)
+            if (va->vd.vmpeg == VM_NONE)
+                vsi->attrguess = true; /* normally undone when scanvideoframe rescans */
+            else if (va->vd.vmpeg == VM_MPEG1)
               {
                 switch (aspect)
                   {
@@ -628,6 +1434,8 @@ static void scanvideoptr
                         (va->vd.vformat == VF_NTSC) * 3;
                 if (newaspect == 11)
                     newaspect++;
+                if (va->vd.vaspect == VA_NONE || va->vd.vformat == VF_NONE)
+                    vsi->attrguess = true;
                 buf[7] = (buf[7] & 0xf) | (newaspect << 4); // reset the aspect ratio
               }
             else if (va->vd.vmpeg == VM_MPEG2)
@@ -640,6 +1448,8 @@ static void scanvideoptr
                     fprintf(stderr, "WARN: unknown mpeg2 aspect ratio %d\n", aspect);
                 buf[7] = (buf[7] & 0xf) | (va->vd.vaspect == VA_4x3 ? 2 : 3) << 4;
                   // reset the aspect ratio
+                if (va->vd.vaspect == VA_NONE)
+                    vsi->attrguess = true;
               } /*if*/
             break;
           } /* case MPID_SEQUENCE */
@@ -728,11 +1538,11 @@ static void scanvideoframe(struct vobgroup *va, unsigned char *buf, struct vobui
     struct vscani oldvsi;
     if (l - f < 8)
       {
-        memcpy(videoslidebuf + 7, buf + f, l - f);
+        memcpy(vsi->slidebuf + 7, buf + f, l - f);
         for (i = 0; i < l - f; i++)
-            scanvideoptr(va, videoslidebuf + i, thisvi, prevsect, vsi);
-        memcpy(buf + f, videoslidebuf + 7, l - f);
-        memset(videoslidebuf, 255, 7);
+            scanvideoptr(va, vsi->slidebuf + i, thisvi, prevsect, vsi);
+        memcpy(buf + f, vsi->slidebuf + 7, l - f);
+        memset(vsi->slidebuf, 255, 7);
         return;
       } /*if*/
  rescan:
@@ -740,17 +1550,14 @@ static void scanvideoframe(struct vobgroup *va, unsigned char *buf, struct vobui
     oldtvi = *thisvi;
     oldvsi = *vsi;
     // copy the first 7 bytes to use with the prev 7 bytes in hdr detection
-    memcpy(videoslidebuf + 7, buf + f, 8); // we scan the first header using the slide buffer
+    memcpy(vsi->slidebuf + 7, buf + f, 8); // we scan the first header using the slide buffer
     for (i = 0; i <= 7; i++)
-        scanvideoptr(va, videoslidebuf + i, thisvi, prevsect, vsi);
-    memcpy(buf + f, videoslidebuf + 7, 8);
+        scanvideoptr(va, vsi->slidebuf + i, thisvi, prevsect, vsi);
+    memcpy(buf + f, vsi->slidebuf + 7, 8);
     // quickly scan all but the last 7 bytes for a hdr
     // buf[f]... was already scanned in the videoslidebuffer to give the correct sector
-    for (i = f + 1; i < l - 7; i++)
-      {
-        if (buf[i] == 0 && buf[i + 1] == 0 && buf[i + 2] == 1)
-            scanvideoptr(va, buf + i, thisvi, cursect, vsi);
-      } /*for*/
+    for (i = f + 1; (i = find_startcode(buf, i, l - 5)) < l - 5; i++)
+        scanvideoptr(va, buf + i, thisvi, cursect, vsi);
     if (!va->vd.vmpeg)
         vobgroup_set_video_attr(va, VIDEO_MPEG, "mpeg1");
     // if the mpeg version changed, then rerun scanvideoframe, because
@@ -762,17 +1569,17 @@ static void scanvideoframe(struct vobgroup *va, unsigned char *buf, struct vobui
         goto rescan;
       } /*if*/
     // use the last 7 bytes in the next iteration
-    memcpy(videoslidebuf, buf + l - 7, 7);
+    memcpy(vsi->slidebuf, buf + l - 7, 7);
   } /*scanvideoframe*/
 
-static void finishvideoscan(struct vobgroup *va, int vob, int prevsect, struct vscani *vsi)
+static void finishvideoscan(struct vobgroup *va, struct vob *thisvob, int prevsect, struct vscani *vsi)
   {
-    struct vobuinfo * const lastvi = &va->vobs[vob]->vobu[va->vobs[vob]->numvobus - 1];
+    struct vobuinfo * const lastvi = &thisvob->vobu[thisvob->numvobus - 1];
     int i;
-    memset(videoslidebuf + 7, 0, 7);
+    memset(vsi->slidebuf + 7, 0, 7);
     for (i = 0; i < 7; i++)
-        scanvideoptr(va, videoslidebuf + i, lastvi, prevsect, vsi);
-    memset(videoslidebuf, 255, 7);
+        scanvideoptr(va, vsi->slidebuf + i, lastvi, prevsect, vsi);
+    memset(vsi->slidebuf, 255, 7);
     closelastref(lastvi, vsi, prevsect);
   } /*finishvideoscan*/
 
@@ -1021,12 +1828,12 @@ static void procremap
       } /*while*/
   } /*procremap*/
 
-static void printvobustatus(struct vobgroup *va, int cursect, bool checknonempty)
-  /* report total number of VOBUs and PGCs seen so far, and how much of the
-    input file has been processed. */
+static void printvobustatus(struct vobgroup *va, int numvobs, int cursect, bool checknonempty)
+  /* report total number of VOBUs in the first numvobs VOBs and PGCs seen so far, and
+    how much of the input file has been processed. */
   {
     int j, nv = 0;
-    for (j = 0; j < va->numvobs; j++)
+    for (j = 0; j < numvobs; j++)
         nv += va->vobs[j]->numvobus;
     // fprintf(stderr, "STAT: VOBU %d at %dMB, %d PGCs, %d:%02d:%02d\r", nv, cursect / 512, va->numallpgcs, total / 324000000, (total % 324000000) / 5400000, (total % 5400000) / 90000);
     fprintf(stderr, "STAT: VOBU %d at %dMB, %d PGCs\r", nv, cursect / 512, va->numallpgcs);
@@ -1116,905 +1923,2181 @@ static void audio_scan_pcm(struct audchannel *ach,const unsigned char *buf,int l
     audiodesc_set_audio_attr(&ach->ad,&ach->adwarn,AUDIO_CHANNELS,attr);
 }
 
-int FindVobus(const char *fbase, struct vobgroup *va, vtypes ismenu)
-  /* collects audio/video/subpicture information, remaps subpicture colours and generates
-    output VOB files for a menu or titleset, complete except for the NAV packs. */
+/*
+    Scan cache: the results of scanning an input file, together with how to turn
+    its sectors into the output sectors, are saved in a file alongside it, so they
+    can be reused instead of rescanning it if it is processed again unchanged, in
+    the same circumstances.
+*/
+
+#define SCANCACHE_MAGIC "dvdauthor scan cache v2\n"
+#define SCANCACHE_VERSIONLEN 32 /* space for PACKAGE_VERSION in header */
+#define SCANCACHE_SAMPLE (1024 * 1024) /* how much of the start, middle and end of an input file to hash */
+
+struct scandelta /* how the output sectors for a VOB differ from its input sectors */
+  {
+    unsigned char *data;
+      /* one record per output sector: input sector index (4 bytes), nr patches (2 bytes),
+        then for each patch, offset (2 bytes), length (2 bytes) and the new bytes */
+    size_t len, max; /* used and allocated size of data */
+    uint32_t *sums; /* checksum of each input sector, so replaying can tell if it has changed */
+    int maxsums; /* allocated length of sums */
+    int insect; /* index of last sector read from input */
+    unsigned char orig[2048]; /* contents of that sector as read */
+  };
+
+static struct scandelta *deltanew(void)
+  {
+    struct scandelta * const d = malloc(sizeof(struct scandelta));
+    d->data = 0;
+    d->len = 0;
+    d->max = 0;
+    d->sums = 0;
+    d->maxsums = 0;
+    d->insect = -1;
+    return
+        d;
+  } /*deltanew*/
+
+static void deltafree(struct scandelta *d)
+  {
+    if (d)
+      {
+        free(d->data);
+        free(d->sums);
+        free(d);
+      } /*if*/
+  } /*deltafree*/
+
+static uint32_t sectorsum(const unsigned char *buf)
+  /* returns a checksum of the contents of a sector, quick enough to compute
+    for every sector read. */
+  {
+    uint64_t sum = 14695981039346656037ULL, word;
+    int i;
+    for (i = 0; i < 2048; i += sizeof word)
+      {
+        memcpy(&word, buf + i, sizeof word);
+        sum = ((sum << 29 | sum >> 35) ^ word) * 0x9e3779b97f4a7c15ULL;
+      } /*for*/
+    return
+        sum ^ sum >> 32;
+  } /*sectorsum*/
+
+static void deltaput(struct scandelta *d, const void *src, size_t len)
+  /* appends len bytes from src to d->data. */
+  {
+    if (d->len + len > d->max)
+      {
+        d->max = (d->len + len) * 2;
+        d->data = realloc(d->data, d->max);
+      } /*if*/
+    memcpy(d->data + d->len, src, len);
+    d->len += len;
+  } /*deltaput*/
+
+static void deltaread(struct scandelta *d, const unsigned char *buf)
+  /* notes the contents of the sector just read from the input. */
+  {
+    memcpy(d->orig, buf, 2048);
+    d->insect++;
+    if (d->insect == d->maxsums)
+      {
+        d->maxsums = d->maxsums != 0 ? d->maxsums * 2 : 1024;
+        d->sums = realloc(d->sums, d->maxsums * sizeof *d->sums);
+      } /*if*/
+    d->sums[d->insect] = sectorsum(buf);
+  } /*deltaread*/
+
+static void deltasector(struct scandelta *d, const unsigned char *buf)
+  /* records how to generate the output sector in buf from the input sector last read. */
+  {
+    const int32_t insect = d->insect;
+    uint16_t count = 0;
+    size_t countpos;
+    deltaput(d, &insect, sizeof insect);
+    countpos = d->len;
+    deltaput(d, &count, sizeof count);
+    if (memcmp(buf, d->orig, 2048) != 0)
+      {
+        int i = 0;
+        while (i < 2048)
+          {
+            int j, last;
+            uint16_t patch[2];
+            if (buf[i] == d->orig[i])
+              {
+                i++;
+                continue;
+              } /*if*/
+          /* extend patch until a run of unchanged bytes that is worth skipping */
+            last = i;
+            for (j = i + 1; j < 2048 && j - last <= 4; j++)
+                if (buf[j] != d->orig[j])
+                    last = j;
+            patch[0] = i;
+            patch[1] = last + 1 - i;
+            deltaput(d, patch, sizeof patch);
+            deltaput(d, buf + i, patch[1]);
+            count++;
+            i = last + 1;
+          } /*while*/
+        memcpy(d->data + countpos, &count, sizeof count);
+      } /*if*/
+  } /*deltasector*/
+
+struct vobscan /* state carried from one input VOB to the next while generating output */
+  {
+    struct vobgroup *va; /* where to collect video attributes */
+    const char *fbase; /* base name for output files, NULL if not writing any */
+    int cursect; /* sector nr in output */
+    int fsect; /* sector nr in current output VOB file, -ve => not opened yet */
+    int outnum; /* +ve for a titleset, in which case used to generate output VOB file names */
+    bool worker;
+      /* scanning a single VOB on a worker thread, without generating any output: don't split
+        the output, don't report progress, and give up on anything that affects shared state */
+    bool usedcolors; /* whether any subpicture colours were merged into a colour table by last VOB scanned */
+    bool usedbuttons; /* whether last VOB scanned defined any buttons */
+    bool attrguess; /* copy of vscani.attrguess for last VOB scanned */
+    struct colorremap crs[32]; /* enough for 32 subpicture streams */
+    unsigned char deferred_buf[2048];
+    struct vobwriter *wr;
+    struct scandelta *delta; /* where to record changes to input sectors, NULL if not wanted */
+    uint64_t bytesread; /* total length of input VOBs, for timing report */
+  };
+
+static void initvobscan(struct vobscan *sc, struct vobgroup *va, const char *fbase, int outnum)
+  /* sets up sc to begin generating output at the start of a new file. The writer
+    must be set up separately. */
+  {
+    sc->va = va;
+    sc->fbase = fbase;
+    sc->cursect = 0;
+    sc->fsect = -1;
+    sc->outnum = outnum;
+    sc->worker = false;
+    sc->usedcolors = false;
+    sc->usedbuttons = false;
+    sc->attrguess = false;
+    sc->delta = 0;
+    sc->bytesread = 0;
+  } /*initvobscan*/
+
+static bool scanvob
+  (
+    struct vobscan *sc,
+    int vnum, /* index into sc->va->vobs of VOB to scan */
+    struct colorinfo *colors, /* where to merge subpicture colours */
+    uint64_t *endoffset /* returned length of input, for messages */
+  )
+  /* reads the next input VOB and appends it to the output, collecting information
+    about its VOBUs and its audio/video/subpicture streams. Returns false if the
+    scan had to be abandoned, which can only happen on a worker thread. */
   {
+    struct vobgroup * const va = sc->va;
+    struct vob * const thisvob = va->vobs[vnum];
+    const char * const fbase = sc->fbase;
+    struct colorremap * const crs = sc->crs;
+    unsigned char * const deferred_buf = sc->deferred_buf;
+    struct vobwriter * const wr = sc->wr;
     unsigned char *buf;
-    static unsigned char deferred_buf[2048];
-    int cursect = 0; /* sector nr in input file */
-    int fsect = -1; /* sector nr in current output VOB file, -ve => not opened yet */
-    int vnum;
-    int outnum = -(int)ismenu + 1; /* +ve for a titleset, in which case used to generate output VOB file names */
-    int vobid =0;
+    int cursect = sc->cursect; /* sector nr in output */
+    int fsect = sc->fsect;
+    int outnum = sc->outnum;
     struct mp2info
       {
         int hdrptr; /* index at which packet header starts */
         unsigned char buf[6]; /* save partial packet in case it crosses sector boundaries */
       } mp2hdr[8]; /* enough for the allowed 8 audio streams */
-    struct colorremap *crs;
+    int i, j;
+    int sysoffs;
+    bool hadfirstvobu = false, complete = false;
+    pts_t backoffs = 0, lastscr = 0;
+    bool fill_in_vobus = false, got_deferred_buf = false;
+    int prevvidsect = -1;
+    struct vscani vsi;
+    struct vobreader rd;
+    uint64_t inoffset;
+    vsi.lastrefsect = 0;
+    vsi.firstgop = 1;
+    vsi.firsttemporal = -1;
+    vsi.lastadjust = 0;
+    vsi.attrguess = false;
+    memset(vsi.slidebuf, 255, 7);
+    memset(vsi.slidebuf + 7, 0, 8);
+    for (i = 0; i < 32; i++)
+        initremap(crs + i);
+    sc->usedcolors = false;
+    sc->usedbuttons = false;
 
-    crs = malloc(sizeof(struct colorremap) * 32); /* enough for 32 subpicture streams */
-    for (vnum = 0; vnum < va->numvobs; vnum++)
+    readeropen(&rd, thisvob->fname);
+    writeattach(wr, &rd);
+    inoffset = 0;
+    memset(mp2hdr, 0, 8 * sizeof(struct mp2info));
+    while (true)
       {
-        int i, j;
-        int sysoffs;
-        bool hadfirstvobu = false;
-        pts_t backoffs = 0, lastscr = 0;
-        bool fill_in_vobus = false, got_deferred_buf = false;
-        struct vob * const thisvob = va->vobs[vnum];
-        int prevvidsect = -1;
-        struct vscani vsi;
-        struct vfile vf;
-        uint64_t inoffset;
-        vsi.lastrefsect = 0;
-        for (i = 0; i < 32; i++)
-            initremap(crs + i);
-
-        vobid++;
-        thisvob->vobid = vobid;
-        vsi.firstgop = 1;
-
-        fprintf(stderr, "\nSTAT: Processing %s...\n", thisvob->fname);
-        vf = varied_open(thisvob->fname, O_RDONLY, "input video file");
-        inoffset = 0;
-        memset(mp2hdr, 0, 8 * sizeof(struct mp2info));
-        while (true)
+        if (fsect == 524272 && !sc->worker)
+          {
+          /* VOB file reached maximum allowed size */
+            writeclose(wr);
+            if (outnum <= 0)
+              { /* menu VOB cannot be split */
+                fprintf(stderr, "\nERR:  Menu VOB reached 1gb at inoffset %#"PRIx64"\n", inoffset);
+                exit(1);
+              } /*if*/
+            outnum++; /* for naming next VOB file */
+            fsect = -1;
+          } /*if*/
+        buf = writegrabbuf(wr);
+        if (got_deferred_buf)
+            memcpy(buf, deferred_buf, 2048);
+        else
           {
-            if (fsect == 524272)
+            i = readsector(&rd, buf);
+            if (i != 2048)
               {
-              /* VOB file reached maximum allowed size */
-                writeclose();
-                if (outnum <= 0)
-                  { /* menu VOB cannot be split */
-                    fprintf(stderr, "\nERR:  Menu VOB reached 1gb at inoffset %#"PRIx64"\n", inoffset);
-                    exit(1);
+                if (i == -1)
+                  {
+                    fprintf(stderr, "\nERR:  Error %d while reading at inoffset %#"PRIx64": %s\n", errno, inoffset, strerror(errno));
+                  }
+                else if (i > 0) /* shouldn't occur */
+                  {
+                    fprintf(stderr, "\nERR:  Partial sector read (%d bytes at inoffset %#"PRIx64")\n", i, inoffset);
+                  }
+                else
+                  {
+                    writeundo(wr);
+                    break;
                   } /*if*/
-                outnum++; /* for naming next VOB file */
-                fsect = -1;
+                exit(1);
               } /*if*/
-            buf = writegrabbuf();
-            if (got_deferred_buf)
-                memcpy(buf, deferred_buf, 2048);
-            else
+            writemark(wr, &rd);
+            if (sc->delta)
+                deltaread(sc->delta, buf);
+          } /*if*/
+        if
+          (
+                buf[14] == 0
+            &&
+                buf[15] == 0
+            &&
+                buf[16] == 1
+            &&
+                buf[17] == MPID_PAD
+            &&
+                !strcmp((const char *)buf + 20, "dvdauthor-data") /* message from spumux */
+          )
+          {
+            // private dvdauthor data, interpret and remove from final stream
+            int i = 35;
+            if (buf[i] != 2)
+              {
+                fprintf(stderr, "ERR:  dvd info packet at inoffset %#"PRIx64" is unexpected version %d\n", inoffset, buf[i]);
+                exit(1);
+              } /*if*/
+            switch (buf[i + 1]) // packet type
               {
-                i = fread(buf, 1, 2048, vf.h);
-                if (i != 2048)
+            case 1: // subtitle/menu color and button information
+              {
+                int substreamid = buf[i + 2] & 31;
+                i += 3;
+                i += 8; // skip start pts and end pts
+                while (buf[i] != 0xff)
                   {
-                    if (i == -1)
+                    switch (buf[i])
                       {
-                        fprintf(stderr, "\nERR:  Error %d while reading at inoffset %#"PRIx64": %s\n", errno, inoffset, strerror(errno));
-                      }
-                    else if (i > 0) /* shouldn't occur */
+                    case 1: // new colormap
                       {
-                        fprintf(stderr, "\nERR:  Partial sector read (%d bytes at inoffset %#"PRIx64")\n", i, inoffset);
+                        int j;
+                        crs[substreamid].origmap = colors;
+                          /* where to merge colours into */
+                        sc->usedcolors = true;
+                        for (j = 0; j < buf[i + 1]; j++)
+                          {
+                          /* collect colours needing remapping, which won't happen
+                            until they're actually referenced */
+                            crs[substreamid].newcolors[j] =
+                                    COLOR_UNUSED /* indicate colour needs remapping */
+                                |
+                                    buf[i + 2 + 3 * j] << 16
+                                |
+                                    buf[i + 3 + 3 * j] << 8
+                                |
+                                    buf[i + 4 + 3 * j];
+                          } /*for*/
+                        for (; j < 16; j++) /* fill in unused entries with identity mapping */
+                            crs[substreamid].newcolors[j] = j;
+                        i += 2 + 3 * buf[i + 1];
                       }
-                    else
-                      {
-                        writeundo();
-                        break;
-                      } /*if*/
-                    exit(1);
-                  } /*if*/
-              } /*if*/
-            if
-              (
-                    buf[14] == 0
-                &&
-                    buf[15] == 0
-                &&
-                    buf[16] == 1
-                &&
-                    buf[17] == MPID_PAD
-                &&
-                    !strcmp((const char *)buf + 20, "dvdauthor-data") /* message from spumux */
-              )
-              {
-                // private dvdauthor data, interpret and remove from final stream
-                int i = 35;
-                if (buf[i] != 2)
-                  {
-                    fprintf(stderr, "ERR:  dvd info packet at inoffset %#"PRIx64" is unexpected version %d\n", inoffset, buf[i]);
-                    exit(1);
-                  } /*if*/
-                switch (buf[i + 1]) // packet type
-                  {
-                case 1: // subtitle/menu color and button information
-                  {
-                    int substreamid = buf[i + 2] & 31;
-                    i += 3;
-                    i += 8; // skip start pts and end pts
-                    while (buf[i] != 0xff)
+                    break;
+                    case 2: // new buttoncoli
                       {
-                        switch (buf[i])
+                        int j;
+                        memcpy(thisvob->buttoncoli, buf + i + 2, buf[i + 1] * 8);
+                        for (j = 0; j < buf[i + 1]; j++)
                           {
-                        case 1: // new colormap
+                          /* remap the colours, not the contrast values */
+                            remapbyte(&crs[substreamid], thisvob->buttoncoli + j * 8 + 0);
+                            remapbyte(&crs[substreamid], thisvob->buttoncoli + j * 8 + 1);
+                            remapbyte(&crs[substreamid], thisvob->buttoncoli + j * 8 + 4);
+                            remapbyte(&crs[substreamid], thisvob->buttoncoli + j * 8 + 5);
+                          } /*for*/
+                        i += 2 + 8 * buf[i + 1];
+                      }
+                    break;
+                    case 3: // button position information
+                      {
+                        int j;
+                        const int nrbuttons = buf[i + 1];
+                        sc->usedbuttons = true;
+                        if (sc->worker)
+                          /* button definitions go into the PGC, which is shared with
+                            other VOBs; leave this one for the main thread to do */
+                            goto giveup;
+                        i += 2;
+                        for (j = 0; j < nrbuttons; j++)
                           {
-                            int j;
-                            crs[substreamid].origmap = thisvob->progchain->colors;
-                              /* where to merge colours into */
-                            for (j = 0; j < buf[i + 1]; j++)
+                            struct button * b;
+                            struct buttoninfo * bi, bitmp;
+                            char * const bn = readpstr(buf, &i);
+                            if (!findbutton(thisvob->progchain, bn, 0))
                               {
-                              /* collect colours needing remapping, which won't happen
-                                until they're actually referenced */
-                                crs[substreamid].newcolors[j] =
-                                        COLOR_UNUSED /* indicate colour needs remapping */
-                                    |
-                                        buf[i + 2 + 3 * j] << 16
-                                    |
-                                        buf[i + 3 + 3 * j] << 8
-                                    |
-                                        buf[i + 4 + 3 * j];
-                              } /*for*/
-                            for (; j < 16; j++) /* fill in unused entries with identity mapping */
-                                crs[substreamid].newcolors[j] = j;
-                            i += 2 + 3 * buf[i + 1];
-                          }
-                        break;
-                        case 2: // new buttoncoli
-                          {
-                            int j;
-                            memcpy(thisvob->buttoncoli, buf + i + 2, buf[i + 1] * 8);
-                            for (j = 0; j < buf[i + 1]; j++)
+                                fprintf
+                                  (
+                                    stderr,
+                                    "ERR:  Cannot find button '%s' as referenced by"
+                                        " the subtitle at inoffset %#"PRIx64"\n",
+                                    bn,
+                                    inoffset
+                                  );
+                                exit(1);
+                              } /*if*/
+                            b = &thisvob->progchain->buttons[findbutton(thisvob->progchain, bn, 0) - 1];
+                            free(bn);
+
+                            if (b->numstream >= MAXBUTTONSTREAM)
                               {
-                              /* remap the colours, not the contrast values */
-                                remapbyte(&crs[substreamid], thisvob->buttoncoli + j * 8 + 0);
-                                remapbyte(&crs[substreamid], thisvob->buttoncoli + j * 8 + 1);
-                                remapbyte(&crs[substreamid], thisvob->buttoncoli + j * 8 + 4);
-                                remapbyte(&crs[substreamid], thisvob->buttoncoli + j * 8 + 5);
-                              } /*for*/
-                            i += 2 + 8 * buf[i + 1];
-                          }
-                        break;
-                        case 3: // button position information
-                          {
-                            int j;
-                            const int nrbuttons = buf[i + 1];
-                            i += 2;
-                            for (j = 0; j < nrbuttons; j++)
+                                fprintf
+                                  (
+                                    stderr,
+                                    "WARN: Too many button streams at inoffset %#"PRIx64";"
+                                        " ignoring buttons\n",
+                                    inoffset
+                                  );
+                                bi = &bitmp; /* place to put discarded data */
+                              }
+                            else
                               {
-                                struct button * b;
-                                struct buttoninfo * bi, bitmp;
-                                char * const bn = readpstr(buf, &i);
-                                if (!findbutton(thisvob->progchain, bn, 0))
-                                  {
-                                    fprintf
-                                      (
-                                        stderr,
-                                        "ERR:  Cannot find button '%s' as referenced by"
-                                            " the subtitle at inoffset %#"PRIx64"\n",
-                                        bn,
-                                        inoffset
-                                      );
-                                    exit(1);
-                                  } /*if*/
-                                b = &thisvob->progchain->buttons[findbutton(thisvob->progchain, bn, 0) - 1];
-                                free(bn);
-
-                                if (b->numstream >= MAXBUTTONSTREAM)
-                                  {
-                                    fprintf
-                                      (
-                                        stderr,
-                                        "WARN: Too many button streams at inoffset %#"PRIx64";"
-                                            " ignoring buttons\n",
-                                        inoffset
-                                      );
-                                    bi = &bitmp; /* place to put discarded data */
-                                  }
-                                else
-                                  {
-                                    bi = &b->stream[b->numstream++];
-                                  } /*if*/
-                                bi->substreamid = substreamid;
-                                i += 2; // skip modifier
-                                bi->autoaction = buf[i++] != 0;
-                                bi->grp = buf[i];
-                                bi->x1 = read2(buf + i + 1);
-                                bi->y1 = read2(buf + i + 3);
-                                bi->x2 = read2(buf + i + 5);
-                                bi->y2 = read2(buf + i + 7);
-                                i += 9;
-                              /* neighbouring button names */
-                                bi->up = readpstr(buf, &i);
-                                bi->down = readpstr(buf, &i);
-                                bi->left = readpstr(buf, &i);
-                                bi->right = readpstr(buf, &i);
-                              } /*for*/
-                          } /*case 3*/
-                        break;
-                        default:
-                            fprintf
-                              (
-                                stderr,
-                                "ERR:  dvd info packet command within subtitle at inoffset %#"PRIx64": %d\n",
-                                inoffset,
-                                buf[i]
-                              );
-                            exit(1);
-                          } /*switch*/
-                      } /*while*/
+                                bi = &b->stream[b->numstream++];
+                              } /*if*/
+                            bi->substreamid = substreamid;
+                            i += 2; // skip modifier
+                            bi->autoaction = buf[i++] != 0;
+                            bi->grp = buf[i];
+                            bi->x1 = read2(buf + i + 1);
+                            bi->y1 = read2(buf + i + 3);
+                            bi->x2 = read2(buf + i + 5);
+                            bi->y2 = read2(buf + i + 7);
+                            i += 9;
+                          /* neighbouring button names */
+                            bi->up = readpstr(buf, &i);
+                            bi->down = readpstr(buf, &i);
+                            bi->left = readpstr(buf, &i);
+                            bi->right = readpstr(buf, &i);
+                          } /*for*/
+                      } /*case 3*/
+                    break;
+                    default:
+                        fprintf
+                          (
+                            stderr,
+                            "ERR:  dvd info packet command within subtitle at inoffset %#"PRIx64": %d\n",
+                            inoffset,
+                            buf[i]
+                          );
+                        exit(1);
+                      } /*switch*/
+                  } /*while*/
 
-                  } /*case 1*/
-                break;
+              } /*case 1*/
+            break;
 
-                default:
-                    fprintf
-                      (
-                        stderr,
-                        "ERR:  unknown dvdauthor-data packet type at inoffset %#"PRIx64": %d\n",
-                        inoffset,
-                        buf[i + 1]
-                      );
-                    exit(1);
-                } /*switch*/
+            default:
+                fprintf
+                  (
+                    stderr,
+                    "ERR:  unknown dvdauthor-data packet type at inoffset %#"PRIx64": %d\n",
+                    inoffset,
+                    buf[i + 1]
+                  );
+                exit(1);
+            } /*switch*/
 
-                writeundo(); /* drop private data from output */
-                continue;
-              } /*if*/
-            // we should get a VOBU before a video with GOP
-            if
-              (
-                    (fill_in_vobus || !hadfirstvobu)
-                &&
-                    !got_deferred_buf
-                &&
-                    has_gop(buf)
-              )
-              {
-                // create VOBU, from Martin Crossley
-                if (!hadfirstvobu)
-                  { /* let user know the first time this happens */
-                    fprintf
-                      (
-                        stderr,
-                        "INFO: found video GOP at inoffset %#"PRIx64" without a preceding VOBU"
-                            " - creating VOBU\n",
-                        inoffset
-                      );
-                  } /*if*/
-                fill_in_vobus = true; /* keep doing it from now on */
-                memcpy(deferred_buf, buf, 2048); /* save just-read sector for processing on next iteration */
-                got_deferred_buf = true; /* remember I've saved it */
-              /* buf already has a system header */
-                buf[41] = MPID_PRIVATE2;
-                buf[42] = 0x03;
-                buf[43] = 0xd4;
-                buf[44] = 0x81; /* rest of PCI will be correctly filled in later by FixVobus */
-                memset(buf + 45, 0, 2048 - 45);
-                buf[1026] = 1;
-                buf[1027] = MPID_PRIVATE2;
-                buf[1028] = 0x03;
-                buf[1029] = 0xfa;
-                buf[1030] = 0x81; /* rest of DSI will be correctly filled in later by FixVobus */
-              }
-            else if (got_deferred_buf)
-                got_deferred_buf = false; /* already picked it up */
-            if (buf[0] == 0 && buf[1] == 0 && buf[2] == 1 && buf[3] == MPID_PACK)
-              {
-                const pts_t newscr = readscr(buf + 4);
-                if (hadfirstvobu && newscr == 0 && lastscr > 0)
-                  /* suggestion from Philippe Sarazin -- alternatively, Shaun Jackman suggests
-                    simply treating newscr < lastscr as a warning and continuing */
-                  {
-                    backoffs -= lastscr; /* adjust to remove SCR discontinuity */
-                    fprintf(stderr, "\nWARN: SCR reset at inoffset %#"PRIx64". New back offset = %" PRId64"\n", inoffset, backoffs);
-                  }
-                else if (newscr < lastscr)
-                  {
-                    fprintf
-                      (
-                        stderr,
-                        "ERR:  SCR moves backwards at inoffset %#"PRIx64","
-                            " remultiplex input: %" PRId64" < %" PRId64"\n",
-                        inoffset,
-                        newscr,
-                        lastscr
-                      );
-                    exit(1);
-                  } /*if*/
-                lastscr = newscr;
-                if (!hadfirstvobu)
-                    backoffs = newscr; /* start SCR from 0 */
-              } /*if*/
-            transpose_ts(buf, -backoffs);
-            if (fsect == -1)
-              {
-              /* start a new VOB file */
-                fsect = 0;
-                if (fbase)
-                  {
-                    char * newname;
-                    if (outnum >= 0)
-                      {
-                        newname = sprintf_alloc("%s_%d.VOB", fbase, outnum);
-                      }
-                    else
-                      {
-                        newname = strdup(fbase);
-                      } /*if*/
-                    writeopen(newname);
-                    free(newname);
-                  } /*if*/
-              } /*if*/
-            if
-              (
-                    buf[14] == 0
-                &&
-                    buf[15] == 0
-                &&
-                    buf[16] == 1
-                &&
-                    buf[17] == MPID_SYSTEM
-              )
-              {
-                if
-                  (
-                        buf[38] == 0
-                    &&
-                        buf[39] == 0
-                    &&
-                        buf[40] == 1
-                    &&
-                        buf[41] == MPID_PRIVATE2 // 1st private2
-                    &&
-                        buf[1024] == 0
-                    &&
-                        buf[1025] == 0
-                    &&
-                        buf[1026] == 1
-                    &&
-                        buf[1027] == MPID_PRIVATE2 // 2nd private2
-                  ) /* looks like a NAV PACK, which means the start of a new VOBU */
-                  {
-                    struct vobuinfo *vi;
-                    if (thisvob->numvobus)
-                        finishvideoscan(va, vnum, prevvidsect, &vsi);
-                    // fprintf(stderr, "INFO: vobu at inoffset %#"PRIx64"\n", inoffset);
-                    hadfirstvobu = true; /* NAV PACK starts a VOBU */
-                    if (thisvob->numvobus == thisvob->maxvobus) /* need more space */
-                      {
-                        if (!thisvob->maxvobus)
-                            thisvob->maxvobus = 1; /* first allocation */
-                        else
-                            thisvob->maxvobus <<= 1;
-                              /* resize in powers of 2 to reduce reallocation calls */
-                        thisvob->vobu = (struct vobuinfo *)realloc
-                          (
-                            /*ptr =*/ thisvob->vobu,
-                            /*size =*/ thisvob->maxvobus * sizeof(struct vobuinfo)
-                          );
-                      } /*if*/
-                    vi = &thisvob->vobu[thisvob->numvobus]; /* for the new VOBU */
-                    memset(vi, 0, sizeof(struct vobuinfo));
-                    vi->sector = cursect;
-                    vi->fsect = fsect;
-                    vi->fnum = outnum;
-                    vi->firstvideopts = -1;
-                    vi->firstIfield = 0;
-                    vi->numfields = 0;
-                    vi->numref = 0;
-                    vi->hasseqend = 0;
-                    vi->hasvideo = 0;
-                    memcpy(thisvob->vobu[thisvob->numvobus].sectdata, buf, 0x26); // save pack and system header; the rest will be reconstructed later
-                    thisvob->numvobus++;
-                    if (!(thisvob->numvobus & 15)) /* time to let user know progress */
-                        printvobustatus(va, cursect, false);
-                    vsi.lastrefsect = 0;
-                    vsi.firstgop = 1; /* restart scan for first GOP */
-                  } /*if*/
-              } /*if*/
+            writeundo(wr); /* drop private data from output */
+            continue;
+          } /*if*/
+        // we should get a VOBU before a video with GOP
+        if
+          (
+                (fill_in_vobus || !hadfirstvobu)
+            &&
+                !got_deferred_buf
+            &&
+                has_gop(buf)
+          )
+          {
+            // create VOBU, from Martin Crossley
             if (!hadfirstvobu)
-              {
+              { /* let user know the first time this happens */
                 fprintf
                   (
                     stderr,
-                    "WARN: Skipping sector at inoffset %#"PRIx64", waiting for first VOBU...\n",
+                    "INFO: found video GOP at inoffset %#"PRIx64" without a preceding VOBU"
+                        " - creating VOBU\n",
                     inoffset
                   );
-                writeundo(); /* ignore it */
-                continue;
               } /*if*/
-            thisvob->vobu[thisvob->numvobus - 1].lastsector = cursect;
-
-            i = 14;
-            j = -1;
-            while (i <= 2044)
+            fill_in_vobus = true; /* keep doing it from now on */
+            memcpy(deferred_buf, buf, 2048); /* save just-read sector for processing on next iteration */
+            got_deferred_buf = true; /* remember I've saved it */
+          /* buf already has a system header */
+            buf[41] = MPID_PRIVATE2;
+            buf[42] = 0x03;
+            buf[43] = 0xd4;
+            buf[44] = 0x81; /* rest of PCI will be correctly filled in later by FixVobus */
+            memset(buf + 45, 0, 2048 - 45);
+            buf[1026] = 1;
+            buf[1027] = MPID_PRIVATE2;
+            buf[1028] = 0x03;
+            buf[1029] = 0xfa;
+            buf[1030] = 0x81; /* rest of DSI will be correctly filled in later by FixVobus */
+          }
+        else if (got_deferred_buf)
+            got_deferred_buf = false; /* already picked it up */
+        if (buf[0] == 0 && buf[1] == 0 && buf[2] == 1 && buf[3] == MPID_PACK)
+          {
+            const pts_t newscr = readscr(buf + 4);
+            if (hadfirstvobu && newscr == 0 && lastscr > 0)
+              /* suggestion from Philippe Sarazin -- alternatively, Shaun Jackman suggests
+                simply treating newscr < lastscr as a warning and continuing */
               {
-                if (buf[i] == 0 && buf[i + 1] == 0 && buf[i + 2] == 1)
-                  {
-                    if (buf[i + 3] >= MPID_PRIVATE1 && buf[i + 3] <= MPID_VIDEO_LAST)
-                      /* private, padding, audio or video stream */
-                      {
-                        j = i;
-                        i += 6 + read2(buf + i + 4); /* start of next packet */
-                        continue;
-                      }
-                    else if
-                      (
-                            buf[i + 3] == MPID_PROGRAM_END
-                        &&
-                            j >= 14
-                        &&
-                            buf[j + 3] == MPID_PAD /* previous was padding stream */
-                      )
-                      {
-                        write2(buf + j + 4, read2(buf + j + 4) + 4);
-                          /* merge program-end packet into prior pad packet */
-                        memset(buf + i, 0, 4); // mplex uses 0 for padding, so will I
-                      } /*if*/
-                  } /*if*/
-                break;
-              } /*while*/
-
-            sysoffs =
-                buf[14] == 0 && buf[15] == 0 && buf[16] == 1 && buf[17] == MPID_SYSTEM ?
-                  /* skip system header if present */
-                    (buf[18] << 8 | buf[19]) + 6
-                :
-                    0;
-            if
-              (
-                    buf[0] == 0
-                &&
-                    buf[1] == 0
-                &&
-                    buf[2] == 1
-                &&
-                    buf[3] == MPID_PACK
-                &&
-                    buf[14 + sysoffs] == 0
-                &&
-                    buf[15 + sysoffs] == 0
-                &&
-                    buf[16 + sysoffs] == 1
-                &&
-                    buf[17 + sysoffs] == MPID_VIDEO_FIRST /* only video stream */
-              )
+                backoffs -= lastscr; /* adjust to remove SCR discontinuity */
+                fprintf(stderr, "\nWARN: SCR reset at inoffset %#"PRIx64". New back offset = %" PRId64"\n", inoffset, backoffs);
+              }
+            else if (newscr < lastscr)
               {
-                struct vobuinfo * const vi = &thisvob->vobu[thisvob->numvobus - 1];
-                vi->hasvideo = 1;
-                scanvideoframe(va, buf + sysoffs, vi, cursect, prevvidsect, &vsi);
-                if
+                fprintf
                   (
-                        (buf[21 + sysoffs] & 128) /* PTS present */
-                    &&
-                        vi->firstvideopts == -1 /* not seen one yet */
-                  )
+                    stderr,
+                    "ERR:  SCR moves backwards at inoffset %#"PRIx64","
+                        " remultiplex input: %" PRId64" < %" PRId64"\n",
+                    inoffset,
+                    newscr,
+                    lastscr
+                  );
+                exit(1);
+              } /*if*/
+            lastscr = newscr;
+            if (!hadfirstvobu)
+                backoffs = newscr; /* start SCR from 0 */
+          } /*if*/
+        transpose_ts(buf, -backoffs);
+        if (fsect == -1)
+          {
+          /* start a new VOB file */
+            fsect = 0;
+            if (fbase)
+              {
+                char * newname;
+                if (outnum >= 0)
+                  {
+                    newname = sprintf_alloc("%s_%d.VOB", fbase, outnum);
+                  }
+                else
                   {
-                    vi->firstvideopts = readpts(buf + 23 + sysoffs);
+                    newname = strdup(fbase);
                   } /*if*/
-                prevvidsect = cursect;
+                writeopen(wr, newname, 0);
+                free(newname);
               } /*if*/
+          } /*if*/
+        if
+          (
+                buf[14] == 0
+            &&
+                buf[15] == 0
+            &&
+                buf[16] == 1
+            &&
+                buf[17] == MPID_SYSTEM
+          )
+          {
             if
               (
-                    buf[0] == 0
+                    buf[38] == 0
                 &&
-                    buf[1] == 0
+                    buf[39] == 0
                 &&
-                    buf[2] == 1
+                    buf[40] == 1
                 &&
-                    buf[3] == MPID_PACK
+                    buf[41] == MPID_PRIVATE2 // 1st private2
                 &&
-                    buf[14 + sysoffs] == 0
+                    buf[1024] == 0
                 &&
-                    buf[15 + sysoffs] == 0
+                    buf[1025] == 0
                 &&
-                    buf[16 + sysoffs] == 1
+                    buf[1026] == 1
                 &&
-                    (
-                        (buf[17 + sysoffs] & 0xf8) == 0xc0 /* MPEG audio stream */
-                    ||
-                        buf[17 + sysoffs] == MPID_PRIVATE1 /* DVD audio or subpicture */
-                    )
-              )
+                    buf[1027] == MPID_PRIVATE2 // 2nd private2
+              ) /* looks like a NAV PACK, which means the start of a new VOBU */
               {
-                pts_t pts0 = 0, pts1 = 0, backpts1 = 0;
-                const int dptr = buf[22 + sysoffs] /* PES header data length */ + 23 + sysoffs; /* offset to packet data */
-                const int endop = read2(buf + 18 + sysoffs) /* PES packet length */ + 20 /* fixed PES header length */ + sysoffs; /* end of packet */
-                int audch;
-                const int haspts = (buf[21 + sysoffs] & 128) != 0;
-                if (buf[17 + sysoffs] == MPID_PRIVATE1) /* DVD audio or subpicture */
-                  {
-                    const int sid = buf[dptr]; /* sub-stream ID */
-                    const int offs = read2(buf + dptr + 2);
-                      /* offset to audio sample frame which corresponds to PTS value */
-                    const int nrframes = buf[dptr + 1];
-                      /* nr audio sample frames beginning in this packet */
-                    switch (sid & 0xf8)
-                      {
-                    case 0x20:                          // subpicture
-                    case 0x28:                          // subpicture
-                    case 0x30:                          // subpicture
-                    case 0x38:                          // subpicture
-                         audch = sid;
-                    break;
-                    case 0x80:                          // ac3 audio
-                        pts1 += 2880 * nrframes;
-                        audch = sid & 7;
-                        audio_scan_ac3(&thisvob->audch[audch], buf + dptr + 4, offs - 1, endop - (dptr + 4));
-                    break;
-                    case 0x88:                          // dts audio
-                      /* pts1 += 960 * nrframes; */ /* why not? */
-                        audch = 24 | (sid & 7);
-                        audio_scan_dts(&thisvob->audch[audch], buf + dptr + 4, offs - 1, endop - (dptr + 4));
-                    break;
-                    case 0xa0:                          // pcm audio
-                        pts1 += 150 * nrframes;
-                        audch = 16 | (sid & 7);
-                        audio_scan_pcm(&thisvob->audch[audch], buf + dptr + 4, endop - (dptr + 4));
-                    break;
-                    default:         // unknown
-                        audch = -1;
-                    break;
-                      } /*switch*/
-                  }
-                else /* regular MPEG audio */
-                  {
-                    const int len = endop - dptr; /* length of packet data */
-                    const int index = buf[17 + sysoffs] & 7; /* audio stream ID */
-                    audch = 8 | index;                      // mp2
-                    memcpy(mp2hdr[index].buf + 3, buf + dptr, 3);
-                    while (mp2hdr[index].hdrptr + 4 <= len)
-                      {
-                        const unsigned char * h;
-                        if (mp2hdr[index].hdrptr < 0)
-                            h = mp2hdr[index].buf + 3 + mp2hdr[index].hdrptr;
-                              /* overlap from previous */
-                        else
-                            h = buf + dptr + mp2hdr[index].hdrptr;
-                        if (!mpa_valid(h))
-                          {
-                            mp2hdr[index].hdrptr++; /* try the next likely offset */
-                            continue;
-                          } /*if*/
-                        if (mp2hdr[index].hdrptr < 0)
-                            backpts1 += 2160; /* how much time to add to end of previous packet */
-                        else
-                            pts1 += 2160;
-                        mp2hdr[index].hdrptr += mpa_len(h); /* to next header */
-                      } /*while*/
-                    mp2hdr[index].hdrptr -= len; /* will be -ve if extends into next sector */
-                    memcpy(mp2hdr[index].buf, buf + dptr + len - 3, 3);
-                    audiodesc_set_audio_attr(&thisvob->audch[audch].ad, &thisvob->audch[audch]. adwarn, AUDIO_SAMPLERATE, "48khz");
-                  } /*if*/
-              /* at this point, pts1 is the duration of the audio in the packet (0 for subpicture) */
-                if (haspts)
-                  {
-                    pts0 = readpts(buf + 23 + sysoffs);
-                    pts1 += pts0;
-                  }
-                else if (pts1 > 0)
+                struct vobuinfo *vi;
+                if (thisvob->numvobus)
+                    finishvideoscan(va, thisvob, prevvidsect, &vsi);
+                // fprintf(stderr, "INFO: vobu at inoffset %#"PRIx64"\n", inoffset);
+                hadfirstvobu = true; /* NAV PACK starts a VOBU */
+                if (thisvob->numvobus == thisvob->maxvobus) /* need more space */
                   {
-                    fprintf
+                    if (!thisvob->maxvobus)
+                        thisvob->maxvobus = 1; /* first allocation */
+                    else
+                        thisvob->maxvobus <<= 1;
+                          /* resize in powers of 2 to reduce reallocation calls */
+                    thisvob->vobu = (struct vobuinfo *)growtable
                       (
-                        stderr,
-                        "WARN: Audio channel %d contains sync headers at inoffset %#"PRIx64" but has no PTS.\n",
-                        audch,
-                        inoffset
+                        /*table =*/ thisvob->vobu,
+                        /*oldsize =*/ thisvob->numvobus * sizeof(struct vobuinfo),
+                        /*newsize =*/ thisvob->maxvobus * sizeof(struct vobuinfo)
+                      );
+                    thisvob->vobuhdr = growtable
+                      (
+                        /*table =*/ thisvob->vobuhdr,
+                        /*oldsize =*/ thisvob->numvobus * sizeof *thisvob->vobuhdr,
+                        /*newsize =*/ thisvob->maxvobus * sizeof *thisvob->vobuhdr
                       );
                   } /*if*/
-                // fprintf(stderr,"aud ch=%d pts %d - %d (%d)\n",audch,pts0,pts1,pts1-pts0);
-                // fprintf(stderr,"pts[%d] %d (%02x %02x %02x %02x %02x)\n",va->numaudpts,pts,buf[23],buf[24],buf[25],buf[26],buf[27]);
-                if (audch < 0 || audch >= 64)
+                vi = &thisvob->vobu[thisvob->numvobus]; /* for the new VOBU */
+                memset(vi, 0, sizeof(struct vobuinfo));
+                vi->sector = cursect;
+                vi->fsect = fsect;
+                vi->fnum = outnum;
+                vi->firstvideopts = -1;
+                vi->firstIfield = 0;
+                vi->numfields = 0;
+                vi->numref = 0;
+                vi->hasseqend = 0;
+                vi->hasvideo = 0;
+                memcpy(thisvob->vobuhdr[thisvob->numvobus], buf, 0x26); // save pack and system header; the rest will be reconstructed later
+                thisvob->numvobus++;
+                if (!(thisvob->numvobus & 15) && !sc->worker) /* time to let user know progress */
+                    printvobustatus(va, vnum + 1, cursect, false);
+                vsi.lastrefsect = 0;
+                vsi.firstgop = 1; /* restart scan for first GOP */
+              } /*if*/
+          } /*if*/
+        if (!hadfirstvobu)
+          {
+            fprintf
+              (
+                stderr,
+                "WARN: Skipping sector at inoffset %#"PRIx64", waiting for first VOBU...\n",
+                inoffset
+              );
+            writeundo(wr); /* ignore it */
+            continue;
+          } /*if*/
+        thisvob->vobu[thisvob->numvobus - 1].lastsector = cursect;
+
+        i = 14;
+        j = -1;
+        while (i <= 2044)
+          {
+            if (buf[i] == 0 && buf[i + 1] == 0 && buf[i + 2] == 1)
+              {
+                if (buf[i + 3] >= MPID_PRIVATE1 && buf[i + 3] <= MPID_VIDEO_LAST)
+                  /* private, padding, audio or video stream */
                   {
-                    fprintf(stderr,"WARN: Invalid audio channel %d at inoffset %#"PRIx64"\n", audch, inoffset);
-                  /* and ignore */
+                    j = i;
+                    i += 6 + read2(buf + i + 4); /* start of next packet */
+                    continue;
                   }
-                else if (haspts)
+                else if
+                  (
+                        buf[i + 3] == MPID_PROGRAM_END
+                    &&
+                        j >= 14
+                    &&
+                        buf[j + 3] == MPID_PAD /* previous was padding stream */
+                  )
                   {
-                    struct audchannel * const ach = &thisvob->audch[audch];
-                    if (ach->numaudpts == ach->maxaudpts) { /* need more space */
-                        if (ach->maxaudpts)
-                            ach->maxaudpts <<= 1;
-                              /* resize in powers of 2 to reduce reallocation calls */
-                        else
-                            ach->maxaudpts = 1; /* first allocation */
-                        ach->audpts = (struct audpts *)realloc
-                          (
-                            /*ptr =*/ ach->audpts,
-                            /*size =*/ ach->maxaudpts * sizeof(struct audpts)
-                          );
-                    } /*if*/
-                    if (ach->numaudpts)
-                      {
-                        // we cannot compute the length of a DTS audio packet
-                        // so just backfill if it is one
-                        // otherwise, for mp2 add any pts to the previous
-                        // sector for a header that spanned two sectors
-                        if ((audch & 0x38) == 0x18) // is this DTS?
-                            ach->audpts[ach->numaudpts - 1].pts[1] = pts0;
-                        else
-                            ach->audpts[ach->numaudpts - 1].pts[1] += backpts1;
-
-                        if (ach->audpts[ach->numaudpts - 1].pts[1] < pts0)
-                          {
-                            if (audch >= 32)
-                                goto noshow; /* not audio */
-                            fprintf
-                              (
-                                stderr,
-                                "WARN: Discontinuity of %" PRId64" in audio channel %d"
-                                    " at inoffset %#"PRIx64"; please remultiplex input.\n",
-                                pts0 - ach->audpts[ach->numaudpts - 1].pts[1],
-                                audch,
-                                inoffset
-                              );
-                            // fprintf(stderr,"last=%d, this=%d\n",ach->audpts[ach->numaudpts-1].pts[1],pts0);
-                          }
-                        else if (ach->audpts[ach->numaudpts - 1].pts[1] > pts0)
-                            fprintf
-                              (
-                                stderr,
-                                "WARN: %s pts for channel %d moves backwards by %"
-                                    PRId64 " at inoffset %#"PRIx64"; please remultiplex input.\n",
-                                audch >= 32 ? "Subpicture" : "Audio",
-                                audch,
-                                ach->audpts[ach->numaudpts - 1].pts[1] - pts0,
-                                inoffset
-                              );
-                        else
-                            goto noshow;
-                        fprintf(stderr, "WARN: Previous sector: ");
-                        printpts(ach->audpts[ach->numaudpts - 1].pts[0]);
-                        fprintf(stderr, " - ");
-                        printpts(ach->audpts[ach->numaudpts - 1].pts[1]);
-                        fprintf(stderr, "\nWARN: Current sector: ");
-                        printpts(pts0);
-                        fprintf(stderr, " - ");
-                        printpts(pts1);
-                        fprintf(stderr, "\n");
-                        ach->audpts[ach->numaudpts - 1].pts[1] = pts0;
-                      } /*if*/
-noshow:
-                  /* fill in new entry */
-                    ach->audpts[ach->numaudpts].pts[0] = pts0;
-                    ach->audpts[ach->numaudpts].pts[1] = pts1;
-                    ach->audpts[ach->numaudpts].asect = cursect;
-                    ach->numaudpts++;
+                    write2(buf + j + 4, read2(buf + j + 4) + 4);
+                      /* merge program-end packet into prior pad packet */
+                    memset(buf + i, 0, 4); // mplex uses 0 for padding, so will I
                   } /*if*/
               } /*if*/
-            // the following code scans subtitle code in order to
-            // remap the colors and update the end pts
+            break;
+          } /*while*/
+
+        sysoffs =
+            buf[14] == 0 && buf[15] == 0 && buf[16] == 1 && buf[17] == MPID_SYSTEM ?
+              /* skip system header if present */
+                (buf[18] << 8 | buf[19]) + 6
+            :
+                0;
+        if
+          (
+                buf[0] == 0
+            &&
+                buf[1] == 0
+            &&
+                buf[2] == 1
+            &&
+                buf[3] == MPID_PACK
+            &&
+                buf[14 + sysoffs] == 0
+            &&
+                buf[15 + sysoffs] == 0
+            &&
+                buf[16 + sysoffs] == 1
+            &&
+                buf[17 + sysoffs] == MPID_VIDEO_FIRST /* only video stream */
+          )
+          {
+            struct vobuinfo * const vi = &thisvob->vobu[thisvob->numvobus - 1];
+            vi->hasvideo = 1;
+            scanvideoframe(va, buf + sysoffs, vi, cursect, prevvidsect, &vsi);
             if
               (
-                    buf[0] == 0
-                &&
-                    buf[1] == 0
-                &&
-                    buf[2] == 1
-                &&
-                    buf[3] == MPID_PACK
+                    (buf[21 + sysoffs] & 128) /* PTS present */
                 &&
-                    buf[14 + sysoffs] == 0
-                &&
-                    buf[15 + sysoffs] == 0
-                &&
-                    buf[16 + sysoffs] == 1
-                &&
-                    buf[17 + sysoffs] == MPID_PRIVATE1
+                    vi->firstvideopts == -1 /* not seen one yet */
               )
               {
-                int dptr = buf[22 + sysoffs] /* PES header data length */ + 23 + sysoffs; /* offset to packet data */
-                const int ml = read2(buf + 18) /* PES packet length */ + 20 /* fixed PES header length */ + sysoffs; /* end of packet */
-                const int st = buf[dptr]; /* sub-stream ID */
-                dptr++; /* skip sub-stream ID */
-                if ((st & 0xe0) == 0x20)
-                  { /* subpicture stream */
-                    procremap
-                      (
-                        /*cr =*/ &crs[st & 31],
-                        /*b =*/ buf + dptr,
-                        /*blen =*/ ml - dptr,
-                        /*timespan =*/
-                            &thisvob->audch[st].audpts[thisvob->audch[st].numaudpts - 1].pts[1]
-                      );
-                  } /*if*/
+                vi->firstvideopts = readpts(buf + 23 + sysoffs);
               } /*if*/
-            cursect++;
-            fsect++;
-            inoffset += 2048;
-          } /*while*/
-        varied_close(vf);
-        if (thisvob->numvobus)
+            prevvidsect = cursect;
+          } /*if*/
+        if
+          (
+                buf[0] == 0
+            &&
+                buf[1] == 0
+            &&
+                buf[2] == 1
+            &&
+                buf[3] == MPID_PACK
+            &&
+                buf[14 + sysoffs] == 0
+            &&
+                buf[15 + sysoffs] == 0
+            &&
+                buf[16 + sysoffs] == 1
+            &&
+                (
+                    (buf[17 + sysoffs] & 0xf8) == 0xc0 /* MPEG audio stream */
+                ||
+                    buf[17 + sysoffs] == MPID_PRIVATE1 /* DVD audio or subpicture */
+                )
+          )
           {
-            int i;
-            pts_t finalaudiopts;
-            finishvideoscan(va, vnum, prevvidsect, &vsi);
-            // find end of audio
-            finalaudiopts = -1;
-            for (i = 0; i < 32; i++)
+            pts_t pts0 = 0, pts1 = 0, backpts1 = 0;
+            const int dptr = buf[22 + sysoffs] /* PES header data length */ + 23 + sysoffs; /* offset to packet data */
+            const int endop = read2(buf + 18 + sysoffs) /* PES packet length */ + 20 /* fixed PES header length */ + sysoffs; /* end of packet */
+            int audch;
+            const int haspts = (buf[21 + sysoffs] & 128) != 0;
+            if (buf[17 + sysoffs] == MPID_PRIVATE1) /* DVD audio or subpicture */
               {
-                struct audchannel * const ach = thisvob->audch + i;
-                if
-                  (
-                        ach->numaudpts
-                    &&
-                        ach->audpts[ach->numaudpts - 1].pts[1] > finalaudiopts
-                  )
-                    finalaudiopts = ach->audpts[ach->numaudpts - 1].pts[1];
-              } /*for*/
-            // pin down all video vobus
-            // note: we make two passes; one assumes that the PTS for the
-            // first frame is exact; the other assumes that the PTS for
-            // the first frame is off by 1/2.  If both fail, then the third pass
-            // assumes things are exact and throws a warning
-            for (i = 0; i < 3; i++)
+                const int sid = buf[dptr]; /* sub-stream ID */
+                const int offs = read2(buf + dptr + 2);
+                  /* offset to audio sample frame which corresponds to PTS value */
+                const int nrframes = buf[dptr + 1];
+                  /* nr audio sample frames beginning in this packet */
+                switch (sid & 0xf8)
+                  {
+                case 0x20:                          // subpicture
+                case 0x28:                          // subpicture
+                case 0x30:                          // subpicture
+                case 0x38:                          // subpicture
+                     audch = sid;
+                break;
+                case 0x80:                          // ac3 audio
+                    pts1 += 2880 * nrframes;
+                    audch = sid & 7;
+                    audio_scan_ac3(&thisvob->audch[audch], buf + dptr + 4, offs - 1, endop - (dptr + 4));
+                break;
+                case 0x88:                          // dts audio
+                  /* pts1 += 960 * nrframes; */ /* why not? */
+                    audch = 24 | (sid & 7);
+                    audio_scan_dts(&thisvob->audch[audch], buf + dptr + 4, offs - 1, endop - (dptr + 4));
+                break;
+                case 0xa0:                          // pcm audio
+                    pts1 += 150 * nrframes;
+                    audch = 16 | (sid & 7);
+                    audio_scan_pcm(&thisvob->audch[audch], buf + dptr + 4, endop - (dptr + 4));
+                break;
+                default:         // unknown
+                    audch = -1;
+                break;
+                  } /*switch*/
+              }
+            else /* regular MPEG audio */
               {
-                pts_t pts_align = -1; /* initially undefined */
-                int complained = 0, j;
-                for (j = 0; j < thisvob->numvobus; j++)
+                const int len = endop - dptr; /* length of packet data */
+                const int index = buf[17 + sysoffs] & 7; /* audio stream ID */
+                audch = 8 | index;                      // mp2
+                memcpy(mp2hdr[index].buf + 3, buf + dptr, 3);
+                while (mp2hdr[index].hdrptr + 4 <= len)
                   {
-                    struct vobuinfo * const vi = thisvob->vobu + j;
-                    if (vi->hasvideo)
+                    const unsigned char * h;
+                    if (mp2hdr[index].hdrptr < 0)
+                        h = mp2hdr[index].buf + 3 + mp2hdr[index].hdrptr;
+                          /* overlap from previous */
+                    else
+                        h = buf + dptr + mp2hdr[index].hdrptr;
+                    if (!mpa_valid(h))
                       {
-                        if (pts_align == -1)
-                          {
-                            pts_align = vi->firstvideopts * 2;
-                            if (i == 1)
-                              {
-                                // I assume pts should round down?  That seems to be how mplex deals with it
-                                // also see earlier comment
-
-                                // since pts round down, then the alternative base we should try is
-                                // firstvideopts+0.5, thus increment
-                                pts_align++;
-                              } /*if*/
-                            // MarkChapters will complain if firstIfield!=0
-                          } /*if*/
-
-                        vi->videopts[0] = calcpts(va, i == 2, &complained, &pts_align, vi->firstvideopts, -vi->firstIfield);
-                        vi->videopts[1] = calcpts(va, i == 2, &complained, &pts_align, vi->firstvideopts, -vi->firstIfield + vi->numfields);
-                        // if this looks like a dud, abort and try the next pass
-                        if (complained && i < 2)
-                            break;
-                        vi->sectpts[0] = vi->videopts[0];
-                        if (j + 1 == thisvob->numvobus && finalaudiopts > vi->videopts[1])
-                            vi->sectpts[1] = finalaudiopts;
-                        else
-                            vi->sectpts[1] = vi->videopts[1];
+                        mp2hdr[index].hdrptr++; /* try the next likely offset */
+                        continue;
                       } /*if*/
-                  } /*for*/
-                if (!complained)
-                    break;
-              } /*for*/
-            // guess at non-video vobus
-            for (i = 0; i < thisvob->numvobus; i++)
+                    if (mp2hdr[index].hdrptr < 0)
+                        backpts1 += 2160; /* how much time to add to end of previous packet */
+                    else
+                        pts1 += 2160;
+                    mp2hdr[index].hdrptr += mpa_len(h); /* to next header */
+                  } /*while*/
+                mp2hdr[index].hdrptr -= len; /* will be -ve if extends into next sector */
+                memcpy(mp2hdr[index].buf, buf + dptr + len - 3, 3);
+                audiodesc_set_audio_attr(&thisvob->audch[audch].ad, &thisvob->audch[audch]. adwarn, AUDIO_SAMPLERATE, "48khz");
+              } /*if*/
+          /* at this point, pts1 is the duration of the audio in the packet (0 for subpicture) */
+            if (haspts)
               {
-                struct vobuinfo * const vi = thisvob->vobu + i;
-                if (!vi->hasvideo)
-                  {
-                    int j, k;
-                    pts_t firstaudiopts = -1, p;
-
-                    for (j = 0; j < 32; j++)
-                      {
-                        const struct audchannel * const ach = thisvob->audch + j;
-                        for (k = 0; k < ach->numaudpts; k++)
-                            if (ach->audpts[k].asect >= vi->sector)
-                              {
-                                if (firstaudiopts == -1 || ach->audpts[k].pts[0] < firstaudiopts)
-                                    firstaudiopts = ach->audpts[k].pts[0];
-                                break;
-                              } /*if; for*/
-                      } /*for*/
-                    if (firstaudiopts == -1)
-                      {
-                        fprintf
-                          (
-                            stderr,
-                            "WARN: Cannot detect pts for VOBU at inoffset %#"PRIx64" if there is"
-                                " no audio or video\nWARN: Using SCR instead.\n",
-                            inoffset
-                          );
-                        firstaudiopts = readscr(vi->sectdata + 4) + 4 * 147;
-                          // 147 is roughly the minimum pts that must transpire between packets;
-                          // we give a couple packets of buffer to allow the dvd player to
-                          // process the data
-                      } /*if*/
-                    if (i)
-                      {
-                        pts_t frpts = getframepts(va);
-                        p = firstaudiopts - thisvob->vobu[i - 1].sectpts[0];
-                        // ensure this is a multiple of a framerate, just to be nice
-                        p += frpts - 1;
-                        p -= p % frpts;
-                        p += thisvob->vobu[i - 1].sectpts[0];
-                        if (p < thisvob->vobu[i - 1].sectpts[1])
-                          {
-                            fprintf
-                              (
-                                stderr,
-                                "ERR:  pts %"PRId64" rounded up to %"PRId64" at rate"
-                                    " %"PRId64" lies within previous vobu %d"
-                                    " [%"PRId64"..%"PRId64"] at inoffset %#"PRIx64"\n",
-                                firstaudiopts,
-                                p,
-                                frpts,
-                                i - 1,
-                                thisvob->vobu[i - 1].sectpts[0],
-                                thisvob->vobu[i - 1].sectpts[1],
-                                inoffset
-                              );
-                            exit(1);
-                          } /*if*/
-                        thisvob->vobu[i - 1].sectpts[1] = p;
-                      }
+                pts0 = readpts(buf + 23 + sysoffs);
+                pts1 += pts0;
+              }
+            else if (pts1 > 0)
+              {
+                fprintf
+                  (
+                    stderr,
+                    "WARN: Audio channel %d contains sync headers at inoffset %#"PRIx64" but has no PTS.\n",
+                    audch,
+                    inoffset
+                  );
+              } /*if*/
+            // fprintf(stderr,"aud ch=%d pts %d - %d (%d)\n",audch,pts0,pts1,pts1-pts0);
+            // fprintf(stderr,"pts[%d] %d (%02x %02x %02x %02x %02x)\n",va->numaudpts,pts,buf[23],buf[24],buf[25],buf[26],buf[27]);
+            if (audch < 0 || audch >= 64)
+              {
+                fprintf(stderr,"WARN: Invalid audio channel %d at inoffset %#"PRIx64"\n", audch, inoffset);
+              /* and ignore */
+              }
+            else if (haspts)
+              {
+                struct audchannel * const ach = &thisvob->audch[audch];
+                if (ach->numaudpts == ach->maxaudpts) { /* need more space */
+                    if (ach->maxaudpts)
+                        ach->maxaudpts <<= 1;
+                          /* resize in powers of 2 to reduce reallocation calls */
                     else
+                        ach->maxaudpts = 1; /* first allocation */
+                    ach->audpts = (struct audpts *)growtable
+                      (
+                        /*table =*/ ach->audpts,
+                        /*oldsize =*/ ach->numaudpts * sizeof(struct audpts),
+                        /*newsize =*/ ach->maxaudpts * sizeof(struct audpts)
+                      );
+                } /*if*/
+                if (ach->numaudpts)
+                  {
+                    // we cannot compute the length of a DTS audio packet
+                    // so just backfill if it is one
+                    // otherwise, for mp2 add any pts to the previous
+                    // sector for a header that spanned two sectors
+                    if ((audch & 0x38) == 0x18) // is this DTS?
+                        ach->audpts[ach->numaudpts - 1].pts[1] = pts0;
+                    else
+                        ach->audpts[ach->numaudpts - 1].pts[1] += backpts1;
+
+                    if (ach->audpts[ach->numaudpts - 1].pts[1] < pts0)
                       {
+                        if (audch >= 32)
+                            goto noshow; /* not audio */
                         fprintf
                           (
                             stderr,
-                            "ERR:  Cannot infer pts for VOBU at inoffset %#"PRIx64" if there is"
-                                " no audio or video and it is the\nERR:  first VOBU.\n",
+                            "WARN: Discontinuity of %" PRId64" in audio channel %d"
+                                " at inoffset %#"PRIx64"; please remultiplex input.\n",
+                            pts0 - ach->audpts[ach->numaudpts - 1].pts[1],
+                            audch,
                             inoffset
                           );
-                        exit(1);
-                      } /*if*/
-                    vi->sectpts[0] = p;
-                    // if we can easily predict the end pts of this sector,
-                    // then fill it in.  otherwise, let the next iteration do it
-                    if (i + 1 == thisvob->numvobus)
-                      { // if this is the end of the vob, use the final audio pts as the last pts
-                        if( finalaudiopts>vi->sectpts[0] )
-                            p = finalaudiopts;
-                        else
-                            p = vi->sectpts[0] + getframepts(va);
-                              // add one frame of a buffer, so we don't have a zero (or less) length vobu
+                        // fprintf(stderr,"last=%d, this=%d\n",ach->audpts[ach->numaudpts-1].pts[1],pts0);
                       }
-                    else if (thisvob->vobu[i+1].hasvideo)
-                      // if the next vobu has video, use the start of the video as the end of this vobu
-                        p = thisvob->vobu[i + 1].sectpts[0];
-                    else
-                      // the next vobu is an audio only vobu, and will backfill the pts as necessary
-                        continue;
-                    if (p <= vi->sectpts[0])
-                      {
+                    else if (ach->audpts[ach->numaudpts - 1].pts[1] > pts0)
                         fprintf
                           (
                             stderr,
-                            "ERR:  Audio and video are too poorly synchronised at inoffset"
-                                " %#"PRIx64"; you must remultiplex.\n",
+                            "WARN: %s pts for channel %d moves backwards by %"
+                                PRId64 " at inoffset %#"PRIx64"; please remultiplex input.\n",
+                            audch >= 32 ? "Subpicture" : "Audio",
+                            audch,
+                            ach->audpts[ach->numaudpts - 1].pts[1] - pts0,
                             inoffset
                           );
-                        exit(1);
+                    else
+                        goto noshow;
+                    fprintf(stderr, "WARN: Previous sector: ");
+                    printpts(ach->audpts[ach->numaudpts - 1].pts[0]);
+                    fprintf(stderr, " - ");
+                    printpts(ach->audpts[ach->numaudpts - 1].pts[1]);
+                    fprintf(stderr, "\nWARN: Current sector: ");
+                    printpts(pts0);
+                    fprintf(stderr, " - ");
+                    printpts(pts1);
+                    fprintf(stderr, "\n");
+                    ach->audpts[ach->numaudpts - 1].pts[1] = pts0;
+                  } /*if*/
+noshow:
+              /* fill in new entry */
+                ach->audpts[ach->numaudpts].pts[0] = pts0;
+                ach->audpts[ach->numaudpts].pts[1] = pts1;
+                ach->audpts[ach->numaudpts].asect = cursect;
+                ach->numaudpts++;
+              } /*if*/
+          } /*if*/
+        // the following code scans subtitle code in order to
+        // remap the colors and update the end pts
+        if
+          (
+                buf[0] == 0
+            &&
+                buf[1] == 0
+            &&
+                buf[2] == 1
+            &&
+                buf[3] == MPID_PACK
+            &&
+                buf[14 + sysoffs] == 0
+            &&
+                buf[15 + sysoffs] == 0
+            &&
+                buf[16 + sysoffs] == 1
+            &&
+                buf[17 + sysoffs] == MPID_PRIVATE1
+          )
+          {
+            int dptr = buf[22 + sysoffs] /* PES header data length */ + 23 + sysoffs; /* offset to packet data */
+            const int ml = read2(buf + 18) /* PES packet length */ + 20 /* fixed PES header length */ + sysoffs; /* end of packet */
+            const int st = buf[dptr]; /* sub-stream ID */
+            dptr++; /* skip sub-stream ID */
+            if ((st & 0xe0) == 0x20)
+              { /* subpicture stream */
+                procremap
+                  (
+                    /*cr =*/ &crs[st & 31],
+                    /*b =*/ buf + dptr,
+                    /*blen =*/ ml - dptr,
+                    /*timespan =*/
+                        &thisvob->audch[st].audpts[thisvob->audch[st].numaudpts - 1].pts[1]
+                  );
+              } /*if*/
+          } /*if*/
+        if (sc->delta)
+            deltasector(sc->delta, buf);
+        cursect++;
+        fsect++;
+        inoffset += 2048;
+      } /*while*/
+    if (thisvob->numvobus)
+        finishvideoscan(va, thisvob, prevvidsect, &vsi);
+    sc->attrguess = vsi.attrguess;
+    complete = true;
+giveup:
+    writedetach(wr);
+    readerclose(&rd);
+    sc->cursect = cursect;
+    sc->fsect = fsect;
+    sc->outnum = outnum;
+    *endoffset = inoffset;
+    return
+        complete;
+  } /*scanvob*/
+
+static void pinvobupts(struct vobgroup *va, struct vob *thisvob, uint64_t inoffset)
+  /* works out the presentation time span of each VOBU in a newly-scanned VOB,
+    and reports the overall audio and video timestamps. */
+  {
+    int i;
+    pts_t finalaudiopts;
+    if (!thisvob->numvobus)
+        return;
+    // find end of audio
+    finalaudiopts = -1;
+    for (i = 0; i < 32; i++)
+      {
+        struct audchannel * const ach = thisvob->audch + i;
+        if
+          (
+                ach->numaudpts
+            &&
+                ach->audpts[ach->numaudpts - 1].pts[1] > finalaudiopts
+          )
+            finalaudiopts = ach->audpts[ach->numaudpts - 1].pts[1];
+      } /*for*/
+    // pin down all video vobus
+    // note: we make two passes; one assumes that the PTS for the
+    // first frame is exact; the other assumes that the PTS for
+    // the first frame is off by 1/2.  If both fail, then the third pass
+    // assumes things are exact and throws a warning
+    for (i = 0; i < 3; i++)
+      {
+        pts_t pts_align = -1; /* initially undefined */
+        int complained = 0, j;
+        for (j = 0; j < thisvob->numvobus; j++)
+          {
+            struct vobuinfo * const vi = thisvob->vobu + j;
+            if (vi->hasvideo)
+              {
+                if (pts_align == -1)
+                  {
+                    pts_align = vi->firstvideopts * 2;
+                    if (i == 1)
+                      {
+                        // I assume pts should round down?  That seems to be how mplex deals with it
+                        // also see earlier comment
+
+                        // since pts round down, then the alternative base we should try is
+                        // firstvideopts+0.5, thus increment
+                        pts_align++;
                       } /*if*/
-                    vi->sectpts[1] = p;
+                    // MarkChapters will complain if firstIfield!=0
                   } /*if*/
+
+                vi->videopts[0] = calcpts(va, i == 2, &complained, &pts_align, vi->firstvideopts, -vi->firstIfield);
+                vi->videopts[1] = calcpts(va, i == 2, &complained, &pts_align, vi->firstvideopts, -vi->firstIfield + vi->numfields);
+                // if this looks like a dud, abort and try the next pass
+                if (complained && i < 2)
+                    break;
+                vi->sectpts[0] = vi->videopts[0];
+                if (j + 1 == thisvob->numvobus && finalaudiopts > vi->videopts[1])
+                    vi->sectpts[1] = finalaudiopts;
+                else
+                    vi->sectpts[1] = vi->videopts[1];
+              } /*if*/
+          } /*for*/
+        if (!complained)
+            break;
+      } /*for*/
+    // guess at non-video vobus
+    for (i = 0; i < thisvob->numvobus; i++)
+      {
+        struct vobuinfo * const vi = thisvob->vobu + i;
+        if (!vi->hasvideo)
+          {
+            int j, k;
+            pts_t firstaudiopts = -1, p;
+
+            for (j = 0; j < 32; j++)
+              {
+                const struct audchannel * const ach = thisvob->audch + j;
+                for (k = 0; k < ach->numaudpts; k++)
+                    if (ach->audpts[k].asect >= vi->sector)
+                      {
+                        if (firstaudiopts == -1 || ach->audpts[k].pts[0] < firstaudiopts)
+                            firstaudiopts = ach->audpts[k].pts[0];
+                        break;
+                      } /*if; for*/
               } /*for*/
+            if (firstaudiopts == -1)
+              {
+                fprintf
+                  (
+                    stderr,
+                    "WARN: Cannot detect pts for VOBU at inoffset %#"PRIx64" if there is"
+                        " no audio or video\nWARN: Using SCR instead.\n",
+                    inoffset
+                  );
+                firstaudiopts = readscr(thisvob->vobuhdr[i] + 4) + 4 * 147;
+                  // 147 is roughly the minimum pts that must transpire between packets;
+                  // we give a couple packets of buffer to allow the dvd player to
+                  // process the data
+              } /*if*/
+            if (i)
+              {
+                pts_t frpts = getframepts(va);
+                p = firstaudiopts - thisvob->vobu[i - 1].sectpts[0];
+                // ensure this is a multiple of a framerate, just to be nice
+                p += frpts - 1;
+                p -= p % frpts;
+                p += thisvob->vobu[i - 1].sectpts[0];
+                if (p < thisvob->vobu[i - 1].sectpts[1])
+                  {
+                    fprintf
+                      (
+                        stderr,
+                        "ERR:  pts %"PRId64" rounded up to %"PRId64" at rate"
+                            " %"PRId64" lies within previous vobu %d"
+                            " [%"PRId64"..%"PRId64"] at inoffset %#"PRIx64"\n",
+                        firstaudiopts,
+                        p,
+                        frpts,
+                        i - 1,
+                        thisvob->vobu[i - 1].sectpts[0],
+                        thisvob->vobu[i - 1].sectpts[1],
+                        inoffset
+                      );
+                    exit(1);
+                  } /*if*/
+                thisvob->vobu[i - 1].sectpts[1] = p;
+              }
+            else
+              {
+                fprintf
+                  (
+                    stderr,
+                    "ERR:  Cannot infer pts for VOBU at inoffset %#"PRIx64" if there is"
+                        " no audio or video and it is the\nERR:  first VOBU.\n",
+                    inoffset
+                  );
+                exit(1);
+              } /*if*/
+            vi->sectpts[0] = p;
+            // if we can easily predict the end pts of this sector,
+            // then fill it in.  otherwise, let the next iteration do it
+            if (i + 1 == thisvob->numvobus)
+              { // if this is the end of the vob, use the final audio pts as the last pts
+                if( finalaudiopts>vi->sectpts[0] )
+                    p = finalaudiopts;
+                else
+                    p = vi->sectpts[0] + getframepts(va);
+                      // add one frame of a buffer, so we don't have a zero (or less) length vobu
+              }
+            else if (thisvob->vobu[i+1].hasvideo)
+              // if the next vobu has video, use the start of the video as the end of this vobu
+                p = thisvob->vobu[i + 1].sectpts[0];
+            else
+              // the next vobu is an audio only vobu, and will backfill the pts as necessary
+                continue;
+            if (p <= vi->sectpts[0])
+              {
+                fprintf
+                  (
+                    stderr,
+                    "ERR:  Audio and video are too poorly synchronised at inoffset"
+                        " %#"PRIx64"; you must remultiplex.\n",
+                    inoffset
+                  );
+                exit(1);
+              } /*if*/
+            vi->sectpts[1] = p;
+          } /*if*/
+      } /*for*/
+
+    fprintf(stderr, "\nINFO: Video pts = ");
+    printpts(thisvob->vobu[0].videopts[0]);
+    fprintf(stderr, " .. ");
+    for (i = thisvob->numvobus - 1; i >= 0; i--)
+        if (thisvob->vobu[i].hasvideo)
+          {
+            printpts(thisvob->vobu[i].videopts[1]);
+            break;
+          } /*if; for*/
+    if (i < 0)
+        fprintf(stderr, "??");
+    for (i = 0; i < 64; i++)
+      {
+        const struct audchannel * const ach = &thisvob->audch[i];
+        if (ach->numaudpts)
+          {
+            fprintf(stderr, "\nINFO: Audio[%d] pts = ", i);
+            printpts(ach->audpts[0].pts[0]);
+            fprintf(stderr, " .. ");
+            printpts(ach->audpts[ach->numaudpts - 1].pts[1]);
+          } /*if*/
+      } /*for*/
+    fprintf(stderr, "\n");
+  } /*pinvobupts*/
+
+struct scankey /* identifies the contents of an input file */
+  {
+    int64_t dev, ino; /* which file it is */
+    int64_t size, mtime, mtimensec;
+    uint64_t hash;
+  };
+
+struct scanreplay /* for regenerating output sectors from input sectors and a scandelta */
+  {
+    const unsigned char *data; /* from scandelta */
+    size_t len; /* length of data */
+    size_t pos; /* where next record starts */
+    const uint32_t *sums; /* from scandelta */
+    int numsums; /* length of sums */
+    int nextsect; /* index of next sector to read from input */
+    unsigned char last[2048]; /* contents of input sector nextsect - 1 */
+  };
+
+static bool replaysector(struct scanreplay *rp, struct vobreader *rd, unsigned char *buf)
+  /* regenerates the next output sector into buf. Returns false if the input
+    doesn't match the recorded changes, or has changed since they were recorded. */
+  {
+    int32_t insect;
+    uint16_t count, patch[2];
+    if (rp->pos + sizeof insect + sizeof count > rp->len)
+        return
+            false;
+    memcpy(&insect, rp->data + rp->pos, sizeof insect);
+    rp->pos += sizeof insect;
+    memcpy(&count, rp->data + rp->pos, sizeof count);
+    rp->pos += sizeof count;
+    if (insect < rp->nextsect - 1)
+        return
+            false;
+    while (rp->nextsect <= insect) /* skip dropped sectors */
+      {
+        if
+          (
+                rp->nextsect >= rp->numsums
+            ||
+                readsector(rd, rp->last) != 2048
+            ||
+                sectorsum(rp->last) != rp->sums[rp->nextsect]
+          )
+            return
+                false;
+        rp->nextsect++;
+      } /*while*/
+    memcpy(buf, rp->last, 2048);
+    while (count-- > 0)
+      {
+        if (rp->pos + sizeof patch > rp->len)
+            return
+                false;
+        memcpy(patch, rp->data + rp->pos, sizeof patch);
+        rp->pos += sizeof patch;
+        if (patch[0] + patch[1] > 2048 || rp->pos + patch[1] > rp->len)
+            return
+                false;
+        memcpy(buf + patch[0], rp->data + rp->pos, patch[1]);
+        rp->pos += patch[1];
+      } /*while*/
+    return
+        true;
+  } /*replaysector*/
+
+static bool scancacheable(const char *fname)
+  /* is the specified input name an ordinary file name, rather than a pipe or
+    file descriptor, so that scan results could be saved for it. */
+  {
+    const size_t len = strlen(fname);
+    return
+            strcmp(fname, "-") != 0
+        &&
+            !(fname[0] == '&' && isdigit(fname[1]))
+        &&
+            !(len != 0 && fname[len - 1] == '|');
+  } /*scancacheable*/
+
+static char *scancachename(const char *fname)
+  /* returns the name of the scan cache file for the specified input file, or
+    NULL if it isn't an ordinary file name. */
+  {
+    return
+        scancacheable(fname) ? sprintf_alloc("%s.dvdauthor-scan", fname) : 0;
+  } /*scancachename*/
+
+static bool getscankey(const char *fname, struct scankey *key)
+  /* identifies the current contents of the specified input file by its device and
+    inode numbers, size, modification time and a hash of samples from its start,
+    middle and end. */
+  {
+    struct stat info;
+    FILE *f;
+    unsigned char *buf;
+    int64_t starts[3];
+    int i;
+    bool ok = true;
+    if (stat(fname, &info) != 0 || !S_ISREG(info.st_mode))
+        return
+            false;
+    key->dev = info.st_dev;
+    key->ino = info.st_ino;
+    key->size = info.st_size;
+    key->mtime = info.st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    key->mtimensec = info.st_mtim.tv_nsec;
+#else
+    key->mtimensec = 0;
+#endif
+    key->hash = 14695981039346656037ULL; /* FNV-1a */
+    f = fopen(fname, "rb");
+    if (!f)
+        return
+            false;
+    buf = malloc(SCANCACHE_SAMPLE);
+    starts[0] = 0;
+    starts[1] = (key->size - SCANCACHE_SAMPLE) / 2;
+    starts[2] = key->size - SCANCACHE_SAMPLE;
+    for (i = 0; ok && i < 3; i++)
+      {
+        size_t len, j;
+        if (starts[i] < 0)
+            starts[i] = 0;
+        ok = fseeko(f, starts[i], SEEK_SET) == 0;
+        if (ok)
+          {
+            len = fread(buf, 1, SCANCACHE_SAMPLE, f);
+            ok = !ferror(f);
+            for (j = 0; j < len; j++)
+                key->hash = (key->hash ^ buf[j]) * 1099511628211ULL;
+          } /*if*/
+      } /*for*/
+    free(buf);
+    fclose(f);
+    return
+        ok;
+  } /*getscankey*/
+
+static void scancacheheader(unsigned char *header, const struct scankey *key)
+  /* fills in the header identifying a scan cache file as matching the specified
+    input file contents and this version and build of dvdauthor. */
+  {
+    const int32_t sizes[4] =
+        {
+            sizeof(struct vobuinfo),
+            sizeof(struct audpts),
+            sizeof(struct audiodesc),
+            sizeof(struct videodesc),
+        };
+    memcpy(header, SCANCACHE_MAGIC, sizeof SCANCACHE_MAGIC - 1);
+    header += sizeof SCANCACHE_MAGIC - 1;
+    memset(header, 0, SCANCACHE_VERSIONLEN);
+    strncpy((char *)header, PACKAGE_VERSION, SCANCACHE_VERSIONLEN - 1);
+    header += SCANCACHE_VERSIONLEN;
+    memcpy(header, sizes, sizeof sizes);
+    header += sizeof sizes;
+    memcpy(header, key, sizeof(struct scankey));
+  } /*scancacheheader*/
+
+#define SCANCACHE_HEADERLEN \
+    (sizeof SCANCACHE_MAGIC - 1 + SCANCACHE_VERSIONLEN + 4 * sizeof(int32_t) + sizeof(struct scankey))
+
+static void savescan
+  (
+    const struct vobscan *sc,
+    int vnum,
+    int base, /* output sector nr at which the VOB started */
+    uint64_t endoffset,
+    const struct videodesc *origvd, /* video attributes as they were before the scan */
+    const int *origcolors, /* colour table as it was before the scan */
+    bool usedcolors,
+    const struct scandelta *delta
+  )
+  /* saves the results of a complete scan of a VOB to its scan cache file, with
+    all sector numbers made relative to its start. */
+  {
+    const struct vob * const thisvob = sc->va->vobs[vnum];
+    char * const cachename = scancachename(thisvob->fname);
+    char *tmpname;
+    struct scankey key;
+    unsigned char header[SCANCACHE_HEADERLEN];
+    FILE *f;
+    int32_t ival;
+    int i, j;
+    if (!cachename)
+        return;
+    if (!getscankey(thisvob->fname, &key))
+      {
+        free(cachename);
+        return;
+      } /*if*/
+    tmpname = sprintf_alloc("%s.%d.tmp", cachename, (int)getpid());
+      /* unique in case the same file is used by titlesets being generated at once */
+    f = fopen(tmpname, "wb");
+    if (!f)
+      {
+        fprintf(stderr, "INFO: Cannot save scan cache %s: %s\n", cachename, strerror(errno));
+        free(tmpname);
+        free(cachename);
+        return;
+      } /*if*/
+    scancacheheader(header, &key);
+    fwrite(header, 1, sizeof header, f);
+    fwrite(origvd, sizeof(struct videodesc), 1, f);
+    fwrite(origcolors, sizeof(int), 16, f);
+    ival = usedcolors;
+    fwrite(&ival, sizeof ival, 1, f);
+    fwrite(&endoffset, sizeof endoffset, 1, f);
+    ival = sc->cursect - base; /* nr sectors of output */
+    fwrite(&ival, sizeof ival, 1, f);
+    fwrite(&sc->va->vd, sizeof(struct videodesc), 1, f);
+    fwrite(thisvob->progchain->colors->color, sizeof(int), 16, f);
+    ival = thisvob->numvobus;
+    fwrite(&ival, sizeof ival, 1, f);
+    for (i = 0; i < thisvob->numvobus; i++)
+      {
+        struct vobuinfo vi = thisvob->vobu[i];
+        vi.sector -= base;
+        vi.lastsector -= base;
+        for (j = 0; j < vi.numref; j++)
+            vi.lastrefsect[j] -= base;
+        vi.fsect = 0; /* assigned when output */
+        vi.fnum = 0;
+        fwrite(&vi, sizeof vi, 1, f);
+      } /*for*/
+    fwrite(thisvob->vobuhdr, sizeof *thisvob->vobuhdr, thisvob->numvobus, f);
+    for (i = 0; i < 64; i++)
+      {
+        const struct audchannel * const ach = &thisvob->audch[i];
+        ival = ach->numaudpts;
+        fwrite(&ival, sizeof ival, 1, f);
+        for (j = 0; j < ach->numaudpts; j++)
+          {
+            struct audpts ap = ach->audpts[j];
+            ap.asect -= base;
+            fwrite(&ap, sizeof ap, 1, f);
+          } /*for*/
+        fwrite(&ach->ad, sizeof(struct audiodesc), 1, f);
+        fwrite(&ach->adwarn, sizeof(struct audiodesc), 1, f);
+      } /*for*/
+    fwrite(thisvob->buttoncoli, 1, sizeof thisvob->buttoncoli, f);
+    fwrite(&delta->len, sizeof delta->len, 1, f);
+    fwrite(delta->data, 1, delta->len, f);
+    ival = delta->insect + 1; /* nr sectors read from input */
+    fwrite(&ival, sizeof ival, 1, f);
+    fwrite(delta->sums, sizeof *delta->sums, ival, f);
+    if (ferror(f) | (fclose(f) != 0) || rename(tmpname, cachename) != 0)
+      {
+        fprintf(stderr, "INFO: Cannot save scan cache %s: %s\n", cachename, strerror(errno));
+        unlink(tmpname);
+      } /*if*/
+    free(tmpname);
+    free(cachename);
+  } /*savescan*/
+
+static bool readall(FILE *f, void *dst, size_t len)
+  /* reads exactly len bytes from f, returning false if that isn't possible. */
+  {
+    return
+        fread(dst, 1, len, f) == len;
+  } /*readall*/
+
+static bool scancached(const char *fname)
+  /* checks whether there is a scan cache file matching the current contents of the
+    specified input file, though it might not be usable in the current circumstances. */
+  {
+    char * const cachename = scancachename(fname);
+    struct scankey key;
+    unsigned char header[SCANCACHE_HEADERLEN], expect[SCANCACHE_HEADERLEN];
+    FILE *f;
+    bool ok = false;
+    if (cachename && getscankey(fname, &key))
+      {
+        f = fopen(cachename, "rb");
+        if (f)
+          {
+            scancacheheader(expect, &key);
+            ok = readall(f, header, sizeof header) && memcmp(header, expect, sizeof header) == 0;
+            fclose(f);
+          } /*if*/
+      } /*if*/
+    free(cachename);
+    return
+        ok;
+  } /*scancached*/
+
+bool HashVobInputs(const struct vobgroup *va, uint64_t *hash)
+  /* folds the names and the identifying keys of the current contents of all the input
+    files for va into *hash. Returns false if any of them isn't an ordinary file. */
+  {
+    int i;
+    for (i = 0; i < va->numvobs; i++)
+      {
+        const char * const fname = va->vobs[i]->fname;
+        struct scankey key;
+        const unsigned char *b;
+        size_t j;
+        if (!scancacheable(fname) || !getscankey(fname, &key))
+            return
+                false;
+        for (j = 0; j <= strlen(fname); j++)
+            *hash = (*hash ^ (unsigned char)fname[j]) * 1099511628211ULL;
+        b = (const unsigned char *)&key;
+        for (j = 0; j < sizeof key; j++)
+            *hash = (*hash ^ b[j]) * 1099511628211ULL;
+      } /*for*/
+    return
+        true;
+  } /*HashVobInputs*/
+
+static void rebasevob(struct vob *thisvob, int base)
+  /* adds base to all the sector numbers recorded for thisvob. */
+  {
+    int i, j;
+    for (i = 0; i < thisvob->numvobus; i++)
+      {
+        struct vobuinfo * const vi = &thisvob->vobu[i];
+        vi->sector += base;
+        vi->lastsector += base;
+        for (j = 0; j < vi->numref; j++)
+            vi->lastrefsect[j] += base;
+      } /*for*/
+    for (i = 0; i < 64; i++)
+      {
+        struct audchannel * const ach = &thisvob->audch[i];
+        for (j = 0; j < ach->numaudpts; j++)
+            ach->audpts[j].asect += base;
+      } /*for*/
+  } /*rebasevob*/
+
+static void clearvobscan(struct vob *thisvob)
+  /* discards everything collected by an unusable scan of thisvob. */
+  {
+    freevobtables(thisvob);
+    memset(thisvob->audch, 0, sizeof thisvob->audch);
+    memset(thisvob->buttoncoli, 0, sizeof thisvob->buttoncoli);
+  } /*clearvobscan*/
+
+static char *outvobname(const struct vobscan *sc, int outnum)
+  /* returns the name of the specified output VOB file. */
+  {
+    return
+        outnum >= 0 ? sprintf_alloc("%s_%d.VOB", sc->fbase, outnum) : strdup(sc->fbase);
+  } /*outvobname*/
+
+struct scanmark /* position in the output to go back to if a VOB has to be scanned again */
+  {
+    int cursect, fsect, outnum;
+  };
+
+static void markscan(const struct vobscan *sc, struct scanmark *mark)
+  /* remembers the current output position in mark. */
+  {
+    mark->cursect = sc->cursect;
+    mark->fsect = sc->fsect;
+    mark->outnum = sc->outnum;
+  } /*markscan*/
+
+static void rewindscan(struct vobscan *sc, const struct scanmark *mark)
+  /* discards all the output generated since mark was taken. */
+  {
+    struct vobwriter * const wr = sc->wr;
+    int outnum;
+    if (sc->fbase)
+      {
+        writeclose(wr);
+        wr->totalwritten -= (uint64_t)(sc->cursect - mark->cursect) * 2048;
+        for (outnum = mark->outnum + (mark->fsect >= 0); outnum <= sc->outnum; outnum++)
+          {
+          /* files begun since the mark */
+            char * const name = outvobname(sc, outnum);
+            unlink(name);
+            free(name);
+          } /*for*/
+        if (mark->fsect >= 0)
+          {
+          /* carry on from the mark in the file that was open then */
+            char * const name = outvobname(sc, mark->outnum);
+            writeopen(wr, name, (off_t)mark->fsect * 2048);
+            free(name);
+          } /*if*/
+      } /*if*/
+    sc->cursect = mark->cursect;
+    sc->fsect = mark->fsect;
+    sc->outnum = mark->outnum;
+  } /*rewindscan*/
+
+static bool appendsectors
+  (
+    struct vobscan *sc,
+    struct vob *thisvob,
+    int numsects,
+    struct vobreader *rd, /* where to get the input sectors from, NULL if not generating output */
+    struct scanreplay *replay /* how to turn them into output sectors */
+  )
+  /* appends previously-scanned sectors to the output VOB files, splitting them at
+    the same places as a scan on the main thread would, and assigns the VOBUs their
+    output positions. thisvob must already have been rebased to sc->cursect. Returns
+    false, leaving the output incomplete, if the input has changed since the scan. */
+  {
+    int i, sect;
+    i = 0; /* next VOBU to assign output position to */
+    for (sect = 0; sect < numsects; sect++)
+      {
+        if (sc->fsect == 524272)
+          {
+          /* VOB file reached maximum allowed size */
+            writeclose(sc->wr);
+            if (sc->outnum <= 0)
+              { /* menu VOB cannot be split */
+                fprintf(stderr, "\nERR:  Menu VOB reached 1gb\n");
+                exit(1);
+              } /*if*/
+            sc->outnum++; /* for naming next VOB file */
+            sc->fsect = -1;
+          } /*if*/
+        if (sc->fsect == -1)
+          {
+          /* start a new VOB file */
+            sc->fsect = 0;
+            if (sc->fbase)
+              {
+                char * const newname = outvobname(sc, sc->outnum);
+                writeopen(sc->wr, newname, 0);
+                free(newname);
+              } /*if*/
+          } /*if*/
+        if (i < thisvob->numvobus && thisvob->vobu[i].sector == sc->cursect)
+          {
+            thisvob->vobu[i].fsect = sc->fsect;
+            thisvob->vobu[i].fnum = sc->outnum;
+            i++;
+          } /*if*/
+        if (rd)
+          {
+            if (!replaysector(replay, rd, writegrabbuf(sc->wr)))
+              {
+                writeundo(sc->wr);
+                return
+                    false;
+              } /*if*/
+            writemark(sc->wr, rd);
+          } /*if*/
+        sc->cursect++;
+        sc->fsect++;
+      } /*for*/
+    return
+        true;
+  } /*appendsectors*/
+
+static bool replayvob
+  (
+    struct vobscan *sc,
+    struct vob *thisvob,
+    int numsects,
+    const unsigned char *data, /* from scandelta */
+    size_t len,
+    const uint32_t *sums,
+    int numsums
+  )
+  /* appends the output for a previously-scanned VOB, regenerated from its input
+    file. Returns false, leaving the output incomplete, if the input has changed
+    since the scan. */
+  {
+    struct vobreader rd;
+    struct scanreplay replay;
+    bool ok;
+    replay.data = data;
+    replay.len = len;
+    replay.pos = 0;
+    replay.sums = sums;
+    replay.numsums = numsums;
+    replay.nextsect = 0;
+    readeropen(&rd, thisvob->fname);
+    writeattach(sc->wr, &rd);
+    ok = appendsectors(sc, thisvob, numsects, &rd, &replay);
+    writedetach(sc->wr);
+    readerclose(&rd);
+    return
+        ok;
+  } /*replayvob*/
+
+static bool cachefits(FILE *f, off_t cachesize, int64_t count, size_t size)
+  /* checks that count items of the specified size could still be read from f,
+    which is cachesize bytes long, before allocating space for them. */
+  {
+    const off_t pos = ftello(f);
+    return
+            count >= 0
+        &&
+            pos >= 0
+        &&
+            pos <= cachesize
+        &&
+            (uint64_t)count <= (uint64_t)(cachesize - pos) / size;
+  } /*cachefits*/
+
+static bool loadscan(struct vobscan *sc, int vnum, uint64_t *endoffset)
+  /* tries to use the scan cache for the specified VOB, appending it to the output
+    if successful. Returns false, having changed nothing, if there is no usable cache. */
+  {
+    struct vobgroup * const va = sc->va;
+    struct vob * const thisvob = va->vobs[vnum];
+    struct colorinfo * const colors = thisvob->progchain->colors;
+    char * const cachename = scancachename(thisvob->fname);
+    struct scankey key;
+    unsigned char header[SCANCACHE_HEADERLEN], expect[SCANCACHE_HEADERLEN];
+    struct videodesc origvd, vd;
+    int origcolors[16], newcolors[16];
+    int32_t usedcolors, numsects, numvobus, numaudpts;
+    struct vobuinfo *vobu = 0;
+    unsigned char (*vobuhdr)[0x26] = 0;
+    struct audchannel audch[64];
+    unsigned char buttoncoli[24];
+    size_t deltalen;
+    unsigned char *delta = 0;
+    int32_t numsums;
+    uint32_t *sums = 0;
+    FILE *f = 0;
+    struct stat info;
+    off_t cachesize;
+    bool ok = false;
+    int i;
+    memset(audch, 0, sizeof audch);
+    do /*once*/
+      {
+        if (!cachename || !getscankey(thisvob->fname, &key))
+            break;
+        f = fopen(cachename, "rb");
+        if (!f)
+            break;
+        if (fstat(fileno(f), &info) != 0)
+            break;
+        cachesize = info.st_size;
+        scancacheheader(expect, &key);
+        if
+          (
+                !readall(f, header, sizeof header)
+            ||
+                memcmp(header, expect, sizeof header) != 0
+            ||
+                !readall(f, &origvd, sizeof origvd)
+            ||
+                !readall(f, origcolors, sizeof origcolors)
+            ||
+                !readall(f, &usedcolors, sizeof usedcolors)
+          )
+            break;
+        if
+          (
+                memcmp(&origvd, &va->vd, sizeof origvd) != 0
+                  /* sequence headers might be rewritten differently */
+            ||
+                usedcolors && memcmp(origcolors, colors->color, sizeof origcolors) != 0
+                  /* colours might be allocated to different entries */
+          )
+            break;
+        if
+          (
+                !readall(f, endoffset, sizeof *endoffset)
+            ||
+                !readall(f, &numsects, sizeof numsects)
+            ||
+                !readall(f, &vd, sizeof vd)
+            ||
+                !readall(f, newcolors, sizeof newcolors)
+            ||
+                numsects < 0
+            ||
+                !readall(f, &numvobus, sizeof numvobus)
+            ||
+                !cachefits(f, cachesize, numvobus, sizeof(struct vobuinfo) + sizeof *vobuhdr)
+          )
+            break;
+        vobu = growtable(0, 0, (numvobus > 0 ? numvobus : 1) * sizeof(struct vobuinfo));
+        vobuhdr = growtable(0, 0, (numvobus > 0 ? numvobus : 1) * sizeof *vobuhdr);
+        if
+          (
+                !readall(f, vobu, numvobus * sizeof(struct vobuinfo))
+            ||
+                !readall(f, vobuhdr, numvobus * sizeof *vobuhdr)
+          )
+            break;
+        for (i = 0; i < 64; i++)
+          {
+            if
+              (
+                    !readall(f, &numaudpts, sizeof numaudpts)
+                ||
+                    !cachefits(f, cachesize, numaudpts, sizeof(struct audpts))
+              )
+                break;
+            audch[i].numaudpts = numaudpts;
+            audch[i].maxaudpts = numaudpts;
+            audch[i].audpts = numaudpts != 0 ? growtable(0, 0, numaudpts * sizeof(struct audpts)) : 0;
+            if
+              (
+                    !readall(f, audch[i].audpts, numaudpts * sizeof(struct audpts))
+                ||
+                    !readall(f, &audch[i].ad, sizeof(struct audiodesc))
+                ||
+                    !readall(f, &audch[i].adwarn, sizeof(struct audiodesc))
+              )
+                break;
+          } /*for*/
+        if
+          (
+                i < 64
+            ||
+                !readall(f, buttoncoli, sizeof buttoncoli)
+            ||
+                !readall(f, &deltalen, sizeof deltalen)
+            ||
+                deltalen > (uint64_t)cachesize
+          )
+            break;
+        delta = malloc(deltalen);
+        if
+          (
+                !readall(f, delta, deltalen)
+            ||
+                !readall(f, &numsums, sizeof numsums)
+            ||
+                !cachefits(f, cachesize, numsums, sizeof *sums)
+          )
+            break;
+        sums = malloc((numsums > 0 ? numsums : 1) * sizeof *sums);
+        ok = readall(f, sums, numsums * sizeof *sums);
+      }
+    while (false);
+    if (f)
+        fclose(f);
+    free(cachename);
+    if (ok)
+      {
+        struct scanmark mark;
+        fprintf(stderr, "INFO: Using saved scan of %s\n", thisvob->fname);
+        freevobtables(thisvob);
+        thisvob->vobu = vobu;
+        thisvob->vobuhdr = vobuhdr;
+        thisvob->numvobus = numvobus;
+        thisvob->maxvobus = numvobus > 0 ? numvobus : 1;
+        memcpy(thisvob->audch, audch, sizeof audch);
+        memcpy(thisvob->buttoncoli, buttoncoli, sizeof buttoncoli);
+        va->vd = vd;
+        if (usedcolors)
+            memcpy(colors->color, newcolors, sizeof newcolors);
+        rebasevob(thisvob, sc->cursect);
+        markscan(sc, &mark);
+        if (sc->fbase)
+            ok = replayvob(sc, thisvob, numsects, delta, deltalen, sums, numsums);
+        else
+            appendsectors(sc, thisvob, numsects, 0, 0);
+        if (!ok)
+          {
+          /* contents changed without changing the key: put everything back as it was */
+            fprintf(stderr, "INFO: %s has changed since its scan was saved, rescanning\n", thisvob->fname);
+            rewindscan(sc, &mark);
+            clearvobscan(thisvob);
+            va->vd = origvd;
+            if (usedcolors)
+                memcpy(colors->color, origcolors, sizeof origcolors);
+          } /*if*/
+      }
+    else
+      {
+        if (vobu)
+          {
+            freetable(vobu, (numvobus > 0 ? numvobus : 1) * sizeof(struct vobuinfo));
+            freetable(vobuhdr, (numvobus > 0 ? numvobus : 1) * sizeof *vobuhdr);
+          } /*if*/
+        for (i = 0; i < 64; i++)
+            freetable(audch[i].audpts, audch[i].maxaudpts * sizeof(struct audpts));
+      } /*if*/
+    free(delta);
+    free(sums);
+    return
+        ok;
+  } /*loadscan*/
+
+static void scanandsave(struct vobscan *sc, int vnum, uint64_t *endoffset)
+  /* scans the specified VOB on the current thread, appending it to the output,
+    and saves the results in its scan cache if possible. */
+  {
+    struct vobgroup * const va = sc->va;
+    struct vob * const thisvob = va->vobs[vnum];
+    struct colorinfo * const colors = thisvob->progchain->colors;
+    const int base = sc->cursect;
+    const struct videodesc origvd = va->vd;
+    int origcolors[16];
+    memcpy(origcolors, colors->color, sizeof origcolors);
+    if (scancache && scancacheable(thisvob->fname))
+        sc->delta = deltanew();
+    scanvob(sc, vnum, colors, endoffset);
+    if (sc->delta && !sc->usedbuttons)
+      /* button definitions go into the PGC, where the cache can't restore them from */
+        savescan(sc, vnum, base, *endoffset, &origvd, origcolors, sc->usedcolors, sc->delta);
+    deltafree(sc->delta);
+    sc->delta = 0;
+  } /*scanandsave*/
+
+static void serialscan(struct vobscan *sc, int vnum)
+  /* scans the specified VOB on the current thread, appending it to the output. */
+  {
+    struct vobgroup * const va = sc->va;
+    struct vob * const thisvob = va->vobs[vnum];
+    const int base = sc->cursect;
+    struct phasetimer timer;
+    uint64_t inoffset;
+    fprintf(stderr, "\nSTAT: Processing %s...\n", thisvob->fname);
+    phase_start(&timer, "ScanVob", thisvob->fname, false);
+    if (!scancache || !loadscan(sc, vnum, &inoffset))
+        scanandsave(sc, vnum, &inoffset);
+    pinvobupts(va, thisvob, inoffset);
+    releasevobtables(thisvob);
+    sc->bytesread += inoffset;
+    phase_stop
+      (
+        &timer,
+        inoffset,
+        sc->fbase ? (uint64_t)(sc->cursect - base) * 2048 : 0,
+        sc->cursect - base
+      );
+  } /*serialscan*/
+
+#ifdef HAVE_PTHREAD
+
+struct scanjob /* an input VOB to be scanned on a worker thread */
+  {
+    int vnum; /* index into vobgroup.vobs */
+    struct vobgroup va; /* private copy for collecting video attributes */
+    struct videodesc origvd; /* video attributes as they were when the scan started */
+    struct colorinfo colors; /* private copy of the PGC colour table */
+    int origcolors[16]; /* PGC colour table as it was when the scan started */
+    uint64_t endoffset; /* length of input, for messages */
+    int numsects; /* nr sectors of output generated */
+    bool complete; /* false if the scan was abandoned */
+    bool usedcolors, attrguess; /* copied from vobscan */
+    bool cached; /* not scanned because a scan cache was found for it */
+    struct scandelta *delta;
+      /* changes to input sectors, for generating the output from the input file and
+        saving in the scan cache, NULL if neither is wanted */
+    bool done; /* worker has finished with this job */
+  };
+
+struct scanpool /* work shared between the main thread and the worker threads */
+  {
+    pthread_mutex_t lock;
+    pthread_cond_t progress; /* signalled when a job is finished or merged */
+    struct scanjob *jobs;
+    int numjobs; /* length of jobs array */
+    int nextjob; /* index of next job to hand out */
+    int nummerged; /* nr of jobs the main thread has finished merging */
+    int lookahead; /* how far workers may get ahead of the main thread */
+  };
+
+static void *scanworker(void *arg)
+  /* worker thread: repeatedly takes the next VOB from the pool and scans it,
+    recording the changes to make to its sectors for the main thread to apply. */
+  {
+    struct scanpool * const pool = (struct scanpool *)arg;
+    struct vobscan * const sc = malloc(sizeof(struct vobscan));
+    struct phasetimer timer;
+    sc->wr = writernew();
+    while (true)
+      {
+        struct scanjob *job;
+        pthread_mutex_lock(&pool->lock);
+        while
+          (
+                pool->nextjob < pool->numjobs
+            &&
+                pool->nextjob >= pool->nummerged + pool->lookahead
+          )
+          /* don't hold too many scan results in memory */
+            pthread_cond_wait(&pool->progress, &pool->lock);
+        job = pool->nextjob < pool->numjobs ? &pool->jobs[pool->nextjob++] : 0;
+        pthread_mutex_unlock(&pool->lock);
+        if (!job)
+            break;
+        initvobscan(sc, &job->va, 0, -1);
+        sc->worker = true;
+        if (scancache && scancached(job->va.vobs[job->vnum]->fname))
+          {
+          /* leave it for the main thread to load */
+            job->cached = true;
+            job->complete = false;
+            pthread_mutex_lock(&pool->lock);
+            job->done = true;
+            pthread_cond_broadcast(&pool->progress);
+            pthread_mutex_unlock(&pool->lock);
+            continue;
+          } /*if*/
+        sc->delta = job->delta;
+        phase_start(&timer, "ScanVob", job->va.vobs[job->vnum]->fname, true);
+        job->complete = scanvob(sc, job->vnum, &job->colors, &job->endoffset);
+        job->numsects = sc->cursect;
+        phase_stop(&timer, job->endoffset, 0, job->numsects);
+        job->usedcolors = sc->usedcolors;
+        job->attrguess = sc->attrguess;
+        pthread_mutex_lock(&pool->lock);
+        job->done = true;
+        pthread_cond_broadcast(&pool->progress);
+        pthread_mutex_unlock(&pool->lock);
+      } /*while*/
+    writerfree(sc->wr);
+    free(sc);
+    return
+        0;
+  } /*scanworker*/
 
-            fprintf(stderr, "\nINFO: Video pts = ");
-            printpts(thisvob->vobu[0].videopts[0]);
-            fprintf(stderr, " .. ");
-            for (i = thisvob->numvobus - 1; i >= 0; i--)
-                if (thisvob->vobu[i].hasvideo)
-                  {
-                    printpts(thisvob->vobu[i].videopts[1]);
-                    break;
-                  } /*if; for*/
-            if (i < 0)
-                fprintf(stderr, "??");
-            for (i = 0; i < 64; i++)
+static bool mergevideodesc(struct videodesc *vd, const struct videodesc *scanned)
+  /* merges the video attributes collected by a worker thread into vd. Returns false,
+    leaving vd unchanged, if any of them conflicts with a value already set. */
+  {
+    int * const dst[] = {&vd->vmpeg, &vd->vres, &vd->vformat, &vd->vaspect, &vd->vframerate};
+    const int src[] = {scanned->vmpeg, scanned->vres, scanned->vformat, scanned->vaspect, scanned->vframerate};
+      /* the ones scanvideoptr can set */
+    int i;
+    for (i = 0; i < 5; i++)
+        if (src[i] != 0 && *dst[i] != 0 && src[i] != *dst[i])
+            return
+                false;
+    for (i = 0; i < 5; i++)
+        if (src[i] != 0)
+            *dst[i] = src[i];
+    return
+        true;
+  } /*mergevideodesc*/
+
+static bool appendscan(struct vobscan *sc, const struct scanjob *job)
+  /* generates the output for a worker-thread scan from the input VOB, appending it
+    to the output VOB files, and adjusts the sector numbers recorded for the VOB to
+    match. Returns false, having added nothing to the output, if the input has
+    changed since it was scanned. */
+  {
+    struct vob * const thisvob = sc->va->vobs[job->vnum];
+    const struct scandelta * const delta = job->delta;
+    struct scanmark mark;
+    rebasevob(thisvob, sc->cursect);
+    if (!sc->fbase)
+      {
+        appendsectors(sc, thisvob, job->numsects, 0, 0);
+        return
+            true;
+      } /*if*/
+    markscan(sc, &mark);
+    if (replayvob(sc, thisvob, job->numsects, delta->data, delta->len, delta->sums, delta->insect + 1))
+        return
+            true;
+    fprintf(stderr, "INFO: %s changed while it was being scanned\n", thisvob->fname);
+    rewindscan(sc, &mark);
+    return
+        false;
+  } /*appendscan*/
+
+static bool mergescan(struct vobscan *sc, const struct scanjob *job)
+  /* incorporates the results of a worker-thread scan into the output. Returns false,
+    having changed nothing, if they cannot be used because the VOB might have come
+    out differently had it been scanned after its predecessors. */
+  {
+    struct vobgroup * const va = sc->va;
+    struct colorinfo * const colors = va->vobs[job->vnum]->progchain->colors;
+    struct videodesc vd = va->vd;
+    if (!job->complete)
+        return
+            false;
+    if (job->usedcolors && memcmp(colors->color, job->origcolors, sizeof job->origcolors) != 0)
+      /* colour table was changed by a previous VOB, so colours might have been allocated
+        to different entries */
+        return
+            false;
+    if (job->attrguess && memcmp(&va->vd, &job->origvd, sizeof(struct videodesc)) != 0)
+      /* sequence headers were rewritten using attributes which previous VOBs have
+        since set */
+        return
+            false;
+    if (!mergevideodesc(&vd, &job->va.vd))
+        return
+            false;
+    if (!appendscan(sc, job))
+        return
+            false;
+    va->vd = vd;
+    if (job->usedcolors)
+        memcpy(colors->color, job->colors.color, sizeof colors->color);
+    return
+        true;
+  } /*mergescan*/
+
+static void parallelscan(struct vobscan *sc)
+  /* scans the first VOB on the current thread while worker threads scan the rest,
+    then assembles the output in the original order. */
+  {
+    struct vobgroup * const va = sc->va;
+    struct scanpool pool;
+    pthread_t *threads;
+    int nrthreads, i;
+    pool.numjobs = va->numvobs - 1;
+    pool.jobs = malloc(pool.numjobs * sizeof(struct scanjob));
+    pool.nextjob = 0;
+    pool.nummerged = 0;
+    for (i = 0; i < pool.numjobs; i++)
+      {
+        struct scanjob * const job = &pool.jobs[i];
+        const struct colorinfo * const colors = va->vobs[i + 1]->progchain->colors;
+        job->vnum = i + 1;
+        job->va = *va;
+        job->origvd = va->vd;
+        job->colors = *colors;
+        memcpy(job->origcolors, colors->color, sizeof job->origcolors);
+        job->cached = false;
+        job->delta =
+            sc->fbase || scancache && scancacheable(va->vobs[job->vnum]->fname) ?
+                deltanew()
+            :
+                0;
+        job->done = false;
+      } /*for*/
+    nrthreads = maxjobs - 1 < pool.numjobs ? maxjobs - 1 : pool.numjobs;
+    pool.lookahead = 2 * nrthreads;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.progress, NULL);
+    threads = malloc(nrthreads * sizeof(pthread_t));
+    for (i = 0; i < nrthreads; i++)
+      {
+        if (pthread_create(&threads[i], NULL, scanworker, &pool) != 0)
+          {
+            fprintf(stderr, "ERR:  Cannot create thread to scan VOBs\n");
+            exit(1);
+          } /*if*/
+      } /*for*/
+    serialscan(sc, 0);
+    for (i = 0; i < pool.numjobs; i++)
+      {
+        struct scanjob * const job = &pool.jobs[i];
+        struct vob * const thisvob = va->vobs[job->vnum];
+        const int mergebase = sc->cursect;
+        struct phasetimer timer;
+        uint64_t mergeread; /* input read on this thread, for timing report */
+        pthread_mutex_lock(&pool.lock);
+        while (!job->done)
+            pthread_cond_wait(&pool.progress, &pool.lock);
+        pthread_mutex_unlock(&pool.lock);
+        fprintf(stderr, "\nSTAT: Processing %s...\n", thisvob->fname);
+        phase_start(&timer, "MergeVob", thisvob->fname, false);
+          /* includes loading or redoing the scan on this thread if necessary */
+        if (job->cached)
+          {
+            if (!loadscan(sc, job->vnum, &job->endoffset))
+                scanandsave(sc, job->vnum, &job->endoffset);
+            mergeread = job->endoffset;
+          }
+        else
+          {
+            const int base = sc->cursect;
+            const struct videodesc origvd = va->vd;
+            int origcolors[16];
+            memcpy(origcolors, thisvob->progchain->colors->color, sizeof origcolors);
+            if (mergescan(sc, job))
               {
-                const struct audchannel * const ach = &thisvob->audch[i];
-                if (ach->numaudpts)
-                  {
-                    fprintf(stderr, "\nINFO: Audio[%d] pts = ", i);
-                    printpts(ach->audpts[0].pts[0]);
-                    fprintf(stderr, " .. ");
-                    printpts(ach->audpts[ach->numaudpts - 1].pts[1]);
-                  } /*if*/
-              } /*for*/
-            fprintf(stderr, "\n");
+                if (scancache && scancacheable(thisvob->fname))
+                    savescan(sc, job->vnum, base, job->endoffset, &origvd, origcolors, job->usedcolors, job->delta);
+                mergeread = sc->fbase ? job->endoffset : 0; /* input read again to generate output */
+              }
+            else
+              {
+                fprintf(stderr, "INFO: Rescanning %s after previous VOBs\n", thisvob->fname);
+                clearvobscan(thisvob);
+                scanandsave(sc, job->vnum, &job->endoffset);
+                mergeread = job->endoffset;
+              } /*if*/
           } /*if*/
+        deltafree(job->delta);
+        pinvobupts(va, thisvob, job->endoffset);
+        releasevobtables(thisvob);
+        sc->bytesread += job->endoffset;
+        phase_stop
+          (
+            &timer,
+            mergeread,
+            sc->fbase ? (uint64_t)(sc->cursect - mergebase) * 2048 : 0,
+            sc->cursect - mergebase
+          );
+        printvobustatus(va, job->vnum + 1, sc->cursect, false);
+        pthread_mutex_lock(&pool.lock);
+        pool.nummerged++;
+        pthread_cond_broadcast(&pool.progress);
+        pthread_mutex_unlock(&pool.lock);
       } /*for*/
-    writeclose();
-    printvobustatus(va, cursect, true);
+    for (i = 0; i < nrthreads; i++)
+        pthread_join(threads[i], NULL);
+    pthread_cond_destroy(&pool.progress);
+    pthread_mutex_destroy(&pool.lock);
+    free(threads);
+    free(pool.jobs);
+  } /*parallelscan*/
+
+#endif /*HAVE_PTHREAD*/
+
+int FindVobus(const char *fbase, struct vobgroup *va, vtypes ismenu)
+  /* collects audio/video/subpicture information, remaps subpicture colours and generates
+    output VOB files for a menu or titleset, complete except for the NAV packs. */
+  {
+    struct vobscan * const sc = malloc(sizeof(struct vobscan));
+    const double starttime = nowseconds();
+    struct phasetimer timer;
+    uint64_t written;
+    int vnum;
+    phase_start(&timer, "FindVobus", pstypes[ismenu], false);
+    initvobscan(sc, va, fbase, -(int)ismenu + 1);
+    sc->wr = writernew();
+    if (navwindow != 0 && fbase)
+        writerhold(sc->wr, navwindow);
+    for (vnum = 0; vnum < va->numvobs; vnum++)
+        va->vobs[vnum]->vobid = vnum + 1;
+#ifdef HAVE_PTHREAD
+    if (maxjobs > 1 && ismenu == VTYPE_VTS && va->numvobs > 1)
+      /* menu VOBs are usually small, and must not be split anyway */
+      {
+        parallelscan(sc);
+      }
+    else
+#endif
+      {
+        for (vnum = 0; vnum < va->numvobs; vnum++)
+            serialscan(sc, vnum);
+      } /*if*/
+    if (sc->wr->held && sc->wr->fd != -1)
+      {
+      /* leave the tail of the last output file for FixVobus to finish off */
+        writefinish(sc->wr);
+        sc->wr->fnum = sc->outnum;
+        va->heldvob = sc->wr;
+        written = sc->wr->totalwritten;
+      }
+    else
+      {
+        writeclose(sc->wr);
+        written = sc->wr->totalwritten;
+        vobstats.bytes += sc->wr->totalwritten;
+        vobstats.copied += sc->wr->totalcopied;
+        writerfree(sc->wr);
+      } /*if*/
+    for (vnum = 0; vnum < va->numvobs; vnum++)
+        indexvobus(va->vobs[vnum]);
+    vobstats.seconds += nowseconds() - starttime;
+    printvobustatus(va, va->numvobs, sc->cursect, true);
     fprintf(stderr, "\n");
-    free(crs);
+    phase_stop(&timer, sc->bytesread, written, sc->cursect);
+    free(sc);
     return 1;
   } /*FindVobus*/
 
+void ReportVobStats(void)
+  /* reports the throughput of VOB generation since the last call. */
+  {
+    if (vobstats.bytes != 0)
+      {
+        fprintf
+          (
+            stderr,
+            "STAT: Wrote %.1f MB of VOBs in %.2f s (%.1f MB/s, %d KB writes%s%s)\n",
+            vobstats.bytes / 1048576.0,
+            vobstats.seconds,
+            vobstats.seconds > 0 ? vobstats.bytes / 1048576.0 / vobstats.seconds : 0.0,
+            writebufsize() / 1024,
+            directio ? ", direct" : "",
+            nocache ? ", uncached" : ""
+          );
+        if (vobstats.copied != 0)
+            fprintf(stderr, "STAT: %.1f MB copied unmodified from input\n", vobstats.copied / 1048576.0);
+      } /*if*/
+    vobstats.bytes = 0;
+    vobstats.copied = 0;
+    vobstats.seconds = 0;
+  } /*ReportVobStats*/
+
 static pts_t pabs(pts_t pts)
   /* returns the absolute value of pts. */
   {
@@ -2049,6 +4132,8 @@ void MarkChapters(struct vobgroup *va)
     to mark all the cells and programs. */
   {
     int i, j, k, lastvobuid;
+    struct phasetimer timer;
+    phase_start(&timer, "MarkChapters", 0, false);
     // mark start and stop points
     lastvobuid = -1;
     for (i = 0; i < va->numallpgcs; i++)
@@ -2118,6 +4203,7 @@ void MarkChapters(struct vobgroup *va)
                 cellvobu = j; /* this VOBU is first in cell */
               } /*if*/
             thisvobu->vobcellid = cellid + va->vobs[i]->vobid * 256;
+            va->vobs[i]->vobuidx.vobcellid[j] = thisvobu->vobcellid;
             thisvobu->firstvobuincell = cellvobu;
           } /*for*/
         cellvobu = va->vobs[i]->numvobus - 1;
@@ -2186,6 +4272,7 @@ void MarkChapters(struct vobgroup *va)
                   } /*if*/
               } /*for*/
           } /*for; for*/
+    phase_stop(&timer, 0, 0, 0);
   } /*MarkChapters*/
 
 static pts_t getcellaudiopts(const struct vobgroup *va,int vcid,int ach,int w)
@@ -2256,16 +4343,418 @@ int calcaudiogap(const struct vobgroup *va,int vcid0,int vcid1,int ach)
     return 1;
 }
 
-void FixVobus(const char *fbase,const struct vobgroup *va,const struct workset *ws,vtypes ismenu)
+struct navbatch /* NAV packs waiting to be written to an output VOB file */
+  {
+    int fd;
+    int count; /* nr packs collected so far */
+    off_t offsets[NAVBATCH]; /* where each pack goes in the file, in increasing order */
+    unsigned char packs[NAVBATCH * 2048];
+  };
+
+static void navflush(struct navbatch *nb)
+  /* writes out all the collected NAV packs, as one write for each run that is
+    contiguous in the output file. */
+  {
+    int i, n;
+    for (i = 0; i < nb->count; i += n)
+      {
+        ssize_t written;
+        n = 1;
+        while (i + n < nb->count && nb->offsets[i + n] == nb->offsets[i] + n * 2048)
+            n++;
+#ifdef HAVE_PWRITE
+        written = pwrite(nb->fd, nb->packs + i * 2048, n * 2048, nb->offsets[i]);
+#else
+        if (lseek(nb->fd, nb->offsets[i], SEEK_SET) == (off_t)-1)
+          {
+            fprintf(stderr, "ERR:  Error %d -- %s -- seeking in output VOB\n", errno, strerror(errno));
+            exit(1);
+          } /*if*/
+        written = write(nb->fd, nb->packs + i * 2048, n * 2048);
+#endif
+        if (written != n * 2048)
+          {
+            fprintf
+              (
+                stderr,
+                "ERR:  Error %d -- %s -- writing NAV PACK to output VOB\n",
+                errno,
+                strerror(errno)
+              );
+            exit(1);
+          } /*if*/
+      } /*for*/
+    nb->count = 0;
+  } /*navflush*/
+
+static void navqueue(struct navbatch *nb, off_t offset, const unsigned char *buf)
+  /* adds a NAV pack to be written at the specified offset in the output file.
+    Packs must be added in increasing order of offset. */
+  {
+    if (nb->count == NAVBATCH)
+        navflush(nb);
+    nb->offsets[nb->count] = offset;
+    memcpy(nb->packs + nb->count * 2048, buf, 2048);
+    nb->count++;
+  } /*navqueue*/
+
+#define DSI_SEEK_START 0x4f1 /* first DSI field filled in from seektable */
+#define SEEKCHUNK 1024 /* nr VOBUs to compute seek information for at a time */
+
+struct seektable /* precomputed DSI search information for a run of VOBUs in a VOB */
+  {
+    const struct vobgroup *va;
+    const struct vob *vob;
+    bool sorted;
+      /* whether timestamps and sectors are in order, so that the searches can be
+        done as merge sweeps instead of binary searches */
+    int rowlen;
+      /* bytes per VOBU, covering DSI offsets DSI_SEEK_START up to the end of the
+        subpicture sync addresses, in the same layout */
+    int first, count; /* range of VOBUs currently in rows */
+    unsigned char *rows;
+    int cellfirst; /* first VOBU in cell being swept */
+    int nextvideo, prevvideo; /* nearest VOBUs with video after and before the current one, -1 if none */
+    int ff[19], rew[19]; /* sweep positions for the forward and backward timeline offsets */
+    int audidx[8]; /* sweep positions in audpts arrays for audio tracks */
+    int spuidx[32], spuvobu[32], spunextvobu[32];
+      /* sweep positions for subpicture tracks in audpts arrays and in the VOBUs spanning
+        the current and next packets */
+  };
+
+static bool ptsinorder(const struct audchannel *ach)
+  /* are the packets in ach in order of both start time and sector. */
+  {
+    int i;
+    for (i = 1; i < ach->numaudpts; i++)
+        if
+          (
+                ach->audpts[i].pts[0] < ach->audpts[i - 1].pts[0]
+            ||
+                ach->audpts[i].asect < ach->audpts[i - 1].asect
+          )
+            return
+                false;
+    return
+        true;
+  } /*ptsinorder*/
+
+static void seekinit(struct seektable *st, const struct vobgroup *va, const struct vob *thisvob)
+  /* sets up st to compute the DSI search information for thisvob. */
+  {
+    int i;
+    st->va = va;
+    st->vob = thisvob;
+    st->rowlen = 0x5a9 + va->numsubpicturetracks * 4 - DSI_SEEK_START;
+    st->first = 0;
+    st->count = 0;
+    st->rows = malloc(SEEKCHUNK * st->rowlen);
+    st->cellfirst = -1;
+    st->nextvideo = 0;
+    st->prevvideo = -1;
+    memset(st->audidx, 0, sizeof st->audidx);
+    memset(st->spuidx, 0, sizeof st->spuidx);
+    memset(st->spuvobu, 0, sizeof st->spuvobu);
+    memset(st->spunextvobu, 0, sizeof st->spunextvobu);
+    st->sorted = true;
+    for (i = 1; st->sorted && i < thisvob->numvobus; i++)
+        if (thisvob->vobuidx.startpts[i] < thisvob->vobuidx.startpts[i - 1])
+            st->sorted = false;
+    for (i = 0; st->sorted && i < va->numaudiotracks; i++)
+      {
+        const int s = getaudch(va, i);
+        if (s >= 0 && !ptsinorder(&thisvob->audch[s]))
+            st->sorted = false;
+      } /*for*/
+    for (i = 0; st->sorted && i < va->numsubpicturetracks; i++)
+        if (!ptsinorder(&thisvob->audch[i | 32]))
+            st->sorted = false;
+  } /*seekinit*/
+
+static void seekfree(struct seektable *st)
+  /* frees the rows allocated by seekinit. */
+  {
+    free(st->rows);
+  } /*seekfree*/
+
+static int sweepvobu(const struct vob *va, int *pos, pts_t pts, int l, int h)
+  /* returns the same as findvobu(va, pts, l, h), given that successive calls with
+    the same *pos (initially l) are for nondecreasing times. */
+  {
+    if (h < l || pts < va->vobuidx.startpts[l])
+        return
+            l - 1;
+    if (pts >= va->vobu[h].sectpts[1])
+        return
+            h + 1;
+    while (*pos < h && va->vobuidx.startpts[*pos + 1] <= pts)
+        ++*pos;
+    return
+        *pos;
+  } /*sweepvobu*/
+
+static int sweeppts(const struct audchannel *ach, int *pos, pts_t pts0)
+  /* returns the index of the last packet in ach starting no later than pts0, or the
+    first one if there is none, given that successive calls with the same *pos (initially 0)
+    are for nondecreasing times. */
+  {
+    while (*pos + 1 < ach->numaudpts && ach->audpts[*pos + 1].pts[0] <= pts0)
+        ++*pos;
+    return
+        *pos;
+  } /*sweeppts*/
+
+static int sweepvobubysect(const struct vob *va, int *pos, int sect)
+  /* returns the same as findvobubysect(va, sect), given that successive calls with
+    the same *pos (initially 0) are for nondecreasing sectors. */
+  {
+    if (va->numvobus == 0 || sect < va->vobuidx.sector[0])
+        return
+            -1;
+    while (*pos + 1 < va->numvobus && va->vobuidx.sector[*pos + 1] <= sect)
+        ++*pos;
+    return
+        *pos;
+  } /*sweepvobubysect*/
+
+static bool videobetween(const struct seektable *st, int cur, int jump)
+  /* is there a VOBU with video strictly between VOBUs cur and jump, cur being the
+    one whose row is being computed. */
+  {
+    return
+        cur < jump ?
+            st->nextvideo != -1 && st->nextvideo < jump
+        : cur > jump ?
+            st->prevvideo != -1 && st->prevvideo > jump
+        :
+            false;
+  } /*videobetween*/
+
+static void seekrow(struct seektable *st, int vobuindex, unsigned char *row)
+  /* computes the DSI search information for the specified VOBU, which must be the
+    one after the previous call, into row. */
+  {
+    const struct vobgroup * const va = st->va;
+    const struct vob * const thisvob = st->vob;
+    const struct vobuinfo * const thisvobu = &thisvob->vobu[vobuindex];
+    unsigned char * const buf = row - DSI_SEEK_START; /* so offsets can be given as in DSI */
+    int j, vff, vrew;
+    memset(row, 0, st->rowlen);
+    if (st->nextvideo != -1 && st->nextvideo <= vobuindex)
+      {
+        int k;
+        for (k = vobuindex + 1; k < thisvob->numvobus && !thisvob->vobuidx.hasvideo[k]; k++)
+          /* look for next one */;
+        st->nextvideo = k < thisvob->numvobus ? k : -1;
+      } /*if*/
+    if (thisvobu->firstvobuincell != st->cellfirst)
+      {
+      /* restart timeline sweeps at start of new cell */
+        st->cellfirst = thisvobu->firstvobuincell;
+        for (j = 0; j < 19; j++)
+          {
+            st->ff[j] = st->cellfirst;
+            st->rew[j] = st->cellfirst;
+          } /*for*/
+      } /*if*/
+    write4(buf + 0x4f1, getsect(thisvob, vobuindex, st->nextvideo, false, 0xbfffffff));
+      /* offset to next VOBU with video */
+  /* offset to next VOBU at various times forward filled in below */
+    write4(buf + 0x541, getsect(thisvob, vobuindex, vobuindex + 1, false, 0x3fffffff));
+      /* offset to next VOBU */
+    write4(buf + 0x545, getsect(thisvob, vobuindex, vobuindex - 1, false, 0x3fffffff));
+      /* offset to previous VOBU */
+  /* offset to previous VOBU at various times backward filled in below */
+    write4(buf + 0x595, getsect(thisvob, vobuindex, st->prevvideo, false, 0xbfffffff));
+      /* offset to previous VOBU with video */
+    for (j = 0; j < va->numaudiotracks; j++)
+      {
+        int s = getaudch(va, j);
+        if (s >= 0)
+          {
+            if (st->sorted)
+              {
+                const struct audchannel * const ach = &thisvob->audch[s];
+                if (ach->numaudpts == 0)
+                    s = -1;
+                else
+                  {
+                    const int id = sweeppts(ach, &st->audidx[j], thisvobu->sectpts[0]);
+                    s = ach->audpts[id].pts[0] > thisvobu->sectpts[1] ? -1 : ach->audpts[id].asect;
+                  } /*if*/
+              }
+            else
+                s = findaudsect(thisvob, s, thisvobu->sectpts[0], thisvobu->sectpts[1]);
+          } /*if*/
+        if (s >= 0)
+          {
+            s = s - thisvobu->sector;
+            if (s > 0x1fff || s < -(0x1fff))
+              {
+                fprintf
+                  (
+                    stderr,
+                    "\nWARN: audio sector out of range: %d (vobu #%d, pts ",
+                    s,
+                    vobuindex
+                  );
+                printpts(thisvobu->sectpts[0]);
+                fprintf(stderr, ")\n");
+                s = 0;
+              } /*if*/
+            if (s < 0)
+                s = (-s) | 0x8000; /* absolute value + backward-direction flag */
+          }
+        else
+            s = 0x3fff; /* no more audio for this stream */
+        write2(buf + 0x599 + j * 2, s);
+          /* relative offset to first audio packet in this stream for this VOBU */
+      } /*for*/
+    for (j = 0; j < va->numsubpicturetracks; j++)
+      {
+        const struct audchannel * const ach = &thisvob->audch[j | 32];
+        int s;
+        if (ach->numaudpts)
+          {
+            int id =
+                st->sorted ?
+                    sweeppts(ach, &st->spuidx[j], thisvobu->sectpts[0])
+                :
+                    findspuidx(thisvob, j | 32, thisvobu->sectpts[0]);
+            // if overlaps A, point to A
+            // else if (A before here or doesn't exist) and (B after here or doesn't exist),
+            //     point to here
+            // else point to B
+            if
+              (
+                    id >= 0
+                &&
+                    ach->audpts[id].pts[0] < thisvobu->sectpts[1]
+                &&
+                    ach->audpts[id].pts[1] >= thisvobu->sectpts[0]
+              )
+                s =
+                    st->sorted ?
+                        sweepvobubysect(thisvob, &st->spuvobu[j], ach->audpts[id].asect)
+                    :
+                        findvobubysect(thisvob, ach->audpts[id].asect);
+            else if
+              (
+                    (id < 0 || ach->audpts[id].pts[1] < thisvobu->sectpts[0])
+                 &&
+                    (
+                        id + 1 == ach->numaudpts
+                    ||
+                        ach->audpts[id + 1].pts[0] >= thisvobu->sectpts[1]
+                    )
+              )
+                s = vobuindex;
+            else
+                s =
+                    st->sorted ?
+                        sweepvobubysect(thisvob, &st->spunextvobu[j], ach->audpts[id + 1].asect)
+                    :
+                        findvobubysect(thisvob, ach->audpts[id + 1].asect);
+            id = (s < vobuindex);
+            s = getsect(thisvob, vobuindex, s, false, 0x7fffffff) & 0x7fffffff;
+            if (!s) /* same VOBU */
+                s = 0x7fffffff;
+                  /* indicates current or later VOBU, no explicit forward offsets */
+            if (s != 0x7fffffff && id)
+                s |= 0x80000000; /* indicates offset to prior VOBU */
+          }
+        else
+            s = 0; /* doesn't exist */
+        write4(buf + 0x5a9 + j * 4, s);
+          /* relative offset to VOBU (NAV pack) containing subpicture data
+            for this stream for this VOBU */
+      } /*for*/
+    vff = vobuindex;
+    vrew = vobuindex;
+    for (j = 0; j < 19; j++)
+      {
+      /* fill in offsets to next/previous VOBUs at various time steps */
+        const pts_t ffpts = thisvobu->sectpts[0] + timeline[j] * DVD_FFREW_HALFSEC;
+        const pts_t rewpts = thisvobu->sectpts[0] - timeline[j] * DVD_FFREW_HALFSEC;
+        int nff, nrew;
+        if (st->sorted)
+          {
+            nff = sweepvobu(thisvob, &st->ff[j], ffpts, thisvobu->firstvobuincell, thisvobu->lastvobuincell);
+            nrew = sweepvobu(thisvob, &st->rew[j], rewpts, thisvobu->firstvobuincell, thisvobu->lastvobuincell);
+          }
+        else
+          {
+            nff = findvobu(thisvob, ffpts, thisvobu->firstvobuincell, thisvobu->lastvobuincell);
+            nrew = findvobu(thisvob, rewpts, thisvobu->firstvobuincell, thisvobu->lastvobuincell);
+          } /*if*/
+        // a hack -- the last vobu in the cell shouldn't have any forward ptrs
+        // EXCEPT this hack violates both Grosse Pointe Blank and Bullitt -- what was I thinking?
+        // if (i == thisvobu->lastvobuincell)
+        //      nff = i + 1;
+      /* note table entries are in order of decreasing time step */
+        write4
+          (
+            buf + 0x53d - j * 4, /* forward jump */
+            getsect
+              (
+                thisvob,
+                vobuindex,
+                nff,
+                j >= 15 && nff > vff + 1 && videobetween(st, vobuindex, nff),
+                0x3fffffff
+              )
+          );
+        write4
+          (
+            buf + 0x549 + j * 4, /* backward jump */
+            getsect
+              (
+                thisvob,
+                vobuindex,
+                nrew,
+                j >= 15 && nrew < vrew - 1 && videobetween(st, vobuindex, nrew),
+                0x3fffffff
+              )
+          );
+        vff = nff;
+        vrew = nrew;
+      } /*for*/
+    if (thisvobu->hasvideo)
+        st->prevvideo = vobuindex;
+  } /*seekrow*/
+
+static const unsigned char *seekget(struct seektable *st, int vobuindex)
+  /* returns the DSI search information for the specified VOBU, computing it if
+    necessary. VOBUs must be asked for in order. */
+  {
+    if (vobuindex >= st->first + st->count)
+      {
+        int i;
+        st->first = vobuindex;
+        st->count = st->vob->numvobus - vobuindex < SEEKCHUNK ? st->vob->numvobus - vobuindex : SEEKCHUNK;
+        for (i = 0; i < st->count; i++)
+            seekrow(st, st->first + i, st->rows + i * st->rowlen);
+      } /*if*/
+    return
+        st->rows + (vobuindex - st->first) * st->rowlen;
+  } /*seekget*/
+
+void FixVobus(const char *fbase, struct vobgroup *va, const struct workset *ws, vtypes ismenu)
   /* fills in the NAV packs (i.e. PCI and DSI packets) for each VOBU in the
-    already-written output VOB files. */
+    already-written output VOB files, and in the output FindVobus held back
+    in memory, which can then be written out complete. */
   {
+    struct vobwriter * const held = va->heldvob;
+    struct navbatch * const nb = malloc(sizeof(struct navbatch));
     int outvob = -1;
-    int vobuindex, j, pn, fnum = -2;
+    struct seektable * const st = malloc(sizeof(struct seektable));
+    int vobuindex, j, pn, fnum = -2, numheld = 0;
     pts_t scr;
-    int vff, vrew;
     int totvob, curvob; /* for displaying statistics */
+    struct phasetimer timer;
+    uint64_t written;
 
+    phase_start(&timer, "FixVobus", 0, false);
     totvob = 0;
     for (pn = 0; pn < va->numvobs; pn++)
         totvob += va->vobs[pn]->numvobus;
@@ -2274,6 +4763,7 @@ void FixVobus(const char *fbase,const struct vobgroup *va,const struct workset *
     for (pn = 0; pn < va->numvobs; pn++)
       {
         const struct vob * const thisvob = va->vobs[pn];
+        seekinit(st, va, thisvob);
         for (vobuindex = 0; vobuindex < thisvob->numvobus; vobuindex++)
           {
             const struct vobuinfo * const thisvobu = &thisvob->vobu[vobuindex];
@@ -2283,7 +4773,10 @@ void FixVobus(const char *fbase,const struct vobgroup *va,const struct workset *
               {
               /* time to start a new output file */
                 if (outvob >= 0)
+                  {
+                    navflush(nb);
                     flushclose(outvob);
+                  } /*if*/
                 fnum = thisvobu->fnum;
                 if (fbase)
                   {
@@ -2311,9 +4804,11 @@ void FixVobus(const char *fbase,const struct vobgroup *va,const struct workset *
                       } /*if*/
                     free(fname);
                   } /*if*/
+                nb->fd = outvob;
+                nb->count = 0;
               } /*if*/
 
-            memcpy(buf, thisvobu->sectdata, 0x26);
+            memcpy(buf, thisvob->vobuhdr[vobuindex], 0x26);
             write4(buf + 0x26, 0x100 + MPID_PRIVATE2); // private stream 2
             write2(buf + 0x2a, 0x3d4); // length
             buf[0x2c] = 0; /* substream ID, 0 = PCI */
@@ -2462,163 +4957,26 @@ void FixVobus(const char *fbase,const struct vobgroup *va,const struct workset *
               /* time of last video frame in last GOP of VOB */
           /* audio gap stuff not supported for now */
           /* seamless angle stuff not supported for now */
-            write4
-              (
-                buf + 0x4f1,
-                getsect(thisvob, vobuindex, findnextvideo(thisvob, vobuindex, 1), 0, 0xbfffffff)
-              );
-              /* offset to next VOBU with video */
-          /* offset to next VOBU at various times forward filled in below */
-            write4(buf + 0x541, getsect(thisvob, vobuindex, vobuindex + 1, 0, 0x3fffffff));
-              /* offset to next VOBU */
-            write4(buf + 0x545, getsect(thisvob, vobuindex, vobuindex - 1, 0, 0x3fffffff));
-              /* offset to previous VOBU */
-          /* offset to previous VOBU at various times backward filled in below */
-            write4
-              (
-                buf + 0x595,
-                getsect(thisvob, vobuindex, findnextvideo(thisvob, vobuindex, -1), 0, 0xbfffffff)
-              );
-              /* offset to previous VOBU with video */
-            for (j = 0; j < va->numaudiotracks; j++)
-              {
-                int s = getaudch(va, j);
-                if (s >= 0)
-                    s = findaudsect(thisvob, s, thisvobu->sectpts[0], thisvobu->sectpts[1]);
-                if (s >= 0)
-                  {
-                    s = s - thisvobu->sector;
-                    if (s > 0x1fff || s < -(0x1fff))
-                      {
-                        fprintf
-                          (
-                            stderr,
-                            "\nWARN: audio sector out of range: %d (vobu #%d, pts ",
-                            s,
-                            vobuindex
-                          );
-                        printpts(thisvobu->sectpts[0]);
-                        fprintf(stderr, ")\n");
-                        s = 0;
-                      } /*if*/
-                    if (s < 0)
-                        s = (-s) | 0x8000; /* absolute value + backward-direction flag */
-                  }
-                else
-                    s = 0x3fff; /* no more audio for this stream */
-                write2(buf + 0x599 + j * 2, s);
-                  /* relative offset to first audio packet in this stream for this VOBU */
-              } /*for*/
-            for (j = 0; j < va->numsubpicturetracks; j++)
-              {
-                const struct audchannel * const ach = &thisvob->audch[j | 32];
-                int s;
-                if (ach->numaudpts)
-                  {
-                    int id = findspuidx(thisvob, j | 32, thisvobu->sectpts[0]);
-                    // if overlaps A, point to A
-                    // else if (A before here or doesn't exist) and (B after here or doesn't exist),
-                    //     point to here
-                    // else point to B
-                    if
-                      (
-                            id >= 0
-                        &&
-                            ach->audpts[id].pts[0] < thisvobu->sectpts[1]
-                        &&
-                            ach->audpts[id].pts[1] >= thisvobu->sectpts[0]
-                      )
-                        s = findvobubysect(thisvob, ach->audpts[id].asect);
-                    else if
-                      (
-                            (id < 0 || ach->audpts[id].pts[1] < thisvobu->sectpts[0])
-                         &&
-                            (
-                                id + 1 == ach->numaudpts
-                            ||
-                                ach->audpts[id + 1].pts[0] >= thisvobu->sectpts[1]
-                            )
-                      )
-                        s = vobuindex;
-                    else
-                        s = findvobubysect(thisvob, ach->audpts[id + 1].asect);
-                    id = (s < vobuindex);
-                    s = getsect(thisvob, vobuindex, s, 0, 0x7fffffff) & 0x7fffffff;
-                    if (!s) /* same VOBU */
-                        s = 0x7fffffff;
-                          /* indicates current or later VOBU, no explicit forward offsets */
-                    if (s != 0x7fffffff && id)
-                        s |= 0x80000000; /* indicates offset to prior VOBU */
-                  }
-                else
-                    s = 0; /* doesn't exist */
-                write4(buf + 0x5a9 + j * 4, s);
-                  /* relative offset to VOBU (NAV pack) containing subpicture data
-                    for this stream for this VOBU */
-              } /*for*/
             write4(buf + 0x40f, thisvobu->lastsector - thisvobu->sector);
               /* relative offset to last sector of VOBU */
-            vff = vobuindex;
-            vrew = vobuindex;
-            for (j = 0; j < 19; j++)
-              {
-              /* fill in offsets to next/previous VOBUs at various time steps */
-                int nff, nrew;
-                nff = findvobu
-                  (
-                    thisvob,
-                    thisvobu->sectpts[0] + timeline[j] * DVD_FFREW_HALFSEC,
-                    thisvobu->firstvobuincell,
-                    thisvobu->lastvobuincell
-                  );
-                // a hack -- the last vobu in the cell shouldn't have any forward ptrs
-                // EXCEPT this hack violates both Grosse Pointe Blank and Bullitt -- what was I thinking?
-                // if (i == thisvobu->lastvobuincell)
-                //      nff = i + 1;
-                nrew = findvobu
-                  (
-                    thisvob,
-                    thisvobu->sectpts[0] - timeline[j] * DVD_FFREW_HALFSEC,
-                    thisvobu->firstvobuincell,
-                    thisvobu->lastvobuincell
-                  );
-              /* note table entries are in order of decreasing time step */
-                write4
-                  (
-                    buf + 0x53d - j * 4, /* forward jump */
-                    getsect(thisvob, vobuindex, nff, j >= 15 && nff > vff + 1, 0x3fffffff)
-                  );
-                write4
-                  (
-                    buf + 0x549 + j * 4, /* backward jump */
-                    getsect(thisvob, vobuindex, nrew, j >= 15 && nrew < vrew - 1, 0x3fffffff)
-                  );
-                vff = nff;
-                vrew = nrew;
-              } /*for*/
+            memcpy(buf + DSI_SEEK_START, seekget(st, vobuindex), st->rowlen);
+              /* offsets to VOBUs with video, VOBUs at various times forward and backward,
+                and audio and subpicture packets */
 
           /* NAV pack all done, write it out */
-            if (outvob != -1)
+            if (held && fnum == held->fnum && thisvobu->fsect >= held->heldsect)
               {
-                if (lseek(outvob, thisvobu->fsect * 2048, SEEK_SET) == (off_t)-1)
-                  /* where the NAV pack should go */
-                  {
-                    fprintf(stderr, "ERR:  Error %d -- %s -- seeking in output VOB\n", errno, strerror(errno));
-                    exit(1);
-                  } /*if*/
-                if (write(outvob, buf, 2048) != 2048)
-                  {
-                    fprintf
-                      (
-                        stderr,
-                        "ERR:  Error %d -- %s -- writing NAV PACK to output VOB\n",
-                        errno,
-                        strerror(errno)
-                      );
-                    exit(1);
-                  } /*if*/
-                  /* update it */
-              } /*if*/
+              /* sector is still in memory */
+                memcpy
+                  (
+                    held->held + (held->heldfirst + thisvobu->fsect - held->heldsect) % held->heldmax * 2048,
+                    buf,
+                    2048
+                  );
+                numheld++;
+              }
+            else if (outvob != -1)
+                navqueue(nb, (off_t)thisvobu->fsect * 2048, buf); /* where the NAV pack should go */
             curvob++;
             if (!(curvob & 15)) /* time for another progress update */
                 fprintf
@@ -2631,10 +4989,34 @@ void FixVobus(const char *fbase,const struct vobgroup *va,const struct workset *
                     curvob * 100 / totvob
                   );
           } /*for vobuindex*/
+        seekfree(st);
+        releasevobtables(thisvob);
       } /*for pn*/
     if (outvob != -1)
+      {
+        navflush(nb);
         flushclose(outvob);
+      } /*if*/
+    free(nb);
+    free(st);
+    written = fbase ? (uint64_t)(totvob - numheld) * 2048 : 0;
+    if (held)
+      {
+        const double starttime = nowseconds();
+        writeclose(held);
+        written += held->totalwritten;
+        vobstats.bytes += held->totalwritten;
+        vobstats.seconds += nowseconds() - starttime;
+        writerfree(held);
+        va->heldvob = 0;
+      } /*if*/
     if (totvob > 0)
-        fprintf(stderr, "STAT: fixed %d VOBUs                         ", totvob);
+      {
+        fprintf(stderr, "STAT: fixed %d VOBUs", totvob);
+        if (held)
+            fprintf(stderr, ", %d before writing", numheld);
+        fprintf(stderr, "                         ");
+      } /*if*/
     fprintf(stderr, "\n");
+    phase_stop(&timer, 0, written, totvob);
   } /*FixVobus*/
@@ -36,6 +36,16 @@ bool
     parser_acceptbody = false;
 char
     *parser_body = 0;
+uint64_t
+    parser_digest = 14695981039346656037ULL;
+
+static void digest(const char *s)
+  /* folds s, including its terminating null, into parser_digest. */
+  {
+    do
+        parser_digest = (parser_digest ^ (unsigned char)*s) * 1099511628211ULL;
+    while (*s++);
+  } /*digest*/
 
 static int xml_varied_read(void *context, char *buffer, int len)
   {
@@ -124,11 +134,14 @@ int readxml
                         if (parser_err)
                             return 1;
                       } /*if*/
+                    digest(elemname);
                     while (xmlTextReaderMoveToNextAttribute(f))
                       {
                         const char * const nm = (const char *)xmlTextReaderName(f);
                         const char * const v = (const char *)xmlTextReaderValue(f);
                         int attrindex;
+                        digest(nm);
+                        digest(v);
                         for (attrindex = 0; attrs[attrindex].elem; attrindex++)
                             if
                               (
@@ -171,6 +184,7 @@ int readxml
                     if (empty)
                       {
                       /* tag ends immediately */
+                        digest("/");
                         if (elems[tagindex].end)
                           {
                             elems[tagindex].end();
@@ -199,6 +213,7 @@ int readxml
         case XML_READER_TYPE_END_ELEMENT:
           {
             const int tagindex = statehistory[xmlTextReaderDepth(f)];
+            digest("/");
             if (elems[tagindex].end)
               {
                 elems[tagindex].end();
@@ -244,6 +259,7 @@ has_nonws_body:
                 fprintf(stderr, "ERR:  text not allowed here\n");
                 return 1;
               } /*if*/
+            digest(v);
             if (!parser_body)
                 parser_body = strdup(v); /* first lot of tag content */
             else
@@ -38,3 +38,6 @@ extern bool parser_acceptbody;
     set true by a tag-start action */
 extern char *parser_body;
   /* tag content, if any, saved here. Note I don't handle sub-tags mixed with content. */
+extern uint64_t parser_digest;
+  /* hash of all element names, attributes and content parsed so far. Can be
+    reset by a callback action to hash a particular part of the file. */
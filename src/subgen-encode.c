@@ -29,277 +29,334 @@
 #include "subgen.h"
 #include "common.h"
 
-static int remainbit,subo;
+struct bitwriter /* accumulates an encoded subpicture unit */
+  {
+    unsigned char *buf; /* SUB_BUFFER_MAX + SUB_BUFFER_HEADROOM bytes */
+    int pos; /* nr of bytes written so far, may go past the end of buf if too much */
+    uint64_t acc; /* bits not yet written out, the last "bits" of them */
+    int bits; /* always less than 32 between calls */
+  };
 
-static void store_init()
-{
-    memset(sub,0,SUB_BUFFER_MAX);
-    remainbit=8;
-    subo=0;
-}
+#define BUFLIMIT (SUB_BUFFER_MAX + SUB_BUFFER_HEADROOM)
 
-static int bitmask[9]={0,1,3,7,15,31,63,127,255};
-static void store_bits(unsigned int val,int bits)
-{
-    if( subo>SUB_BUFFER_MAX )
-        return;
-    while(bits) {
-        if( bits>remainbit ) {
-            sub[subo++]|=(val>>(bits-remainbit))&bitmask[remainbit];
-            bits-=remainbit;
-            remainbit=8;
-        } else if( bits==remainbit ) {
-            sub[subo++]|=val&bitmask[remainbit];
-            remainbit=8;
-            return;
-        } else {
-            sub[subo]|=(val&bitmask[bits])<<(remainbit-bits);
-            remainbit-=bits;
-            return;
-        }
-    }
-}
+static void bw_init(struct bitwriter *bw, unsigned char *buf)
+  {
+    bw->buf = buf;
+    bw->pos = 0;
+    bw->acc = 0;
+    bw->bits = 0;
+  } /*bw_init*/
+
+static inline void bw_put(struct bitwriter *bw, uint32_t val, int bits)
+  /* appends the low-order bits of val, bits being in [1 .. 32]. */
+  {
+    bw->acc = bw->acc << bits | (val & (uint32_t)0xffffffff >> (32 - bits));
+    bw->bits += bits;
+    if (bw->bits >= 32)
+      {
+        const uint32_t w = bw->acc >> (bw->bits - 32);
+        bw->bits -= 32;
+        if (bw->pos + 4 <= BUFLIMIT)
+          {
+            bw->buf[bw->pos] = w >> 24;
+            bw->buf[bw->pos + 1] = w >> 16;
+            bw->buf[bw->pos + 2] = w >> 8;
+            bw->buf[bw->pos + 3] = w;
+          } /*if*/
+        bw->pos += 4;
+      } /*if*/
+  } /*bw_put*/
 
-static void store_2bit(int val)
-{
-    assert(val>=0 && val<=3);
-    store_bits(val,2);
-}
+static void bw_align(struct bitwriter *bw)
+  /* pads with zero bits to a byte boundary. */
+  {
+    if (bw->bits & 7)
+        bw_put(bw, 0, 8 - (bw->bits & 7));
+  } /*bw_align*/
 
-static void store_nibble(int val)
-{
-    assert(val>=0 && val<=15);
-    store_bits(val,4);
-}
+static int bw_tell(struct bitwriter *bw)
+  /* returns the offset of the next byte to be written, which must be on
+    a byte boundary. */
+  {
+    assert((bw->bits & 7) == 0);
+    for (; bw->bits; bw->bits -= 8)
+      {
+        if (bw->pos < BUFLIMIT)
+            bw->buf[bw->pos] = bw->acc >> (bw->bits - 8);
+        bw->pos++;
+      } /*for*/
+    return
+        bw->pos;
+  } /*bw_tell*/
+
+static void bw_skip(struct bitwriter *bw, int nrbytes)
+  /* leaves room for nrbytes bytes to be filled in later with bw_patch. */
+  {
+    for (; nrbytes; nrbytes--)
+        bw_put(bw, 0, 8);
+  } /*bw_skip*/
 
+static void bw_patch(struct bitwriter *bw, int at, int val)
+  /* fills in two bytes at offset at with val. */
+  {
+    if (at + 2 <= BUFLIMIT)
+      {
+        bw->buf[at] = val >> 8;
+        bw->buf[at + 1] = val;
+      } /*if*/
+  } /*bw_patch*/
 
-static void store_trinibble(int val)
+static void bw_nibble(struct bitwriter *bw, int val)
 {
-    store_nibble((val>>8)&15);
-    store_nibble((val>>4)&15);
-    store_nibble(val&15);
+    assert(val>=0 && val<=15);
+    bw_put(bw,val,4);
 }
 
-static void store_align()
+static void bw_trinibble(struct bitwriter *bw, int val)
 {
-    if( remainbit!=8 )
-        store_bits(0,remainbit);
+    bw_put(bw,val,12);
 }
 
-static void store_1(int val)
+static void bw_1(struct bitwriter *bw, int val)
 {
-    store_bits(val,8);
+    bw_put(bw,val,8);
 }
 
-static void store_2(int val)
+static void bw_2(struct bitwriter *bw, int val)
 {
-    store_bits(val,16);
+    bw_put(bw,val,16);
 }
 
-static void store_4(unsigned int val)
+static void bw_4(struct bitwriter *bw, unsigned int val)
 {
-    store_bits(val,32);
+    bw_put(bw,val,32);
 }
 
-static void svcd_rotate(stinfo *s)
-  /* ensures the most popular colour has palette index 0, because that
-    is the only index that SVCD does run-length compression for. */
+static inline int runlength(const unsigned char *p, int x, int xd)
+  /* returns the number of pixels from p[x] onwards, up to p[xd - 1], with the
+    same colour as p[x]. Whole words are compared while it continues. */
+  {
+    const int c = p[x];
+    int end = x + 1;
+    if (end + 8 <= xd)
+      {
+        const uint64_t pattern = c * UINT64_C(0x0101010101010101);
+        uint64_t w;
+        memcpy(&w, p + end, 8);
+        while (w == pattern)
+          {
+            end += 8;
+            if (end + 8 > xd)
+                break;
+            memcpy(&w, p + end, 8);
+          } /*while*/
+      } /*if*/
+    while (end < xd && p[end] == c)
+        end++;
+    return
+        end - x;
+  } /*runlength*/
+
+static int svcd_rotate(const stinfo *s)
+  /* returns how far to rotate the colour table so the most popular colour ends
+    up at palette index 0, because that is the only index that SVCD does
+    run-length compression for. */
   {
     int cst[4]; /* colour histogram */
     int i, j;
+    const unsigned char *p = s->fimg, * const end = s->fimg + s->xd * s->yd;
     for (i = 0; i < 4; i++)
         cst[i] = 0;
-    for (i = 0; i < s->xd * s->yd; i++)
-        cst[s->fimg[i]]++;
+    while (p != end)
+      {
+        const int n = runlength(p, 0, end - p);
+        cst[*p] += n;
+        p += n;
+      } /*while*/
     j = 0;
     for (i = 1; i < 4; i++) /* find most popular colour */
         if (cst[i] > cst[j])
             j = i;
-    if (j != 0)
-      { /* rotate entire colour table so most popular colour ends up at index 0 */
-        colorspec p[4];
-        for (i = 0; i < s->xd * s->yd; i++)
-            s->fimg[i] = s->fimg[i] - j & 3;
-        for (i = 0; i < 4; i++)
-            p[i] = s->pal[i + j & 3];
-        memcpy(s->pal, p, 4 * sizeof(colorspec));
-      } /*if*/
+    return
+        j;
   } /*svcd_rotate*/
 
-int svcd_encode(stinfo *s)
+static void svcd_encode_row(struct bitwriter *bw, const unsigned char *row, int xd, int rot)
+  /* encodes one row of pixels, with colour index rot becoming 0. */
+  {
+    int x, c;
+    for (x = 0; x < xd;)
+      {
+        if (row[x] != rot)
+          {
+            bw_put(bw, row[x] - rot & 3, 2);
+            x++;
+          }
+        else
+          {
+            c = runlength(row, x, xd);
+            x += c;
+            while (c > 4)
+              {
+                bw_nibble(bw, 3);
+                c -= 4;
+              } /*while*/
+            bw_nibble(bw, c - 1);
+          } /*if*/
+      } /*for*/
+    bw_align(bw);
+  } /*svcd_encode_row*/
+
+int svcd_encode(stinfo *s, unsigned char *sub)
 {
-    unsigned int x,y,c,l2o;
-    const colorspec * const epal = s->pal;
+    unsigned int y,c,l2o;
+    const int rot = svcd_rotate(s);
+    colorspec epal[4];
+    struct bitwriter bw;
 
-    svcd_rotate(s);
+    for (c = 0; c < 4; c++)
+        epal[c] = s->pal[c + rot & 3];
 
-    store_init();
-    subo = 2;
+    bw_init(&bw, sub);
+    bw_skip(&bw, 2);
     if (s->sd != -1)
     {
-    store_2(0x2e00);
-        store_4(s->sd);
+    bw_2(&bw, 0x2e00);
+        bw_4(&bw, s->sd);
     }
     else
     {
-    store_2(0x2600);
+    bw_2(&bw, 0x2600);
     }
 
     if (debug > 2)
     fprintf(stderr,\
                 "sd: %d   xd: %d  yd: %d  x0: %d  y0: %d\n", s->sd, s->xd, s->yd, s->x0, s->y0);
 
-    store_2(s->x0);
-    store_2(s->y0);
-    store_2(s->xd);
-    store_2(s->yd);
+    bw_2(&bw, s->x0);
+    bw_2(&bw, s->y0);
+    bw_2(&bw, s->xd);
+    bw_2(&bw, s->yd);
     for(c = 0;c<4;c++)
     {
-    store_1(calcY(&epal[c]));
-    store_1(calcCr(&epal[c]));
-    store_1(calcCb(&epal[c]));
-    store_1(epal[c].a);
+    bw_1(&bw, calcY(&epal[c]));
+    bw_1(&bw, calcCr(&epal[c]));
+    bw_1(&bw, calcCb(&epal[c]));
+    bw_1(&bw, epal[c].a);
     }
 
-    store_1(0); //?????
+    bw_1(&bw, 0); //?????
 
-    l2o = subo;
-    subo += 2;
-    y = 0;
- odd_row:
-    for(; y<s->yd; y += 2)
-    {
-    for(x = 0; x<s->xd;x++)
-        {
-            if ((c = s->fimg[y*s->xd+x]) != 0) store_2bit(c);
-            else
-            {
-                c = 1;
-                while (((++x)<s->xd)  &&  (!s->fimg[y*s->xd+x])) c++;
-                x--;
-                while (c>4)
-                {
-                    store_nibble(3);
-                    c -= 4;
-                }
-                store_nibble(c-1);
-            }
-        }
-        store_align();
-    }
+    l2o = bw_tell(&bw);
+    bw_skip(&bw, 2);
+    for (y = 0; y < s->yd; y += 2) /* even field */
+        svcd_encode_row(&bw, s->fimg + y * s->xd, s->xd, rot);
 
-    if (!(y&1))
+    if (!(bw_tell(&bw)&1))
     {
-    if (!(subo&1))
-        {
-            if (debug>3)
-                fprintf(stderr,\
-            "padded betweed fields with 1 byte to %d\n",subo%4);
-            store_1( 0 );
-        }
-    y = 1;
-    sub[l2o] = (subo - l2o - 2) >> 8;
-    sub[l2o+1] = (subo - l2o - 2);
-    goto odd_row;
+        if (debug>3)
+            fprintf(stderr,\
+        "padded betweed fields with 1 byte to %d\n",bw_tell(&bw)%4);
+        bw_1(&bw, 0);
     }
+    bw_patch(&bw, l2o, bw_tell(&bw) - l2o - 2);
+
+    for (y = 1; y < s->yd; y += 2) /* odd field */
+        svcd_encode_row(&bw, s->fimg + y * s->xd, s->xd, rot);
 
-    store_1( 0 );// no additional commands
+    bw_1(&bw, 0);// no additional commands
     c = 0;
-    while (subo&3)
+    while (bw_tell(&bw)&3)
     {
-    store_1( 0 ); c++;
+    bw_1(&bw, 0); c++;
     }
     if (debug>3) fprintf(stderr,"padded with %d byte\n",c);
 
-    sub[0] = subo >> 8;
-    sub[1] = subo;
-    if (subo == 65536) return -1;
-    else return subo;
+    bw_patch(&bw, 0, bw_tell(&bw));
+    if (bw.pos > SUB_BUFFER_MAX) return -1;
+    else return bw.pos;
 } /* end function svcd_encode */
 
 
-int cvd_encode(stinfo *s)
+static void cvd_encode_row(struct bitwriter *bw, const unsigned char *row, int xd)
+  /* encodes one row of pixels. */
+  {
+    int x, c, d;
+    for (x = 0; x < xd;)
+      {
+        d = row[x];
+        c = runlength(row, x, xd);
+        x += c;
+        if (x == xd)
+          {
+            bw_nibble(bw, 0);
+            bw_nibble(bw, d);
+            bw_align(bw);
+            continue;
+          } /*if*/
+        while (c > 3)
+          {
+            bw_nibble(bw, 12 + d);
+            c -= 3;
+          } /*while*/
+        bw_nibble(bw, (c << 2) + d);
+      } /*for*/
+  } /*cvd_encode_row*/
+
+int cvd_encode(stinfo *s, unsigned char *sub)
 {
-    unsigned int x, y, c, d;
+    unsigned int y, c;
     colorspec *epal=s->pal;
     int ofs, ofs1=0;
+    struct bitwriter bw;
 
-    store_init();
-    subo = 4;
+    bw_init(&bw, sub);
+    bw_skip(&bw, 4);
     ofs = 4;
 
-    for(y = 0; y < s->yd; y += 2)
-    {
-    odd_row_cvd:
-    for(x = 0; x < s->xd;)
-        {
-            d = s->fimg[y * s->xd + x];
-            c = 1;
-            while (((++x) < s->xd)  &&  (s->fimg[y * s->xd + x] == d) ) c++;
-            if(x == s->xd)
-            {
-                store_nibble(0);
-                store_nibble(d);
-                store_align();
-                continue;
-            }
-
-            while(c > 3)
-            {
-                store_nibble(12 + d);
-                c -= 3;
-            }
-
-            store_nibble((c << 2) + d);
-        }
-    }
-
-    if(!(y & 1))
-    {
-    y = 1;
-    ofs1 = subo;
-    goto odd_row_cvd;
-    }
+    for (y = 0; y < s->yd; y += 2) /* even field */
+        cvd_encode_row(&bw, s->fimg + y * s->xd, s->xd);
+    ofs1 = bw_tell(&bw);
+    for (y = 1; y < s->yd; y += 2) /* odd field */
+        cvd_encode_row(&bw, s->fimg + y * s->xd, s->xd);
 
-    sub[2] = subo >> 8;
-    sub[3] = subo;
+    bw_patch(&bw, 2, bw_tell(&bw));
 
 /* setting this to all 0xff then no more subtitles */
-    store_1( 0x0c );
-    store_1( 0 );
-    store_1( 0 );
-    store_1( 0 );
+    bw_1(&bw, 0x0c );
+    bw_1(&bw, 0 );
+    bw_1(&bw, 0 );
+    bw_1(&bw, 0 );
 
 /* set pallette 0-3 */
     for(c = 0; c < 4; c++)
     {
-//#define nco if (subo<65536) sub[subo++]
-    store_1( 0x24 + c );
+    bw_1(&bw, 0x24 + c );
     if(debug > 3)
         {
             fprintf(stderr, "c=%d R=%.2f G=%.2f B=%.2f\n",\
                     c, (double)epal[c].r, (double)epal[c].g, (double)epal[c].b);
         }
 
-    store_1( calcY(&epal[c]) );
-    store_1( calcCr(&epal[c]) );
-    store_1( calcCb(&epal[c]) );
+    bw_1(&bw, calcY(&epal[c]) );
+    bw_1(&bw, calcCr(&epal[c]) );
+    bw_1(&bw, calcCb(&epal[c]) );
 
     } /* end for pallette 0-3 */
 
 /* sethighlight  pallette  */
     for(c = 0; c < 4; c++)
     {
-    store_1( 0x2c + c );
+    bw_1(&bw, 0x2c + c );
     if(debug > 3)
         {
             fprintf(stderr, "c=%d R=%.2f G=%.2f B=%.2f\n",\
                     c, (double)epal[c].r, (double)epal[c].g, (double)epal[c].b);
         }
 
-    store_1( calcY(&epal[c]) );
-    store_1( calcCr(&epal[c]) );
-    store_1( calcCb(&epal[c]) );
+    bw_1(&bw, calcY(&epal[c]) );
+    bw_1(&bw, calcCr(&epal[c]) );
+    bw_1(&bw, calcCb(&epal[c]) );
     } /* end for pallette 4-7 */
 
     if(debug > 3)
@@ -310,51 +367,49 @@ int cvd_encode(stinfo *s)
     }
 
 /* x0, y0 */
-    store_trinibble( 0x17f );
-    store_bits(s->x0,10);
-    store_bits(s->y0,10);
+    bw_trinibble(&bw, 0x17f );
+    bw_put(&bw, s->x0,10);
+    bw_put(&bw, s->y0,10);
 
 /* xd, yd */
-    store_trinibble( 0x1ff );
-    store_bits(s->x0+s->xd-1,10);
-    store_bits(s->y0+s->yd-1,10);
+    bw_trinibble(&bw, 0x1ff );
+    bw_put(&bw, s->x0+s->xd-1,10);
+    bw_put(&bw, s->y0+s->yd-1,10);
 
 /* 0x37 is pallette.a 0-3 contrast */
-    store_2( 0x37ff );
-//nco = 0x00;
-//nco = 0xff;
-    store_nibble( epal[3].a >> 4 );
-    store_nibble( epal[2].a >> 4 );
-    store_nibble( epal[1].a >> 4 );
-    store_nibble( epal[0].a >> 4 );
+    bw_2(&bw, 0x37ff );
+    bw_nibble(&bw, epal[3].a >> 4 );
+    bw_nibble(&bw, epal[2].a >> 4 );
+    bw_nibble(&bw, epal[1].a >> 4 );
+    bw_nibble(&bw, epal[0].a >> 4 );
 
-    if(debug > 3)
+    if(debug > 3 && bw_tell(&bw) <= BUFLIMIT)
     {
     fprintf(stderr, "EPALS nco0(2 3h, 2l)=%02x nco1(2 1h,0l)=%02x\n",\
-                sub[subo - 1], sub[subo - 2]);
+                sub[bw_tell(&bw) - 1], sub[bw_tell(&bw) - 2]);
     }
 
 /* 0x3f is high light pallette.a 4-7 contrast */
-    store_2( 0x3fff );
-    store_2( 0xfff0 );
+    bw_2(&bw, 0x3fff );
+    bw_2(&bw, 0xfff0 );
 
 /* ofs is 4 ? is offset in bitmap to first field data (interlace) */
-    store_2( 0x47ff );
-    store_2( ofs );
+    bw_2(&bw, 0x47ff );
+    bw_2(&bw, ofs );
 
 /* ofs1 is offset to other field in bitmap (interlace) */
-    store_2( 0x4fff );
-    store_2( ofs1 );
+    bw_2(&bw, 0x4fff );
+    bw_2(&bw, ofs1 );
 
 /* unknown!!! (in RX too!) setting all to 0xff keeps the pic on screen! */
-    store_1( 0x0c );
-    store_1( 0 );
-    store_1( 0 );
-    store_1( 0 );
+    bw_1(&bw, 0x0c );
+    bw_1(&bw, 0 );
+    bw_1(&bw, 0 );
+    bw_1(&bw, 0 );
 
 /* sd, time in display, duration */
-    store_1( 0x04 );
-    store_bits( s->sd, 24 );
+    bw_1(&bw, 0x04 );
+    bw_put(&bw, s->sd, 24 );
 
 // IA3
 //0: 02 68 02 24
@@ -366,118 +421,83 @@ int cvd_encode(stinfo *s)
 //6: 05 4f 15 40
 
 
-    sub[0] = subo >> 8;
-    sub[1] = subo;
-    store_1(4);
-    store_1(8);
-    store_1(12);
-    store_1(16);
+    bw_patch(&bw, 0, bw_tell(&bw));
+    bw_1(&bw, 4);
+    bw_1(&bw, 8);
+    bw_1(&bw, 12);
+    bw_1(&bw, 16);
 
-    if(subo == 65536) return -1;
-    else return subo;
+    if(bw_tell(&bw) > SUB_BUFFER_MAX) return -1;
+    else return bw.pos;
 } /* end function cvd_encode */
 
 
-static void do_rle(int count, int color)
-{
-    int a;
-
-    /* argument check */
-    assert(count>=1 && count<=255);
-    assert(color>=0 && color<=3);
-
-    /* make rle code in b */
-    a = (count << 2) | color;
-
-    /* a now ranges from 0x4 up, because count is at least 1 */
-
-    if(count >= 64)     // 64 - 255
-    {
-    /* 64-255, 16 bits, 0 0 0 0  0 0 n n  n n n n  n n c c */
-    store_nibble(0);
-    store_nibble( (a & 0xf00) >> 8);
-    store_nibble( (a & 0xf0) >> 4);
-    store_nibble( a & 0xf);
-    }
-    else if(count >= 16)    // 16 - 63
-    {
-    /* 16 - 63, 12 bits, 0 0 0 0  n n n n  n n c c */
-    store_nibble( 0);
-    store_nibble( (a & 0xf0) >> 4);
-    store_nibble( a & 0xf);
-    }
-    else if(count >= 4)     // 4 - 15
-    {
-    /* 4-15, 8 bits, 0 0 n n  n n c c */
-    store_nibble( (a & 0xf0) >> 4);
-    store_nibble( a & 0xf);
-    }
-    else            // 1 - 3
-    {
-    /* 1-3, 4 bits, n n c c */
-    store_nibble( a & 0xf );
-    }
-} /* end function do_rle */
-
-
-static void dvd_encode_row(int y,int xd,unsigned char *icptr)
-{
-    int new_pos, x;
-    int osubo=subo;
-
-    new_pos = 0;
-    icptr+=y*xd;
-    for(x = 0; x < xd-1; x++)
-    {
-        /* get color from x,y */
+/*
+  DVD run-length codes are (count << 2 | colour) in 4, 8, 12 or 16 bits,
+  depending on the count, with leading zero nibbles making up the width:
 
-        if(icptr[x + 1] != icptr[x])
-        {
-            int count=x+1-new_pos;
-            while(count>255) {
-                do_rle(255,icptr[x]);
-                count-=255;
-            }
-            if( count )
-                do_rle(count,icptr[x]);
-            new_pos = x + 1;
-        }
-    } /* end for x */
+   1-3:      n n c c
+   4-15:     0 0 n n  n n c c
+   16-63:    0 0 0 0  n n n n  n n c c
+   64-255:   0 0 0 0  0 0 n n  n n n n  n n c c
 
-    /*
-      One special case,
-      encoding a count of zero using the 16-bit format,
-      indicates the same pixel value until the end of the line.
-    */
+  A count of zero in 16 bits means the same colour to the end of the line.
+*/
 
-    if( xd != new_pos )
-    {
-        int count=xd-new_pos;
-
-        if( count < 64 )
-            do_rle(count,icptr[new_pos]);
-        else {
-            /* send same colors to end of line */
-            store_nibble(0);
-            store_nibble(0);
-            store_nibble(0);
-            store_nibble(icptr[new_pos]);
-        }
-    }
+#define RLE4(n) n, n, n, n
+#define RLE16(n) RLE4(n), RLE4(n), RLE4(n), RLE4(n)
+#define RLE64(n) RLE16(n), RLE16(n), RLE16(n), RLE16(n)
+static const unsigned char rlebits[256] = /* width in bits of the code for each count */
+  {
+    0, 4, 4, 4,
+    RLE4(8), RLE4(8), RLE4(8),
+    RLE16(12), RLE16(12), RLE16(12),
+    RLE64(16), RLE64(16), RLE64(16),
+  };
+#undef RLE4
+#undef RLE16
+#undef RLE64
+
+#define MAXROWBYTES (1440 / 8) /* limit on size of an encoded row */
+
+static void dvd_encode_row(struct bitwriter *bw,int y,int xd,const unsigned char *icptr)
+  /* appends the run-length encoding of row y of the image. */
+  {
+    const int start = bw_tell(bw);
+    int x;
+    icptr += y * xd;
+    for (x = 0; x < xd;)
+      {
+        const int c = icptr[x];
+        int count = runlength(icptr, x, xd);
+        x += count;
+        if (x == xd && count >= 64)
+          /* same colour to end of line */
+            bw_put(bw, c, 16);
+        else
+          {
+            while (count > 255)
+              {
+                bw_put(bw, 255 << 2 | c, 16);
+                count -= 255;
+              } /*while*/
+            bw_put(bw, count << 2 | c, rlebits[count]);
+          } /*if*/
+      } /*for*/
 
     /*
       If, at the end of a line, the bit count is not a multiple of 8, four fill bits of 0 are added.
     */
 
-    store_align();
+    bw_align(bw);
 
-    if( subo-osubo >= 1440/8 ) {
+    if( bw_tell(bw)-start >= MAXROWBYTES ) {
         fprintf(stderr,"ERR:  Encoded row takes more than 1440 bits.  Please simplify subtitle.\n");
         exit(1);
     }
-}
+  } /*dvd_encode_row*/
 
-int dvd_encode(stinfo *s)
+int dvd_encode(stinfo *s, unsigned char *sub)
 {
     int a;
     int xstart, xsize;
@@ -486,6 +506,7 @@ int dvd_encode(stinfo *s)
     int offset0, offset1;
     int y;
     unsigned char *icptr;
+    struct bitwriter bw;
 
     xstart = s->x0;
     xsize = s->xd;
@@ -510,21 +531,20 @@ int dvd_encode(stinfo *s)
     icptr = s->fimg;
 //icptr = img;// use if call to imgfix() commented out
 
-    store_init();
-    subo=0;
+    bw_init(&bw, sub);
 
     //2 bytes packet size, to be filled in later
     //2 bytes pointer to control area, to be filled in later
-    subo += 4;
+    bw_skip(&bw, 4);
 
     /* copy image data to sub */
-    offset0=subo;
+    offset0=bw_tell(&bw);
     for( y=0; y<s->yd; y+=2 ) /* top field */
-        dvd_encode_row(y,s->xd,icptr);
+        dvd_encode_row(&bw,y,s->xd,icptr);
 
-    offset1=subo;
+    offset1=bw_tell(&bw);
     for( y=1; y<s->yd; y+=2 ) /* bottom field */
-        dvd_encode_row(y,s->xd,icptr);
+        dvd_encode_row(&bw,y,s->xd,icptr);
 
     /* start first command block */
 /*
@@ -548,52 +568,50 @@ int dvd_encode(stinfo *s)
 */
 
     /* set pointer to this command block */
-    a = subo;
-    sub[2] = a >> 8;
-    sub[3] = a;
+    bw_patch(&bw, 2, bw_tell(&bw));
 
-    store_2(0); // delay to wait before executing this command block
+    bw_2(&bw,0); // delay to wait before executing this command block
 
     /* remember position, will set later */
-    next_command_ptr = subo;
-    subo+=2; // pointer to next command block, 2 bytes, to be filled in from next command block.
+    next_command_ptr = bw_tell(&bw);
+    bw_skip(&bw, 2); // pointer to next command block, 2 bytes, to be filled in from next command block.
 
 
     if( s->forced )
-        store_1(SPU_FSTA_DSP); /* command 0, forced start display, 1 byte. */
+        bw_1(&bw,SPU_FSTA_DSP); /* command 0, forced start display, 1 byte. */
     else
-        store_1(SPU_STA_DSP); /* command 1, start display, 1 byte */
+        bw_1(&bw,SPU_STA_DSP); /* command 1, start display, 1 byte */
 
     /* selected palettes for pixel value */
 
     /* command 3, palette, 3 bytes */
-    store_1(SPU_SET_COLOR);
-    store_nibble(findmasterpal(s,&s->pal[3]));
-    store_nibble(findmasterpal(s,&s->pal[2]));
-    store_nibble(findmasterpal(s,&s->pal[1]));
-    store_nibble(findmasterpal(s,&s->pal[0]));
+    bw_1(&bw,SPU_SET_COLOR);
+    bw_nibble(&bw,findmasterpal(s,&s->pal[3]));
+    bw_nibble(&bw,findmasterpal(s,&s->pal[2]));
+    bw_nibble(&bw,findmasterpal(s,&s->pal[1]));
+    bw_nibble(&bw,findmasterpal(s,&s->pal[0]));
 
     /* command 4, alpha blend, contrast / transparency t_palette, 3 bytes  0, 15, 15, 15 */
-    store_1(SPU_SET_CONTR);
-    store_nibble(s->pal[3].a>>4);
-    store_nibble(s->pal[2].a>>4);
-    store_nibble(s->pal[1].a>>4);
-    store_nibble(s->pal[0].a>>4);
+    bw_1(&bw,SPU_SET_CONTR);
+    bw_nibble(&bw,s->pal[3].a>>4);
+    bw_nibble(&bw,s->pal[2].a>>4);
+    bw_nibble(&bw,s->pal[1].a>>4);
+    bw_nibble(&bw,s->pal[0].a>>4);
 
     /* command 5, display area, 7 bytes from: startx, xsize, starty, ysize */
-    store_1(SPU_SET_DAREA);
-    store_trinibble(xstart);
-    store_trinibble(xstart+xsize-1);
-    store_trinibble(ystart);
-    store_trinibble(ystart+ysize-1);
+    bw_1(&bw,SPU_SET_DAREA);
+    bw_trinibble(&bw,xstart);
+    bw_trinibble(&bw,xstart+xsize-1);
+    bw_trinibble(&bw,ystart);
+    bw_trinibble(&bw,ystart+ysize-1);
 
     /* command 6, image offsets, 5 bytes */
-    store_1(SPU_SET_DSPXA);
-    store_2(offset0);
-    store_2(offset1);
+    bw_1(&bw,SPU_SET_DSPXA);
+    bw_2(&bw,offset0);
+    bw_2(&bw,offset1);
 
     /* command 0xff, end command block, 1 byte, */
-    store_1(SPU_CMD_END);
+    bw_1(&bw,SPU_CMD_END);
 
     /* end first command block */
 
@@ -604,55 +622,50 @@ int dvd_encode(stinfo *s)
         int duration;
 
         /* set pointer in previous block to point to this position */
-        a = subo;
-        sub[next_command_ptr+0] = a >> 8;
-        sub[next_command_ptr+1] = a;
+        bw_patch(&bw, next_command_ptr, bw_tell(&bw));
 
         /* update pointer to this command block */
-        next_command_ptr = subo;
+        next_command_ptr = bw_tell(&bw);
 
         /* delay to wait before executing next comand */
         duration = (s->sd+512)/1024;
         while( duration >= 65536 ) {
           /* duration too long for one command block, generate additional command blocks
             that do nothing but delay */
-            store_2(65535);
+            bw_2(&bw,65535);
             duration-=65535;
-            store_2(next_command_ptr+5);
-            store_1(SPU_CMD_END);
-            next_command_ptr = subo;
+            bw_2(&bw,next_command_ptr+5);
+            bw_1(&bw,SPU_CMD_END);
+            next_command_ptr = bw_tell(&bw);
         }
 
-        store_2(duration);
+        bw_2(&bw,duration);
 
         /* last block, point to self */
-        store_2(next_command_ptr);
+        bw_2(&bw,next_command_ptr);
 
         /* stop command (executed after above delay) */
-        store_1(SPU_STP_DSP);
+        bw_1(&bw,SPU_STP_DSP);
 
         /* end command block command */
-        store_1(SPU_CMD_END);
+        bw_1(&bw,SPU_CMD_END);
     } else {
-        a=next_command_ptr-2;
-        sub[next_command_ptr+0] = a >> 8;
-        sub[next_command_ptr+1] = a;
+        bw_patch(&bw, next_command_ptr, next_command_ptr-2);
     }
 
     /* end second commmand block */
 
 
     /* make size even if odd */
-    if(subo & 1)
+    if(bw_tell(&bw) & 1)
     {
     /* only if odd length, to make it even */
-    store_1(SPU_CMD_END);
+    bw_1(&bw,SPU_CMD_END);
     }
 
     /* set subtitle packet size */
-    a = subo;
-    sub[0] = a >> 8;
-    sub[1] = a;
+    a = bw_tell(&bw);
+    bw_patch(&bw, 0, a);
 
     if( a >= SUB_BUFFER_MAX )
         return -1;
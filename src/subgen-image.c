@@ -27,6 +27,9 @@
 #include <assert.h>
 #include <fcntl.h>
 #include <math.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #if defined(HAVE_MAGICK) || defined(HAVE_GMAGICK)
 #include <stdarg.h>
@@ -45,6 +48,11 @@
 
 bool text_forceit = false;     /* Forcing of the subtitles */
 sub_data *textsub_subdata;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t textsub_lock = PTHREAD_MUTEX_INITIALIZER;
+  /* text subtitles are laid out with the one set of fonts into the one
+    textsub_image_buffer, so only one can be rendered at a time */
+#endif
 
 static void constructblankpic(pict *p,int w,int h)
   /* allocates and fills in p with an image consisting entirely of transparent pixels */
@@ -313,14 +321,14 @@ static int read_png(pict *s)
 }
 #endif
 
-static int read_frame(pict *s)
-  /* fills in s from textsub_image_buffer. */
+static int read_frame(pict *s, const unsigned char *frame)
+  /* fills in s from frame, which is in the same format as textsub_image_buffer. */
   {
     int x, y;
     createimage(s, movie_width, movie_height);
     for (y = 0; y < movie_height; y++)
       {
-          const unsigned char * d = textsub_image_buffer + y * movie_width * 4;
+          const unsigned char * d = frame + y * movie_width * 4;
           for (x = 0; x < movie_width; x++)
             {
               colorspec p;
@@ -338,11 +346,22 @@ static int read_pic(stinfo *s, pict *p)
   /* gets the image(s) specified by p into s. */
   {
     int r = 0;
-    if (have_textsub)
+    if (s->sub_title) /* from the <textsub>, not an image file */
       {
+      /* take a copy of the rendered text, so the rest of the work on it
+        can go on while other threads render theirs */
+        unsigned char * const frame = malloc(textsub_image_buffer_size);
+#ifdef HAVE_PTHREAD
+        pthread_mutex_lock(&textsub_lock);
+#endif
         vo_update_osd(s->sub_title); /* will allocate and render into textsub_image_buffer */
+        memcpy(frame, textsub_image_buffer, textsub_image_buffer_size);
+#ifdef HAVE_PTHREAD
+        pthread_mutex_unlock(&textsub_lock);
+#endif
         s->forced = text_forceit;
-        r = read_frame(p);
+        r = read_frame(p, frame);
+        free(frame);
       }
     else /* read image file */
       {
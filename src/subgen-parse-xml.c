@@ -83,7 +83,7 @@ static unsigned int parsetime(const char *t)
         return rt * 90000 + 90000 * n / nd;
   } /*parsetime*/
 
-static bool
+static bool /* these are for the current control file */
     had_stream = false, /* whether I've seen <stream> */
     had_spu = false, /* whether I've seen <spu> */
     had_textsub = false; /* whether I've seen <textsub> */
@@ -276,7 +276,7 @@ static void textsub_begin()
         fprintf(stderr, "ERR:  cannot have both <spu> and <textsub>\n");
         exit(1);
       } /*if*/
-    if (had_textsub)
+    if (had_textsub || have_textsub) /* in this or an earlier control file */
       {
         fprintf(stderr,"ERR:  Only one textsub is currently allowed.\n");
         exit(1);
@@ -482,5 +482,8 @@ static struct elemattr spu_attrs[]={
 
 int spumux_parse(const char *fname)
 {
+   had_stream = false;
+   had_spu = false;
+   had_textsub = false;
    return readxml(fname,spu_elems,spu_attrs);
 }
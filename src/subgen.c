@@ -32,6 +32,12 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include <netinet/in.h>
 
@@ -66,7 +72,6 @@ the subpicture stream ID, based off the following values */
 
 static unsigned char *cbuf;
 
-static unsigned int spuindex;
 static bool
     show_progress = false,
     dodvdauthor_data = true,
@@ -87,17 +92,34 @@ int nr_subtitles_skipped;
 
 static char header[32];
 
-unsigned char *sub;
+static unsigned char *sub; /* subpicture unit encoded on the muxing thread */
 int debug;
 static int max_sub_size;
 
 static bool substream_present[256];
+static int jobs = 1; /* nr of subtitles to process at once */
+
+struct spustream /* a subpicture stream being inserted */
+  {
+    unsigned char substr; /* its substream ID */
+    stinfo **spus; /* its subtitles, as collected by spumux_parse */
+    int numspus;
+    int spuindex; /* index into spus of next subtitle to process */
+    stinfo *newsti; /* next subtitle to insert */
+    int subno; /* count of subtitles inserted, less 1 */
+    int header_size; /* PES header size including substream ID, 12 for its first packet */
+    int skipped; /* count of subtitles skipped */
+#ifdef HAVE_PTHREAD
+    struct renderpool *pool; /* NULL if subtitles are processed as they are muxed */
+#endif
+  };
 
+static struct spustream *streams; /* one per control file, in the order given */
+static int numstreams;
 
-// these 4 lines of variables are used by muxnext() and main() to communicate
-static int subno,secsize,mode,fdo,header_size,muxrate;
-static unsigned char substr, *sector;
-static stinfo *newsti;
+// these 3 lines of variables are used by muxnext() and main() to communicate
+static int secsize,mode,muxrate;
+static unsigned char *sector;
 static uint64_t lastgts, nextgts;
 
 
@@ -335,6 +357,7 @@ static void freestinfo(stinfo *s)
         free(s->buttons[i].right);
       } /*for*/
     free(s->buttons);
+    free(s->spu);
     free(s);
 }
 
@@ -397,57 +420,362 @@ static void wdstr(char *s)
     wdbyte(0);
 }
 
-static int sread(int h, void *b, int l)
-  /* reads l bytes into b from fd h. Returns actual nr bytes read, or -1 on error. */
+#define IORINGSIZE (1024 * 1024) /* size of input and output buffers, must be a power of 2 */
+
+struct ioring /* buffering for standard input or output */
   {
-    int tr = 0; /* count of bytes read */
-    while (l > 0)
+    int fd;
+    unsigned char *buf; /* IORINGSIZE bytes */
+    uint64_t head; /* total bytes ever put into buf */
+    uint64_t tail; /* total bytes ever taken out of buf */
+  };
+
+static struct ioring input, output;
+
+#ifndef HAVE_SYS_UIO_H
+struct iovec
+  {
+    void *iov_base;
+    size_t iov_len;
+  };
+#endif
+
+static void ringinit(struct ioring *r, int fd)
+  {
+    r->fd = fd;
+    r->buf = malloc(IORINGSIZE);
+    if (!r->buf)
+      {
+        fprintf(stderr, "ERR:  Could not allocate space for I/O buffer, aborting.\n");
+        exit(1);
+      } /*if*/
+    r->head = 0;
+    r->tail = 0;
+  } /*ringinit*/
+
+static int ringsegments(const struct ioring *r, uint64_t from, size_t len, struct iovec *iov)
+  /* fills in iov with the contiguous pieces of r->buf making up len bytes starting
+    at stream position from, and returns how many there are: 0, 1 or 2. */
+  {
+    const size_t start = from & (IORINGSIZE - 1);
+    if (!len)
+        return 0;
+    iov[0].iov_base = r->buf + start;
+    if (start + len <= IORINGSIZE)
       {
-        int r = read(h, b, l);
-        if (r == -1)
+        iov[0].iov_len = len;
+        return 1;
+      } /*if*/
+    iov[0].iov_len = IORINGSIZE - start;
+    iov[1].iov_base = r->buf;
+    iov[1].iov_len = len - iov[0].iov_len;
+    return 2;
+  } /*ringsegments*/
+
+static int ringfill(struct ioring *r)
+  /* reads as much more input as is available and will fit into r, with one
+    system call. Returns the nr of bytes read, 0 at end of input, or -1 on error. */
+  {
+    struct iovec iov[2];
+    const int n = ringsegments(r, r->head, IORINGSIZE - (r->head - r->tail), iov);
+    ssize_t got;
+    do
+#ifdef HAVE_SYS_UIO_H
+        got = readv(r->fd, iov, n);
+#else
+        got = read(r->fd, iov[0].iov_base, iov[0].iov_len);
+#endif
+    while (got == -1 && errno == EINTR);
+    if (got == -1)
+      {
+        fprintf(stderr, "WARN:  Read error %d -- %s\n", errno, strerror(errno));
+        return -1;
+      } /*if*/
+    r->head += got;
+    return got;
+  } /*ringfill*/
+
+static void ringflush(struct ioring *r)
+  /* writes out everything in r. */
+  {
+    while (r->head != r->tail) /* keep trying until it's all written */
+      {
+        struct iovec iov[2];
+        const int n = ringsegments(r, r->tail, r->head - r->tail, iov);
+        ssize_t done;
+#ifdef HAVE_SYS_UIO_H
+        done = writev(r->fd, iov, n);
+#else
+        done = write(r->fd, iov[0].iov_base, iov[0].iov_len);
+#endif
+        if (done == -1)
           {
-            fprintf(stderr, "WARN:  Read error %d -- %s\n", errno, strerror(errno));
-            return -1;
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr,"ERR:  Write error %d -- %s\n", errno, strerror(errno));
+            exit(1);
           } /*if*/
-        if (!r)
+        r->tail += done;
+      } /*while*/
+  } /*ringflush*/
+
+static int sread(struct ioring *r, void *b, int l)
+  /* reads l bytes into b from r. Returns actual nr bytes read, or -1 on error. */
+  {
+    int tr = 0; /* count of bytes read */
+    while (l > 0)
+      {
+        size_t avail = r->head - r->tail, start;
+        if (!avail)
           {
-            if (tr)
-                fprintf(stderr, "WARN:  Read %d, expected %d\n", tr + r, tr + l);
-            return tr;
+            const int got = ringfill(r);
+            if (got == -1)
+                return -1;
+            if (!got)
+              {
+                if (tr)
+                    fprintf(stderr, "WARN:  Read %d, expected %d\n", tr, tr + l);
+                return tr;
+              } /*if*/
+            avail = got;
           } /*if*/
-        l -= r;
-        b = ((unsigned char *)b) + r;
-        tr += r;
+        start = r->tail & (IORINGSIZE - 1);
+        if (avail > IORINGSIZE - start)
+            avail = IORINGSIZE - start;
+        if (avail > l)
+            avail = l;
+        memcpy(b, r->buf + start, avail);
+        r->tail += avail;
+        l -= avail;
+        b = ((unsigned char *)b) + avail;
+        tr += avail;
       } /*while*/
     return tr;
   } /*sread*/
 
-static void swrite(int h, const void *b, int l)
-  /* writes l bytes from b to fd h. */
+static unsigned char *swritespace(struct ioring *r, int *l)
+  /* returns where to put up to *l more bytes of output into r, reducing *l to
+    the contiguous space there is, which will be at least 1. */
+  {
+    size_t start, room;
+    if (r->head - r->tail == IORINGSIZE)
+        ringflush(r);
+    start = r->head & (IORINGSIZE - 1);
+    room = IORINGSIZE - (r->head - r->tail);
+    if (room > IORINGSIZE - start)
+        room = IORINGSIZE - start;
+    if (*l > room)
+        *l = room;
+    return r->buf + start;
+  } /*swritespace*/
+
+static void swrite(struct ioring *r, const void *b, int l)
+  /* writes l bytes from b to r. */
+  {
+    lps += l;
+    while (l > 0)
+      {
+        int n = l;
+        memcpy(swritespace(r, &n), b, n);
+        r->head += n;
+        l -= n;
+        b = ((const unsigned char *)b) + n;
+      } /*while*/
+  } /*swrite*/
+
+static void swritepad(struct ioring *r, int l)
+  /* writes l bytes of padding (all ones) to r. */
   {
     lps += l;
-    while (l > 0) /* keep trying until it's all written */
+    while (l > 0)
+      {
+        int n = l;
+        memset(swritespace(r, &n), 0xff, n);
+        r->head += n;
+        l -= n;
+      } /*while*/
+  } /*swritepad*/
+
+static int encodesub(stinfo *s, unsigned char *buf)
+  /* encodes s into buf in the chosen format, returning its length or -1 if it
+    is too large. */
+  {
+    switch (mode)
+      {
+    case DVD_SUB:
+        return
+            dvd_encode(s, buf);
+    case CVD_SUB:
+        return
+            cvd_encode(s, buf);
+    case SVCD_SUB:
+        return
+            svcd_encode(s, buf);
+    default:
+        return
+            0;
+      } /*switch*/
+  } /*encodesub*/
+
+#ifdef HAVE_PTHREAD
+
+#define LOOKAHEAD_PER_JOB 4 /* how many subtitles each worker may get ahead of the muxing */
+
+enum
+  {
+    RENDER_PENDING, /* not processed yet */
+    RENDER_OK, /* process_subtitle succeeded */
+    RENDER_FAILED, /* process_subtitle failed, subtitle to be skipped */
+  };
+
+struct renderpool /* subtitles being processed on worker threads ahead of the muxing */
+  {
+    pthread_mutex_t lock;
+    pthread_cond_t progress; /* signalled when a subtitle is processed or consumed */
+    pthread_t *threads;
+    int numthreads;
+    unsigned char *state; /* RENDER_xxx for each subtitle of the stream */
+    int nextjob; /* index of next subtitle to hand out */
+    int consumed; /* nr of subtitles the muxing has taken */
+    int lookahead; /* how far workers may get ahead of the muxing */
+  };
+
+static void *renderworker(void *arg)
+  /* worker thread: repeatedly takes the next subtitle of the stream arg from
+    its pool, loads and builds its image and encodes it. */
+  {
+    struct spustream * const st = arg;
+    struct renderpool * const pool = st->pool;
+    unsigned char * const buf = malloc(SUB_BUFFER_MAX + SUB_BUFFER_HEADROOM);
+    while (true)
       {
-        int r = write(h, b, l);
-        if (r == -1)
+        int i;
+        bool ok;
+        pthread_mutex_lock(&pool->lock);
+        while (pool->nextjob < st->numspus && pool->nextjob >= pool->consumed + pool->lookahead)
+          /* don't hold too many subtitle images in memory */
+            pthread_cond_wait(&pool->progress, &pool->lock);
+        i = pool->nextjob < st->numspus ? pool->nextjob++ : -1;
+        pthread_mutex_unlock(&pool->lock);
+        if (i < 0)
+            break;
+        ok = process_subtitle(st->spus[i]);
+        if (ok)
           {
-            fprintf(stderr,"ERR:  Write error %d -- %s\n", errno, strerror(errno));
-            exit(1);
+          /* the muxing thread will have to encode it again if its duration
+            has to be changed to fit in with the next subtitle */
+            stinfo * const s = st->spus[i];
+            s->spusd = s->sd;
+            s->spusize = encodesub(s, buf);
+            if (s->spusize > 0)
+              {
+                s->spu = malloc(s->spusize);
+                memcpy(s->spu, buf, s->spusize);
+              } /*if*/
           } /*if*/
-        l -= r;
-        b = ((const unsigned char *)b) + r;
+        pthread_mutex_lock(&pool->lock);
+        pool->state[i] = ok ? RENDER_OK : RENDER_FAILED;
+        pthread_cond_broadcast(&pool->progress);
+        pthread_mutex_unlock(&pool->lock);
       } /*while*/
-  } /*swrite*/
+    free(buf);
+    return
+        0;
+  } /*renderworker*/
+
+static void startrender(struct spustream *st)
+  /* starts up worker threads to process the subtitles of st, if more than
+    one job was asked for. The jobs are shared out between the streams; any
+    stream left without one is processed on the muxing thread. */
+  {
+    const int index = st - streams;
+    const int numthreads = jobs / numstreams + (index < jobs % numstreams ? 1 : 0);
+    struct renderpool *pool;
+    int i;
+    st->pool = 0;
+    if (jobs < 2 || numthreads < 1 || st->numspus < 2)
+        return;
+    pool = malloc(sizeof(struct renderpool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->progress, NULL);
+    pool->state = malloc(st->numspus);
+    memset(pool->state, RENDER_PENDING, st->numspus);
+    pool->nextjob = 0;
+    pool->consumed = 0;
+    pool->lookahead = numthreads * LOOKAHEAD_PER_JOB;
+    pool->threads = malloc(numthreads * sizeof(pthread_t));
+    pool->numthreads = 0;
+    st->pool = pool;
+    for (i = 0; i < numthreads && i < st->numspus; i++)
+      {
+        if (pthread_create(&pool->threads[pool->numthreads], NULL, renderworker, st) != 0)
+          {
+            fprintf(stderr, "WARN: Cannot create worker thread: %s\n", strerror(errno));
+            break;
+          } /*if*/
+        pool->numthreads++;
+      } /*for*/
+    if (!pool->numthreads)
+      {
+      /* do it all on the muxing thread after all */
+        pthread_cond_destroy(&pool->progress);
+        pthread_mutex_destroy(&pool->lock);
+        free(pool->threads);
+        free(pool->state);
+        free(pool);
+        st->pool = 0;
+      } /*if*/
+  } /*startrender*/
+
+static bool awaitrender(struct spustream *st, int i)
+  /* waits for a worker thread to finish processing subtitle i of st, and returns
+    whether it succeeded. */
+  {
+    struct renderpool * const pool = st->pool;
+    bool ok;
+    pthread_mutex_lock(&pool->lock);
+    pool->consumed = i + 1;
+    pthread_cond_broadcast(&pool->progress); /* room for more look-ahead */
+    while (pool->state[i] == RENDER_PENDING)
+        pthread_cond_wait(&pool->progress, &pool->lock);
+    ok = pool->state[i] == RENDER_OK;
+    pthread_mutex_unlock(&pool->lock);
+    return
+        ok;
+  } /*awaitrender*/
+
+static void finishrender(struct spustream *st)
+  /* waits for the worker threads of st to finish, and disposes of its pool. */
+  {
+    struct renderpool * const pool = st->pool;
+    int i;
+    if (!pool)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->nextjob = st->numspus; /* in case not all subtitles were consumed */
+    pthread_cond_broadcast(&pool->progress);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->numthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+    pthread_cond_destroy(&pool->progress);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool->state);
+    free(pool);
+    st->pool = 0;
+  } /*finishrender*/
+
+#endif
 
-static stinfo *getnextsub(void)
-  /* processes and returns the next subtitle definition, if there is one. */
+static stinfo *getnextsub(struct spustream *st)
+  /* processes and returns the next subtitle definition from st, if there is one. */
   {
     while (true)
       {
         stinfo *s;
-        if (spuindex >= numspus) /* no more to return */
+        if (st->spuindex >= st->numspus) /* no more to return */
             return 0;
-        s = spus[spuindex++];
+        s = st->spus[st->spuindex++];
         if (tofs > 0)
             s->spts += tofs;
 /*      fprintf(stderr,"spts: %d\n",s->spts); */
@@ -461,42 +789,55 @@ static stinfo *getnextsub(void)
             (int)(s->spts / 90 / 1000) % 60,
             (int)(s->spts / 90) % 1000
           );
+#ifdef HAVE_PTHREAD
+        if (st->pool ? awaitrender(st, st->spuindex - 1) : process_subtitle(s))
+#else
         if (process_subtitle(s))
+#endif
             return s;
         freestinfo(s);
-        nr_subtitles_skipped++;
+        st->skipped++;
       } /*while*/
   } /*getnextsub*/
 
 static void usage()
 {
-    fprintf(stderr, "syntax: spumux [options] script.sub < in.mpg > out.mpg\n");
+    fprintf(stderr, "syntax: spumux [options] script.sub... < in.mpg > out.mpg\n");
     fprintf(stderr, "\t-m <mode>   dvd, cvd, or svcd (only the first letter is checked).\n\t\tDefault is DVD.\n");
-    fprintf(stderr, "\t-s <stream> number of the substream to insert (default 0)\n");
+    fprintf(stderr, "\t-s <stream> number of the substream to insert (default 0); with several scripts,\n\t\ta comma-separated list, continued upwards from the last one given\n");
     fprintf(stderr, "\t-v <level>  verbosity level (default 0) \n");
     fprintf(stderr, "\t-P          enable progress indicator\n");
+    fprintf(stderr, "\t-J <jobs>   number of subtitles to load, render and encode at once, using\n\t\tseparate threads (default 1)\n");
     fprintf(stderr,"\n\tSee manpage for config file format.\n");
     exit(-1);
 }
 
 static void muxnext(bool eoinput)
+  /* inserts all the subtitles that are due by now, taking them from all the
+    streams in order of their start times. */
   {
     if (domux && (lastgts == 0 || tofs == -1 || (lps % secsize && !eoinput)))
         return;
-    while (newsti)
+    while (true)
       {
-        stinfo *cursti;
-        int bytes_sent, sub_size;
+        struct spustream *st = 0;
+        stinfo *cursti, *newsti;
+        int bytes_sent, sub_size, i;
+        const unsigned char *spudata;
         unsigned char seq;
-        unsigned int q;
         int64_t duegts;
+        for (i = 0; i < numstreams; i++)
+            if (streams[i].newsti && (!st || streams[i].newsti->spts < st->newsti->spts))
+                st = &streams[i];
+        if (!st)
+            break; /* all done */
       /* wait for correct time to insert sub, leave time for vpts to occur */
-        duegts = (newsti->spts - .15 * 90000) * 300;
+        duegts = (st->newsti->spts - .15 * 90000) * 300;
         if (duegts < 0)
             duegts = 0;
         if (domux && duegts > lastgts && !eoinput)
             break; /* not yet time */
-        cursti = newsti;
+        cursti = st->newsti;
         if (debug > 1)
           {
             fprintf
@@ -506,7 +847,7 @@ static void muxnext(bool eoinput)
                 cursti->xd, cursti->yd, cursti->x0, cursti->y0
               );
           } /*if*/
-        newsti = getnextsub();
+        newsti = st->newsti = getnextsub(st);
         if (!newsti)
           {
             fprintf(stderr, "INFO: Found EOF in .sub file.\n");
@@ -553,35 +894,30 @@ static void muxnext(bool eoinput)
                   {
                     fprintf(stderr,\
                             "WARN:  Sub with too short or negative duration on line %d, skipping\n",\
-                            spuindex - 1);
+                            st->spuindex - 1);
                   } /*if*/
-                nr_subtitles_skipped++;
+                st->skipped++;
                 continue;
               } /*if*/
           } /*if*/
-        switch (mode)
+        if (cursti->spu && cursti->spusd == cursti->sd)
           {
-        case DVD_SUB:
-          /* rle here */
-            sub_size = dvd_encode(cursti);
-        break;
-        case CVD_SUB:
-            sub_size = cvd_encode(cursti);
-        break;
-        case SVCD_SUB:
-            sub_size = svcd_encode(cursti);
-        break;
-        default:
-            sub_size = 0;
-        break;
-          } /*switch*/
+          /* already encoded on a worker thread */
+            spudata = cursti->spu;
+            sub_size = cursti->spusize;
+          }
+        else
+          {
+            spudata = sub;
+            sub_size = encodesub(cursti, sub);
+          } /*if*/
         if (sub_size == -1)
           {
             if (debug > -1)
               {
-                fprintf(stderr, "WARN: Image too large (encoded size>64k), skipping line %d\n", spuindex - 1);
+                fprintf(stderr, "WARN: Image too large (encoded size>64k), skipping line %d\n", st->spuindex - 1);
               } /*if*/
-            nr_subtitles_skipped++;
+            st->skipped++;
             continue;
           } /*if*/
         if (sub_size > max_sub_size)
@@ -591,8 +927,12 @@ static void muxnext(bool eoinput)
                 fprintf(stderr, "INFO: Max_sub_size=%d\n", max_sub_size);
           } /*if*/
         seq = 0;
-        subno++;
+        st->subno++;
         lastgts = duegts;
+        if (numstreams > 1 && nextgts > DVDRATE && lastgts < nextgts - DVDRATE)
+          /* don't go back before the last pack written, which can happen when an
+            earlier subtitle from another stream pushed it later */
+            lastgts = nextgts - DVDRATE;
         if (mode == DVD_SUB)
           {
             if (dodvdauthor_data)
@@ -602,10 +942,10 @@ static void muxnext(bool eoinput)
                 unsigned int c;
               /* write packet start code */
                 c = htonl(0x100 + MPID_PACK);
-                swrite(fdo, &c, 4);
+                swrite(&output, &c, 4);
                 mkpackh(lastgts, muxrate, 0);
                 fixgts(&lastgts, &nextgts);
-                swrite(fdo, header, 10);
+                swrite(&output, header, 10);
                 // start padding streamcode
                 header[0] = 0;
                 header[1] = 0;
@@ -613,7 +953,7 @@ static void muxnext(bool eoinput)
                 header[3] = MPID_PAD; /* for my private button/palette data */
                 header[4] = pdl >> 8;
                 header[5] = pdl;
-                swrite(fdo, header, 6);
+                swrite(&output, header, 6);
 
                 memset(sector, 0xff, pdl);
 
@@ -622,7 +962,7 @@ static void muxnext(bool eoinput)
                 wdstr("dvdauthor-data");
                 wdbyte(2); // version
                 wdbyte(1); // subtitle info
-                wdbyte(substr); // sub number
+                wdbyte(st->substr); // sub number
                 wdlong(cursti->spts); // start pts
                 wdlong(cursti->sd == -1 ? -1 : cursti->sd + cursti->spts); // end pts
 
@@ -716,7 +1056,7 @@ static void muxnext(bool eoinput)
                       } /*for*/
                   } /*if*/
               /* fprintf(stderr,"INFO: Private sector size %d\n",wdest-sector); */
-                swrite(fdo, sector, pdl);
+                swrite(&output, sector, pdl);
               }
             else
               {
@@ -737,11 +1077,11 @@ static void muxnext(bool eoinput)
             uint16_t b;
           /* if not first time here */
             if (bytes_sent)
-                header_size = 4; /* empty MPEG-2 PES header extension on continuation packet */
-            else if (header_size != 12) // not first time
-                header_size = 9; /* drop PES extension from subsequent packets */
+                st->header_size = 4; /* empty MPEG-2 PES header extension on continuation packet */
+            else if (st->header_size != 12) // not first time
+                st->header_size = 9; /* drop PES extension from subsequent packets */
           /* calculate how many bytes to send */
-            bytes_this_packet = secsize - 20 - header_size - svcd_adjust;
+            bytes_this_packet = secsize - 20 - st->header_size - svcd_adjust;
             stuffing = bytes_this_packet - (sub_size - bytes_sent);
             if ( stuffing < 0)
                 stuffing = 0;
@@ -753,58 +1093,58 @@ static void muxnext(bool eoinput)
               } /*if*/
           /* write header */
             c = htonl(0x100 + MPID_PACK);
-            swrite(fdo, &c, 4);
+            swrite(&output, &c, 4);
             mkpackh(lastgts, muxrate, 0);
             fixgts(&lastgts, &nextgts);
 /*
   fprintf(stderr, "system time: %d 0x%lx %d\n", lastgts, ftell(fds), frame);
   fprintf(stderr, "spts=%d\n", spts);
 */
-            swrite(fdo, header, 10);
+            swrite(&output, header, 10);
           /* write private stream code */
             c = htonl(0x100 + MPID_PRIVATE1);
-            swrite(fdo, &c, 4);
+            swrite(&output, &c, 4);
           /* write packet length */
-            b = ntohs(bytes_this_packet + header_size + svcd_adjust + stuffing);
-            swrite(fdo, &b, 2);
-            if (header_size == 9)
+            b = ntohs(bytes_this_packet + st->header_size + svcd_adjust + stuffing);
+            swrite(&output, &b, 2);
+            if (st->header_size == 9)
                 mkpesh0(cursti->spts);
-            else if (header_size == 12)
+            else if (st->header_size == 12)
                 mkpesh1(cursti->spts);
             else /* header_size = 4 */
                 mkpesh2();
             header[2] += stuffing; /* include in PES header data size */
-            memset(header + header_size - 1, 0xff, stuffing);
-            header[header_size + stuffing - 1] = /* substream ID */
+            memset(header + st->header_size - 1, 0xff, stuffing);
+            header[st->header_size + stuffing - 1] = /* substream ID */
                 svcd_adjust ?
                     SVCD_SUB_CHANNEL /* real subpicture stream number inserted below */
                 :
-                    substr; /* subpicture stream number */
-            swrite(fdo, header, header_size + stuffing);
+                    st->substr; /* subpicture stream number */
+            swrite(&output, header, st->header_size + stuffing);
             if (svcd_adjust)
               {
               /* additional 4 byte svcd header */
-                const uint16_t cc = htons(subno);
-                swrite(fdo, &substr, 1); /* real subpicture stream number */
+                const uint16_t cc = htons(st->subno);
+                swrite(&output, &st->substr, 1); /* real subpicture stream number */
                 if (bytes_sent + bytes_this_packet == sub_size)
                     seq |= 128; /* end of current sub */
-                swrite(fdo, &seq, 1); // packet number in current sub
+                swrite(&output, &seq, 1); // packet number in current sub
                 // 0 - up, last packet has bit 7 set
-                swrite(fdo, &cc, 2);
+                swrite(&output, &cc, 2);
               } /*if*/
             seq++; /* won't count past 127? */
           /* write bytes_this_packet data bytes, increment bytes_sent by bytes written */
-            swrite(fdo, sub + bytes_sent, bytes_this_packet);
+            swrite(&output, spudata + bytes_sent, bytes_this_packet);
             bytes_sent += bytes_this_packet;
           /* test if full sector */
-            bytes_this_packet += 20 + header_size + stuffing + svcd_adjust;
+            bytes_this_packet += 20 + st->header_size + stuffing + svcd_adjust;
             if (bytes_this_packet != secsize)
               {
                 unsigned short bs;
               /* if sector not full, write padding? */
               /* write padding code */
                 c = htonl(0x100 + MPID_PAD); /* really just padding this time */
-                swrite(fdo, &c, 4);
+                swrite(&output, &c, 4);
               /* calculate number of padding bytes */
                 b = secsize - bytes_this_packet - 6;
                 if (debug > 4)
@@ -813,11 +1153,9 @@ static void muxnext(bool eoinput)
                   } /*if*/
               /* write padding stream size */
                 bs = htons(b);          //fixa
-                swrite(fdo, &bs, 2);
+                swrite(&output, &bs, 2);
               /* write padding end marker ? */
-                c = 0xff;
-                for (q = 0; q < b; q++)
-                    swrite(fdo, &c, 1);
+                swritepad(&output, b);
               } /*if*/
           } /* end while bytes_sent ! sub_size */
 
@@ -835,10 +1173,10 @@ static void muxnext(bool eoinput)
       } /*while*/
   } /*muxnext*/
 
-static void textsub_statistics()
+static void textsub_statistics(int numsubs)
   {
     fprintf(stderr, "\nINFO: Text Subtitle Statistics:\n");
-    fprintf(stderr, "INFO: - Processed %d subtitles.\n", numspus);
+    fprintf(stderr, "INFO: - Processed %d subtitles.\n", numsubs);
     fprintf(stderr, "INFO: - The longest display line had %d characters.\n", sub_max_chars - 1);
     fprintf(stderr, "INFO: - The maximum number of displayed lines was %d.\n", sub_max_lines);
     fprintf(stderr, "INFO: - The normal display height of the font %s was %d.\n", sub_font, sub_max_font_height);
@@ -846,17 +1184,44 @@ static void textsub_statistics()
     fprintf(stderr, "INFO: - The biggest subtitle box had %d bytes.\n", max_sub_size);
   } /*textsub_statistics*/
 
+static void addsubstrs(const char *ids, unsigned int **substrs, int *numsubstrs)
+  /* appends the comma-separated substream IDs in ids onto *substrs. */
+  {
+    char * const s = strdup(ids);
+    char *id = s;
+    while (true)
+      {
+        char * const next = strchr(id, ',');
+        unsigned int substr;
+        if (next)
+            *next = 0;
+        substr = strtounsigned(id, "substream id");
+        if (substr > 31)
+          {
+            fprintf(stderr, "ERR:  Invalid stream ID, must be in 0 .. 31\n");
+            exit(1);
+          } /*if*/
+        *substrs = realloc(*substrs, (*numsubstrs + 1) * sizeof(unsigned int));
+        (*substrs)[(*numsubstrs)++] = substr;
+        if (!next)
+            break;
+        id = next + 1;
+      } /*while*/
+    free(s);
+  } /*addsubstrs*/
+
 int main(int argc,char **argv)
 {
-    int fdi;
     unsigned int c, ch, a;
     unsigned short int b;
     unsigned char psbuf[psbufs];
-    int optch;
+    unsigned int *substrs = 0, substrbase;
+    int optch, numsubstrs = 0, textsubs = 0, i, j;
 #ifdef HAVE_GETOPT_LONG
     const static struct option longopts[]={
         {"nodvdauthor-data", 0, 0, 1},
         {"nomux", 0, 0, 2},
+        {"jobs", 1, 0, 'J'},
         {0, 0, 0, 0}
     };
 #define GETOPTFUNC(x,y,z) getopt_long(x,y,z,longopts,NULL)
@@ -866,7 +1231,6 @@ int main(int argc,char **argv)
 
     default_video_format = get_video_format();
     init_locale();
-    newsti = 0;
     mode = DVD_SUB; /* default */
     sub = malloc(SUB_BUFFER_MAX + SUB_BUFFER_HEADROOM);
     if (!sub)
@@ -907,8 +1271,7 @@ int main(int argc,char **argv)
       } /*if*/
     tofs = -1;
     debug = 0;
-    substr = 0; /* default */
-    while (-1 != (optch = GETOPTFUNC(argc, argv, "hm:s:v:P")))
+    while (-1 != (optch = GETOPTFUNC(argc, argv, "hm:s:v:PJ:")))
       {
         switch (optch)
           {
@@ -936,12 +1299,7 @@ int main(int argc,char **argv)
               } /*switch*/
         break;
         case 's':
-            substr = strtounsigned(optarg, "substream id");
-            if (substr > 31)
-              {
-                fprintf(stderr, "ERR:  Invalid stream ID, must be in 0 .. 31\n");
-                exit(1);
-              } /*if*/
+            addsubstrs(optarg, &substrs, &numsubstrs);
         break;
         case 'v':
             debug = strtounsigned(optarg, "verbosity");
@@ -949,6 +1307,18 @@ int main(int argc,char **argv)
         case 'P':
             show_progress = true;
         break;
+        case 'J':
+            jobs = strtounsigned(optarg, "number of jobs");
+            if (jobs < 1)
+              {
+                fprintf(stderr, "ERR:  Number of jobs must be at least 1\n");
+                exit(1);
+              } /*if*/
+#ifndef HAVE_PTHREAD
+            if (jobs > 1)
+                fprintf(stderr, "WARN: Built without thread support, ignoring number of jobs\n");
+#endif
+        break;
         case 'h':
             usage();
         break;
@@ -964,52 +1334,92 @@ int main(int argc,char **argv)
         break;
           } /*switch*/
       } /*while*/
-    if (argc - optind != 1)
+    numstreams = argc - optind;
+    if (numstreams < 1)
       {
-        fprintf(stderr, "WARN: Only one argument expected\n");
+        fprintf(stderr, "WARN: At least one argument expected\n");
         usage();
       } /*if*/
+    if (numsubstrs > numstreams)
+      {
+        fprintf(stderr, "ERR:  More substream IDs than control files\n");
+        exit(1);
+      } /*if*/
 
     switch(mode)
       {
     case DVD_SUB:
     default:
         svcd_adjust = 0;
-        substr += DVD_SUB_CHANNEL;
+        substrbase = DVD_SUB_CHANNEL;
         muxrate = 10080 * 10 / 4; // 0x1131; // 10080 kbps
         secsize = 2048;
     break;
     case CVD_SUB:
         svcd_adjust = 0;
-        substr += CVD_SUB_CHANNEL;
+        substrbase = CVD_SUB_CHANNEL;
         muxrate = 1040 * 10/4; //0x0a28; // 1040 kbps
         secsize = 2324;
     break;
     case SVCD_SUB:
         svcd_adjust = 4;
         // svcd substream identification works differently...
-        // substr += SVCD_SUB_CHANNEL;
+        substrbase = 0; // not SVCD_SUB_CHANNEL
         muxrate = 1760 * 10 / 4; //0x1131; // 1760 kbps
         secsize = 2324;
     break;
       } /*switch*/
-    fdi = 0; /* stdin */
-    fdo = 1; /* stdout */
     if (domux)
       {
-        win32_setmode(fdi,O_BINARY);
+        ringinit(&input, 0); /* stdin */
+        win32_setmode(input.fd,O_BINARY);
       } /*if*/
-    win32_setmode(fdo,O_BINARY);
-    if (spumux_parse(argv[optind]))
-        return -1;
+    ringinit(&output, 1); /* stdout */
+    win32_setmode(output.fd,O_BINARY);
+    streams = malloc(numstreams * sizeof(struct spustream));
+    memset(streams, 0, numstreams * sizeof(struct spustream));
+    for (i = 0; i < numstreams; i++)
+      {
+        struct spustream * const st = &streams[i];
+        const unsigned int substr =
+            i < numsubstrs ?
+                substrs[i]
+            : i != 0 ?
+                streams[i - 1].substr - substrbase + 1
+            :
+                0;
+        if (substr > 31)
+          {
+            fprintf(stderr, "ERR:  Invalid stream ID, must be in 0 .. 31\n");
+            exit(1);
+          } /*if*/
+        st->substr = substr + substrbase;
+        for (j = 0; j < i; j++)
+            if (streams[j].substr == st->substr)
+              {
+                fprintf(stderr, "ERR:  Substream ID %d given for more than one control file\n", substr);
+                exit(1);
+              } /*if*/
+        if (spumux_parse(argv[optind + i]))
+            return -1;
+      /* take over what spumux_parse collected, ready for the next file */
+        st->spus = spus;
+        st->numspus = numspus;
+        if (have_textsub && !textsubs)
+            textsubs = numspus; /* only one file can have them */
+        spus = 0;
+        numspus = 0;
+        st->subno = -1;
+        st->header_size = 12;
+          /* first PES header extension will have PTS data and a PES extension */
+      } /*for*/
+    free(substrs);
     if (tofs >= 0 && debug > 0)
         fprintf(stderr, "INFO: Subtitles offset by %fs\n", (double)tofs / 90000);
     if (have_textsub)
       {
         vo_init_osd();
       } /*if*/
-    spuindex = 0;
-    nr_subtitles_skipped = 0;
     if (!(sector = malloc(secsize)))
       {
         fprintf(stderr, "ERR:  Could not allocate space for sector buffer, aborting.\n");
@@ -1017,17 +1427,21 @@ int main(int argc,char **argv)
       } /*if*/
     memset(substream_present, false, sizeof substream_present);
 
-    newsti = getnextsub();
+    for (i = 0; i < numstreams; i++)
+      {
+#ifdef HAVE_PTHREAD
+        startrender(&streams[i]);
+#endif
+        streams[i].newsti = getnextsub(&streams[i]);
+      } /*for*/
     max_sub_size = 0;
-    header_size = 12; /* first PES header extension will have PTS data and a PES extension */
     lps = 0;
     lastgts = 0;
     nextgts = 0;
-    subno = -1;
     while (domux)
       {
         muxnext(false);
-        if (sread(fdi, &c, 4) != 4)
+        if (sread(&input, &c, 4) != 4)
             goto eoi;
         ch = ntohl(c); /* header ID */
         if (ch == 0x100 + MPID_PACK)
@@ -1040,7 +1454,7 @@ l_01ba:
               } /*if*/
             if (debug > 5)
                 fprintf(stderr, "INFO: pack_start_code\n");
-            if (sread(fdi, psbuf, psbufs) != psbufs)
+            if (sread(&input, psbuf, psbufs) != psbufs)
                 break;
             lastgts = getgts(psbuf);
             if (lastgts != -1)
@@ -1056,17 +1470,17 @@ l_01ba:
                 lastgts = nextgts;
               } /*if*/
             mkpackh(lastgts, muxrate, 0);
-            swrite(fdo, &c, 4);
-            swrite(fdo, header, psbufs);
+            swrite(&output, &c, 4);
+            swrite(&output, header, psbufs);
           }
         else if (ch >= 0x100 + MPID_SYSTEM && ch <= 0x100 + MPID_VIDEO_LAST)
           {
-            swrite(fdo, &c, 4); /* packet header excl length */
-            if (sread(fdi, &b, 2) != 2)
+            swrite(&output, &c, 4); /* packet header excl length */
+            if (sread(&input, &b, 2) != 2)
                 break;
-            swrite(fdo, &b, 2); /* packet length */
+            swrite(&output, &b, 2); /* packet length */
             b = ntohs(b);
-            if (sread(fdi, cbuf, b) != b) /* packet contents */
+            if (sread(&input, cbuf, b) != b) /* packet contents */
                 break;
             if (ch == 0x100 + MPID_PRIVATE1)
               {
@@ -1083,11 +1497,12 @@ l_01ba:
                         -1;
                 if (substreamid >= 0)
                   {
-                    if (substreamid == substr)
-                      {
-                        fprintf(stderr, "ERR:  duplicate substream ID 0x%02x\n", substr);
-                        exit(1);
-                      } /*if*/
+                    for (i = 0; i < numstreams; i++)
+                        if (substreamid == streams[i].substr)
+                          {
+                            fprintf(stderr, "ERR:  duplicate substream ID 0x%02x\n", substreamid);
+                            exit(1);
+                          } /*if*/
                     if (!substream_present[substreamid])
                       {
                         const char * modestr;
@@ -1124,7 +1539,7 @@ l_01ba:
                       } /*if*/
                   } /*if*/
               } /*if*/
-            swrite(fdo, cbuf, b);
+            swrite(&output, cbuf, b);
             if (ch == 0x100 + MPID_VIDEO_FIRST && tofs == -1)
               { /* video stream (DVD only allows one) */
                 if (debug > 5)
@@ -1132,20 +1547,21 @@ l_01ba:
                 a = getpts(cbuf);
                 if (a != -1)
                   {
-                    if (newsti)
-                        newsti->spts += a;
+                    for (i = 0; i < numstreams; i++)
+                        if (streams[i].newsti)
+                            streams[i].newsti->spts += a;
                     tofs = a;
                   } /*if*/
               } /*if*/
           }
         else if (ch == 0x100 + MPID_PROGRAM_END)
           {
-            swrite(fdo, &c, 4);
+            swrite(&output, &c, 4);
             // do nothing
           }
         else
           { /* unrecognized */
-            swrite(fdo, &c, 4);
+            swrite(&output, &c, 4);
             if (debug > 0)
               {
                 fprintf(stderr, "WARN: Unknown header %.2x %.2x %.2x %.2x\n",\
@@ -1155,9 +1571,9 @@ l_01ba:
             while (a != 0x100 + MPID_PACK) /* until next PACK header */
               {
                 unsigned char nc;
-                if (sread(fdi, &nc, 1) < 1)
+                if (sread(&input, &nc, 1) < 1)
                     goto eoi;
-                swrite(fdo, &nc, 1);
+                swrite(&output, &nc, 1);
                 a = (a << 8) | nc;
                 if (debug > 6)
                     fprintf(stderr, "INFO: 0x%x\n", a);
@@ -1169,20 +1585,28 @@ l_01ba:
       } /*while*/
  eoi:
     muxnext(true); // end of input
+    ringflush(&output);
 /*    fprintf(stderr, "max_sub_size=%d\n", max_sub_size); */
-    if (subno != 0xffff)
-      {
-        fprintf(stderr,
-            "INFO: %d subtitles added, %d subtitles skipped, stream: %d, offset: %.2f\n",
-            subno + 1, nr_subtitles_skipped, substr, (double)tofs / 90000);
-      }
-    else
+    for (i = 0; i < numstreams; i++)
       {
-        fprintf(stderr, "WARN: no subtitles added\n");
-      } /*if*/
+        struct spustream * const st = &streams[i];
+#ifdef HAVE_PTHREAD
+        finishrender(st);
+#endif
+        if (st->subno != 0xffff)
+          {
+            fprintf(stderr,
+                "INFO: %d subtitles added, %d subtitles skipped, stream: %d, offset: %.2f\n",
+                st->subno + 1, st->skipped, st->substr, (double)tofs / 90000);
+          }
+        else
+          {
+            fprintf(stderr, "WARN: no subtitles added\n");
+          } /*if*/
+      } /*for*/
     if (have_textsub)
       {
-        textsub_statistics();
+        textsub_statistics(textsubs);
         vo_finish_osd();
       } /*if*/
     image_shutdown();
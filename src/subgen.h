@@ -58,16 +58,18 @@ typedef struct { /* representation of a subpicture and associated buttons */
     int groupmap[3][4]; /* colour table for each button group, -1 for unused entries in each group */
     button *buttons; /* array of buttons */
     subtitle_elt *sub_title; /* subtitle text to be rendered */
+    unsigned char *spu; /* subpicture unit encoded ahead of muxing, NULL if none */
+    int spusize; /* its length, or -1 if it came out too large */
+    int spusd; /* value of sd it was encoded with */
 } stinfo;
 
 #define SUB_BUFFER_MAX      53220
 #define SUB_BUFFER_HEADROOM     1024
 
-extern unsigned char *sub;
 extern int debug;
 extern bool have_textsub; /* whether a <textsub> tag has been seen */
 
-extern stinfo **spus;
+extern stinfo **spus; /* subtitles collected by spumux_parse */
 extern int numspus;
 
 extern int nr_subtitles_skipped;
@@ -86,9 +88,12 @@ int spumux_parse(const char *fname);
 
 // subgen-encode
 
-int dvd_encode(stinfo *s);
-int svcd_encode(stinfo *s);
-int cvd_encode(stinfo *s);
+int dvd_encode(stinfo *s, unsigned char *sub);
+int svcd_encode(stinfo *s, unsigned char *sub);
+int cvd_encode(stinfo *s, unsigned char *sub);
+  /* these encode s into sub, which must hold SUB_BUFFER_MAX + SUB_BUFFER_HEADROOM
+    bytes, and return its length, or -1 if it is too large. They can be called
+    on different threads at once for different subtitles. */
 
 // subgen-image
 